@@ -0,0 +1,59 @@
+#ifndef __ISO_FMR_BE_H
+#define __ISO_FMR_BE_H
+
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Big-endian field access for the buffer based codecs. The memcpy()s are
+ * turned into plain (unaligned) loads and stores, combined with a byte swap
+ * where required.
+ */
+
+static inline uint16_t iso_fmr_get_be16(const uint8_t *p)
+{
+	uint16_t val;
+
+	memcpy(&val, p, sizeof(val));
+
+	return be16toh(val);
+}
+
+static inline uint32_t iso_fmr_get_be32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+
+	return be32toh(val);
+}
+
+static inline uint64_t iso_fmr_get_be64(const uint8_t *p)
+{
+	uint64_t val;
+
+	memcpy(&val, p, sizeof(val));
+
+	return be64toh(val);
+}
+
+static inline void iso_fmr_put_be16(uint8_t *p, uint16_t val)
+{
+	val = htobe16(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline void iso_fmr_put_be32(uint8_t *p, uint32_t val)
+{
+	val = htobe32(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline void iso_fmr_put_be64(uint8_t *p, uint64_t val)
+{
+	val = htobe64(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "be.h"
+#include "convert.h"
+#include "v20.h"
+#include "v030.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*a))
+
+static const char *iso_fmr_v030_to_v20_errors[] = {
+	[iso_fmr_v030_to_v20_invalid_v030_record] = "invalid V030 record",
+	[iso_fmr_v030_to_v20_too_many_representations] =
+			"V20 records can only carry 255 views (representations)",
+	[iso_fmr_v030_to_v20_different_image_sizes] =
+			"V20 records can only carry views of one size",
+	[iso_fmr_v030_to_v20_incompatible_finger_position] =
+			"finger position incompatible with V20",
+	[iso_fmr_v030_to_v20_incompatible_impression_type] =
+			"impression type incompatible with V20",
+};
+
+const char *iso_fmr_v030_to_v20_get_error_string(
+		enum iso_fmr_v030_to_v20_error error)
+{
+	return error < ARRAY_SIZE(iso_fmr_v030_to_v20_errors) ?
+			iso_fmr_v030_to_v20_errors[error] : NULL;
+}
+
+size_t iso_fmr_v030_to_v20(const void *buffer, size_t len,
+		void *out, size_t size, enum iso_fmr_v030_to_v20_error *error,
+		enum iso_fmr_v030_error *v030_error, size_t *bytes)
+{
+	const uint8_t *buf = buffer, *p;
+	uint8_t *o = out;
+	enum iso_fmr_v030_to_v20_error dummy_error;
+	enum iso_fmr_v030_error dummy_v030_error;
+	size_t dummy_bytes;
+	uint16_t size_x = 0, size_y = 0, resolution_x = 0, resolution_y = 0;
+	int number_representations, device_certification_block_flag;
+	size_t total_length = 24;
+	int r;
+
+#define __fail(err, field) \
+		do { \
+			*error = err; \
+			*bytes = (field) - buf; \
+			return 0; \
+		} while (0)
+
+	if (!error)
+		error = &dummy_error;
+	if (!v030_error)
+		v030_error = &dummy_v030_error;
+	if (!bytes)
+		bytes = &dummy_bytes;
+
+	*error = 0;
+
+	/* All the checks the decoder does, but without decoding anything */
+	*v030_error = iso_fmr_v030_validate(buffer, len, bytes);
+	if (*v030_error) {
+		*error = iso_fmr_v030_to_v20_invalid_v030_record;
+		return 0;
+	}
+
+	number_representations = iso_fmr_get_be16(buf + 12);
+	if (number_representations > 255)
+		__fail(iso_fmr_v030_to_v20_too_many_representations, buf + 12);
+	device_certification_block_flag = buf[14];
+
+	for (p = buf + 15, r = 0; r < number_representations; r++) {
+		int minutia_field_length, number_minutiae, m;
+		size_t view_length;
+
+		/* Skip to the finger position, past the blocks */
+		p += 19 + 5 * p[18];
+		if (device_certification_block_flag)
+			p += 1 + 3 * p[0];
+
+		if (size_x && (size_x != iso_fmr_get_be16(p + 7) ||
+				size_y != iso_fmr_get_be16(p + 9) ||
+				resolution_x != iso_fmr_get_be16(p + 2) ||
+				resolution_y != iso_fmr_get_be16(p + 4))) {
+			__fail(iso_fmr_v030_to_v20_different_image_sizes, p + 2);
+		} else if (!size_x) {
+			size_x = iso_fmr_get_be16(p + 7);
+			size_y = iso_fmr_get_be16(p + 9);
+			resolution_x = iso_fmr_get_be16(p + 2);
+			resolution_y = iso_fmr_get_be16(p + 4);
+		}
+
+		if (!iso_fmr_v20_get_finger_position_string(p[0]))
+			__fail(iso_fmr_v030_to_v20_incompatible_finger_position,
+					p);
+		if (!iso_fmr_v20_get_impression_type_string(p[6]))
+			__fail(iso_fmr_v030_to_v20_incompatible_impression_type,
+					p + 6);
+
+		minutia_field_length = p[11] >> 4;
+		number_minutiae = p[12];
+		view_length = 6 + 6 * number_minutiae;
+
+		if (total_length + view_length <= size) {
+			uint8_t *v = o + total_length;
+
+			v[0] = p[0];
+			v[1] = ((p[1] & 0xf) << 4) | p[6];
+			v[2] = 0; /* V20 finger quality, V030 data not converted */
+			v[3] = number_minutiae;
+
+			/* Type and coordinates are laid out the same way */
+			for (m = 0; m < number_minutiae; m++) {
+				const uint8_t *i = p + 13 + minutia_field_length * m;
+				uint8_t *j = v + 4 + 6 * m;
+
+				j[0] = i[0];
+				j[1] = i[1];
+				j[2] = i[2] & 0x3f;
+				j[3] = i[3];
+				j[4] = i[4];
+				j[5] = minutia_field_length == 6 && i[5] < 254 ?
+						i[5] : 0;
+			}
+
+			/* No extended data */
+			iso_fmr_put_be16(v + 4 + 6 * number_minutiae, 0);
+		}
+		total_length += view_length;
+
+		p += 13 + minutia_field_length * number_minutiae;
+		p += 2 + iso_fmr_get_be16(p);
+	}
+
+#undef __fail
+
+	if (size >= 24) {
+		iso_fmr_put_be32(o, 0x464d5200);
+		iso_fmr_put_be32(o + 4, 0x20323000);
+		iso_fmr_put_be32(o + 8, total_length);
+		iso_fmr_put_be16(o + 12, 0);
+		iso_fmr_put_be16(o + 14, size_x);
+		iso_fmr_put_be16(o + 16, size_y);
+		iso_fmr_put_be16(o + 18, resolution_x);
+		iso_fmr_put_be16(o + 20, resolution_y);
+		o[22] = number_representations;
+		o[23] = 0;
+	}
+
+	*bytes = len;
+
+	return total_length;
+}
@@ -0,0 +1,42 @@
+#ifndef __ISO_FMR_CONVERT_H
+#define __ISO_FMR_CONVERT_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "v030.h"
+
+enum iso_fmr_v030_to_v20_error {
+	__iso_fmr_v030_to_v20_no_error,
+	iso_fmr_v030_to_v20_invalid_v030_record,
+	iso_fmr_v030_to_v20_too_many_representations,
+	iso_fmr_v030_to_v20_different_image_sizes,
+	iso_fmr_v030_to_v20_incompatible_finger_position,
+	iso_fmr_v030_to_v20_incompatible_impression_type,
+};
+
+/*
+ * Converts a v030 record in @buffer straight into a v20 record in @out,
+ * in a single pass over the (validated) input. Fills @out up to its @size,
+ * never more, and returns the full size of the v20 record, which can be
+ * larger than @size. Returns 0 for error: either @v030_error is set, as the
+ * input is not a valid v030 record, or the record can't be represented
+ * as v20. Either way, @bytes is the offset of the offending input field.
+ */
+size_t iso_fmr_v030_to_v20(const void *buffer, size_t len,
+		void *out, size_t size, enum iso_fmr_v030_to_v20_error *error,
+		enum iso_fmr_v030_error *v030_error, size_t *bytes);
+
+const char *iso_fmr_v030_to_v20_get_error_string(
+		enum iso_fmr_v030_to_v20_error error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
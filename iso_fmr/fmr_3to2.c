@@ -1,10 +1,19 @@
-#include <byteswap.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "convert.h"
 #include "v20.h"
 #include "v030.h"
 
@@ -12,10 +21,389 @@
 static void usage(const char *comm)
 {
 	fprintf(stderr, "Usage: %s [-h] [NAME030] [NAME20]\n", comm);
+	fprintf(stderr, "       %s [-h] [-j THREADS] -d DIR030|-m MANIFEST -o DIR20\n", comm);
 	fprintf(stderr, "where:\n");
 	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
 	fprintf(stderr, "\tNAME030\t(optional) input FMR v030 file, stdin by default\n");
 	fprintf(stderr, "\tNAME20\t(optional) input FMR v20 file, stdout by default\n");
+	fprintf(stderr, "\t-d\tbulk mode, convert all files in DIR030\n");
+	fprintf(stderr, "\t-m\tbulk mode, convert files listed (one per line) in MANIFEST, - for stdin\n");
+	fprintf(stderr, "\t-o\tbulk mode output directory, files keep their names, existing ones are not overwritten\n");
+	fprintf(stderr, "\t-j\tbulk mode number of threads, one per CPU by default\n");
+}
+
+static void print_error(const char *name, const uint8_t *v030,
+		enum iso_fmr_v030_to_v20_error error,
+		enum iso_fmr_v030_error v030_error, size_t bytes)
+{
+	char prefix[PATH_MAX + 2] = "";
+
+	if (name)
+		snprintf(prefix, sizeof(prefix), "%s: ", name);
+
+	switch (error) {
+	case iso_fmr_v030_to_v20_invalid_v030_record:
+		fprintf(stderr, "%serror: %s at byte %zu\n", prefix,
+				iso_fmr_v030_get_error_string(v030_error),
+				bytes);
+		break;
+	case iso_fmr_v030_to_v20_too_many_representations:
+		fprintf(stderr, "%serror: V20 records can only carry 255 views (representations)\n",
+				prefix);
+		break;
+	case iso_fmr_v030_to_v20_different_image_sizes:
+		fprintf(stderr, "%serror: V20 records can only carry views of one size\n",
+				prefix);
+		break;
+	case iso_fmr_v030_to_v20_incompatible_finger_position:
+		fprintf(stderr, "%serror: Finger position '%s' incompatible with V20\n",
+				prefix,
+				iso_fmr_v030_get_finger_position_string(v030[bytes]));
+		break;
+	case iso_fmr_v030_to_v20_incompatible_impression_type:
+		fprintf(stderr, "%serror: Impression type '%s' incompatible with V20\n",
+				prefix,
+				iso_fmr_v030_get_impression_type_string(v030[bytes]));
+		break;
+	default:
+		break;
+	}
+}
+
+static void *read_all(FILE *in, size_t *len)
+{
+	size_t size = 4096;
+	uint8_t *buf = malloc(size), *tmp;
+
+	*len = 0;
+	while (buf) {
+		size_t got = fread(buf + *len, 1, size - *len, in);
+
+		*len += got;
+		if (*len < size)
+			break;
+
+		size *= 2;
+		tmp = realloc(buf, size);
+		if (!tmp)
+			free(buf);
+		buf = tmp;
+	}
+
+	if (buf && ferror(in)) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+struct bulk {
+	char **names;
+	int number_names;
+	const char *out_dir;
+	int next;
+	pthread_mutex_t lock;
+	/* Totals, updated by the workers when they're done */
+	int converted, failed;
+	size_t bytes_in, bytes_out;
+};
+
+static int bulk_add(struct bulk *bulk, const char *dir, const char *name)
+{
+	char **names;
+	char *path;
+
+	if (!(bulk->number_names & (bulk->number_names - 1))) {
+		names = realloc(bulk->names, sizeof(*names) *
+				(bulk->number_names ? bulk->number_names * 2 : 1));
+		if (!names)
+			return -1;
+		bulk->names = names;
+	}
+
+	if (dir) {
+		path = malloc(strlen(dir) + 1 + strlen(name) + 1);
+		if (path)
+			sprintf(path, "%s/%s", dir, name);
+	} else {
+		path = strdup(name);
+	}
+	if (!path)
+		return -1;
+
+	bulk->names[bulk->number_names++] = path;
+
+	return 0;
+}
+
+static int bulk_add_dir(struct bulk *bulk, const char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *entry;
+
+	if (!d)
+		return -1;
+
+	while ((entry = readdir(d))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		if (entry->d_type != DT_REG && entry->d_type != DT_LNK &&
+				entry->d_type != DT_UNKNOWN)
+			continue;
+		if (bulk_add(bulk, dir, entry->d_name) < 0) {
+			closedir(d);
+			return -1;
+		}
+	}
+
+	closedir(d);
+
+	return 0;
+}
+
+static int bulk_add_manifest(struct bulk *bulk, const char *manifest)
+{
+	FILE *f = strcmp(manifest, "-") ? fopen(manifest, "r") : stdin;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int res = 0;
+
+	if (!f)
+		return -1;
+
+	while (!res && (len = getline(&line, &size, f)) >= 0) {
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len)
+			res = bulk_add(bulk, NULL, line);
+	}
+	if (ferror(f))
+		res = -1;
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	return res;
+}
+
+/* Returns size of the input file, or -1 for error (already reported) */
+static ssize_t bulk_convert(struct bulk *bulk, const char *name,
+		uint8_t **v20, size_t *v20_size, size_t *v20_len)
+{
+	char tmp[PATH_MAX], path[PATH_MAX];
+	enum iso_fmr_v030_to_v20_error error;
+	enum iso_fmr_v030_error v030_error;
+	size_t bytes, len, done;
+	const uint8_t *v030 = NULL;
+	struct stat st;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: error: %m\n", name);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	len = st.st_size;
+	if (len) {
+		v030 = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (v030 == MAP_FAILED) {
+			fprintf(stderr, "%s: error: %m\n", name);
+			close(fd);
+			return -1;
+		}
+		madvise((void *)v030, len, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	/* Usually the buffer is already big enough and this is the only pass */
+	*v20_len = iso_fmr_v030_to_v20(v030, len, *v20, *v20_size,
+			&error, &v030_error, &bytes);
+	if (!error && *v20_len > *v20_size) {
+		uint8_t *bigger = realloc(*v20, *v20_len);
+
+		if (!bigger) {
+			fprintf(stderr, "%s: error: out of memory for V20 record\n",
+					name);
+			if (len)
+				munmap((void *)v030, len);
+			return -1;
+		}
+		*v20 = bigger;
+		*v20_size = *v20_len;
+		iso_fmr_v030_to_v20(v030, len, *v20, *v20_size,
+				NULL, NULL, NULL);
+	}
+	if (error) {
+		print_error(name, v030, error, v030_error, bytes);
+		if (len)
+			munmap((void *)v030, len);
+		return -1;
+	}
+	if (len)
+		munmap((void *)v030, len);
+
+	/* basename() may modify its argument */
+	snprintf(tmp, sizeof(tmp), "%s", name);
+	if (snprintf(path, sizeof(path), "%s/%s", bulk->out_dir,
+			basename(tmp)) >=
+			sizeof(path)) {
+		fprintf(stderr, "%s: error: output path too long\n", name);
+		return -1;
+	}
+
+	/*
+	 * Files of the same name from different directories would end up
+	 * in the same output file, so existing ones are never overwritten,
+	 * and the ones not written in whole are removed.
+	 */
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd < 0 && errno == EEXIST) {
+		fprintf(stderr, "%s: error: %s already exists\n", name, path);
+		return -1;
+	}
+	if (fd < 0) {
+		fprintf(stderr, "%s: error: %m\n", path);
+		return -1;
+	}
+	for (done = 0; done < *v20_len; ) {
+		ssize_t res = write(fd, *v20 + done, *v20_len - done);
+
+		if (res <= 0) {
+			/* Nothing written at all would loop forever */
+			if (!res)
+				errno = EIO;
+			fprintf(stderr, "%s: error: %m\n", path);
+			close(fd);
+			unlink(path);
+			return -1;
+		}
+		done += res;
+	}
+	if (close(fd) < 0) {
+		fprintf(stderr, "%s: error: %m\n", path);
+		unlink(path);
+		return -1;
+	}
+
+	return len;
+}
+
+static void *bulk_worker(void *arg)
+{
+	struct bulk *bulk = arg;
+	uint8_t *v20 = NULL;
+	size_t v20_size = 0, v20_len;
+	int converted = 0, failed = 0;
+	size_t bytes_in = 0, bytes_out = 0;
+
+	while (1) {
+		ssize_t res;
+		int i;
+
+		pthread_mutex_lock(&bulk->lock);
+		i = bulk->next++;
+		pthread_mutex_unlock(&bulk->lock);
+		if (i >= bulk->number_names)
+			break;
+
+		res = bulk_convert(bulk, bulk->names[i], &v20, &v20_size,
+				&v20_len);
+		if (res < 0) {
+			failed++;
+			continue;
+		}
+		converted++;
+		bytes_in += res;
+		bytes_out += v20_len;
+	}
+
+	free(v20);
+
+	pthread_mutex_lock(&bulk->lock);
+	bulk->converted += converted;
+	bulk->failed += failed;
+	bulk->bytes_in += bytes_in;
+	bulk->bytes_out += bytes_out;
+	pthread_mutex_unlock(&bulk->lock);
+
+	return NULL;
+}
+
+static int bulk_main(const char *in_dir, const char *manifest,
+		const char *out_dir, int threads)
+{
+	struct bulk bulk = {
+		.out_dir = out_dir,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct timespec start, end;
+	pthread_t *workers;
+	double seconds;
+	int i, started;
+
+	if (in_dir && bulk_add_dir(&bulk, in_dir) < 0) {
+		perror("Failed to read input directory");
+		return 1;
+	}
+	if (manifest && bulk_add_manifest(&bulk, manifest) < 0) {
+		perror("Failed to read manifest");
+		return 1;
+	}
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+	if (threads > bulk.number_names)
+		threads = bulk.number_names ? bulk.number_names : 1;
+
+	workers = malloc(sizeof(*workers) * threads);
+	if (!workers) {
+		fprintf(stderr, "error: out of memory for workers\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (started = 0; started < threads; started++) {
+		errno = pthread_create(&workers[started], NULL, bulk_worker,
+				&bulk);
+		if (errno) {
+			perror("Failed to create worker thread");
+			break;
+		}
+	}
+	/* Whatever did start still does all the work */
+	if (!started)
+		bulk_worker(&bulk);
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	seconds = (end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9;
+	if (seconds <= 0)
+		seconds = 1e-9;
+
+	fprintf(stderr, "%d files converted, %d failed, %d threads, %.3f s\n",
+			bulk.converted, bulk.failed, started ? started : 1,
+			seconds);
+	fprintf(stderr, "%.0f files/s, %.2f MB/s in, %.2f MB/s out\n",
+			(bulk.converted + bulk.failed) / seconds,
+			bulk.bytes_in / seconds / 1e6,
+			bulk.bytes_out / seconds / 1e6);
+
+	for (i = 0; i < bulk.number_names; i++)
+		free(bulk.names[i]);
+	free(bulk.names);
+	free(workers);
+
+	return bulk.failed ? 1 : 0;
 }
 
 int main(int argc, char *argv[])
@@ -23,20 +411,42 @@ int main(int argc, char *argv[])
 	int opt;
 	FILE *in = stdin;
 	FILE *out = stdout;
-	struct iso_fmr_v030 *v030;
+	uint8_t *v030, *v20;
+	size_t v030_len, v20_len;
+	enum iso_fmr_v030_to_v20_error error;
 	enum iso_fmr_v030_error v030_error;
-	struct iso_fmr_v20 *v20;
 	size_t bytes;
-	int i;
+	const char *in_dir = NULL, *manifest = NULL, *out_dir = NULL;
+	int threads = 0;
 
-	while ((opt = getopt(argc, argv, "h")) != -1) {
+	while ((opt = getopt(argc, argv, "hd:m:o:j:")) != -1) {
 		switch (opt) {
+		case 'd':
+			in_dir = optarg;
+			break;
+		case 'm':
+			manifest = optarg;
+			break;
+		case 'o':
+			out_dir = optarg;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
 		default:
 			usage(argv[0]);
 			return 1;
 		}
 	}
 
+	if (in_dir || manifest || out_dir) {
+		if (!out_dir || (!in_dir && !manifest) || optind != argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		return bulk_main(in_dir, manifest, out_dir, threads);
+	}
+
 	if (argc - optind > 0 && argc - optind <= 2) {
 		in = fopen(argv[optind], "rb");
 		if (!in) {
@@ -48,95 +458,39 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	v030 = iso_fmr_v030_decode((int (*)(void *))getc, in,
-			&v030_error, &bytes);
-	if (v030_error) {
-		fprintf(stderr, "error: %s at byte %zu\n",
-				iso_fmr_v030_get_error_string(v030_error),
-				bytes);
+	v030 = read_all(in, &v030_len);
+	if (!v030) {
+		perror("Failed to read input file");
 		return 1;
 	}
 
 	if (in != stdin)
 		fclose(in);
 
-	v20 = iso_fmr_v20_init();
-	if (!v20) {
-		fprintf(stderr, "error: out of memory for V20 record\n");
-		return 1;
-	}
-	if (v030->number_representations > 255) {
-		fprintf(stderr, "error: V20 records can only carry 255 views (representations)\n");
+	/* First pass only works out the size of the V20 record */
+	v20_len = iso_fmr_v030_to_v20(v030, v030_len, NULL, 0,
+			&error, &v030_error, &bytes);
+	if (error) {
+		print_error(NULL, v030, error, v030_error, bytes);
 		return 1;
 	}
-	for (i = 0; i < v030->number_representations; i++) {
-		struct iso_fmr_v030_representation *v030_repr =
-			&v030->representations[i];
-		struct iso_fmr_v20_view *v20_view = iso_fmr_v20_add_view(v20,
-				0, NULL);
-		int j;
 
-		if (!v20_view) {
-			fprintf(stderr, "error: out of memory for V20 view\n");
-			return 1;
-		}
-
-		if (v20->size_x && (v20->size_x != v030_repr->size_x ||
-				v20->size_y != v030_repr->size_y ||
-				v20->resolution_x != v030_repr->sampling_rate_x ||
-				v20->resolution_y != v030_repr->sampling_rate_y)) {
-			fprintf(stderr, "error: V20 records can only carry views of one size\n");
-			return 1;
-		} else if (!v20->size_x) {
-			v20->size_x = v030_repr->size_x;
-			v20->size_y = v030_repr->size_y;
-			v20->resolution_x = v030_repr->sampling_rate_x;
-			v20->resolution_y = v030_repr->sampling_rate_y;
-		}
-
-		if (!iso_fmr_v20_get_finger_position_string(v030_repr->finger_position)) {
-			fprintf(stderr, "error: Finger position '%s' incompatible with V20\n",
-					iso_fmr_v030_get_finger_position_string(v030_repr->finger_position));
-			return 1;
-		}
-		v20_view->finger_position = v030_repr->finger_position;
-		v20_view->representation_number = v030_repr->representation_number;
-		if (!iso_fmr_v20_get_impression_type_string(v030_repr->impression_type)) {
-			fprintf(stderr, "error: Impression type '%s' incompatible with V20\n",
-					iso_fmr_v030_get_impression_type_string(v030_repr->impression_type));
-			return 1;
-		}
-		/* V20 finger quality will be 0, we don't convert V030 data */
-		for (j = 0; j < v030_repr->number_minutiae; j++) {
-			struct iso_fmr_v030_minutia *v030_minutia =
-				&v030_repr->minutiae[j];
-			struct iso_fmr_v20_minutia *v20_minutia =
-				iso_fmr_v20_add_minutia(v20, v20_view);
-
-			if (!v20_minutia) {
-				fprintf(stderr, "error: out of memory for V20 minutia\n");
-				return 1;
-			}
-
-			v20_minutia->type = v030_minutia->type;
-			v20_minutia->x = v030_minutia->x;
-			v20_minutia->y = v030_minutia->y;
-			v20_minutia->angle = v030_minutia->angle;
-			if (v030_repr->minutia_field_length == 6 &&
-					v030_minutia->quality < 254)
-				v20_minutia->quality = v030_minutia->quality;
-		}
+	v20 = malloc(v20_len);
+	if (!v20) {
+		fprintf(stderr, "error: out of memory for V20 record\n");
+		return 1;
 	}
+	iso_fmr_v030_to_v20(v030, v030_len, v20, v20_len, NULL, NULL, NULL);
 
 	if (argc - optind == 2) {
 		out = fopen(argv[optind + 1], "wb");
-		if (!in) {
+		if (!out) {
 			perror("Failed to open output file");
 			return 1;
 		}
 	}
 
-	if (iso_fmr_v20_encode(v20, (int (*)(int, void *))putc, out) < 0) {
+	if (fwrite(v20, 1, v20_len, out) != v20_len) {
 		perror("failed to write output file");
 		return 1;
 	}
@@ -144,8 +498,8 @@ int main(int argc, char *argv[])
 	if (out != stdout)
 		fclose(out);
 
-	iso_fmr_v030_free(v030);
-	iso_fmr_v20_free(v20);
+	free(v030);
+	free(v20);
 
 	return 0;
 }
@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "v20.h"
+#include "v030.h"
+
+
+/*
+ * Allocations made by the codecs are counted through the linker's --wrap,
+ * see the Makefile, so only calls made by the codecs (and this file) go
+ * through here.
+ */
+static unsigned long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+
+struct record {
+	uint8_t *buf;
+	size_t len;
+};
+
+static struct record *v20, *v030;
+static void **decoded;
+
+struct stream {
+	uint8_t *buf;
+	size_t pos;
+};
+
+static int getbyte(void *context)
+{
+	struct stream *stream = context;
+
+	return stream->buf[stream->pos++];
+}
+
+static int putbyte(int byte, void *context)
+{
+	struct stream *stream = context;
+
+	stream->buf[stream->pos++] = byte;
+
+	return byte;
+}
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-n RECORDS] [-v VIEWS] [-r REPRESENTATIONS] [-m MINUTIAE] [-e EXTENDED] [-s SEED]\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-n\tnumber of (different) records, 10000 by default\n");
+	fprintf(stderr, "\t-v\tviews per V20 record, 2 by default\n");
+	fprintf(stderr, "\t-r\trepresentations per V030 record, 2 by default\n");
+	fprintf(stderr, "\t-m\tminutiae per view/representation, 40 by default\n");
+	fprintf(stderr, "\t-e\textended data bytes per view/representation, 0 by default\n");
+	fprintf(stderr, "\t-s\trandom seed, 1 by default\n");
+}
+
+static struct iso_fmr_v20 *v20_build(int views, int minutiae, int extended)
+{
+	struct iso_fmr_v20 *record = iso_fmr_v20_init();
+	uint8_t ext[extended + 1];
+	int v, m;
+
+	if (!record)
+		return NULL;
+
+	record->size_x = 400 + rand() % 200;
+	record->size_y = 500 + rand() % 200;
+	record->resolution_x = record->resolution_y = 197;
+
+	memset(ext, 0xa5, sizeof(ext));
+	for (v = 0; v < views; v++) {
+		struct iso_fmr_v20_view *view;
+
+		view = iso_fmr_v20_add_view(record, extended, ext);
+		if (!view)
+			goto fail;
+		view->finger_position = 1 + rand() % 10;
+		view->representation_number = v & 0xf;
+		view->finger_quality = rand() % 101;
+
+		for (m = 0; m < minutiae; m++) {
+			struct iso_fmr_v20_minutia *minutia;
+
+			minutia = iso_fmr_v20_add_minutia(record, view);
+			if (!minutia)
+				goto fail;
+			minutia->type = 1 + rand() % 2;
+			minutia->x = rand() % record->size_x;
+			minutia->y = rand() % record->size_y;
+			minutia->angle = rand();
+			minutia->quality = rand() % 101;
+		}
+	}
+
+	return record;
+
+fail:
+	iso_fmr_v20_free(record);
+	return NULL;
+}
+
+static struct iso_fmr_v030 *v030_build(int representations, int minutiae,
+		int extended)
+{
+	struct iso_fmr_v030 *record = iso_fmr_v030_init();
+	uint8_t ext[extended + 1];
+	int r, m;
+
+	if (!record)
+		return NULL;
+
+	memset(ext, 0x5a, sizeof(ext));
+	for (r = 0; r < representations; r++) {
+		struct iso_fmr_v030_representation *repr;
+		struct iso_fmr_v030_quality_block *block;
+
+		repr = iso_fmr_v030_add_representation(record, extended, ext);
+		if (!repr)
+			goto fail;
+		repr->finger_position = 1 + rand() % 10;
+		repr->representation_number = r;
+		repr->sampling_rate_x = repr->sampling_rate_y = 197;
+		repr->size_x = 400 + rand() % 200;
+		repr->size_y = 500 + rand() % 200;
+
+		block = iso_fmr_v030_add_quality_block(record, repr);
+		if (!block)
+			goto fail;
+		block->quality_value = rand() % 101;
+
+		for (m = 0; m < minutiae; m++) {
+			struct iso_fmr_v030_minutia *minutia;
+
+			minutia = iso_fmr_v030_add_minutia(record, repr);
+			if (!minutia)
+				goto fail;
+			minutia->type = 1 + rand() % 2;
+			minutia->x = rand() % repr->size_x;
+			minutia->y = rand() % repr->size_y;
+			minutia->angle = rand();
+			minutia->quality = rand() % 101;
+		}
+	}
+
+	return record;
+
+fail:
+	iso_fmr_v030_free(record);
+	return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Every operation works on record @i and returns its size, or 0 for error */
+static size_t v20_decode(int i)
+{
+	struct stream stream = { v20[i].buf, 0 };
+	enum iso_fmr_v20_error error;
+
+	decoded[i] = iso_fmr_v20_decode(getbyte, &stream, &error, NULL);
+
+	return error ? 0 : v20[i].len;
+}
+
+static size_t v20_decode_buffer(int i)
+{
+	enum iso_fmr_v20_error error;
+
+	decoded[i] = iso_fmr_v20_decode_buffer(v20[i].buf, v20[i].len,
+			&error, NULL);
+
+	return error ? 0 : v20[i].len;
+}
+
+static size_t v20_validate(int i)
+{
+	return iso_fmr_v20_validate(v20[i].buf, v20[i].len, NULL) ?
+			0 : v20[i].len;
+}
+
+static size_t v20_encode(int i)
+{
+	struct stream stream = { v20[i].buf, 0 };
+
+	return iso_fmr_v20_encode(decoded[i], putbyte, &stream) < 0 ?
+			0 : stream.pos;
+}
+
+static size_t v030_decode(int i)
+{
+	struct stream stream = { v030[i].buf, 0 };
+	enum iso_fmr_v030_error error;
+
+	decoded[i] = iso_fmr_v030_decode(getbyte, &stream, &error, NULL);
+
+	return error ? 0 : v030[i].len;
+}
+
+static size_t v030_decode_buffer(int i)
+{
+	enum iso_fmr_v030_error error;
+
+	decoded[i] = iso_fmr_v030_decode_buffer(v030[i].buf, v030[i].len,
+			&error, NULL);
+
+	return error ? 0 : v030[i].len;
+}
+
+static size_t v030_validate(int i)
+{
+	return iso_fmr_v030_validate(v030[i].buf, v030[i].len, NULL) ?
+			0 : v030[i].len;
+}
+
+static int bench(const char *name, size_t (*op)(int i), int records,
+		uint64_t *latency)
+{
+	unsigned long allocs = allocations;
+	uint64_t total = 0;
+	size_t bytes = 0;
+	int i;
+
+	for (i = 0; i < records; i++) {
+		uint64_t start = now();
+		size_t len = op(i);
+
+		latency[i] = now() - start;
+		if (!len) {
+			fprintf(stderr, "error: %s failed for record %d\n",
+					name, i);
+			return -1;
+		}
+		bytes += len;
+		total += latency[i];
+	}
+	allocs = allocations - allocs;
+	if (!total)
+		total = 1;
+
+	qsort(latency, records, sizeof(*latency), compare);
+
+	printf("%-18s %10.0f rec/s %9.2f MB/s %6.2f allocs/rec"
+			"   ns p50 %6llu p90 %6llu p99 %6llu p99.9 %6llu max %7llu\n",
+			name, records * 1e9 / total, bytes * 1e3 / total,
+			(double)allocs / records,
+			(unsigned long long)latency[records / 2],
+			(unsigned long long)latency[records * 90 / 100],
+			(unsigned long long)latency[records * 99 / 100],
+			(unsigned long long)latency[records * 999 / 1000],
+			(unsigned long long)latency[records - 1]);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	int records = 10000, views = 2, representations = 2, minutiae = 40;
+	int extended = 0;
+	unsigned int seed = 1;
+	uint64_t *latency;
+	int i, res;
+
+	while ((opt = getopt(argc, argv, "hn:v:r:m:e:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			records = atoi(optarg);
+			break;
+		case 'v':
+			views = atoi(optarg);
+			break;
+		case 'r':
+			representations = atoi(optarg);
+			break;
+		case 'm':
+			minutiae = atoi(optarg);
+			break;
+		case 'e':
+			extended = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || records < 1 || views < 0 || views > 255 ||
+			representations < 1 || representations > 255 ||
+			minutiae < 1 || minutiae > 255 ||
+			extended < 0 || extended > 0xffff) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	v20 = calloc(records, sizeof(*v20));
+	v030 = calloc(records, sizeof(*v030));
+	decoded = calloc(records, sizeof(*decoded));
+	latency = calloc(records, sizeof(*latency));
+	if (!v20 || !v030 || !decoded || !latency) {
+		fprintf(stderr, "error: out of memory for %d records\n",
+				records);
+		return 1;
+	}
+
+	/* Different records, so that the decoders don't run on a hot cache */
+	srand(seed);
+	for (i = 0; i < records; i++) {
+		struct iso_fmr_v20 *v20_record;
+		struct iso_fmr_v030 *v030_record;
+		struct stream stream;
+
+		v20_record = v20_build(views, minutiae, extended);
+		v030_record = v030_build(representations, minutiae, extended);
+		if (!v20_record || !v030_record) {
+			fprintf(stderr, "error: out of memory for records\n");
+			return 1;
+		}
+
+		v20[i].len = v20_record->total_length;
+		v20[i].buf = malloc(v20[i].len);
+		v030[i].len = iso_fmr_v030_encode(v030_record, NULL, 0);
+		v030[i].buf = malloc(v030[i].len);
+		if (!v20[i].buf || !v030[i].buf) {
+			fprintf(stderr, "error: out of memory for records\n");
+			return 1;
+		}
+
+		stream.buf = v20[i].buf;
+		stream.pos = 0;
+		iso_fmr_v20_encode(v20_record, putbyte, &stream);
+		iso_fmr_v030_encode(v030_record, v030[i].buf, v030[i].len);
+
+		iso_fmr_v20_free(v20_record);
+		iso_fmr_v030_free(v030_record);
+	}
+
+	printf("%d records, V20 %d views, V030 %d representations, %d minutiae, %d extended data bytes\n",
+			records, views, representations, minutiae, extended);
+
+	res = bench("v20 decode", v20_decode, records, latency);
+	for (i = 0; i < records; i++) {
+		iso_fmr_v20_free(decoded[i]);
+		decoded[i] = NULL;
+	}
+	/* Records decoded here are used by the encoder */
+	if (!res)
+		res = bench("v20 decode_buffer", v20_decode_buffer, records,
+				latency);
+	if (!res)
+		res = bench("v20 validate", v20_validate, records, latency);
+	if (!res)
+		res = bench("v20 encode", v20_encode, records, latency);
+	for (i = 0; i < records; i++) {
+		iso_fmr_v20_free(decoded[i]);
+		decoded[i] = NULL;
+	}
+
+	if (!res)
+		res = bench("v030 decode", v030_decode, records, latency);
+	for (i = 0; i < records; i++) {
+		iso_fmr_v030_free(decoded[i]);
+		decoded[i] = NULL;
+	}
+	if (!res)
+		res = bench("v030 decode_buffer", v030_decode_buffer, records,
+				latency);
+	for (i = 0; i < records; i++)
+		iso_fmr_v030_free(decoded[i]);
+	if (!res)
+		res = bench("v030 validate", v030_validate, records, latency);
+
+	for (i = 0; i < records; i++) {
+		free(v20[i].buf);
+		free(v030[i].buf);
+	}
+	free(v20);
+	free(v030);
+	free(decoded);
+	free(latency);
+
+	return res ? 1 : 0;
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gallery.h"
+#include "v20.h"
+#include "v030.h"
+
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] -c GALLERY NAME...\n", comm);
+	fprintf(stderr, "       %s [-h] -l GALLERY\n", comm);
+	fprintf(stderr, "       %s [-h] -x INDEX GALLERY\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-c\tcreate GALLERY out of FMR v20 or v030 files NAME...\n");
+	fprintf(stderr, "\t-l\tlist (and validate) records in GALLERY\n");
+	fprintf(stderr, "\t-x\twrite record INDEX of GALLERY to stdout\n");
+}
+
+static void *read_file(const char *name, size_t *len)
+{
+	FILE *f = fopen(name, "rb");
+	uint8_t *buf = NULL;
+	long size;
+
+	if (!f)
+		return NULL;
+
+	if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+			fseek(f, 0, SEEK_SET) == 0) {
+		buf = malloc(size ? size : 1);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+		*len = size;
+	}
+
+	fclose(f);
+
+	return buf;
+}
+
+static int create(const char *path, char *names[], int number_names)
+{
+	struct iso_fmr_gallery_writer *writer;
+	int i;
+
+	writer = iso_fmr_gallery_writer_open(path);
+	if (!writer) {
+		perror("Failed to create gallery");
+		return 1;
+	}
+
+	for (i = 0; i < number_names; i++) {
+		size_t len;
+		void *record = read_file(names[i], &len);
+
+		if (!record) {
+			perror(names[i]);
+			iso_fmr_gallery_writer_close(writer);
+			return 1;
+		}
+		if (iso_fmr_gallery_writer_add(writer, record, len) < 0) {
+			perror(names[i]);
+			free(record);
+			iso_fmr_gallery_writer_close(writer);
+			return 1;
+		}
+		free(record);
+	}
+
+	if (iso_fmr_gallery_writer_close(writer) < 0) {
+		perror("Failed to write gallery");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int list(struct iso_fmr_gallery *gallery)
+{
+	uint32_t i, number_records;
+	int res = 0;
+
+	number_records = iso_fmr_gallery_get_number_records(gallery);
+	for (i = 0; i < number_records; i++) {
+		const void *record;
+		size_t len, bytes;
+
+		record = iso_fmr_gallery_get_record(gallery, i, &len);
+		printf("%u: ", i);
+		if (iso_fmr_gallery_get_version(gallery, i) == 0x20323000) {
+			enum iso_fmr_v20_error error;
+
+			error = iso_fmr_v20_validate(record, len, &bytes);
+			printf("V20, %zu bytes", len);
+			if (error) {
+				printf(", error: %s at byte %zu",
+					iso_fmr_v20_get_error_string(error),
+					bytes);
+				res = 1;
+			}
+		} else {
+			enum iso_fmr_v030_error error;
+
+			error = iso_fmr_v030_validate(record, len, &bytes);
+			printf("V030, %zu bytes", len);
+			if (error) {
+				printf(", error: %s at byte %zu",
+					iso_fmr_v030_get_error_string(error),
+					bytes);
+				res = 1;
+			}
+		}
+		printf("\n");
+	}
+
+	return res;
+}
+
+static int extract(struct iso_fmr_gallery *gallery, const char *index)
+{
+	const void *record;
+	size_t len;
+
+	record = iso_fmr_gallery_get_record(gallery, strtoul(index, NULL, 0),
+			&len);
+	if (!record) {
+		fprintf(stderr, "error: no record %s in gallery\n", index);
+		return 1;
+	}
+
+	if (fwrite(record, 1, len, stdout) != len) {
+		perror("failed to write output file");
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	const char *create_path = NULL, *index = NULL;
+	int list_records = 0;
+	struct iso_fmr_gallery *gallery;
+	int res;
+
+	while ((opt = getopt(argc, argv, "hc:lx:")) != -1) {
+		switch (opt) {
+		case 'c':
+			create_path = optarg;
+			break;
+		case 'l':
+			list_records = 1;
+			break;
+		case 'x':
+			index = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (create_path && !list_records && !index)
+		return create(create_path, argv + optind, argc - optind);
+
+	if (create_path || list_records == !!index || argc - optind != 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	gallery = iso_fmr_gallery_open(argv[optind]);
+	if (!gallery) {
+		perror("Failed to open gallery");
+		return 1;
+	}
+
+	res = list_records ? list(gallery) : extract(gallery, index);
+
+	iso_fmr_gallery_close(gallery);
+
+	return res;
+}
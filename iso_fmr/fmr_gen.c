@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gallery.h"
+#include "v20.h"
+#include "v030.h"
+
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-V 20|030] [-n RECORDS] [-s SEED] [-v VIEWS] [-f FINGER] [-i IMPRESSION]\n", comm);
+	fprintf(stderr, "          [-m MINUTIAE] [-q QUALITY] [-e EXTENDED] [-c RATE] [-o DIR|-g GALLERY]\n");
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-V\trecord version, 20 by default\n");
+	fprintf(stderr, "\t-n\tnumber of records, 1000 by default\n");
+	fprintf(stderr, "\t-s\trandom seed, 1 by default, same seed and options give same records\n");
+	fprintf(stderr, "\t-v\tviews (representations) per record, MIN[-MAX], 1 by default\n");
+	fprintf(stderr, "\t-f\tfinger position code, MIN[-MAX], 1-10 by default\n");
+	fprintf(stderr, "\t-i\timpression type code, MIN[-MAX], 0 by default\n");
+	fprintf(stderr, "\t-m\tminutiae per view, MIN[-MAX], 25-70 by default\n");
+	fprintf(stderr, "\t-q\tview quality, MIN[-MAX], 40-100 by default\n");
+	fprintf(stderr, "\t-e\textended data bytes per view, MIN[-MAX], 0 by default\n");
+	fprintf(stderr, "\t-c\tfraction of deliberately corrupted records, 0 by default\n");
+	fprintf(stderr, "\t-o\twrite loose files DIR/NNNNNNNN.fmr\n");
+	fprintf(stderr, "\t-g\twrite a gallery container\n");
+	fprintf(stderr, "\tRecords are written to stdout, one after another, by default.\n");
+}
+
+struct range {
+	int min, max;
+};
+
+static int parse_range(const char *s, struct range *range, int min, int max)
+{
+	char *end;
+
+	range->min = strtol(s, &end, 0);
+	if (*end == '-')
+		range->max = strtol(end + 1, &end, 0);
+	else
+		range->max = range->min;
+
+	return *end || range->min < min || range->max > max ||
+			range->min > range->max ? -1 : 0;
+}
+
+/*
+ * xorshift64*, so that the records only depend on the seed, not on the
+ * C library's rand()
+ */
+static uint64_t state;
+
+static uint32_t random32(void)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+
+	return (state * 0x2545f4914f6cdd1dull) >> 32;
+}
+
+static int uniform(struct range range)
+{
+	return range.min + random32() % (range.max - range.min + 1);
+}
+
+/* Roughly normal, centered in the range */
+static int bell(struct range range)
+{
+	return range.min + (random32() % (range.max - range.min + 1) +
+			random32() % (range.max - range.min + 1) +
+			random32() % (range.max - range.min + 1)) / 3;
+}
+
+static int clamp(int val, int min, int max)
+{
+	return val < min ? min : val > max ? max : val;
+}
+
+struct options {
+	struct range views;
+	struct range finger_position;
+	struct range impression_type;
+	struct range minutiae;
+	struct range quality;
+	struct range extended;
+};
+
+/*
+ * Minutiae are spread around a fingerprint "core" near the image centre,
+ * denser there, with ridge endings and bifurcations in equal measure and
+ * qualities around the view's quality.
+ */
+struct minutia {
+	uint8_t type;
+	uint16_t x, y;
+	uint8_t angle;
+	uint8_t quality;
+};
+
+static void minutia_generate(struct minutia *minutia, int size_x, int size_y,
+		int core_x, int core_y, int quality)
+{
+	struct range spread_x = { core_x - size_x / 3, core_x + size_x / 3 };
+	struct range spread_y = { core_y - size_y / 3, core_y + size_y / 3 };
+	struct range spread_q = { quality - 15, quality + 15 };
+
+	minutia->type = random32() % 20 ? 1 + random32() % 2 : 0;
+	minutia->x = clamp(bell(spread_x), 0, size_x - 1);
+	minutia->y = clamp(bell(spread_y), 0, size_y - 1);
+	minutia->angle = random32();
+	minutia->quality = clamp(bell(spread_q), 0, 100);
+}
+
+static void extended_generate(uint8_t *ext, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		ext[i] = random32();
+}
+
+struct stream {
+	uint8_t *buf;
+	size_t pos;
+};
+
+static int putbyte(int byte, void *context)
+{
+	struct stream *stream = context;
+
+	stream->buf[stream->pos++] = byte;
+
+	return byte;
+}
+
+static uint8_t *v20_generate(const struct options *options, size_t *len)
+{
+	struct iso_fmr_v20 *record = iso_fmr_v20_init();
+	uint8_t ext[0x10000];
+	int core_x, core_y;
+	int views, v, m;
+	uint8_t *buf = NULL;
+
+	if (!record)
+		return NULL;
+
+	record->size_x = 300 + random32() % 200;
+	record->size_y = 400 + random32() % 200;
+	record->resolution_x = record->resolution_y = 197;
+	core_x = record->size_x / 2 + (int)(random32() % 41) - 20;
+	core_y = record->size_y / 2 + (int)(random32() % 41) - 20;
+
+	views = uniform(options->views);
+	for (v = 0; v < views; v++) {
+		struct iso_fmr_v20_view *view;
+		int minutiae, extended = uniform(options->extended);
+
+		extended_generate(ext, extended);
+		view = iso_fmr_v20_add_view(record, extended, ext);
+		if (!view)
+			goto out;
+		view->finger_position = uniform(options->finger_position);
+		view->representation_number = v & 0xf;
+		view->impression_type = uniform(options->impression_type);
+		view->finger_quality = uniform(options->quality);
+
+		minutiae = bell(options->minutiae);
+		for (m = 0; m < minutiae; m++) {
+			struct iso_fmr_v20_minutia *minutia;
+			struct minutia tmp;
+
+			minutia = iso_fmr_v20_add_minutia(record, view);
+			if (!minutia)
+				goto out;
+			minutia_generate(&tmp, record->size_x, record->size_y,
+					core_x, core_y, view->finger_quality);
+			minutia->type = tmp.type;
+			minutia->x = tmp.x;
+			minutia->y = tmp.y;
+			minutia->angle = tmp.angle;
+			minutia->quality = tmp.quality;
+		}
+	}
+
+	buf = malloc(record->total_length);
+	if (buf) {
+		struct stream stream = { buf, 0 };
+
+		iso_fmr_v20_encode(record, putbyte, &stream);
+		*len = stream.pos;
+	}
+
+out:
+	iso_fmr_v20_free(record);
+
+	return buf;
+}
+
+static uint8_t *v030_generate(const struct options *options, size_t *len)
+{
+	struct iso_fmr_v030 *record = iso_fmr_v030_init();
+	uint8_t ext[0x10000];
+	int representations, r, m;
+	uint8_t *buf = NULL;
+
+	if (!record)
+		return NULL;
+
+	representations = uniform(options->views);
+	for (r = 0; r < representations; r++) {
+		struct iso_fmr_v030_representation *repr;
+		struct iso_fmr_v030_quality_block *block;
+		int minutiae, core_x, core_y;
+		int extended = uniform(options->extended);
+
+		extended_generate(ext, extended);
+		repr = iso_fmr_v030_add_representation(record, extended, ext);
+		if (!repr)
+			goto out;
+		repr->capture_data_time.year = 2010 + random32() % 15;
+		repr->capture_data_time.month = 1 + random32() % 12;
+		repr->capture_data_time.day = 1 + random32() % 28;
+		repr->capture_data_time.hour = random32() % 24;
+		repr->capture_data_time.minute = random32() % 60;
+		repr->capture_data_time.second = random32() % 60;
+		repr->finger_position = uniform(options->finger_position);
+		repr->representation_number = r;
+		repr->sampling_rate_x = repr->sampling_rate_y = 197;
+		repr->impression_type = uniform(options->impression_type);
+		repr->size_x = 300 + random32() % 200;
+		repr->size_y = 400 + random32() % 200;
+		core_x = repr->size_x / 2 + (int)(random32() % 41) - 20;
+		core_y = repr->size_y / 2 + (int)(random32() % 41) - 20;
+
+		block = iso_fmr_v030_add_quality_block(record, repr);
+		if (!block)
+			goto out;
+		block->quality_value = uniform(options->quality);
+
+		minutiae = bell(options->minutiae);
+		for (m = 0; m < minutiae; m++) {
+			struct iso_fmr_v030_minutia *minutia;
+			struct minutia tmp;
+
+			minutia = iso_fmr_v030_add_minutia(record, repr);
+			if (!minutia)
+				goto out;
+			minutia_generate(&tmp, repr->size_x, repr->size_y,
+					core_x, core_y, block->quality_value);
+			minutia->type = tmp.type;
+			minutia->x = tmp.x;
+			minutia->y = tmp.y;
+			minutia->angle = tmp.angle;
+			minutia->quality = tmp.quality;
+		}
+	}
+
+	*len = iso_fmr_v030_encode(record, NULL, 0);
+	buf = malloc(*len);
+	if (buf)
+		iso_fmr_v030_encode(record, buf, *len);
+
+out:
+	iso_fmr_v030_free(record);
+
+	return buf;
+}
+
+/*
+ * Flips a random bit or, if @truncate is allowed, cuts the record short.
+ * The total length field is left alone when it has to stay valid.
+ */
+static void corrupt(uint8_t *buf, size_t *len, int truncate)
+{
+	if (truncate && random32() % 2) {
+		*len = random32() % *len;
+	} else {
+		size_t first = truncate ? 0 : 12;
+
+		buf[first + random32() % (*len - first)] ^=
+				1 << random32() % 8;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	int version = 20;
+	unsigned long records = 1000, i, corrupted = 0;
+	unsigned long long seed = 1;
+	double rate = 0;
+	const char *out_dir = NULL, *gallery_path = NULL;
+	struct iso_fmr_gallery_writer *gallery = NULL;
+	struct options options = {
+		.views = { 1, 1 },
+		.finger_position = { 1, 10 },
+		.impression_type = { 0, 0 },
+		.minutiae = { 25, 70 },
+		.quality = { 40, 100 },
+		.extended = { 0, 0 },
+	};
+	const char *(*finger_position_string)(uint8_t finger_position);
+	const char *(*impression_type_string)(uint8_t impression_type);
+	struct timespec start, end;
+	size_t bytes = 0;
+	double seconds;
+	int res = 0, v;
+
+	while ((opt = getopt(argc, argv, "hV:n:s:v:f:i:m:q:e:c:o:g:")) != -1) {
+		switch (opt) {
+		case 'V':
+			version = atoi(optarg);
+			if (version != 20 && version != 30)
+				goto usage;
+			break;
+		case 'n':
+			records = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			if (parse_range(optarg, &options.views, 1, 255) < 0)
+				goto usage;
+			break;
+		case 'f':
+			if (parse_range(optarg, &options.finger_position,
+					0, 255) < 0)
+				goto usage;
+			break;
+		case 'i':
+			if (parse_range(optarg, &options.impression_type,
+					0, 15) < 0)
+				goto usage;
+			break;
+		case 'm':
+			if (parse_range(optarg, &options.minutiae, 1, 255) < 0)
+				goto usage;
+			break;
+		case 'q':
+			if (parse_range(optarg, &options.quality, 0, 100) < 0)
+				goto usage;
+			break;
+		case 'e':
+			if (parse_range(optarg, &options.extended,
+					0, 0xffff) < 0)
+				goto usage;
+			break;
+		case 'c':
+			rate = atof(optarg);
+			if (rate < 0 || rate > 1)
+				goto usage;
+			break;
+		case 'o':
+			out_dir = optarg;
+			break;
+		case 'g':
+			gallery_path = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc || (out_dir && gallery_path))
+		goto usage;
+
+	/* Every code in the ranges has to be valid for the version */
+	finger_position_string = version == 20 ?
+			iso_fmr_v20_get_finger_position_string :
+			iso_fmr_v030_get_finger_position_string;
+	impression_type_string = version == 20 ?
+			iso_fmr_v20_get_impression_type_string :
+			iso_fmr_v030_get_impression_type_string;
+	for (v = options.finger_position.min;
+			v <= options.finger_position.max; v++) {
+		if (!finger_position_string(v)) {
+			fprintf(stderr, "error: invalid finger position %d\n",
+					v);
+			return 1;
+		}
+	}
+	for (v = options.impression_type.min;
+			v <= options.impression_type.max; v++) {
+		if (!impression_type_string(v)) {
+			fprintf(stderr, "error: invalid impression type %d\n",
+					v);
+			return 1;
+		}
+	}
+
+	if (gallery_path) {
+		gallery = iso_fmr_gallery_writer_open(gallery_path);
+		if (!gallery) {
+			perror("Failed to create gallery");
+			return 1;
+		}
+	}
+
+	/* splitmix64 step, so that similar seeds give different streams */
+	state = seed + 0x9e3779b97f4a7c15ull;
+	state = (state ^ (state >> 30)) * 0xbf58476d1ce4e5b9ull;
+	state = (state ^ (state >> 27)) * 0x94d049bb133111ebull;
+	state ^= state >> 31;
+	if (!state)
+		state = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; !res && i < records; i++) {
+		uint8_t *buf;
+		size_t len;
+
+		buf = version == 20 ? v20_generate(&options, &len) :
+				v030_generate(&options, &len);
+		if (!buf) {
+			fprintf(stderr, "error: out of memory for record\n");
+			res = 1;
+			break;
+		}
+
+		if (random32() < rate * 4294967296.0) {
+			/* Galleries only take records of consistent length */
+			corrupt(buf, &len, !gallery);
+			corrupted++;
+		}
+
+		if (gallery) {
+			if (iso_fmr_gallery_writer_add(gallery, buf, len) < 0) {
+				perror("Failed to write gallery");
+				res = 1;
+			}
+		} else if (out_dir) {
+			char path[4096];
+			FILE *f;
+
+			snprintf(path, sizeof(path), "%s/%08lu.fmr", out_dir,
+					i);
+			f = fopen(path, "wb");
+			if (!f || fwrite(buf, 1, len, f) != len) {
+				perror(path);
+				res = 1;
+			}
+			if (f && fclose(f) < 0) {
+				perror(path);
+				res = 1;
+			}
+		} else if (fwrite(buf, 1, len, stdout) != len) {
+			perror("Failed to write output");
+			res = 1;
+		}
+
+		bytes += len;
+		free(buf);
+	}
+
+	if (gallery && iso_fmr_gallery_writer_close(gallery) < 0) {
+		perror("Failed to write gallery");
+		res = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	seconds = (end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9;
+	if (seconds <= 0)
+		seconds = 1e-9;
+	fprintf(stderr, "%lu records, %lu corrupted, %zu bytes, %.0f records/s\n",
+			i, corrupted, bytes, i / seconds);
+
+	return res;
+
+usage:
+	usage(argv[0]);
+	return 1;
+}
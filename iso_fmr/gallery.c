@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "be.h"
+#include "gallery.h"
+
+#define HEADER_SIZE 24
+
+struct iso_fmr_gallery_writer {
+	FILE *file;
+	uint64_t *offsets;
+	uint32_t number_records;
+	uint64_t pos;
+};
+
+struct iso_fmr_gallery {
+	const uint8_t *map;
+	size_t size;
+	uint32_t number_records;
+	const uint8_t *offsets;
+};
+
+struct iso_fmr_gallery_writer *iso_fmr_gallery_writer_open(const char *path)
+{
+	struct iso_fmr_gallery_writer *writer = calloc(1, sizeof(*writer));
+	uint8_t header[HEADER_SIZE] = { 0 };
+
+	if (!writer)
+		return NULL;
+
+	writer->file = fopen(path, "wb");
+	if (!writer->file) {
+		free(writer);
+		return NULL;
+	}
+
+	/* Placeholder, the real one is written on close */
+	if (fwrite(header, sizeof(header), 1, writer->file) != 1) {
+		fclose(writer->file);
+		free(writer);
+		return NULL;
+	}
+	writer->pos = sizeof(header);
+
+	return writer;
+}
+
+int iso_fmr_gallery_writer_add(struct iso_fmr_gallery_writer *writer,
+		const void *record, size_t len)
+{
+	const uint8_t *buf = record;
+	uint32_t n = writer->number_records;
+
+	/* Both versions have the same total length field */
+	if (len < 12 || iso_fmr_get_be32(buf) != 0x464d5200 ||
+			(iso_fmr_get_be32(buf + 4) != 0x20323000 &&
+			iso_fmr_get_be32(buf + 4) != 0x30333000) ||
+			iso_fmr_get_be32(buf + 8) != len) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (n == UINT32_MAX - 1) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	/* Table grows in powers of two, with space for the final entry */
+	if (!((n + 1) & n)) {
+		uint64_t *offsets = realloc(writer->offsets,
+				sizeof(*offsets) * (n + 1) * 2);
+
+		if (!offsets)
+			return -1;
+		writer->offsets = offsets;
+	}
+
+	if (fwrite(record, len, 1, writer->file) != 1)
+		return -1;
+
+	writer->offsets[writer->number_records++] = writer->pos;
+	writer->pos += len;
+
+	return 0;
+}
+
+int iso_fmr_gallery_writer_close(struct iso_fmr_gallery_writer *writer)
+{
+	uint8_t header[HEADER_SIZE], entry[8];
+	uint64_t table = writer->pos;
+	uint32_t i;
+	int res = 0;
+
+	for (i = 0; !res && i <= writer->number_records; i++) {
+		iso_fmr_put_be64(entry, i < writer->number_records ?
+				writer->offsets[i] : table);
+		if (fwrite(entry, sizeof(entry), 1, writer->file) != 1)
+			res = -1;
+	}
+
+	iso_fmr_put_be32(header, ISO_FMR_GALLERY_FORMAT_ID);
+	iso_fmr_put_be32(header + 4, ISO_FMR_GALLERY_VERSION);
+	iso_fmr_put_be32(header + 8, writer->number_records);
+	iso_fmr_put_be32(header + 12, 0);
+	iso_fmr_put_be64(header + 16, table);
+
+	if (!res && (fseek(writer->file, 0, SEEK_SET) < 0 ||
+			fwrite(header, sizeof(header), 1, writer->file) != 1))
+		res = -1;
+	if (fclose(writer->file) < 0)
+		res = -1;
+
+	free(writer->offsets);
+	free(writer);
+
+	return res;
+}
+
+static uint64_t iso_fmr_gallery_offset(const struct iso_fmr_gallery *gallery,
+		uint32_t i)
+{
+	return iso_fmr_get_be64(gallery->offsets + 8 * (size_t)i);
+}
+
+struct iso_fmr_gallery *iso_fmr_gallery_open(const char *path)
+{
+	struct iso_fmr_gallery *gallery;
+	uint64_t table, prev, offset;
+	struct stat st;
+	uint32_t i;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size < HEADER_SIZE + 8) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	gallery = malloc(sizeof(*gallery));
+	if (!gallery) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	gallery->map = map;
+	gallery->size = st.st_size;
+
+	if (iso_fmr_get_be32(gallery->map) != ISO_FMR_GALLERY_FORMAT_ID ||
+			iso_fmr_get_be32(gallery->map + 4) !=
+			ISO_FMR_GALLERY_VERSION)
+		goto invalid;
+
+	gallery->number_records = iso_fmr_get_be32(gallery->map + 8);
+	table = iso_fmr_get_be64(gallery->map + 16);
+	if (table < HEADER_SIZE || table > gallery->size ||
+			(gallery->size - table) / 8 <
+			(uint64_t)gallery->number_records + 1)
+		goto invalid;
+	gallery->offsets = gallery->map + table;
+
+	/* Checked once, so that the accessors don't have to */
+	prev = HEADER_SIZE;
+	for (i = 0; i <= gallery->number_records; i++) {
+		offset = iso_fmr_gallery_offset(gallery, i);
+		if ((!i && offset != HEADER_SIZE) || offset < prev ||
+				offset > table)
+			goto invalid;
+		prev = offset;
+	}
+	if (prev != table)
+		goto invalid;
+
+	return gallery;
+
+invalid:
+	iso_fmr_gallery_close(gallery);
+	errno = EINVAL;
+	return NULL;
+}
+
+void iso_fmr_gallery_close(struct iso_fmr_gallery *gallery)
+{
+	if (!gallery)
+		return;
+
+	munmap((void *)gallery->map, gallery->size);
+	free(gallery);
+}
+
+uint32_t iso_fmr_gallery_get_number_records(
+		const struct iso_fmr_gallery *gallery)
+{
+	return gallery->number_records;
+}
+
+const void *iso_fmr_gallery_get_record(const struct iso_fmr_gallery *gallery,
+		uint32_t i, size_t *len)
+{
+	uint64_t offset;
+
+	if (i >= gallery->number_records) {
+		if (len)
+			*len = 0;
+		return NULL;
+	}
+
+	offset = iso_fmr_gallery_offset(gallery, i);
+	if (len)
+		*len = iso_fmr_gallery_offset(gallery, i + 1) - offset;
+
+	return gallery->map + offset;
+}
+
+uint32_t iso_fmr_gallery_get_version(const struct iso_fmr_gallery *gallery,
+		uint32_t i)
+{
+	size_t len;
+	const uint8_t *record = iso_fmr_gallery_get_record(gallery, i, &len);
+
+	return record && len >= 8 ? iso_fmr_get_be32(record + 4) : 0;
+}
+
+struct iso_fmr_v20 *iso_fmr_gallery_decode_v20(
+		const struct iso_fmr_gallery *gallery, uint32_t i,
+		enum iso_fmr_v20_error *error, size_t *bytes)
+{
+	size_t len;
+	const void *record = iso_fmr_gallery_get_record(gallery, i, &len);
+
+	return iso_fmr_v20_decode_buffer(record, len, error, bytes);
+}
+
+struct iso_fmr_v030 *iso_fmr_gallery_decode_v030(
+		const struct iso_fmr_gallery *gallery, uint32_t i,
+		enum iso_fmr_v030_error *error, size_t *bytes)
+{
+	size_t len;
+	const void *record = iso_fmr_gallery_get_record(gallery, i, &len);
+
+	return iso_fmr_v030_decode_buffer(record, len, error, bytes);
+}
@@ -0,0 +1,74 @@
+#ifndef __ISO_FMR_GALLERY_H
+#define __ISO_FMR_GALLERY_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "v20.h"
+#include "v030.h"
+
+/*
+ * Gallery container, many v20 and/or v030 records in one file. All fields
+ * are big-endian:
+ *
+ *	header, 24 bytes:
+ *		format id (0x464d5247, "FMRG")	4 bytes
+ *		version (1)			4 bytes
+ *		number of records		4 bytes
+ *		reserved (0)			4 bytes
+ *		offset table position		8 bytes
+ *	records, concatenated, as they are on their own
+ *	offset table, number of records + 1 entries of 8 bytes:
+ *		position of every record, followed by the end of the last one
+ *
+ * Records are not checked when added, except for their format id, version
+ * and total length, so they are decoded and validated as usual on access.
+ */
+
+#define ISO_FMR_GALLERY_FORMAT_ID 0x464d5247
+#define ISO_FMR_GALLERY_VERSION 1
+
+struct iso_fmr_gallery_writer;
+
+/* These return NULL or -1, with errno set, on failure */
+struct iso_fmr_gallery_writer *iso_fmr_gallery_writer_open(const char *path);
+int iso_fmr_gallery_writer_add(struct iso_fmr_gallery_writer *writer,
+		const void *record, size_t len);
+/* Writes the offset table and header out, the file is complete only now */
+int iso_fmr_gallery_writer_close(struct iso_fmr_gallery_writer *writer);
+
+struct iso_fmr_gallery;
+
+/*
+ * The reader maps the whole file, checks the header and the offset table
+ * once, and from then on accesses any record in constant time, with no
+ * system calls involved.
+ */
+struct iso_fmr_gallery *iso_fmr_gallery_open(const char *path);
+void iso_fmr_gallery_close(struct iso_fmr_gallery *gallery);
+uint32_t iso_fmr_gallery_get_number_records(
+		const struct iso_fmr_gallery *gallery);
+/* Raw record, valid until the gallery is closed, NULL if @i is invalid */
+const void *iso_fmr_gallery_get_record(const struct iso_fmr_gallery *gallery,
+		uint32_t i, size_t *len);
+/* Record version field, eg. 0x20323000 for v20, 0 if @i is invalid */
+uint32_t iso_fmr_gallery_get_version(const struct iso_fmr_gallery *gallery,
+		uint32_t i);
+
+struct iso_fmr_v20 *iso_fmr_gallery_decode_v20(
+		const struct iso_fmr_gallery *gallery, uint32_t i,
+		enum iso_fmr_v20_error *error, size_t *bytes);
+struct iso_fmr_v030 *iso_fmr_gallery_decode_v030(
+		const struct iso_fmr_gallery *gallery, uint32_t i,
+		enum iso_fmr_v030_error *error, size_t *bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,5 +3,5 @@ CONFIG = staticlib
 
 TARGET = iso_fmr
 
-SOURCES += v20.c v030.c
-HEADERS += v20.h v030.h
+SOURCES += v20.c v030.c convert.c gallery.c
+HEADERS += v20.h v030.h be.h convert.h gallery.h
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "be.h"
 #include "v030.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(*a))
@@ -147,45 +148,120 @@ const char *iso_fmr_v030_get_minutia_type_string(uint8_t minutia_type)
 			iso_fmr_v030_minutia_types[minutia_type] : NULL;
 }
 
-static uint32_t iso_fmr_v030_get_be_uint(int size,
-		int (*getbyte)(void *context), void *context,
+/*
+ * Reports a field ending at @end, which doesn't fit in the data. Going beyond
+ * the declared total length (when @limit is shorter than the buffer) takes
+ * precedence over premature end of data.
+ */
+static void iso_fmr_v030_overrun(size_t end, size_t limit, size_t len,
 		enum iso_fmr_v030_error *error, size_t *bytes)
 {
-	uint32_t val = 0;
-	int byte;
+	*error = limit < len ? iso_fmr_v030_invalid_total_length :
+			iso_fmr_v030_premature_end_of_data;
+	*bytes = end < len ? end : len;
+}
 
-	while (size--) {
-		byte = getbyte(context);
-		if (byte < 0) {
-			*error = iso_fmr_v030_premature_end_of_data;
-			return 0;
-		}
-		val |= (byte & 0xff) << (size * 8);
-		(*bytes)++;
-	}
+/*
+ * Records decoded into an arena are laid out in a single block: the record
+ * itself, followed by the representations, blocks, minutiae arrays and
+ * extended data blocks, all of them pointer-aligned.
+ */
+#define ARENA_ALIGN(size) \
+		(((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
 
-	*error = 0;
+struct iso_fmr_v030_arena {
+	uint8_t *next;
+	size_t left;
+};
+
+/* Allocates from the arena, or from the heap when there's none */
+static void *iso_fmr_v030_alloc(struct iso_fmr_v030_arena *arena, size_t size)
+{
+	void *p;
+
+	if (!arena)
+		return malloc(size);
+
+	size = ARENA_ALIGN(size);
+	if (size > arena->left)
+		return NULL;
 
-	return val;
+	p = arena->next;
+	arena->next += size;
+	arena->left -= size;
+
+	return p;
 }
 
-struct iso_fmr_v030 *iso_fmr_v030_decode(int (*getbyte)(void *context),
-		void *context, enum iso_fmr_v030_error *error, size_t *bytes)
+/*
+ * Validation runs the decoder without storing anything: every
+ * representation, block and minutia is decoded into the same scratch
+ * structure and extended data blocks are skipped.
+ */
+struct iso_fmr_v030_scratch {
+	struct iso_fmr_v030 record;
+	struct iso_fmr_v030_representation repr;
+	struct iso_fmr_v030_quality_block quality_block;
+	struct iso_fmr_v030_certification_block certification_block;
+	struct iso_fmr_v030_minutia minutia;
+	uint32_t *offsets; /* Optional, filled with representations' offsets */
+};
+
+static struct iso_fmr_v030 *iso_fmr_v030_decode_into(const void *buffer,
+		size_t len, struct iso_fmr_v030_arena *arena,
+		struct iso_fmr_v030_scratch *scratch,
+		enum iso_fmr_v030_error *error, size_t *bytes)
 {
+	const uint8_t *buf = buffer;
 	struct iso_fmr_v030 *record;
 	enum iso_fmr_v030_error dummy_error;
 	size_t dummy_bytes;
+	size_t limit = len, pos = 0;
+	int fits;
 	int r;
 
-#define __get(field) \
+	/*
+	 * Every section (record header, fixed parts of a representation,
+	 * blocks, minutiae, extended data block) is bounds-checked once, as
+	 * a whole. Only when it doesn't fit, its fields are checked one by one,
+	 * to report the same error and byte offset as when decoding byte
+	 * by byte.
+	 */
+#define __section(size) \
+		do { \
+			fits = pos + (size) <= limit; \
+		} while (0)
+#define __need(size) \
 		do { \
-			field = iso_fmr_v030_get_be_uint(sizeof(field), \
-					getbyte, context, error, bytes); \
-			if (record->total_length && \
-					*bytes > record->total_length) \
-				*error = iso_fmr_v030_invalid_total_length; \
-			if (*error) \
+			if (!fits && pos + (size) > limit) { \
+				iso_fmr_v030_overrun(pos + (size), limit, \
+						len, error, bytes); \
 				goto out; \
+			} \
+		} while (0)
+#define __get8(field) \
+		do { \
+			__need(1); \
+			field = buf[pos]; \
+			pos += 1; \
+		} while (0)
+#define __get16(field) \
+		do { \
+			__need(2); \
+			field = iso_fmr_get_be16(buf + pos); \
+			pos += 2; \
+		} while (0)
+#define __get32(field) \
+		do { \
+			__need(4); \
+			field = iso_fmr_get_be32(buf + pos); \
+			pos += 4; \
+		} while (0)
+#define __fail(err) \
+		do { \
+			*error = err; \
+			*bytes = pos; \
+			goto out; \
 		} while (0)
 
 	if (!error)
@@ -196,250 +272,983 @@ struct iso_fmr_v030 *iso_fmr_v030_decode(int (*getbyte)(void *context),
 	*error = 0;
 	*bytes = 0;
 
-	record = malloc(sizeof(*record));
-	if (!record) {
-		*error = iso_fmr_v030_out_of_memory;
-		goto out;
-	}
+	record = scratch ? &scratch->record :
+			iso_fmr_v030_alloc(arena, sizeof(*record));
+	if (!record)
+		__fail(iso_fmr_v030_out_of_memory);
 	memset(record, 0, sizeof(*record));
 
-	__get(record->format_id);
-	if (record->format_id != 0x464d5200) {
-		*error = iso_fmr_v030_invalid_format_id;
-		goto out;
-	}
+	__section(15);
 
-	__get(record->version);
-	if (record->version != 0x30333000) {
-		*error = iso_fmr_v030_invalid_version;
-		goto out;
-	}
+	__get32(record->format_id);
+	if (record->format_id != 0x464d5200)
+		__fail(iso_fmr_v030_invalid_format_id);
 
-	__get(record->total_length);
-	if (record->total_length < 54) {
-		*error = iso_fmr_v030_invalid_total_length;
-		goto out;
-	}
+	__get32(record->version);
+	if (record->version != 0x30333000)
+		__fail(iso_fmr_v030_invalid_version);
 
-	__get(record->number_representations);
-	if (record->number_representations == 0) {
-		*error = iso_fmr_v030_invalid_number_representations;
-		goto out;
-	}
-	record->representations = malloc(sizeof(*record->representations) *
-			record->number_representations);
-	if (!record->representations) {
-		*error = iso_fmr_v030_out_of_memory;
-		goto out;
-	}
-	memset(record->representations, 0, sizeof(*record->representations) *
-			record->number_representations);
+	__get32(record->total_length);
+	if (record->total_length < 54)
+		__fail(iso_fmr_v030_invalid_total_length);
+	if (record->total_length < limit)
+		limit = record->total_length;
 
-	__get(record->device_certification_block_flag);
-	if (record->device_certification_block_flag > 1) {
-		*error = iso_fmr_v030_invalid_device_certification_block_flag;
-		goto out;
+	__get16(record->number_representations);
+	if (record->number_representations == 0)
+		__fail(iso_fmr_v030_invalid_number_representations);
+	if (!scratch) {
+		record->representations = iso_fmr_v030_alloc(arena,
+				sizeof(*record->representations) *
+				record->number_representations);
+		if (!record->representations)
+			__fail(iso_fmr_v030_out_of_memory);
+		memset(record->representations, 0,
+				sizeof(*record->representations) *
+				record->number_representations);
 	}
 
+	__get8(record->device_certification_block_flag);
+	if (record->device_certification_block_flag > 1)
+		__fail(iso_fmr_v030_invalid_device_certification_block_flag);
+
 	for (r = 0; r < record->number_representations; r++) {
-		struct iso_fmr_v030_representation *repr =
-				&record->representations[r];
+		struct iso_fmr_v030_representation *repr = scratch ?
+				&scratch->repr : &record->representations[r];
+		struct iso_fmr_v030_minutia *minutia;
 		uint8_t tmp8;
-		int m;
+		uint16_t tmp16;
+		int fit, b, m;
 
-		__get(repr->representation_length);
-		if (repr->representation_length < 39) {
-			*error = iso_fmr_v030_invalid_representation_length;
-			goto out;
-		}
+		if (scratch && scratch->offsets)
+			scratch->offsets[r] = pos;
+
+		__section(19);
+
+		__get32(repr->representation_length);
+		if (repr->representation_length < 39)
+			__fail(iso_fmr_v030_invalid_representation_length);
 
 		/* TODO: fix date/time format */
-		__get(repr->capture_data_time.year);
-		__get(repr->capture_data_time.month);
-		__get(repr->capture_data_time.day);
-		__get(repr->capture_data_time.hour);
-		__get(repr->capture_data_time.minute);
-		__get(repr->capture_data_time.second);
-		__get(repr->capture_data_time.microsecond);
-
-		__get(repr->capture_device_technology_id);
-		__get(repr->capture_device_vendor_id);
-		__get(repr->capture_device_type_id);
-
-		__get(repr->number_quality_blocks);
+		__get16(repr->capture_data_time.year);
+		__get8(repr->capture_data_time.month);
+		__get8(repr->capture_data_time.day);
+		__get8(repr->capture_data_time.hour);
+		__get8(repr->capture_data_time.minute);
+		__get8(repr->capture_data_time.second);
+		__get16(repr->capture_data_time.microsecond);
+
+		__get8(repr->capture_device_technology_id);
+		__get16(repr->capture_device_vendor_id);
+		__get16(repr->capture_device_type_id);
+
+		__get8(repr->number_quality_blocks);
 		if (repr->number_quality_blocks) {
-			int b;
+			struct iso_fmr_v030_quality_block *block;
 
-			repr->quality_blocks = malloc(sizeof(*repr->quality_blocks) *
-					repr->number_quality_blocks);
-			if (!repr->quality_blocks) {
-				*error = iso_fmr_v030_out_of_memory;
-				goto out;
+			if (!scratch) {
+				repr->quality_blocks = iso_fmr_v030_alloc(arena,
+						sizeof(*repr->quality_blocks) *
+						repr->number_quality_blocks);
+				if (!repr->quality_blocks)
+					__fail(iso_fmr_v030_out_of_memory);
+				memset(repr->quality_blocks, 0,
+						sizeof(*repr->quality_blocks) *
+						repr->number_quality_blocks);
 			}
-			memset(repr->quality_blocks, 0,
-					sizeof(*repr->quality_blocks) *
-					repr->number_quality_blocks);
 
-			for (b = 0; b < repr->number_quality_blocks; b++) {
-				struct iso_fmr_v030_quality_block *block =
+			fit = (limit - pos) / 5;
+			if (fit > repr->number_quality_blocks)
+				fit = repr->number_quality_blocks;
+
+			for (b = 0; b < fit; b++) {
+				const uint8_t *p = buf + pos;
+
+				block = scratch ? &scratch->quality_block :
 						&repr->quality_blocks[b];
 
-				__get(block->quality_value);
+				block->quality_value = p[0];
 				if (block->quality_value > 100 &&
 						block->quality_value != 0xff) {
-					*error = iso_fmr_v030_invalid_quality_value;
-					goto out;
+					pos += 1;
+					__fail(iso_fmr_v030_invalid_quality_value);
 				}
 
-				__get(block->quality_vendor_id);
-				__get(block->quality_algorithm_id);
+				block->quality_vendor_id = iso_fmr_get_be16(p + 1);
+				block->quality_algorithm_id =
+						iso_fmr_get_be16(p + 3);
+				pos += 5;
+			}
+
+			if (b < repr->number_quality_blocks) {
+				/* Truncated block, find the failing field */
+				block = scratch ? &scratch->quality_block :
+						&repr->quality_blocks[b];
+				fits = 0;
+
+				__get8(block->quality_value);
+				if (block->quality_value > 100 &&
+						block->quality_value != 0xff)
+					__fail(iso_fmr_v030_invalid_quality_value);
+
+				__get16(block->quality_vendor_id);
+				__get16(block->quality_algorithm_id);
 			}
 		}
 
-		if (record->device_certification_block_flag)
-			__get(repr->number_certification_blocks);
+		if (record->device_certification_block_flag) {
+			__section(1);
+			__get8(repr->number_certification_blocks);
+		}
 
 		if (repr->number_certification_blocks) {
-			int b;
+			struct iso_fmr_v030_certification_block *block;
 
-			repr->certification_blocks = malloc(sizeof(*repr->certification_blocks) *
-					repr->number_certification_blocks);
-			if (!repr->certification_blocks) {
-				*error = iso_fmr_v030_out_of_memory;
-				goto out;
+			if (!scratch) {
+				repr->certification_blocks = iso_fmr_v030_alloc(arena,
+						sizeof(*repr->certification_blocks) *
+						repr->number_certification_blocks);
+				if (!repr->certification_blocks)
+					__fail(iso_fmr_v030_out_of_memory);
+				memset(repr->certification_blocks, 0,
+						sizeof(*repr->certification_blocks) *
+						repr->number_certification_blocks);
 			}
-			memset(repr->certification_blocks, 0,
-					sizeof(*repr->certification_blocks) *
-					repr->number_certification_blocks);
 
-			for (b = 0; b < repr->number_certification_blocks; b++) {
-				struct iso_fmr_v030_certification_block *block =
+			fit = (limit - pos) / 3;
+			if (fit > repr->number_certification_blocks)
+				fit = repr->number_certification_blocks;
+
+			for (b = 0; b < fit; b++) {
+				const uint8_t *p = buf + pos;
+
+				block = scratch ?
+						&scratch->certification_block :
+						&repr->certification_blocks[b];
+
+				block->certification_authority_id =
+						iso_fmr_get_be16(p);
+				block->certification_scheme_id = p[2];
+				pos += 3;
+			}
+
+			if (b < repr->number_certification_blocks) {
+				/* Truncated block, find the failing field */
+				block = scratch ?
+						&scratch->certification_block :
 						&repr->certification_blocks[b];
+				fits = 0;
 
-				__get(block->certification_authority_id);
-				__get(block->certification_scheme_id);
+				__get16(block->certification_authority_id);
+				__get8(block->certification_scheme_id);
 			}
 		}
 
-		__get(repr->finger_position);
+		__section(13);
+
+		__get8(repr->finger_position);
 		if (repr->finger_position >=
 				ARRAY_SIZE(iso_fmr_v030_finger_positions) ||
-				!iso_fmr_v030_finger_positions[repr->finger_position]) {
-			*error = iso_fmr_v030_invalid_finger_position;
-			goto out;
-		}
+				!iso_fmr_v030_finger_positions[repr->finger_position])
+			__fail(iso_fmr_v030_invalid_finger_position);
 
-		__get(repr->representation_number);
+		__get8(repr->representation_number);
 
-		__get(repr->sampling_rate_x);
-		if (repr->sampling_rate_x < 98) {
-			*error = iso_fmr_v030_invalid_sampling_rate;
-			goto out;
-		}
-		__get(repr->sampling_rate_y);
-		if (repr->sampling_rate_y < 98) {
-			*error = iso_fmr_v030_invalid_sampling_rate;
-			goto out;
-		}
+		__get16(repr->sampling_rate_x);
+		if (repr->sampling_rate_x < 98)
+			__fail(iso_fmr_v030_invalid_sampling_rate);
+		__get16(repr->sampling_rate_y);
+		if (repr->sampling_rate_y < 98)
+			__fail(iso_fmr_v030_invalid_sampling_rate);
 
-		__get(repr->impression_type);
+		__get8(repr->impression_type);
 		if (repr->impression_type >=
 				ARRAY_SIZE(iso_fmr_v030_impression_types) ||
-			!iso_fmr_v030_impression_types[repr->impression_type]) {
-			*error = iso_fmr_v030_invalid_impression_type;
-			goto out;
-		}
+			!iso_fmr_v030_impression_types[repr->impression_type])
+			__fail(iso_fmr_v030_invalid_impression_type);
 
-		__get(repr->size_x);
-		if (repr->size_x > 0x3fff) {
-			*error = iso_fmr_v030_invalid_image_size;
-			goto out;
-		}
-		__get(repr->size_y);
-		if (repr->size_y > 0x3fff) {
-			*error = iso_fmr_v030_invalid_image_size;
-			goto out;
-		}
+		__get16(repr->size_x);
+		if (repr->size_x > 0x3fff)
+			__fail(iso_fmr_v030_invalid_image_size);
+		__get16(repr->size_y);
+		if (repr->size_y > 0x3fff)
+			__fail(iso_fmr_v030_invalid_image_size);
 
-		__get(tmp8);
+		__get8(tmp8);
 		repr->minutia_field_length = tmp8 >> 4;
 		if (repr->minutia_field_length != 5 &&
-				repr->minutia_field_length != 6) {
-			*error = iso_fmr_v030_invalid_minutia_field_length;
-			goto out;
-		}
+				repr->minutia_field_length != 6)
+			__fail(iso_fmr_v030_invalid_minutia_field_length);
 		repr->ridge_ending_type = tmp8 & 0xf;
 		if (repr->ridge_ending_type >=
-				ARRAY_SIZE(iso_fmr_v030_ridge_ending_types)) {
-			*error = iso_fmr_v030_invalid_ridge_ending_type;
-			goto out;
-		}
+				ARRAY_SIZE(iso_fmr_v030_ridge_ending_types))
+			__fail(iso_fmr_v030_invalid_ridge_ending_type);
 
-		__get(repr->number_minutiae);
-		if (repr->number_minutiae < 1) {
-			*error = iso_fmr_v030_invalid_number_minutiae;
-			goto out;
-		}
-		repr->minutiae = malloc(sizeof(*repr->minutiae) *
-				repr->number_minutiae);
-		if (!repr->minutiae) {
-			*error = iso_fmr_v030_out_of_memory;
-			goto out;
+		__get8(repr->number_minutiae);
+		if (repr->number_minutiae < 1)
+			__fail(iso_fmr_v030_invalid_number_minutiae);
+		if (!scratch) {
+			repr->minutiae = iso_fmr_v030_alloc(arena,
+					sizeof(*repr->minutiae) *
+					repr->number_minutiae);
+			if (!repr->minutiae)
+				__fail(iso_fmr_v030_out_of_memory);
+			memset(repr->minutiae, 0, sizeof(*repr->minutiae) *
+					repr->number_minutiae);
 		}
 
-		for (m = 0; m < repr->number_minutiae; m++) {
-			struct iso_fmr_v030_minutia *minutia =
+		/* Minutiae are checked in bulk, as many as there is space for */
+		fit = (limit - pos) / repr->minutia_field_length;
+		if (fit > repr->number_minutiae)
+			fit = repr->number_minutiae;
+
+		for (m = 0; m < fit; m++) {
+			const uint8_t *p = buf + pos;
+
+			minutia = scratch ? &scratch->minutia :
 					&repr->minutiae[m];
-			uint16_t tmp16;
 
-			__get(tmp16);
+			tmp16 = iso_fmr_get_be16(p);
 			minutia->type = tmp16 >> 14;
 			if (minutia->type >=
 					ARRAY_SIZE(iso_fmr_v030_minutia_types)) {
-				*error = iso_fmr_v030_invalid_minutia_type;
-				goto out;
+				pos += 2;
+				__fail(iso_fmr_v030_invalid_minutia_type);
 			}
 
 			minutia->x = tmp16 & 0x3fff;
-			__get(tmp16);
-			minutia->y = tmp16 & 0x3fff;
-			__get(minutia->angle);
+			minutia->y = iso_fmr_get_be16(p + 2) & 0x3fff;
+			minutia->angle = p[4];
+			pos += repr->minutia_field_length;
 
 			if (repr->minutia_field_length == 5)
 				continue;
 
-			__get(minutia->quality);
-			if (minutia->quality > 100 && minutia->quality < 254) {
-				*error = iso_fmr_v030_invalid_minutia_quality;
-				goto out;
-			}
+			minutia->quality = p[5];
+			if (minutia->quality > 100 && minutia->quality < 254)
+				__fail(iso_fmr_v030_invalid_minutia_quality);
+		}
+
+		if (m < repr->number_minutiae) {
+			/* Truncated minutia, find the failing field */
+			minutia = scratch ? &scratch->minutia :
+					&repr->minutiae[m];
+			fits = 0;
+
+			__get16(tmp16);
+			minutia->type = tmp16 >> 14;
+			if (minutia->type >=
+					ARRAY_SIZE(iso_fmr_v030_minutia_types))
+				__fail(iso_fmr_v030_invalid_minutia_type);
+
+			minutia->x = tmp16 & 0x3fff;
+			__get16(tmp16);
+			minutia->y = tmp16 & 0x3fff;
+			__get8(minutia->angle);
+			__get8(minutia->quality);
 		}
 
-		__get(repr->extended_data_block_length);
+		__section(2);
+
+		__get16(repr->extended_data_block_length);
 		if (repr->extended_data_block_length) {
 			size_t size = repr->extended_data_block_length;
-			unsigned char *b = malloc(size);
+			unsigned char *b = NULL;
 
-			if (!b) {
-				*error = iso_fmr_v030_out_of_memory;
-				goto out;
+			if (!scratch) {
+				b = iso_fmr_v030_alloc(arena, size);
+				if (!b)
+					__fail(iso_fmr_v030_out_of_memory);
+				repr->extended_data_block = b;
 			}
-			repr->extended_data_block = b;
 
-			while (size--)
-				__get(*b++);
+			if (pos + size > limit) {
+				/* The block is opaque, so it fails at its first
+				 * byte out of bounds */
+				if (b) {
+					memset(b, 0, size);
+					memcpy(b, buf + pos, limit - pos);
+				}
+				iso_fmr_v030_overrun(limit + 1, limit, len,
+						error, bytes);
+				goto out;
+			}
+			if (b)
+				memcpy(b, buf + pos, size);
+			pos += size;
 		}
 	}
 
-#undef __get
+	if (pos < record->total_length)
+		__fail(iso_fmr_v030_invalid_total_length);
+
+	*bytes = pos;
 
-	if (*bytes < record->total_length)
-		*error = iso_fmr_v030_invalid_total_length;
+#undef __fail
+#undef __get32
+#undef __get16
+#undef __get8
+#undef __need
+#undef __section
 
 out:
 	return record;
 }
 
+struct iso_fmr_v030 *iso_fmr_v030_decode_buffer(const void *buffer, size_t len,
+		enum iso_fmr_v030_error *error, size_t *bytes)
+{
+	return iso_fmr_v030_decode_into(buffer, len, NULL, NULL, error, bytes);
+}
+
+enum iso_fmr_v030_error iso_fmr_v030_validate(const void *buffer, size_t len,
+		size_t *bytes)
+{
+	struct iso_fmr_v030_scratch scratch;
+	enum iso_fmr_v030_error error;
+
+	memset(&scratch, 0, sizeof(scratch));
+
+	iso_fmr_v030_decode_into(buffer, len, NULL, &scratch, &error, bytes);
+
+	return error;
+}
+
+/*
+ * Walks the record structure (without validating it) to find out how big
+ * an arena is needed to decode it. It's never less than the decoder will
+ * allocate, even if the record turns out to be invalid or truncated.
+ */
+size_t iso_fmr_v030_arena_size(const void *buffer, size_t len)
+{
+	const uint8_t *buf = buffer;
+	size_t size = ARENA_ALIGN(sizeof(struct iso_fmr_v030));
+	size_t pos = 15;
+	int number_representations, device_certification_block_flag, r;
+
+	if (len < 14)
+		return size;
+
+	number_representations = iso_fmr_get_be16(buf + 12);
+	size += ARENA_ALIGN(sizeof(struct iso_fmr_v030_representation) *
+			number_representations);
+
+	if (len < 15 || buf[14] > 1)
+		return size;
+	device_certification_block_flag = buf[14];
+
+	for (r = 0; r < number_representations; r++) {
+		size_t number_quality_blocks, number_certification_blocks = 0;
+		size_t minutia_field_length, number_minutiae;
+		size_t extended_data_block_length;
+
+		if (pos + 19 > len)
+			break;
+		number_quality_blocks = buf[pos + 18];
+		size += ARENA_ALIGN(sizeof(struct iso_fmr_v030_quality_block) *
+				number_quality_blocks);
+		pos += 19 + 5 * number_quality_blocks;
+
+		if (device_certification_block_flag) {
+			if (pos + 1 > len)
+				break;
+			number_certification_blocks = buf[pos];
+			size += ARENA_ALIGN(sizeof(struct iso_fmr_v030_certification_block) *
+					number_certification_blocks);
+			pos += 1 + 3 * number_certification_blocks;
+		}
+
+		if (pos + 13 > len)
+			break;
+		minutia_field_length = buf[pos + 11] >> 4;
+		if (minutia_field_length != 5 && minutia_field_length != 6)
+			break;
+		number_minutiae = buf[pos + 12];
+		size += ARENA_ALIGN(sizeof(struct iso_fmr_v030_minutia) *
+				number_minutiae);
+		pos += 13 + minutia_field_length * number_minutiae;
+
+		if (pos + 2 > len)
+			break;
+		extended_data_block_length = iso_fmr_get_be16(buf + pos);
+		size += ARENA_ALIGN(extended_data_block_length);
+		pos += 2 + extended_data_block_length;
+	}
+
+	return size;
+}
+
+struct iso_fmr_v030 *iso_fmr_v030_decode_arena(const void *buffer, size_t len,
+		void *arena, size_t arena_size,
+		enum iso_fmr_v030_error *error, size_t *bytes)
+{
+	struct iso_fmr_v030_arena a;
+	struct iso_fmr_v030 *record;
+
+	if (!arena) {
+		arena_size = iso_fmr_v030_arena_size(buffer, len);
+		a.next = malloc(arena_size);
+		a.left = a.next ? arena_size : 0;
+	} else {
+		a.next = arena;
+		a.left = arena_size;
+	}
+
+	record = iso_fmr_v030_decode_into(buffer, len, &a, NULL, error, bytes);
+
+	/* The record is at the beginning of the arena, if it fit in at all */
+	if (!arena && !record)
+		free(a.next);
+
+	return record;
+}
+
+struct iso_fmr_v030_index {
+	const uint8_t *buffer;
+	struct iso_fmr_v030 record;
+	uint32_t offsets[];
+};
+
+struct iso_fmr_v030_index *iso_fmr_v030_index_create(const void *buffer,
+		size_t len, enum iso_fmr_v030_error *error, size_t *bytes)
+{
+	const uint8_t *buf = buffer;
+	struct iso_fmr_v030_index *index;
+	struct iso_fmr_v030_scratch scratch;
+	enum iso_fmr_v030_error dummy_error;
+	int number_representations = len > 13 ? iso_fmr_get_be16(buf + 12) : 0;
+
+	if (!error)
+		error = &dummy_error;
+
+	index = malloc(sizeof(*index) +
+			sizeof(*index->offsets) * number_representations);
+	if (!index) {
+		*error = iso_fmr_v030_out_of_memory;
+		if (bytes)
+			*bytes = 0;
+		return NULL;
+	}
+
+	memset(&scratch, 0, sizeof(scratch));
+	scratch.offsets = index->offsets;
+
+	iso_fmr_v030_decode_into(buffer, len, NULL, &scratch, error, bytes);
+	if (*error) {
+		free(index);
+		return NULL;
+	}
+
+	index->buffer = buf;
+	index->record = scratch.record;
+
+	return index;
+}
+
+void iso_fmr_v030_index_free(struct iso_fmr_v030_index *index)
+{
+	free(index);
+}
+
+const struct iso_fmr_v030 *iso_fmr_v030_index_get_record(
+		const struct iso_fmr_v030_index *index)
+{
+	return &index->record;
+}
+
+static const uint8_t *iso_fmr_v030_index_repr(
+		const struct iso_fmr_v030_index *index, int r)
+{
+	if (r < 0 || r >= index->record.number_representations)
+		return NULL;
+
+	return index->buffer + index->offsets[r];
+}
+
+/* Skips the quality and certification blocks, up to the finger position */
+static const uint8_t *iso_fmr_v030_index_skip_blocks(
+		const struct iso_fmr_v030_index *index, const uint8_t *p)
+{
+	p += 19 + 5 * p[18];
+	if (index->record.device_certification_block_flag)
+		p += 1 + 3 * p[0];
+
+	return p;
+}
+
+int iso_fmr_v030_index_get_representation(
+		const struct iso_fmr_v030_index *index, int r,
+		struct iso_fmr_v030_representation *repr)
+{
+	const uint8_t *p = iso_fmr_v030_index_repr(index, r);
+	const uint8_t *q;
+
+	if (!p)
+		return -1;
+
+	memset(repr, 0, sizeof(*repr));
+	repr->representation_length = iso_fmr_get_be32(p);
+	repr->capture_data_time.year = iso_fmr_get_be16(p + 4);
+	repr->capture_data_time.month = p[6];
+	repr->capture_data_time.day = p[7];
+	repr->capture_data_time.hour = p[8];
+	repr->capture_data_time.minute = p[9];
+	repr->capture_data_time.second = p[10];
+	repr->capture_data_time.microsecond = iso_fmr_get_be16(p + 11);
+	repr->capture_device_technology_id = p[13];
+	repr->capture_device_vendor_id = iso_fmr_get_be16(p + 14);
+	repr->capture_device_type_id = iso_fmr_get_be16(p + 16);
+	repr->number_quality_blocks = p[18];
+	if (index->record.device_certification_block_flag)
+		repr->number_certification_blocks = p[19 + 5 * p[18]];
+
+	q = iso_fmr_v030_index_skip_blocks(index, p);
+	repr->finger_position = q[0];
+	repr->representation_number = q[1];
+	repr->sampling_rate_x = iso_fmr_get_be16(q + 2);
+	repr->sampling_rate_y = iso_fmr_get_be16(q + 4);
+	repr->impression_type = q[6];
+	repr->size_x = iso_fmr_get_be16(q + 7);
+	repr->size_y = iso_fmr_get_be16(q + 9);
+	repr->minutia_field_length = q[11] >> 4;
+	repr->ridge_ending_type = q[11] & 0xf;
+	repr->number_minutiae = q[12];
+	repr->extended_data_block_length =
+			iso_fmr_get_be16(q + 13 + (q[11] >> 4) * q[12]);
+
+	return 0;
+}
+
+int iso_fmr_v030_index_get_quality_blocks(
+		const struct iso_fmr_v030_index *index, int r,
+		struct iso_fmr_v030_quality_block *blocks)
+{
+	const uint8_t *p = iso_fmr_v030_index_repr(index, r);
+	int b;
+
+	if (!p)
+		return -1;
+
+	for (b = 0; b < p[18]; b++) {
+		const uint8_t *q = p + 19 + 5 * b;
+
+		blocks[b].quality_value = q[0];
+		blocks[b].quality_vendor_id = iso_fmr_get_be16(q + 1);
+		blocks[b].quality_algorithm_id = iso_fmr_get_be16(q + 3);
+	}
+
+	return b;
+}
+
+int iso_fmr_v030_index_get_certification_blocks(
+		const struct iso_fmr_v030_index *index, int r,
+		struct iso_fmr_v030_certification_block *blocks)
+{
+	const uint8_t *p = iso_fmr_v030_index_repr(index, r);
+	int b;
+
+	if (!p)
+		return -1;
+	if (!index->record.device_certification_block_flag)
+		return 0;
+
+	p += 19 + 5 * p[18];
+	for (b = 0; b < p[0]; b++) {
+		const uint8_t *q = p + 1 + 3 * b;
+
+		blocks[b].certification_authority_id = iso_fmr_get_be16(q);
+		blocks[b].certification_scheme_id = q[2];
+	}
+
+	return b;
+}
+
+int iso_fmr_v030_index_get_minutiae(const struct iso_fmr_v030_index *index,
+		int r, int first, int number,
+		struct iso_fmr_v030_minutia *minutiae)
+{
+	const uint8_t *p = iso_fmr_v030_index_repr(index, r);
+	int minutia_field_length;
+	int m;
+
+	if (!p)
+		return -1;
+	p = iso_fmr_v030_index_skip_blocks(index, p);
+	minutia_field_length = p[11] >> 4;
+
+	if (first < 0 || first > p[12] || number < 0)
+		return -1;
+	if (number > p[12] - first)
+		number = p[12] - first;
+
+	/* Already validated, so no checks here */
+	for (p += 13 + minutia_field_length * first, m = 0; m < number;
+			m++, p += minutia_field_length) {
+		struct iso_fmr_v030_minutia *minutia = &minutiae[m];
+		uint16_t tmp16 = iso_fmr_get_be16(p);
+
+		minutia->type = tmp16 >> 14;
+		minutia->x = tmp16 & 0x3fff;
+		minutia->y = iso_fmr_get_be16(p + 2) & 0x3fff;
+		minutia->angle = p[4];
+		minutia->quality = minutia_field_length == 6 ? p[5] : 0;
+	}
+
+	return number;
+}
+
+const void *iso_fmr_v030_index_get_extended_data(
+		const struct iso_fmr_v030_index *index, int r, uint16_t *length)
+{
+	const uint8_t *p = iso_fmr_v030_index_repr(index, r);
+
+	*length = 0;
+
+	if (!p)
+		return NULL;
+	p = iso_fmr_v030_index_skip_blocks(index, p);
+	p += 13 + (p[11] >> 4) * p[12];
+
+	*length = iso_fmr_get_be16(p);
+
+	return *length ? p + 2 : NULL;
+}
+
+/*
+ * Reads a record from a stream into a buffer, no further than its declared
+ * total length. Stops early when the header is already known to be wrong,
+ * so that the stream can still be re-read as a different version record.
+ */
+static uint8_t *iso_fmr_v030_read(int (*getbyte)(void *context),
+		void *context, size_t *len, int *complete)
+{
+	uint8_t *buf, *tmp;
+	size_t size = 12;
+	uint32_t total_length;
+	int byte;
+
+	*len = 0;
+	*complete = 0;
+
+	buf = malloc(size);
+	if (!buf)
+		return NULL;
+
+	while (*len < 12) {
+		byte = getbyte(context);
+		if (byte < 0)
+			return buf;
+		buf[(*len)++] = byte;
+
+		if (*len == 4 && iso_fmr_get_be32(buf) != 0x464d5200)
+			return buf;
+		if (*len == 8 && iso_fmr_get_be32(buf + 4) != 0x30333000)
+			return buf;
+	}
+
+	total_length = iso_fmr_get_be32(buf + 8);
+	if (total_length < 54)
+		return buf;
+
+	while (*len < total_length) {
+		if (*len == size) {
+			size = size * 4 < total_length ? size * 4 : total_length;
+			tmp = realloc(buf, size);
+			if (!tmp) {
+				free(buf);
+				return NULL;
+			}
+			buf = tmp;
+		}
+
+		byte = getbyte(context);
+		if (byte < 0)
+			return buf;
+		buf[(*len)++] = byte;
+	}
+
+	*complete = 1;
+
+	return buf;
+}
+
+struct iso_fmr_v030 *iso_fmr_v030_decode(int (*getbyte)(void *context),
+		void *context, enum iso_fmr_v030_error *error, size_t *bytes)
+{
+	struct iso_fmr_v030 *record;
+	enum iso_fmr_v030_error dummy_error;
+	size_t dummy_bytes;
+	uint8_t *buf;
+	size_t len;
+	int complete;
+
+	if (!error)
+		error = &dummy_error;
+	if (!bytes)
+		bytes = &dummy_bytes;
+
+	buf = iso_fmr_v030_read(getbyte, context, &len, &complete);
+	if (!buf) {
+		*error = iso_fmr_v030_out_of_memory;
+		*bytes = 0;
+		return NULL;
+	}
+
+	record = iso_fmr_v030_decode_buffer(buf, len, error, bytes);
+
+	/*
+	 * The record overruns its declared total length: carry on reading,
+	 * as far as a byte by byte decoder would, to report the same error.
+	 */
+	while (complete && *bytes == len &&
+			(*error == iso_fmr_v030_premature_end_of_data ||
+			*error == iso_fmr_v030_invalid_total_length)) {
+		uint8_t *tmp;
+		int byte = getbyte(context);
+
+		if (byte < 0)
+			break;
+
+		tmp = realloc(buf, len + 1);
+		if (!tmp)
+			break;
+		buf = tmp;
+		buf[len++] = byte;
+
+		iso_fmr_v030_free(record);
+		record = iso_fmr_v030_decode_buffer(buf, len, error, bytes);
+	}
+
+	free(buf);
+
+	return record;
+}
+
+struct iso_fmr_v030 *iso_fmr_v030_init(void)
+{
+	struct iso_fmr_v030 *record;
+
+	record = malloc(sizeof(*record));
+	if (!record)
+		return NULL;
+	memset(record, 0, sizeof(*record));
+
+	record->format_id = 0x464d5200;
+	record->version = 0x30333000;
+	record->total_length = 15;
+
+	return record;
+}
+
+struct iso_fmr_v030_representation *iso_fmr_v030_add_representation(
+		struct iso_fmr_v030 *record,
+		uint16_t extended_data_block_length, void *extended_data_block)
+{
+	struct iso_fmr_v030_representation *reprs = realloc(
+			record->representations, sizeof(*reprs) *
+			(record->number_representations + 1));
+	struct iso_fmr_v030_representation *repr;
+
+	if (!reprs)
+		return NULL;
+	record->representations = reprs;
+
+	repr = &reprs[record->number_representations];
+	memset(repr, 0, sizeof(*repr));
+
+	if (extended_data_block_length) {
+		repr->extended_data_block = malloc(extended_data_block_length);
+		if (!repr->extended_data_block)
+			return NULL;
+
+		memcpy(repr->extended_data_block, extended_data_block,
+				extended_data_block_length);
+		repr->extended_data_block_length = extended_data_block_length;
+	}
+
+	repr->minutia_field_length = 6;
+
+	record->number_representations++;
+
+	return repr;
+}
+
+struct iso_fmr_v030_quality_block *iso_fmr_v030_add_quality_block(
+		struct iso_fmr_v030 *record,
+		struct iso_fmr_v030_representation *repr)
+{
+	struct iso_fmr_v030_quality_block *blocks = realloc(
+			repr->quality_blocks, sizeof(*blocks) *
+			(repr->number_quality_blocks + 1));
+
+	if (!blocks)
+		return NULL;
+	memset(&blocks[repr->number_quality_blocks], 0, sizeof(*blocks));
+
+	repr->quality_blocks = blocks;
+	return &repr->quality_blocks[repr->number_quality_blocks++];
+}
+
+struct iso_fmr_v030_certification_block *iso_fmr_v030_add_certification_block(
+		struct iso_fmr_v030 *record,
+		struct iso_fmr_v030_representation *repr)
+{
+	struct iso_fmr_v030_certification_block *blocks = realloc(
+			repr->certification_blocks, sizeof(*blocks) *
+			(repr->number_certification_blocks + 1));
+
+	if (!blocks)
+		return NULL;
+	memset(&blocks[repr->number_certification_blocks], 0, sizeof(*blocks));
+
+	record->device_certification_block_flag = 1;
+	repr->certification_blocks = blocks;
+	return &repr->certification_blocks[repr->number_certification_blocks++];
+}
+
+struct iso_fmr_v030_minutia *iso_fmr_v030_add_minutia(
+		struct iso_fmr_v030 *record,
+		struct iso_fmr_v030_representation *repr)
+{
+	struct iso_fmr_v030_minutia *minutiae = realloc(repr->minutiae,
+			sizeof(*minutiae) * (repr->number_minutiae + 1));
+
+	if (!minutiae)
+		return NULL;
+	memset(&minutiae[repr->number_minutiae], 0, sizeof(*minutiae));
+
+	repr->minutiae = minutiae;
+	return &repr->minutiae[repr->number_minutiae++];
+}
+
+/*
+ * Calculates (and updates in the record) the total and representation
+ * lengths, so the record can be then written out in one go.
+ */
+static uint32_t iso_fmr_v030_update_lengths(struct iso_fmr_v030 *record)
+{
+	int r;
+
+	record->total_length = 15;
+
+	for (r = 0; r < record->number_representations; r++) {
+		struct iso_fmr_v030_representation *repr =
+				&record->representations[r];
+		int minutia_field_length =
+				repr->minutia_field_length == 5 ? 5 : 6;
+
+		repr->representation_length = 19 +
+				5 * repr->number_quality_blocks + 13 +
+				minutia_field_length * repr->number_minutiae +
+				2 + repr->extended_data_block_length;
+		if (record->device_certification_block_flag)
+			repr->representation_length += 1 +
+					3 * repr->number_certification_blocks;
+
+		record->total_length += repr->representation_length;
+	}
+
+	return record->total_length;
+}
+
+size_t iso_fmr_v030_encode(struct iso_fmr_v030 *record, void *buffer,
+		size_t size)
+{
+	uint8_t *p = buffer;
+	int r;
+
+	if (iso_fmr_v030_update_lengths(record) > size)
+		return record->total_length;
+
+	iso_fmr_put_be32(p, record->format_id);
+	iso_fmr_put_be32(p + 4, record->version);
+	iso_fmr_put_be32(p + 8, record->total_length);
+	iso_fmr_put_be16(p + 12, record->number_representations);
+	p[14] = record->device_certification_block_flag;
+	p += 15;
+
+	for (r = 0; r < record->number_representations; r++) {
+		struct iso_fmr_v030_representation *repr =
+				&record->representations[r];
+		int minutia_field_length =
+				repr->minutia_field_length == 5 ? 5 : 6;
+		int b, m;
+
+		iso_fmr_put_be32(p, repr->representation_length);
+		iso_fmr_put_be16(p + 4, repr->capture_data_time.year);
+		p[6] = repr->capture_data_time.month;
+		p[7] = repr->capture_data_time.day;
+		p[8] = repr->capture_data_time.hour;
+		p[9] = repr->capture_data_time.minute;
+		p[10] = repr->capture_data_time.second;
+		iso_fmr_put_be16(p + 11, repr->capture_data_time.microsecond);
+		p[13] = repr->capture_device_technology_id;
+		iso_fmr_put_be16(p + 14, repr->capture_device_vendor_id);
+		iso_fmr_put_be16(p + 16, repr->capture_device_type_id);
+		p[18] = repr->number_quality_blocks;
+		p += 19;
+
+		for (b = 0; b < repr->number_quality_blocks; b++, p += 5) {
+			struct iso_fmr_v030_quality_block *block =
+					&repr->quality_blocks[b];
+
+			p[0] = block->quality_value;
+			iso_fmr_put_be16(p + 1, block->quality_vendor_id);
+			iso_fmr_put_be16(p + 3, block->quality_algorithm_id);
+		}
+
+		if (record->device_certification_block_flag) {
+			*p++ = repr->number_certification_blocks;
+
+			for (b = 0; b < repr->number_certification_blocks;
+					b++, p += 3) {
+				struct iso_fmr_v030_certification_block *block =
+						&repr->certification_blocks[b];
+
+				iso_fmr_put_be16(p,
+						block->certification_authority_id);
+				p[2] = block->certification_scheme_id;
+			}
+		}
+
+		p[0] = repr->finger_position;
+		p[1] = repr->representation_number;
+		iso_fmr_put_be16(p + 2, repr->sampling_rate_x);
+		iso_fmr_put_be16(p + 4, repr->sampling_rate_y);
+		p[6] = repr->impression_type;
+		iso_fmr_put_be16(p + 7, repr->size_x);
+		iso_fmr_put_be16(p + 9, repr->size_y);
+		p[11] = (minutia_field_length << 4) |
+				(repr->ridge_ending_type & 0xf);
+		p[12] = repr->number_minutiae;
+		p += 13;
+
+		for (m = 0; m < repr->number_minutiae; m++) {
+			struct iso_fmr_v030_minutia *minutia =
+					&repr->minutiae[m];
+
+			iso_fmr_put_be16(p, ((minutia->type & 0x3) << 14) |
+					(minutia->x & 0x3fff));
+			iso_fmr_put_be16(p + 2, minutia->y & 0x3fff);
+			p[4] = minutia->angle;
+			if (minutia_field_length == 6)
+				p[5] = minutia->quality;
+			p += minutia_field_length;
+		}
+
+		iso_fmr_put_be16(p, repr->extended_data_block_length);
+		p += 2;
+		if (repr->extended_data_block_length) {
+			memcpy(p, repr->extended_data_block,
+					repr->extended_data_block_length);
+			p += repr->extended_data_block_length;
+		}
+	}
+
+	return record->total_length;
+}
+
+
 void iso_fmr_v030_free(struct iso_fmr_v030 *record)
 {
 	struct iso_fmr_v030_representation *repr;
@@ -449,6 +1258,8 @@ void iso_fmr_v030_free(struct iso_fmr_v030 *record)
 
 	for (repr = record->representations; record->number_representations;
 			repr++, record->number_representations--) {
+		free(repr->quality_blocks);
+		free(repr->certification_blocks);
 		free(repr->minutiae);
 		if (repr->extended_data_block)
 			free(repr->extended_data_block);
@@ -456,3 +1267,8 @@ void iso_fmr_v030_free(struct iso_fmr_v030 *record)
 	free(record->representations);
 	free(record);
 }
+
+void iso_fmr_v030_free_arena(struct iso_fmr_v030 *record)
+{
+	free(record);
+}
@@ -6,6 +6,7 @@ extern "C"
 {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 enum iso_fmr_v030_error {
@@ -98,8 +99,79 @@ struct iso_fmr_v030_minutia {
 
 struct iso_fmr_v030 *iso_fmr_v030_decode(int (*getbyte)(void *context),
 		void *context, enum iso_fmr_v030_error *error, size_t *bytes);
+struct iso_fmr_v030 *iso_fmr_v030_decode_buffer(const void *buffer, size_t len,
+		enum iso_fmr_v030_error *error, size_t *bytes);
+
+/* Checks the record as the decoders do, without allocating anything */
+enum iso_fmr_v030_error iso_fmr_v030_validate(const void *buffer, size_t len,
+		size_t *bytes);
+
+/*
+ * Arena decoding places the whole record in one contiguous block: either
+ * the caller's @arena (pointer-aligned, at least iso_fmr_v030_arena_size()
+ * bytes, released by the caller) or, when @arena is NULL, a block allocated
+ * by the decoder and released with iso_fmr_v030_free_arena().
+ */
+size_t iso_fmr_v030_arena_size(const void *buffer, size_t len);
+struct iso_fmr_v030 *iso_fmr_v030_decode_arena(const void *buffer, size_t len,
+		void *arena, size_t arena_size,
+		enum iso_fmr_v030_error *error, size_t *bytes);
+
+struct iso_fmr_v030 *iso_fmr_v030_init(void);
+struct iso_fmr_v030_representation *iso_fmr_v030_add_representation(
+		struct iso_fmr_v030 *record,
+		uint16_t extended_data_block_length, void *extended_data_block);
+struct iso_fmr_v030_quality_block *iso_fmr_v030_add_quality_block(
+		struct iso_fmr_v030 *record,
+		struct iso_fmr_v030_representation *repr);
+struct iso_fmr_v030_certification_block *iso_fmr_v030_add_certification_block(
+		struct iso_fmr_v030 *record,
+		struct iso_fmr_v030_representation *repr);
+struct iso_fmr_v030_minutia *iso_fmr_v030_add_minutia(
+		struct iso_fmr_v030 *record,
+		struct iso_fmr_v030_representation *repr);
+/*
+ * Sets the record's total and representation lengths and, if it fits in
+ * @size bytes, writes the record into @buffer. Returns the record's size
+ * either way, so calling it with @size 0 tells the buffer size required.
+ */
+size_t iso_fmr_v030_encode(struct iso_fmr_v030 *record, void *buffer,
+		size_t size);
 
 void iso_fmr_v030_free(struct iso_fmr_v030 *record);
+void iso_fmr_v030_free_arena(struct iso_fmr_v030 *record);
+
+/*
+ * Read-only view of a record in a buffer: it's validated and the
+ * representations' offsets are noted once, then the fields are decoded
+ * straight from the buffer on demand. The buffer must outlive the index.
+ * The record returned by iso_fmr_v030_index_get_record() has the header
+ * fields only, representations returned by
+ * iso_fmr_v030_index_get_representation() have no block, minutiae and
+ * extended data block pointers. Blocks arrays passed by the caller must
+ * have room for the number of blocks given in the representation.
+ */
+struct iso_fmr_v030_index;
+
+struct iso_fmr_v030_index *iso_fmr_v030_index_create(const void *buffer,
+		size_t len, enum iso_fmr_v030_error *error, size_t *bytes);
+void iso_fmr_v030_index_free(struct iso_fmr_v030_index *index);
+const struct iso_fmr_v030 *iso_fmr_v030_index_get_record(
+		const struct iso_fmr_v030_index *index);
+int iso_fmr_v030_index_get_representation(
+		const struct iso_fmr_v030_index *index, int r,
+		struct iso_fmr_v030_representation *repr);
+int iso_fmr_v030_index_get_quality_blocks(
+		const struct iso_fmr_v030_index *index, int r,
+		struct iso_fmr_v030_quality_block *blocks);
+int iso_fmr_v030_index_get_certification_blocks(
+		const struct iso_fmr_v030_index *index, int r,
+		struct iso_fmr_v030_certification_block *blocks);
+int iso_fmr_v030_index_get_minutiae(const struct iso_fmr_v030_index *index,
+		int r, int first, int number,
+		struct iso_fmr_v030_minutia *minutiae);
+const void *iso_fmr_v030_index_get_extended_data(
+		const struct iso_fmr_v030_index *index, int r, uint16_t *length);
 
 const char *iso_fmr_v030_get_error_string(enum iso_fmr_v030_error error);
 const char *iso_fmr_v030_get_device_technology_string(uint8_t device_technology);
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "be.h"
 #include "v20.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(*a))
@@ -75,47 +76,119 @@ const char *iso_fmr_v20_get_minutia_type_string(uint8_t minutia_type)
 			iso_fmr_v20_minutia_types[minutia_type] : NULL;
 }
 
-static uint32_t iso_fmr_v20_get_be_uint(int size,
-		int (*getbyte)(void *context), void *context,
+/*
+ * Reports a field ending at @end, which doesn't fit in the data. Going beyond
+ * the declared total length (when @limit is shorter than the buffer) takes
+ * precedence over premature end of data.
+ */
+static void iso_fmr_v20_overrun(size_t end, size_t limit, size_t len,
 		enum iso_fmr_v20_error *error, size_t *bytes)
 {
-	uint32_t val = 0;
-	int byte;
+	*error = limit < len ? iso_fmr_v20_invalid_total_length :
+			iso_fmr_v20_premature_end_of_data;
+	*bytes = end < len ? end : len;
+}
 
-	while (size--) {
-		byte = getbyte(context);
-		if (byte < 0) {
-			*error = iso_fmr_v20_premature_end_of_data;
-			return 0;
-		}
-		val |= (byte & 0xff) << (size * 8);
-		(*bytes)++;
-	}
+/*
+ * Records decoded into an arena are laid out in a single block: the record
+ * itself, followed by the views, minutiae arrays and extended data blocks,
+ * all of them pointer-aligned.
+ */
+#define ARENA_ALIGN(size) \
+		(((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+struct iso_fmr_v20_arena {
+	uint8_t *next;
+	size_t left;
+};
 
-	*error = 0;
+/* Allocates from the arena, or from the heap when there's none */
+static void *iso_fmr_v20_alloc(struct iso_fmr_v20_arena *arena, size_t size)
+{
+	void *p;
+
+	if (!arena)
+		return malloc(size);
+
+	size = ARENA_ALIGN(size);
+	if (size > arena->left)
+		return NULL;
+
+	p = arena->next;
+	arena->next += size;
+	arena->left -= size;
 
-	return val;
+	return p;
 }
 
-struct iso_fmr_v20 *iso_fmr_v20_decode(int (*getbyte)(void *context),
-		void *context, enum iso_fmr_v20_error *error, size_t *bytes)
+/*
+ * Validation runs the decoder without storing anything: every view and
+ * minutia is decoded into the same scratch structure and extended data
+ * blocks are skipped.
+ */
+struct iso_fmr_v20_scratch {
+	struct iso_fmr_v20 record;
+	struct iso_fmr_v20_view view;
+	struct iso_fmr_v20_minutia minutia;
+	uint32_t *offsets; /* Optional, filled with views' byte offsets */
+};
+
+static struct iso_fmr_v20 *iso_fmr_v20_decode_into(const void *buffer,
+		size_t len, struct iso_fmr_v20_arena *arena,
+		struct iso_fmr_v20_scratch *scratch,
+		enum iso_fmr_v20_error *error, size_t *bytes)
 {
+	const uint8_t *buf = buffer;
 	struct iso_fmr_v20 *record;
 	enum iso_fmr_v20_error dummy_error;
 	size_t dummy_bytes;
+	size_t limit = len, pos = 0;
 	uint16_t tmp16;
 	uint8_t reserved;
+	int fits;
 	int v;
 
-#define __get(field) \
+	/*
+	 * Every section (record header, view header, minutiae, extended data
+	 * block) is bounds-checked once, as a whole. Only when it doesn't fit,
+	 * its fields are checked one by one, to report the same error and
+	 * byte offset as when decoding byte by byte.
+	 */
+#define __section(size) \
 		do { \
-			field = iso_fmr_v20_get_be_uint(sizeof(field), \
-					getbyte, context, error, bytes); \
-			if (record->total_length && \
-					*bytes > record->total_length) \
-				*error = iso_fmr_v20_invalid_total_length; \
-			if (*error) \
+			fits = pos + (size) <= limit; \
+		} while (0)
+#define __need(size) \
+		do { \
+			if (!fits && pos + (size) > limit) { \
+				iso_fmr_v20_overrun(pos + (size), limit, \
+						len, error, bytes); \
 				goto out; \
+			} \
+		} while (0)
+#define __get8(field) \
+		do { \
+			__need(1); \
+			field = buf[pos]; \
+			pos += 1; \
+		} while (0)
+#define __get16(field) \
+		do { \
+			__need(2); \
+			field = iso_fmr_get_be16(buf + pos); \
+			pos += 2; \
+		} while (0)
+#define __get32(field) \
+		do { \
+			__need(4); \
+			field = iso_fmr_get_be32(buf + pos); \
+			pos += 4; \
+		} while (0)
+#define __fail(err) \
+		do { \
+			*error = err; \
+			*bytes = pos; \
+			goto out; \
 		} while (0)
 
 	if (!error)
@@ -126,140 +199,496 @@ struct iso_fmr_v20 *iso_fmr_v20_decode(int (*getbyte)(void *context),
 	*error = 0;
 	*bytes = 0;
 
-	record = malloc(sizeof(*record));
-	if (!record) {
-		*error = iso_fmr_v20_out_of_memory;
-		goto out;
-	}
+	record = scratch ? &scratch->record :
+			iso_fmr_v20_alloc(arena, sizeof(*record));
+	if (!record)
+		__fail(iso_fmr_v20_out_of_memory);
 	memset(record, 0, sizeof(*record));
 
-	__get(record->format_id);
-	if (record->format_id != 0x464d5200) {
-		*error = iso_fmr_v20_invalid_format_id;
-		goto out;
-	}
+	__section(24);
 
-	__get(record->version);
-	if (record->version != 0x20323000) {
-		*error = iso_fmr_v20_invalid_version;
-		goto out;
-	}
+	__get32(record->format_id);
+	if (record->format_id != 0x464d5200)
+		__fail(iso_fmr_v20_invalid_format_id);
 
-	__get(record->total_length);
-	if (record->total_length < 24) {
-		*error = iso_fmr_v20_invalid_total_length;
-		goto out;
-	}
+	__get32(record->version);
+	if (record->version != 0x20323000)
+		__fail(iso_fmr_v20_invalid_version);
 
-	__get(tmp16);
+	__get32(record->total_length);
+	if (record->total_length < 24)
+		__fail(iso_fmr_v20_invalid_total_length);
+	if (record->total_length < limit)
+		limit = record->total_length;
+
+	__get16(tmp16);
 	record->capture_equip_cert = tmp16 >> 12;
 	record->capture_device_type_id = tmp16 & 0xfff;
 
-	__get(record->size_x);
-	__get(record->size_y);
-	__get(record->resolution_x);
-	__get(record->resolution_y);
-
-	__get(record->number_views);
-	record->views = malloc(sizeof(*record->views) * record->number_views);
-	if (!record->views) {
-		*error = iso_fmr_v20_out_of_memory;
-		goto out;
+	__get16(record->size_x);
+	__get16(record->size_y);
+	__get16(record->resolution_x);
+	__get16(record->resolution_y);
+
+	__get8(record->number_views);
+	if (!scratch) {
+		record->views = iso_fmr_v20_alloc(arena,
+				sizeof(*record->views) * record->number_views);
+		if (!record->views)
+			__fail(iso_fmr_v20_out_of_memory);
+		memset(record->views, 0,
+				sizeof(*record->views) * record->number_views);
 	}
-	memset(record->views, 0, sizeof(*record->views) * record->number_views);
 
-	__get(reserved);
-	if (reserved != 0) {
-		*error = iso_fmr_v20_invalid_reserved_byte;
-		goto out;
-	}
+	__get8(reserved);
+	if (reserved != 0)
+		__fail(iso_fmr_v20_invalid_reserved_byte);
 
 	for (v = 0; v < record->number_views; v++) {
-		struct iso_fmr_v20_view *view = &record->views[v];
+		struct iso_fmr_v20_view *view = scratch ? &scratch->view :
+				&record->views[v];
+		struct iso_fmr_v20_minutia *minutia;
 		uint8_t tmp8;
-		int m;
+		int fit, m;
 
-		__get(view->finger_position);
+		if (scratch && scratch->offsets)
+			scratch->offsets[v] = pos;
+
+		__section(4);
+
+		__get8(view->finger_position);
 		if (view->finger_position >=
-				ARRAY_SIZE(iso_fmr_v20_finger_positions)) {
-			*error = iso_fmr_v20_invalid_finger_position;
-			goto out;
-		}
+				ARRAY_SIZE(iso_fmr_v20_finger_positions))
+			__fail(iso_fmr_v20_invalid_finger_position);
 
-		__get(tmp8);
+		__get8(tmp8);
 		view->representation_number = tmp8 >> 4;
 		view->impression_type = tmp8 & 0xf;
 		if (view->impression_type >=
-				ARRAY_SIZE(iso_fmr_v20_impression_types)) {
-			*error = iso_fmr_v20_invalid_impression_type;
-			goto out;
+				ARRAY_SIZE(iso_fmr_v20_impression_types))
+			__fail(iso_fmr_v20_invalid_impression_type);
+
+		__get8(view->finger_quality);
+		if (view->finger_quality > 100)
+			__fail(iso_fmr_v20_invalid_finger_quality);
+
+		__get8(view->number_minutiae);
+		if (!scratch) {
+			view->minutiae = iso_fmr_v20_alloc(arena,
+					sizeof(*view->minutiae) *
+					view->number_minutiae);
+			if (!view->minutiae)
+				__fail(iso_fmr_v20_out_of_memory);
+			memset(view->minutiae, 0, sizeof(*view->minutiae) *
+					view->number_minutiae);
 		}
 
-		__get(view->finger_quality);
-		if (view->finger_quality > 100) {
-			*error = iso_fmr_v20_invalid_finger_quality;
-			goto out;
-		}
+		/* Minutiae are checked in bulk, as many as there is space for */
+		fit = (limit - pos) / 6;
+		if (fit > view->number_minutiae)
+			fit = view->number_minutiae;
 
-		__get(view->number_minutiae);
-		view->minutiae = malloc(sizeof(*view->minutiae) *
-				view->number_minutiae);
-		if (!view->minutiae) {
-			*error = iso_fmr_v20_out_of_memory;
-			goto out;
-		}
-		memset(view->minutiae, 0, sizeof(*view->minutiae) *
-				view->number_minutiae);
+		for (m = 0; m < fit; m++) {
+			const uint8_t *p = buf + pos;
 
-		for (m = 0; m < view->number_minutiae; m++) {
-			struct iso_fmr_v20_minutia *minutia =
+			minutia = scratch ? &scratch->minutia :
 					&view->minutiae[m];
 
-			__get(tmp16);
+			tmp16 = iso_fmr_get_be16(p);
 			minutia->type = tmp16 >> 14;
 			if (minutia->type >=
 					ARRAY_SIZE(iso_fmr_v20_minutia_types)) {
-				*error = iso_fmr_v20_invalid_minutia_type;
-				goto out;
+				pos += 2;
+				__fail(iso_fmr_v20_invalid_minutia_type);
 			}
 
 			minutia->x = tmp16 & 0x3fff;
-			__get(tmp16);
+			minutia->y = iso_fmr_get_be16(p + 2) & 0x3fff;
+			minutia->angle = p[4];
+			minutia->quality = p[5];
+			pos += 6;
+			if (minutia->quality > 100)
+				__fail(iso_fmr_v20_invalid_minutia_quality);
+		}
+
+		if (m < view->number_minutiae) {
+			/* Truncated minutia, find the failing field */
+			minutia = scratch ? &scratch->minutia :
+					&view->minutiae[m];
+			fits = 0;
+
+			__get16(tmp16);
+			minutia->type = tmp16 >> 14;
+			if (minutia->type >=
+					ARRAY_SIZE(iso_fmr_v20_minutia_types))
+				__fail(iso_fmr_v20_invalid_minutia_type);
+
+			minutia->x = tmp16 & 0x3fff;
+			__get16(tmp16);
 			minutia->y = tmp16 & 0x3fff;
-			__get(minutia->angle);
-			__get(minutia->quality);
-			if (minutia->quality > 100) {
-				*error = iso_fmr_v20_invalid_minutia_quality;
-				goto out;
-			}
+			__get8(minutia->angle);
+			__get8(minutia->quality);
 		}
 
-		__get(view->extended_data_block_length);
+		__section(2);
+
+		__get16(view->extended_data_block_length);
 		if (view->extended_data_block_length) {
 			size_t size = view->extended_data_block_length;
-			unsigned char *b = malloc(size);
+			unsigned char *b = NULL;
+
+			if (!scratch) {
+				b = iso_fmr_v20_alloc(arena, size);
+				if (!b)
+					__fail(iso_fmr_v20_out_of_memory);
+				view->extended_data_block = b;
+				memset(view->extended_data_block, 0, size);
+			}
 
-			if (!b) {
-				*error = iso_fmr_v20_out_of_memory;
+			if (pos + size > limit) {
+				/* The block is opaque, so it fails at its first
+				 * byte out of bounds */
+				if (b)
+					memcpy(b, buf + pos, limit - pos);
+				iso_fmr_v20_overrun(limit + 1, limit, len,
+						error, bytes);
 				goto out;
 			}
-			view->extended_data_block = b;
-			memset(view->extended_data_block, 0, size);
-
-			while (size--)
-				__get(*b++);
+			if (b)
+				memcpy(b, buf + pos, size);
+			pos += size;
 		}
 	}
 
-#undef __get
+	if (pos < record->total_length)
+		__fail(iso_fmr_v20_invalid_total_length);
+
+	*bytes = pos;
 
-	if (*bytes < record->total_length)
-		*error = iso_fmr_v20_invalid_total_length;
+#undef __fail
+#undef __get32
+#undef __get16
+#undef __get8
+#undef __need
+#undef __section
 
 out:
 	return record;
 }
 
+struct iso_fmr_v20 *iso_fmr_v20_decode_buffer(const void *buffer, size_t len,
+		enum iso_fmr_v20_error *error, size_t *bytes)
+{
+	return iso_fmr_v20_decode_into(buffer, len, NULL, NULL, error, bytes);
+}
+
+enum iso_fmr_v20_error iso_fmr_v20_validate(const void *buffer, size_t len,
+		size_t *bytes)
+{
+	struct iso_fmr_v20_scratch scratch;
+	enum iso_fmr_v20_error error;
+
+	memset(&scratch, 0, sizeof(scratch));
+
+	iso_fmr_v20_decode_into(buffer, len, NULL, &scratch, &error, bytes);
+
+	return error;
+}
+
+/*
+ * Walks the record structure (without validating it) to find out how big
+ * an arena is needed to decode it. It's never less than the decoder will
+ * allocate, even if the record turns out to be invalid or truncated.
+ */
+size_t iso_fmr_v20_arena_size(const void *buffer, size_t len)
+{
+	const uint8_t *buf = buffer;
+	size_t size = ARENA_ALIGN(sizeof(struct iso_fmr_v20));
+	size_t pos = 24;
+	int number_views, v;
+
+	if (len < 23)
+		return size;
+
+	number_views = buf[22];
+	size += ARENA_ALIGN(sizeof(struct iso_fmr_v20_view) * number_views);
+
+	for (v = 0; v < number_views; v++) {
+		size_t number_minutiae, extended_data_block_length;
+
+		if (pos + 4 > len)
+			break;
+		number_minutiae = buf[pos + 3];
+		size += ARENA_ALIGN(sizeof(struct iso_fmr_v20_minutia) *
+				number_minutiae);
+		pos += 4 + 6 * number_minutiae;
+
+		if (pos + 2 > len)
+			break;
+		extended_data_block_length = iso_fmr_get_be16(buf + pos);
+		size += ARENA_ALIGN(extended_data_block_length);
+		pos += 2 + extended_data_block_length;
+	}
+
+	return size;
+}
+
+struct iso_fmr_v20 *iso_fmr_v20_decode_arena(const void *buffer, size_t len,
+		void *arena, size_t arena_size,
+		enum iso_fmr_v20_error *error, size_t *bytes)
+{
+	struct iso_fmr_v20_arena a;
+	struct iso_fmr_v20 *record;
+
+	if (!arena) {
+		arena_size = iso_fmr_v20_arena_size(buffer, len);
+		a.next = malloc(arena_size);
+		a.left = a.next ? arena_size : 0;
+	} else {
+		a.next = arena;
+		a.left = arena_size;
+	}
+
+	record = iso_fmr_v20_decode_into(buffer, len, &a, NULL, error, bytes);
+
+	/* The record is at the beginning of the arena, if it fit in at all */
+	if (!arena && !record)
+		free(a.next);
+
+	return record;
+}
+
+struct iso_fmr_v20_index {
+	const uint8_t *buffer;
+	struct iso_fmr_v20 record;
+	uint32_t offsets[];
+};
+
+struct iso_fmr_v20_index *iso_fmr_v20_index_create(const void *buffer,
+		size_t len, enum iso_fmr_v20_error *error, size_t *bytes)
+{
+	const uint8_t *buf = buffer;
+	struct iso_fmr_v20_index *index;
+	struct iso_fmr_v20_scratch scratch;
+	enum iso_fmr_v20_error dummy_error;
+	int number_views = len > 22 ? buf[22] : 0;
+
+	if (!error)
+		error = &dummy_error;
+
+	index = malloc(sizeof(*index) +
+			sizeof(*index->offsets) * number_views);
+	if (!index) {
+		*error = iso_fmr_v20_out_of_memory;
+		if (bytes)
+			*bytes = 0;
+		return NULL;
+	}
+
+	memset(&scratch, 0, sizeof(scratch));
+	scratch.offsets = index->offsets;
+
+	iso_fmr_v20_decode_into(buffer, len, NULL, &scratch, error, bytes);
+	if (*error) {
+		free(index);
+		return NULL;
+	}
+
+	index->buffer = buf;
+	index->record = scratch.record;
+
+	return index;
+}
+
+void iso_fmr_v20_index_free(struct iso_fmr_v20_index *index)
+{
+	free(index);
+}
+
+const struct iso_fmr_v20 *iso_fmr_v20_index_get_record(
+		const struct iso_fmr_v20_index *index)
+{
+	return &index->record;
+}
+
+int iso_fmr_v20_index_get_view(const struct iso_fmr_v20_index *index,
+		int v, struct iso_fmr_v20_view *view)
+{
+	const uint8_t *p;
+
+	if (v < 0 || v >= index->record.number_views)
+		return -1;
+	p = index->buffer + index->offsets[v];
+
+	memset(view, 0, sizeof(*view));
+	view->finger_position = p[0];
+	view->representation_number = p[1] >> 4;
+	view->impression_type = p[1] & 0xf;
+	view->finger_quality = p[2];
+	view->number_minutiae = p[3];
+	view->extended_data_block_length =
+			iso_fmr_get_be16(p + 4 + 6 * p[3]);
+
+	return 0;
+}
+
+int iso_fmr_v20_index_get_minutiae(const struct iso_fmr_v20_index *index,
+		int v, int first, int number, struct iso_fmr_v20_minutia *minutiae)
+{
+	const uint8_t *p;
+	int m;
+
+	if (v < 0 || v >= index->record.number_views)
+		return -1;
+	p = index->buffer + index->offsets[v];
+
+	if (first < 0 || first > p[3] || number < 0)
+		return -1;
+	if (number > p[3] - first)
+		number = p[3] - first;
+
+	/* Already validated, so no checks here */
+	for (p += 4 + 6 * first, m = 0; m < number; m++, p += 6) {
+		struct iso_fmr_v20_minutia *minutia = &minutiae[m];
+		uint16_t tmp16 = iso_fmr_get_be16(p);
+
+		minutia->type = tmp16 >> 14;
+		minutia->x = tmp16 & 0x3fff;
+		minutia->y = iso_fmr_get_be16(p + 2) & 0x3fff;
+		minutia->angle = p[4];
+		minutia->quality = p[5];
+	}
+
+	return number;
+}
+
+const void *iso_fmr_v20_index_get_extended_data(
+		const struct iso_fmr_v20_index *index, int v, uint16_t *length)
+{
+	const uint8_t *p;
+
+	*length = 0;
+
+	if (v < 0 || v >= index->record.number_views)
+		return NULL;
+	p = index->buffer + index->offsets[v];
+	p += 4 + 6 * p[3];
+
+	*length = iso_fmr_get_be16(p);
+
+	return *length ? p + 2 : NULL;
+}
+
+/*
+ * Reads a record from a stream into a buffer, no further than its declared
+ * total length. Stops early when the header is already known to be wrong,
+ * so that the stream can still be re-read as a different version record.
+ */
+static uint8_t *iso_fmr_v20_read(int (*getbyte)(void *context),
+		void *context, size_t *len, int *complete)
+{
+	uint8_t *buf, *tmp;
+	size_t size = 12;
+	uint32_t total_length;
+	int byte;
+
+	*len = 0;
+	*complete = 0;
+
+	buf = malloc(size);
+	if (!buf)
+		return NULL;
+
+	while (*len < 12) {
+		byte = getbyte(context);
+		if (byte < 0)
+			return buf;
+		buf[(*len)++] = byte;
+
+		if (*len == 4 && iso_fmr_get_be32(buf) != 0x464d5200)
+			return buf;
+		if (*len == 8 && iso_fmr_get_be32(buf + 4) != 0x20323000)
+			return buf;
+	}
+
+	total_length = iso_fmr_get_be32(buf + 8);
+	if (total_length < 24)
+		return buf;
+
+	while (*len < total_length) {
+		if (*len == size) {
+			size = size * 4 < total_length ? size * 4 : total_length;
+			tmp = realloc(buf, size);
+			if (!tmp) {
+				free(buf);
+				return NULL;
+			}
+			buf = tmp;
+		}
+
+		byte = getbyte(context);
+		if (byte < 0)
+			return buf;
+		buf[(*len)++] = byte;
+	}
+
+	*complete = 1;
+
+	return buf;
+}
+
+struct iso_fmr_v20 *iso_fmr_v20_decode(int (*getbyte)(void *context),
+		void *context, enum iso_fmr_v20_error *error, size_t *bytes)
+{
+	struct iso_fmr_v20 *record;
+	enum iso_fmr_v20_error dummy_error;
+	size_t dummy_bytes;
+	uint8_t *buf;
+	size_t len;
+	int complete;
+
+	if (!error)
+		error = &dummy_error;
+	if (!bytes)
+		bytes = &dummy_bytes;
+
+	buf = iso_fmr_v20_read(getbyte, context, &len, &complete);
+	if (!buf) {
+		*error = iso_fmr_v20_out_of_memory;
+		*bytes = 0;
+		return NULL;
+	}
+
+	record = iso_fmr_v20_decode_buffer(buf, len, error, bytes);
+
+	/*
+	 * The record overruns its declared total length: carry on reading,
+	 * as far as a byte by byte decoder would, to report the same error.
+	 */
+	while (complete && *bytes == len &&
+			(*error == iso_fmr_v20_premature_end_of_data ||
+			*error == iso_fmr_v20_invalid_total_length)) {
+		uint8_t *tmp;
+		int byte = getbyte(context);
+
+		if (byte < 0)
+			break;
+
+		tmp = realloc(buf, len + 1);
+		if (!tmp)
+			break;
+		buf = tmp;
+		buf[len++] = byte;
+
+		iso_fmr_v20_free(record);
+		record = iso_fmr_v20_decode_buffer(buf, len, error, bytes);
+	}
+
+	free(buf);
+
+	return record;
+}
+
 
 struct iso_fmr_v20 *iso_fmr_v20_init(void)
 {
@@ -287,6 +716,7 @@ struct iso_fmr_v20_view *iso_fmr_v20_add_view(struct iso_fmr_v20 *record,
 	if (!views)
 		return NULL;
 	memset(&views[record->number_views], 0, sizeof(*views));
+	record->views = views;
 
 	view = &views[record->number_views];
 
@@ -297,11 +727,11 @@ struct iso_fmr_v20_view *iso_fmr_v20_add_view(struct iso_fmr_v20 *record,
 
 		memcpy(view->extended_data_block, extended_data_block,
 				extended_data_block_length);
+		view->extended_data_block_length = extended_data_block_length;
 	}
 
 	record->number_views++;
 	record->total_length += 6 + extended_data_block_length;
-	record->views = views;
 
 	return view;
 }
@@ -408,3 +838,8 @@ void iso_fmr_v20_free(struct iso_fmr_v20 *record)
 	free(record->views);
 	free(record);
 }
+
+void iso_fmr_v20_free_arena(struct iso_fmr_v20 *record)
+{
+	free(record);
+}
@@ -6,6 +6,7 @@ extern "C"
 {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 enum iso_fmr_v20_error {
@@ -61,6 +62,23 @@ struct iso_fmr_v20_minutia {
 
 struct iso_fmr_v20 *iso_fmr_v20_decode(int (*getbyte)(void *context),
 		void *context, enum iso_fmr_v20_error *error, size_t *bytes);
+struct iso_fmr_v20 *iso_fmr_v20_decode_buffer(const void *buffer, size_t len,
+		enum iso_fmr_v20_error *error, size_t *bytes);
+
+/* Checks the record as the decoders do, without allocating anything */
+enum iso_fmr_v20_error iso_fmr_v20_validate(const void *buffer, size_t len,
+		size_t *bytes);
+
+/*
+ * Arena decoding places the whole record in one contiguous block: either
+ * the caller's @arena (pointer-aligned, at least iso_fmr_v20_arena_size()
+ * bytes, released by the caller) or, when @arena is NULL, a block allocated
+ * by the decoder and released with iso_fmr_v20_free_arena().
+ */
+size_t iso_fmr_v20_arena_size(const void *buffer, size_t len);
+struct iso_fmr_v20 *iso_fmr_v20_decode_arena(const void *buffer, size_t len,
+		void *arena, size_t arena_size,
+		enum iso_fmr_v20_error *error, size_t *bytes);
 
 struct iso_fmr_v20 *iso_fmr_v20_init(void);
 struct iso_fmr_v20_view *iso_fmr_v20_add_view(struct iso_fmr_v20 *record,
@@ -71,6 +89,29 @@ int iso_fmr_v20_encode(struct iso_fmr_v20 *record,
 		int (*putbyte)(int byte, void *context), void *context);
 
 void iso_fmr_v20_free(struct iso_fmr_v20 *record);
+void iso_fmr_v20_free_arena(struct iso_fmr_v20 *record);
+
+/*
+ * Read-only view of a record in a buffer: it's validated and the views'
+ * offsets are noted once, then the fields are decoded straight from the
+ * buffer on demand. The buffer must outlive the index. The record returned
+ * by iso_fmr_v20_index_get_record() has the header fields only, views
+ * returned by iso_fmr_v20_index_get_view() have no minutiae and extended
+ * data block pointers.
+ */
+struct iso_fmr_v20_index;
+
+struct iso_fmr_v20_index *iso_fmr_v20_index_create(const void *buffer,
+		size_t len, enum iso_fmr_v20_error *error, size_t *bytes);
+void iso_fmr_v20_index_free(struct iso_fmr_v20_index *index);
+const struct iso_fmr_v20 *iso_fmr_v20_index_get_record(
+		const struct iso_fmr_v20_index *index);
+int iso_fmr_v20_index_get_view(const struct iso_fmr_v20_index *index,
+		int v, struct iso_fmr_v20_view *view);
+int iso_fmr_v20_index_get_minutiae(const struct iso_fmr_v20_index *index,
+		int v, int first, int number, struct iso_fmr_v20_minutia *minutiae);
+const void *iso_fmr_v20_index_get_extended_data(
+		const struct iso_fmr_v20_index *index, int v, uint16_t *length);
 
 
 const char *iso_fmr_v20_get_error_string(enum iso_fmr_v20_error error);
@@ -0,0 +1,581 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iso_fmr/v20.h"
+#include "iso_fmr/v030.h"
+#include "match.h"
+
+
+/* Rows, or impostor pairs, taken by a thread at a time */
+#define CHUNK 64
+#define THREADS_MAX 1024
+
+#define SCORES (FMR_MATCH_SCORE_MAX + 1)
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-q] [-j THREADS] [-i IMPOSTORS] [-s SEED] [-d STEP] LIST\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-q\tquantized matcher mode\n");
+	fprintf(stderr, "\t-j\tnumber of threads, all CPUs by default\n");
+	fprintf(stderr, "\t-i\tnumber of random impostor pairs, all of them by default\n");
+	fprintf(stderr, "\t-s\trandom seed of the impostor pairs, 1 by default\n");
+	fprintf(stderr, "\t-d\tthreshold step of the DET curve points, 100 by default\n");
+	fprintf(stderr, "\tLIST\tfile of \"LABEL NAME\" lines, FMR v20 or v030 files\n");
+	fprintf(stderr, "\t\tof the same LABEL are of the same finger\n");
+	fprintf(stderr, "The report is \"KEY VALUE...\" lines, with FMR100 and FMR1000 the\n");
+	fprintf(stderr, "lowest FNMR with FMR of 1%% and 0.1%% at most, and a \"det THRESHOLD\n");
+	fprintf(stderr, "FMR FNMR\" line for every step, rates as fractions.\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *read_file(const char *name, size_t *len)
+{
+	FILE *f = fopen(name, "rb");
+	uint8_t *buf = NULL;
+	long size;
+
+	if (!f)
+		return NULL;
+
+	if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+			fseek(f, 0, SEEK_SET) == 0) {
+		buf = malloc(size ? size : 1);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+		*len = size;
+	}
+
+	fclose(f);
+
+	return buf;
+}
+
+struct view {
+	uint8_t finger_position;
+	struct fmr_match_template *template;
+};
+
+struct record {
+	char *label;
+	char *name;
+	int number_views;
+	struct view *views;
+};
+
+static struct fmr_match_template *template_create(
+		const struct fmr_match_minutia *minutiae, int number_minutiae)
+{
+	void *buffer = malloc(fmr_match_template_size(number_minutiae));
+
+	if (!buffer)
+		return NULL;
+
+	return fmr_match_template_init(buffer, minutiae, number_minutiae);
+}
+
+/* Templates of all views (representations) in the file, of any version */
+static int load(struct record *record)
+{
+	struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+	uint8_t *buf;
+	size_t len, bytes;
+	int v, res = -1;
+
+	buf = read_file(record->name, &len);
+	if (!buf) {
+		perror(record->name);
+		return -1;
+	}
+
+	if (len >= 8 && !memcmp(buf + 4, "\x20\x32\x30\x00", 4)) {
+		enum iso_fmr_v20_error error;
+		struct iso_fmr_v20 *fmr;
+
+		fmr = iso_fmr_v20_decode_buffer(buf, len, &error, &bytes);
+		if (error) {
+			fprintf(stderr, "%s: error: %s at byte %zu\n",
+					record->name,
+					iso_fmr_v20_get_error_string(error),
+					bytes);
+			goto out;
+		}
+
+		record->number_views = fmr->number_views;
+		record->views = calloc(fmr->number_views + 1,
+				sizeof(*record->views));
+		for (v = 0; record->views && v < fmr->number_views; v++) {
+			record->views[v].finger_position =
+					fmr->views[v].finger_position;
+			record->views[v].template = template_create(minutiae,
+					fmr_match_minutiae_from_v20(fmr, v,
+					minutiae));
+		}
+		iso_fmr_v20_free(fmr);
+	} else {
+		enum iso_fmr_v030_error error;
+		struct iso_fmr_v030 *fmr;
+
+		fmr = iso_fmr_v030_decode_buffer(buf, len, &error, &bytes);
+		if (error) {
+			fprintf(stderr, "%s: error: %s at byte %zu\n",
+					record->name,
+					iso_fmr_v030_get_error_string(error),
+					bytes);
+			goto out;
+		}
+
+		record->number_views = fmr->number_representations;
+		record->views = calloc(fmr->number_representations + 1,
+				sizeof(*record->views));
+		for (v = 0; record->views &&
+				v < fmr->number_representations; v++) {
+			record->views[v].finger_position =
+				fmr->representations[v].finger_position;
+			record->views[v].template = template_create(minutiae,
+					fmr_match_minutiae_from_v030(fmr, v,
+					minutiae));
+		}
+		iso_fmr_v030_free(fmr);
+	}
+
+	for (v = 0; record->views && v < record->number_views; v++)
+		if (!record->views[v].template)
+			break;
+	if (!record->views || v < record->number_views) {
+		fprintf(stderr, "error: out of memory for templates\n");
+		goto out;
+	}
+	res = 0;
+
+out:
+	free(buf);
+
+	return res;
+}
+
+static int record_cmp(const void *a, const void *b)
+{
+	const struct record *ra = a, *rb = b;
+	int res = strcmp(ra->label, rb->label);
+
+	return res ? res : strcmp(ra->name, rb->name);
+}
+
+/* Records of the list, sorted by label, so that mates are next to others */
+static struct record *load_list(const char *list, int *number_records)
+{
+	FILE *f = fopen(list, "r");
+	struct record *records = NULL;
+	char line[4096], label[4096], name[4096];
+	int n = 0, lineno = 0, i;
+
+	if (!f) {
+		perror(list);
+		return NULL;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if (sscanf(line, "%4095s %4095s", label, name) != 2) {
+			if (sscanf(line, " %1s", label) == 1) {
+				fprintf(stderr, "%s:%d: error: not a \"LABEL NAME\" line\n",
+						list, lineno);
+				goto fail;
+			}
+			continue;
+		}
+
+		if (!(n & (n - 1))) {
+			struct record *new = realloc(records,
+					sizeof(*records) * (n ? n * 2 : 1));
+			if (!new)
+				goto oom;
+			records = new;
+		}
+		records[n].label = strdup(label);
+		records[n].name = strdup(name);
+		records[n].number_views = 0;
+		records[n].views = NULL;
+		if (!records[n].label || !records[n].name)
+			goto oom;
+		n++;
+	}
+	fclose(f);
+	f = NULL;
+
+	qsort(records, n, sizeof(*records), record_cmp);
+	for (i = 0; i < n; i++)
+		if (load(&records[i]))
+			goto fail;
+
+	*number_records = n;
+
+	return records;
+
+oom:
+	fprintf(stderr, "error: out of memory\n");
+fail:
+	if (f)
+		fclose(f);
+	*number_records = n;
+
+	return NULL;
+}
+
+/* Best score of views of the same, or unknown, finger, -1 for none */
+static int compare(const struct record *a, const struct record *b,
+		int (*compare)(const struct fmr_match_template *,
+		const struct fmr_match_template *))
+{
+	int best = -1;
+	int va, vb, score;
+
+	for (va = 0; va < a->number_views; va++) {
+		for (vb = 0; vb < b->number_views; vb++) {
+			if (a->views[va].finger_position &&
+					b->views[vb].finger_position &&
+					a->views[va].finger_position !=
+					b->views[vb].finger_position)
+				continue;
+
+			score = compare(a->views[va].template,
+					b->views[vb].template);
+			if (score > best)
+				best = score;
+		}
+	}
+
+	return best;
+}
+
+struct pair {
+	uint32_t a, b;
+};
+
+struct eval {
+	const struct record *records;
+	int number_records;
+	/* For every record, the first one past its label */
+	int *label_end;
+	/* Sampled impostor pairs, NULL for all of them */
+	const struct pair *pairs;
+	long number_pairs;
+	int (*compare)(const struct fmr_match_template *,
+			const struct fmr_match_template *);
+	atomic_long next_row, next_pair;
+};
+
+struct worker {
+	pthread_t thread;
+	struct eval *eval;
+	/* Of genuine [1] and impostor [0] comparisons, -1 last */
+	uint64_t histogram[2][SCORES + 1];
+};
+
+static void worker_add(struct worker *worker, int genuine, int score)
+{
+	worker->histogram[genuine][score < 0 ? SCORES : score]++;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *worker = arg;
+	struct eval *eval = worker->eval;
+	const struct record *records = eval->records;
+	long first, i, j;
+
+	/* Genuine pairs, and with no sampling all the others of the row */
+	while ((first = atomic_fetch_add(&eval->next_row, CHUNK)) <
+			eval->number_records) {
+		for (i = first; i < first + CHUNK &&
+				i < eval->number_records; i++) {
+			int end = eval->pairs ? eval->label_end[i] :
+					eval->number_records;
+
+			for (j = i + 1; j < end; j++)
+				worker_add(worker, j < eval->label_end[i],
+						compare(&records[i],
+						&records[j], eval->compare));
+		}
+	}
+
+	while ((first = atomic_fetch_add(&eval->next_pair, CHUNK)) <
+			eval->number_pairs) {
+		for (i = first; i < first + CHUNK && i < eval->number_pairs;
+				i++)
+			worker_add(worker, 0, compare(
+					&records[eval->pairs[i].a],
+					&records[eval->pairs[i].b],
+					eval->compare));
+	}
+
+	return NULL;
+}
+
+/* xorshift64*, as in fmr_gen, so that pairs only depend on the seed */
+static uint64_t state;
+
+static uint32_t random32(void)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+
+	return (state * 0x2545f4914f6cdd1dull) >> 32;
+}
+
+/* Random pairs of different labels, with replacement */
+static struct pair *sample_impostors(const struct eval *eval, long number)
+{
+	struct pair *pairs = malloc(sizeof(*pairs) * (number ? number : 1));
+	long i;
+
+	if (!pairs)
+		return NULL;
+
+	for (i = 0; i < number; i++) {
+		uint32_t a, b;
+
+		do {
+			a = random32() % eval->number_records;
+			b = random32() % eval->number_records;
+		} while (!strcmp(eval->records[a].label,
+				eval->records[b].label));
+		pairs[i].a = a;
+		pairs[i].b = b;
+	}
+
+	return pairs;
+}
+
+/* Impostors of score @t or more, and genuine below it, as fractions */
+static double fmr_at(const uint64_t *impostor, uint64_t impostors, int t)
+{
+	return (double)impostor[t] / impostors;
+}
+
+static double fnmr_at(const uint64_t *genuine, uint64_t genuines, int t)
+{
+	return (double)(genuines - genuine[t]) / genuines;
+}
+
+/* Lowest FNMR at FMR of @fmr at most */
+static void print_fnmr_at_fmr(const char *key, const uint64_t *genuine,
+		uint64_t genuines, const uint64_t *impostor,
+		uint64_t impostors, double fmr)
+{
+	int t;
+
+	for (t = 0; t < SCORES && fmr_at(impostor, impostors, t) > fmr; t++)
+		;
+	printf("%s %.6f\n", key, fnmr_at(genuine, genuines, t));
+	printf("%s_threshold %d\n", key, t);
+}
+
+int main(int argc, char *argv[])
+{
+	struct eval eval;
+	struct worker *workers;
+	struct record *records;
+	struct pair *pairs = NULL;
+	/* Comparisons of scores t and more, from the histograms */
+	uint64_t genuine[SCORES + 1], impostor[SCORES + 1];
+	uint64_t genuines, impostors, incomparable[2];
+	int opt, quantized = 0, threads = 0, step = 100;
+	long number_impostors = -1, i;
+	int number_records, started, t, k, eer_t;
+	uint64_t seed = 1;
+	double start, load_time, seconds, eer;
+
+	while ((opt = getopt(argc, argv, "hqj:i:s:d:")) != -1) {
+		switch (opt) {
+		case 'q':
+			quantized = 1;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'i':
+			number_impostors = atol(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'd':
+			step = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1 || threads < 0 || step < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	start = now();
+	records = load_list(argv[optind], &number_records);
+	if (!records)
+		return 1;
+	load_time = now() - start;
+
+	memset(&eval, 0, sizeof(eval));
+	eval.records = records;
+	eval.number_records = number_records;
+	eval.compare = quantized ? fmr_match_compare_quantized :
+			fmr_match_compare;
+	eval.label_end = malloc(sizeof(*eval.label_end) *
+			(number_records ? number_records : 1));
+	if (!eval.label_end) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+	for (i = number_records - 1; i >= 0; i--)
+		eval.label_end[i] = i + 1 < number_records &&
+				!strcmp(records[i].label,
+				records[i + 1].label) ?
+				eval.label_end[i + 1] : i + 1;
+	if (number_records < 2 || eval.label_end[0] == number_records) {
+		fprintf(stderr, "error: no impostor pairs, 2 labels at least needed\n");
+		return 1;
+	}
+
+	if (number_impostors >= 0) {
+		state = seed + 0x9e3779b97f4a7c15ull;
+		state = (state ^ (state >> 30)) * 0xbf58476d1ce4e5b9ull;
+		state = (state ^ (state >> 27)) * 0x94d049bb133111ebull;
+		state ^= state >> 31;
+		pairs = sample_impostors(&eval, number_impostors);
+		if (!pairs) {
+			fprintf(stderr, "error: out of memory for pairs\n");
+			return 1;
+		}
+		eval.pairs = pairs;
+		eval.number_pairs = number_impostors;
+	}
+	atomic_init(&eval.next_row, 0);
+	atomic_init(&eval.next_pair, 0);
+
+	if (!threads)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > THREADS_MAX)
+		threads = THREADS_MAX;
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+
+	start = now();
+	for (started = 0; started < threads; started++) {
+		workers[started].eval = &eval;
+		if (pthread_create(&workers[started].thread, NULL, worker,
+				&workers[started]))
+			break;
+	}
+	if (!started) {
+		fprintf(stderr, "error: failed to create threads\n");
+		return 1;
+	}
+	for (k = 0; k < started; k++)
+		pthread_join(workers[k].thread, NULL);
+	seconds = now() - start;
+
+	/* Cumulative from the top, genuine[t] is of scores t or more */
+	memset(genuine, 0, sizeof(genuine));
+	memset(impostor, 0, sizeof(impostor));
+	incomparable[0] = incomparable[1] = 0;
+	for (k = 0; k < started; k++) {
+		for (t = 0; t < SCORES; t++) {
+			impostor[t] += workers[k].histogram[0][t];
+			genuine[t] += workers[k].histogram[1][t];
+		}
+		incomparable[0] += workers[k].histogram[0][SCORES];
+		incomparable[1] += workers[k].histogram[1][SCORES];
+	}
+	for (t = SCORES - 1; t > 0; t--) {
+		impostor[t - 1] += impostor[t];
+		genuine[t - 1] += genuine[t];
+	}
+	genuines = genuine[0];
+	impostors = impostor[0];
+	if (!genuines || !impostors) {
+		fprintf(stderr, "error: no comparable %s pairs\n",
+				genuines ? "impostor" : "genuine");
+		return 1;
+	}
+
+	/* Where FNMR, going up with the threshold, gets to FMR, going down */
+	for (eer_t = 0; eer_t < SCORES && fnmr_at(genuine, genuines, eer_t) <
+			fmr_at(impostor, impostors, eer_t); eer_t++)
+		;
+	eer = (fnmr_at(genuine, genuines, eer_t) +
+			fmr_at(impostor, impostors, eer_t)) / 2;
+	if (eer_t > 0 && fmr_at(impostor, impostors, eer_t - 1) -
+			fnmr_at(genuine, genuines, eer_t - 1) <
+			fnmr_at(genuine, genuines, eer_t) -
+			fmr_at(impostor, impostors, eer_t)) {
+		eer_t--;
+		eer = (fnmr_at(genuine, genuines, eer_t) +
+				fmr_at(impostor, impostors, eer_t)) / 2;
+	}
+
+	printf("records %d\n", number_records);
+	printf("mode %s\n", quantized ? "quantized" : "reference");
+	printf("threads %d\n", started);
+	printf("genuine %llu\n", (unsigned long long)genuines);
+	printf("impostor %llu\n", (unsigned long long)impostors);
+	printf("genuine_incomparable %llu\n",
+			(unsigned long long)incomparable[1]);
+	printf("impostor_incomparable %llu\n",
+			(unsigned long long)incomparable[0]);
+	printf("load_seconds %.3f\n", load_time);
+	printf("seconds %.3f\n", seconds);
+	printf("comparisons_per_second %.0f\n", (genuines + impostors +
+			incomparable[0] + incomparable[1]) / seconds);
+	printf("eer %.6f\n", eer);
+	printf("eer_threshold %d\n", eer_t);
+	print_fnmr_at_fmr("fmr100", genuine, genuines, impostor, impostors,
+			0.01);
+	print_fnmr_at_fmr("fmr1000", genuine, genuines, impostor, impostors,
+			0.001);
+	for (t = 0; t < SCORES; t += step)
+		printf("det %d %.6f %.6f\n", t, fmr_at(impostor, impostors, t),
+				fnmr_at(genuine, genuines, t));
+
+	for (i = 0; i < number_records; i++) {
+		for (k = 0; k < records[i].number_views; k++)
+			free(records[i].views[k].template);
+		free(records[i].views);
+		free(records[i].label);
+		free(records[i].name);
+	}
+	free(records);
+	free(eval.label_end);
+	free(pairs);
+	free(workers);
+
+	return 0;
+}
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "match.h"
+#include "minutiae.h"
+#include "trig.h"
+
+
+/* Typical area of a 500 dpi live scan */
+#define WIDTH 400
+#define HEIGHT 500
+
+static const int candidates_steps[] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000,
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-n TEMPLATES] [-q PROBES] [-c CANDIDATES] [-s SEED]\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-n\tsynthetic gallery size, 20000 by default\n");
+	fprintf(stderr, "\t-q\tnumber of probes, distorted gallery templates, 200 by default\n");
+	fprintf(stderr, "\t-c\tmost candidates passed to the matcher, 1000 by default\n");
+	fprintf(stderr, "\t-s\trandom seed, 1 by default\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int random_range(int min, int max)
+{
+	return min + rand() % (max - min + 1);
+}
+
+/* Minutiae directions follow a smooth, random, ridge flow */
+static int generate(struct fmr_match_minutia *minutiae)
+{
+	int number = random_range(30, 60);
+	int flow_x = random_range(-64, 64), flow_y = random_range(-64, 64);
+	uint8_t flow = rand();
+	int m;
+
+	for (m = 0; m < number; m++) {
+		minutiae[m].x = rand() % WIDTH;
+		minutiae[m].y = rand() % HEIGHT;
+		minutiae[m].angle = flow + (minutiae[m].x * flow_x +
+				minutiae[m].y * flow_y) / 256 +
+				random_range(-16, 16) + (rand() % 2) * 128;
+		minutiae[m].type = 1 + rand() % 2;
+	}
+
+	return number;
+}
+
+/*
+ * Another impression of the same finger: rotated, shifted, with jitter,
+ * some minutiae missing, some spurious, and cropped to the scan area.
+ */
+static int distort(const struct fmr_match_minutia *in, int number,
+		struct fmr_match_minutia *out)
+{
+	uint8_t rotation = random_range(-20, 20);
+	int c = fmr_match_cos[rotation], s = fmr_match_sin(rotation);
+	int shift_x = random_range(-30, 30), shift_y = random_range(-30, 30);
+	int m, n = 0, spurious = random_range(0, 10);
+
+	for (m = 0; m < number; m++) {
+		int x = in[m].x - WIDTH / 2, y = in[m].y - HEIGHT / 2;
+		int u, v;
+
+		if (rand() % 100 < 25)
+			continue;
+
+		u = ((x * c + y * s) >> 14) + WIDTH / 2 + shift_x +
+				random_range(-5, 5);
+		v = ((y * c - x * s) >> 14) + HEIGHT / 2 + shift_y +
+				random_range(-5, 5);
+		if (u < 0 || u >= WIDTH || v < 0 || v >= HEIGHT)
+			continue;
+
+		out[n].x = u;
+		out[n].y = v;
+		out[n].angle = in[m].angle + rotation + random_range(-8, 8);
+		out[n].type = in[m].type;
+		n++;
+	}
+
+	while (spurious-- && n < FMR_MATCH_MINUTIAE_MAX) {
+		out[n].x = rand() % WIDTH;
+		out[n].y = rand() % HEIGHT;
+		out[n].angle = rand();
+		out[n].type = 1 + rand() % 2;
+		n++;
+	}
+
+	return n;
+}
+
+static struct fmr_minutiae *to_minutiae(const struct fmr_match_minutia *in,
+		int number)
+{
+	void *buffer = aligned_alloc(FMR_MINUTIAE_ALIGN,
+			fmr_minutiae_size(number));
+
+	return buffer ? fmr_minutiae_from_array(buffer, in, number) : NULL;
+}
+
+static struct fmr_match_template *to_template(
+		const struct fmr_match_minutia *in, int number)
+{
+	void *buffer = malloc(fmr_match_template_size(number));
+
+	return buffer ? fmr_match_template_init(buffer, in, number) : NULL;
+}
+
+struct probe {
+	uint32_t mate;
+	struct fmr_minutiae *minutiae;
+	struct fmr_match_template *template;
+};
+
+/* Rank of the probe's mate among the candidates, -1 if it's not there */
+static int mate_rank(const struct fmr_index_candidate *candidates,
+		int number, uint32_t mate)
+{
+	int i;
+
+	for (i = 0; i < number; i++)
+		if (candidates[i].id == mate)
+			return i;
+
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+	static struct fmr_match_minutia distorted[FMR_MATCH_MINUTIAE_MAX];
+	struct fmr_minutiae **gallery;
+	struct fmr_match_template **templates;
+	struct fmr_index_candidate *candidates;
+	struct probe *probes;
+	struct fmr_index *index;
+	int opt;
+	long number_templates = 20000;
+	int number_probes = 200, max_candidates = 1000;
+	unsigned int seed = 1;
+	int *ranks;
+	double start, insert_time, delete_time, search_time = 0;
+	double brute_time, compare_time;
+	long comparisons, i;
+	int p, c, step, number, res = 0;
+	volatile int sink = 0;
+
+	while ((opt = getopt(argc, argv, "hn:q:c:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			number_templates = atol(optarg);
+			break;
+		case 'q':
+			number_probes = atoi(optarg);
+			break;
+		case 'c':
+			max_candidates = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || number_templates < 1 ||
+			number_templates > UINT32_MAX || number_probes < 1 ||
+			max_candidates < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (max_candidates > number_templates)
+		max_candidates = number_templates;
+
+	gallery = malloc(sizeof(*gallery) * number_templates);
+	templates = malloc(sizeof(*templates) * number_templates);
+	probes = malloc(sizeof(*probes) * number_probes);
+	candidates = malloc(sizeof(*candidates) * max_candidates);
+	ranks = malloc(sizeof(*ranks) * number_probes);
+	index = fmr_index_create();
+	if (!gallery || !templates || !probes || !candidates || !ranks ||
+			!index) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+
+	/* Probes are distorted copies of randomly chosen templates */
+	srand(seed);
+	for (p = 0; p < number_probes; p++)
+		probes[p].mate = rand() % number_templates;
+
+	for (i = 0; i < number_templates; i++) {
+		number = generate(minutiae);
+		gallery[i] = to_minutiae(minutiae, number);
+		templates[i] = to_template(minutiae, number);
+		if (!gallery[i] || !templates[i]) {
+			fprintf(stderr, "error: out of memory for templates\n");
+			return 1;
+		}
+
+		for (p = 0; p < number_probes; p++) {
+			if (probes[p].mate != i)
+				continue;
+			number = distort(minutiae, number, distorted);
+			probes[p].minutiae = to_minutiae(distorted, number);
+			probes[p].template = to_template(distorted, number);
+			if (!probes[p].minutiae || !probes[p].template) {
+				fprintf(stderr, "error: out of memory for probes\n");
+				return 1;
+			}
+			/* Same number of source minutiae for the next one */
+			number = gallery[i]->number_minutiae;
+		}
+	}
+
+	start = now();
+	for (i = 0; i < number_templates; i++) {
+		if (fmr_index_insert(index, i, gallery[i])) {
+			perror("failed to insert template");
+			return 1;
+		}
+	}
+	insert_time = now() - start;
+
+	/* Rate of the full matcher, on a part of the gallery for a big one */
+	comparisons = number_templates < 100000 ? number_templates : 100000;
+	start = now();
+	for (i = 0; i < comparisons; i++)
+		sink += fmr_match_compare(probes[i % number_probes].template,
+				templates[i]);
+	compare_time = (now() - start) / comparisons;
+	brute_time = compare_time * number_templates;
+
+	for (p = 0; p < number_probes; p++) {
+		start = now();
+		number = fmr_index_search(index, probes[p].minutiae,
+				candidates, max_candidates);
+		search_time += now() - start;
+		if (number < 0) {
+			perror("failed to search");
+			return 1;
+		}
+		ranks[p] = mate_rank(candidates, number, probes[p].mate);
+	}
+	search_time /= number_probes;
+
+	printf("%ld templates, %zu bytes of index, inserted at %.0f templates/s\n",
+			number_templates, fmr_index_get_size(index),
+			number_templates / insert_time);
+	printf("index search %.3f ms, matcher %.0f comparisons/s, brute force %.1f ms\n",
+			search_time * 1e3, 1 / compare_time, brute_time * 1e3);
+	printf("%10s %8s %10s\n", "candidates", "recall", "speedup");
+
+	for (step = 0; step < ARRAY_SIZE(candidates_steps) &&
+			candidates_steps[step] <= max_candidates; step++) {
+		int recalled = 0;
+
+		for (p = 0; p < number_probes; p++)
+			if (ranks[p] >= 0 && ranks[p] < candidates_steps[step])
+				recalled++;
+
+		printf("%10d %7.1f%% %9.1fx\n", candidates_steps[step],
+				100.0 * recalled / number_probes, brute_time /
+				(search_time + candidates_steps[step] *
+				compare_time));
+	}
+
+	/* Delete every other template, and put them back, in place */
+	start = now();
+	for (i = 1; i < number_templates; i += 2)
+		fmr_index_delete(index, i);
+	delete_time = now() - start;
+
+	for (p = 0; p < number_probes; p++) {
+		number = fmr_index_search(index, probes[p].minutiae,
+				candidates, max_candidates);
+		for (c = 0; c < number; c++) {
+			if (candidates[c].id % 2) {
+				fprintf(stderr, "error: deleted template %u found\n",
+						candidates[c].id);
+				res = 1;
+				break;
+			}
+		}
+	}
+
+	start = now();
+	for (i = 1; i < number_templates; i += 2) {
+		if (fmr_index_insert(index, i, gallery[i])) {
+			perror("failed to insert template");
+			return 1;
+		}
+	}
+	insert_time = now() - start;
+
+	/* The same keys, so the same votes, and the same candidates */
+	for (p = 0; p < number_probes; p++) {
+		number = fmr_index_search(index, probes[p].minutiae,
+				candidates, max_candidates);
+		if (mate_rank(candidates, number, probes[p].mate) != ranks[p]) {
+			fprintf(stderr, "error: different results for probe %d after re-insertion\n",
+					p);
+			res = 1;
+		}
+	}
+
+	printf("deleted %ld at %.0f templates/s, re-inserted at %.0f templates/s, %s\n",
+			number_templates / 2, number_templates / 2 / delete_time,
+			number_templates / 2 / insert_time,
+			res ? "results differ" : "same results");
+
+	for (p = 0; p < number_probes; p++) {
+		free(probes[p].minutiae);
+		free(probes[p].template);
+	}
+	for (i = 0; i < number_templates; i++) {
+		free(gallery[i]);
+		free(templates[i]);
+	}
+	fmr_index_free(index);
+	free(gallery);
+	free(templates);
+	free(probes);
+	free(candidates);
+	free(ranks);
+
+	return res;
+}
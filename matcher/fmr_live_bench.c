@@ -0,0 +1,431 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "live.h"
+#include "match.h"
+#include "search.h"
+#include "trig.h"
+
+
+/* Typical area of a 500 dpi live scan */
+#define WIDTH 400
+#define HEIGHT 500
+
+#define PROBES 200
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-d] [-n TEMPLATES] [-w WRITES] [-r READERS] [-t SECONDS] [-s SEED]\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-d\tkeep MCC descriptors, for the cascade's second stage\n");
+	fprintf(stderr, "\t-n\tsynthetic gallery size, 20000 by default\n");
+	fprintf(stderr, "\t-w\ttemplates added, and deleted, by the writer, 10000 by default\n");
+	fprintf(stderr, "\t-r\tnumber of searching threads, 2 by default\n");
+	fprintf(stderr, "\t-t\tduration of each phase, 2 seconds by default\n");
+	fprintf(stderr, "\t-s\trandom seed, 1 by default\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int random_range(int min, int max)
+{
+	return min + rand() % (max - min + 1);
+}
+
+struct template {
+	int number_minutiae;
+	struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+};
+
+/* Minutiae directions follow a smooth, random, ridge flow */
+static void generate(struct template *template)
+{
+	int flow_x = random_range(-64, 64), flow_y = random_range(-64, 64);
+	uint8_t flow = rand();
+	int m;
+
+	template->number_minutiae = random_range(30, 60);
+	for (m = 0; m < template->number_minutiae; m++) {
+		struct fmr_match_minutia *minutia = &template->minutiae[m];
+
+		minutia->x = rand() % WIDTH;
+		minutia->y = rand() % HEIGHT;
+		minutia->angle = flow + (minutia->x * flow_x +
+				minutia->y * flow_y) / 256 +
+				random_range(-16, 16) + (rand() % 2) * 128;
+		minutia->type = 1 + rand() % 2;
+	}
+}
+
+/* Another impression of the same finger, as in fmr_index_bench */
+static void distort(const struct template *in, struct template *out)
+{
+	uint8_t rotation = random_range(-20, 20);
+	int c = fmr_match_cos[rotation], s = fmr_match_sin(rotation);
+	int shift_x = random_range(-30, 30), shift_y = random_range(-30, 30);
+	int m, n = 0, spurious = random_range(0, 10);
+
+	for (m = 0; m < in->number_minutiae; m++) {
+		int x = in->minutiae[m].x - WIDTH / 2;
+		int y = in->minutiae[m].y - HEIGHT / 2;
+		int u, v;
+
+		if (rand() % 100 < 25)
+			continue;
+
+		u = ((x * c + y * s) >> 14) + WIDTH / 2 + shift_x +
+				random_range(-5, 5);
+		v = ((y * c - x * s) >> 14) + HEIGHT / 2 + shift_y +
+				random_range(-5, 5);
+		if (u < 0 || u >= WIDTH || v < 0 || v >= HEIGHT)
+			continue;
+
+		out->minutiae[n].x = u;
+		out->minutiae[n].y = v;
+		out->minutiae[n].angle = in->minutiae[m].angle + rotation +
+				random_range(-8, 8);
+		out->minutiae[n].type = in->minutiae[m].type;
+		n++;
+	}
+
+	while (spurious-- && n < FMR_MATCH_MINUTIAE_MAX) {
+		out->minutiae[n].x = rand() % WIDTH;
+		out->minutiae[n].y = rand() % HEIGHT;
+		out->minutiae[n].angle = rand();
+		out->minutiae[n].type = 1 + rand() % 2;
+		n++;
+	}
+
+	out->number_minutiae = n;
+}
+
+struct bench {
+	struct fmr_live *live;
+	struct fmr_search_cascade cascade;
+	struct fmr_search_probe **probes;
+	/* Of ids from number_templates on */
+	const struct template *writes;
+	long number_templates, number_writes, written;
+	int stop;
+	double write_time;
+};
+
+struct reader {
+	pthread_t thread;
+	struct bench *bench;
+	unsigned int seed;
+	int failed;
+	/* Of every search, in nanoseconds */
+	uint64_t *latencies;
+	long number_latencies;
+};
+
+static void *reader(void *arg)
+{
+	struct reader *reader = arg;
+	struct bench *bench = reader->bench;
+	struct fmr_search_candidate candidates[10];
+
+	while (!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED)) {
+		const struct fmr_search_probe *probe =
+				bench->probes[rand_r(&reader->seed) % PROBES];
+		double start = now();
+
+		if (fmr_live_search(bench->live, probe, &bench->cascade,
+				candidates, 10, 1, NULL) < 0) {
+			reader->failed = 1;
+			break;
+		}
+
+		if (!(reader->number_latencies &
+				(reader->number_latencies - 1))) {
+			uint64_t *latencies = realloc(reader->latencies,
+					sizeof(*latencies) * (reader->number_latencies ?
+					reader->number_latencies * 2 : 1));
+			if (!latencies) {
+				reader->failed = 1;
+				break;
+			}
+			reader->latencies = latencies;
+		}
+		reader->latencies[reader->number_latencies++] =
+				(now() - start) * 1e9;
+	}
+
+	return NULL;
+}
+
+/* Adds an entry, deletes one of the first ones, and so on */
+static void *writer(void *arg)
+{
+	struct bench *bench = arg;
+	double start = now();
+	long i;
+
+	for (i = 0; i < bench->number_writes &&
+			!__atomic_load_n(&bench->stop, __ATOMIC_RELAXED); i++) {
+		const struct template *template = &bench->writes[i];
+
+		if (fmr_live_add_minutiae(bench->live,
+				bench->number_templates + i, 0,
+				template->minutiae, template->number_minutiae)) {
+			perror("failed to add template");
+			break;
+		}
+		if (i < bench->number_templates &&
+				fmr_live_delete(bench->live, i)) {
+			perror("failed to delete template");
+			break;
+		}
+	}
+
+	bench->written = i;
+	bench->write_time = now() - start;
+
+	return NULL;
+}
+
+static int uint64_cmp(const void *a, const void *b)
+{
+	uint64_t ua = *(const uint64_t *)a, ub = *(const uint64_t *)b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+/* Searches for @seconds, with or without the writer, and the report */
+static int phase(struct bench *bench, struct reader *readers,
+		int number_readers, int seconds, int writing)
+{
+	pthread_t writer_thread;
+	uint64_t *latencies;
+	long number = 0, i;
+	int r, res = 0;
+
+	bench->stop = 0;
+	for (r = 0; r < number_readers; r++) {
+		readers[r].number_latencies = 0;
+		if (pthread_create(&readers[r].thread, NULL, reader,
+				&readers[r])) {
+			fprintf(stderr, "error: failed to create thread\n");
+			return -1;
+		}
+	}
+	if (writing && pthread_create(&writer_thread, NULL, writer, bench)) {
+		fprintf(stderr, "error: failed to create thread\n");
+		return -1;
+	}
+
+	sleep(seconds);
+	__atomic_store_n(&bench->stop, 1, __ATOMIC_RELAXED);
+
+	for (r = 0; r < number_readers; r++) {
+		pthread_join(readers[r].thread, NULL);
+		if (readers[r].failed) {
+			perror("failed to search");
+			res = -1;
+		}
+		number += readers[r].number_latencies;
+	}
+	if (writing)
+		pthread_join(writer_thread, NULL);
+
+	latencies = malloc(sizeof(*latencies) * (number ? number : 1));
+	if (!latencies) {
+		fprintf(stderr, "error: out of memory\n");
+		return -1;
+	}
+	for (r = 0, i = 0; r < number_readers; r++) {
+		memcpy(latencies + i, readers[r].latencies,
+				sizeof(*latencies) * readers[r].number_latencies);
+		i += readers[r].number_latencies;
+	}
+	qsort(latencies, number, sizeof(*latencies), uint64_cmp);
+
+	printf("%-8s %10.0f %9.3f %9.3f %9.3f",
+			writing ? "writing" : "reading", (double)number / seconds,
+			number ? latencies[number / 2] / 1e6 : 0,
+			number ? latencies[number * 99 / 100] / 1e6 : 0,
+			number ? latencies[number - 1] / 1e6 : 0);
+	if (writing)
+		printf(" %10.0f", bench->written / bench->write_time);
+	else
+		printf(" %10s", "-");
+	printf(" %8d %8u\n", fmr_live_get_number_segments(bench->live),
+			fmr_live_get_number_entries(bench->live));
+
+	free(latencies);
+
+	return res;
+}
+
+/* Best candidate's id, or -1 for none */
+static long best(struct fmr_live *live, const struct template *template,
+		const struct fmr_search_cascade *cascade)
+{
+	struct fmr_search_probe *probe;
+	struct fmr_search_candidate candidate;
+	int number;
+
+	probe = fmr_search_probe_create(template->minutiae,
+			template->number_minutiae, 0);
+	if (!probe)
+		return -1;
+	number = fmr_live_search(live, probe, cascade, &candidate, 1, 1, NULL);
+	free(probe);
+
+	return number > 0 && candidate.score >= cascade->score ?
+			candidate.id : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench bench;
+	struct reader *readers;
+	struct template *templates, *writes, added, probe;
+	int opt, descriptors = 0, number_readers = 2, seconds = 2;
+	long number_templates = 20000, number_writes = 10000, id, i;
+	unsigned int seed = 1;
+	double start;
+	int r, res = 0;
+
+	while ((opt = getopt(argc, argv, "hdn:w:r:t:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			descriptors = 1;
+			break;
+		case 'n':
+			number_templates = atol(optarg);
+			break;
+		case 'w':
+			number_writes = atol(optarg);
+			break;
+		case 'r':
+			number_readers = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || number_templates < 1 || number_writes < 0 ||
+			number_templates + number_writes >= UINT32_MAX ||
+			number_readers < 1 || number_readers >=
+			FMR_LIVE_SEARCHES_MAX || seconds < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	memset(&bench, 0, sizeof(bench));
+	bench.live = fmr_live_create(descriptors);
+	bench.probes = malloc(sizeof(*bench.probes) * PROBES);
+	templates = malloc(sizeof(*templates) * number_templates);
+	writes = malloc(sizeof(*writes) * (number_writes ? number_writes : 1));
+	readers = calloc(number_readers, sizeof(*readers));
+	if (!bench.live || !bench.probes || !templates || !writes ||
+			!readers) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+	fmr_search_cascade_init(&bench.cascade);
+	if (!descriptors)
+		bench.cascade.descriptors_score = 0;
+	bench.writes = writes;
+	bench.number_templates = number_templates;
+	bench.number_writes = number_writes;
+
+	srand(seed);
+	for (i = 0; i < number_templates; i++)
+		generate(&templates[i]);
+	for (i = 0; i < number_writes; i++)
+		generate(&writes[i]);
+	for (i = 0; i < PROBES; i++) {
+		distort(&templates[rand() % number_templates], &probe);
+		bench.probes[i] = fmr_search_probe_create(probe.minutiae,
+				probe.number_minutiae, 0);
+		if (!bench.probes[i]) {
+			fprintf(stderr, "error: out of memory for probes\n");
+			return 1;
+		}
+	}
+
+	start = now();
+	for (i = 0; i < number_templates; i++) {
+		if (fmr_live_add_minutiae(bench.live, i, 0,
+				templates[i].minutiae,
+				templates[i].number_minutiae)) {
+			perror("failed to add template");
+			return 1;
+		}
+	}
+	printf("%ld templates added at %.0f templates/s, in %d segments\n",
+			number_templates, number_templates / (now() - start),
+			fmr_live_get_number_segments(bench.live));
+
+	for (r = 0; r < number_readers; r++) {
+		readers[r].bench = &bench;
+		readers[r].seed = seed + r;
+	}
+
+	printf("%-8s %10s %9s %9s %9s %10s %8s %8s\n", "phase", "searches/s",
+			"p50 ms", "p99 ms", "max ms", "writes/s", "segments",
+			"entries");
+	if (phase(&bench, readers, number_readers, seconds, 0) ||
+			phase(&bench, readers, number_readers, seconds, 1))
+		return 1;
+
+	/* Searchable once added, and not any more once deleted */
+	id = number_templates + number_writes;
+	generate(&added);
+	distort(&added, &probe);
+	if (fmr_live_add_minutiae(bench.live, id, 0, added.minutiae,
+			added.number_minutiae)) {
+		perror("failed to add template");
+		return 1;
+	}
+	if (best(bench.live, &probe, &bench.cascade) != id) {
+		fprintf(stderr, "error: template %ld not found once added\n", id);
+		res = 1;
+	}
+	if (fmr_live_delete(bench.live, id)) {
+		perror("failed to delete template");
+		return 1;
+	}
+	if (best(bench.live, &probe, &bench.cascade) == id) {
+		fprintf(stderr, "error: template %ld found once deleted\n", id);
+		res = 1;
+	}
+	if (!res)
+		printf("added template found, deleted one not\n");
+
+	for (i = 0; i < PROBES; i++)
+		free(bench.probes[i]);
+	for (r = 0; r < number_readers; r++)
+		free(readers[r].latencies);
+	fmr_live_free(bench.live);
+	free(bench.probes);
+	free(templates);
+	free(writes);
+	free(readers);
+
+	return res;
+}
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iso_fmr/v20.h"
+#include "iso_fmr/v030.h"
+#include "match.h"
+
+
+struct view {
+	uint8_t finger_position;
+	struct fmr_match_template *template;
+};
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-q] [-n ITERATIONS] NAME1 NAME2\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-q\tquantized matcher mode\n");
+	fprintf(stderr, "\t-n\trepeat comparisons and report their rate\n");
+	fprintf(stderr, "\tNAME1, NAME2\tFMR v20 or v030 files\n");
+}
+
+static void *read_file(const char *name, size_t *len)
+{
+	FILE *f = fopen(name, "rb");
+	uint8_t *buf = NULL;
+	long size;
+
+	if (!f)
+		return NULL;
+
+	if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+			fseek(f, 0, SEEK_SET) == 0) {
+		buf = malloc(size ? size : 1);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+		*len = size;
+	}
+
+	fclose(f);
+
+	return buf;
+}
+
+static struct fmr_match_template *template_create(
+		const struct fmr_match_minutia *minutiae, int number_minutiae)
+{
+	void *buffer = malloc(fmr_match_template_size(number_minutiae));
+
+	if (!buffer)
+		return NULL;
+
+	return fmr_match_template_init(buffer, minutiae, number_minutiae);
+}
+
+/* Templates of all views (representations) in the file, of any version */
+static struct view *load(const char *name, int *number_views)
+{
+	struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+	struct view *views = NULL;
+	uint8_t *buf;
+	size_t len, bytes;
+	int v;
+
+	buf = read_file(name, &len);
+	if (!buf) {
+		perror(name);
+		return NULL;
+	}
+
+	if (len >= 8 && !memcmp(buf + 4, "\x20\x32\x30\x00", 4)) {
+		enum iso_fmr_v20_error error;
+		struct iso_fmr_v20 *record;
+
+		record = iso_fmr_v20_decode_buffer(buf, len, &error, &bytes);
+		if (error) {
+			fprintf(stderr, "%s: error: %s at byte %zu\n", name,
+					iso_fmr_v20_get_error_string(error),
+					bytes);
+			goto out;
+		}
+
+		*number_views = record->number_views;
+		views = calloc(*number_views + 1, sizeof(*views));
+		for (v = 0; views && v < *number_views; v++) {
+			views[v].finger_position =
+					record->views[v].finger_position;
+			views[v].template = template_create(minutiae,
+					fmr_match_minutiae_from_v20(record, v,
+					minutiae));
+		}
+		iso_fmr_v20_free(record);
+	} else {
+		enum iso_fmr_v030_error error;
+		struct iso_fmr_v030 *record;
+
+		record = iso_fmr_v030_decode_buffer(buf, len, &error, &bytes);
+		if (error) {
+			fprintf(stderr, "%s: error: %s at byte %zu\n", name,
+					iso_fmr_v030_get_error_string(error),
+					bytes);
+			goto out;
+		}
+
+		*number_views = record->number_representations;
+		views = calloc(*number_views + 1, sizeof(*views));
+		for (v = 0; views && v < *number_views; v++) {
+			views[v].finger_position =
+				record->representations[v].finger_position;
+			views[v].template = template_create(minutiae,
+					fmr_match_minutiae_from_v030(record, v,
+					minutiae));
+		}
+		iso_fmr_v030_free(record);
+	}
+
+	for (v = 0; views && v < *number_views; v++) {
+		if (!views[v].template) {
+			fprintf(stderr, "error: out of memory for templates\n");
+			exit(1);
+		}
+	}
+
+out:
+	free(buf);
+
+	return views;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	long iterations = 0, i;
+	struct view *a, *b;
+	int na, nb, va, vb;
+	int best = -1, best_a = 0, best_b = 0;
+	int (*compare)(const struct fmr_match_template *,
+			const struct fmr_match_template *) = fmr_match_compare;
+
+	while ((opt = getopt(argc, argv, "hqn:")) != -1) {
+		switch (opt) {
+		case 'q':
+			compare = fmr_match_compare_quantized;
+			break;
+		case 'n':
+			iterations = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	a = load(argv[optind], &na);
+	b = load(argv[optind + 1], &nb);
+	if (!a || !b)
+		return 1;
+
+	for (va = 0; va < na; va++) {
+		for (vb = 0; vb < nb; vb++) {
+			int score;
+
+			if (a[va].finger_position && b[vb].finger_position &&
+					a[va].finger_position !=
+					b[vb].finger_position)
+				continue;
+
+			score = compare(a[va].template, b[vb].template);
+			printf("View %d - view %d: %d\n", va, vb, score);
+			if (score > best) {
+				best = score;
+				best_a = va;
+				best_b = vb;
+			}
+		}
+	}
+
+	if (best < 0) {
+		fprintf(stderr, "error: no views of the same finger\n");
+		return 1;
+	}
+	printf("Score: %d (out of %d)\n", best, FMR_MATCH_SCORE_MAX);
+
+	if (iterations > 0) {
+		struct timespec start, end;
+		double seconds;
+		volatile int sink = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < iterations; i++)
+			sink += compare(a[best_a].template,
+					b[best_b].template);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		seconds = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("%ld comparisons in %.3f s, %.0f comparisons/s\n",
+				iterations, seconds, iterations / seconds);
+	}
+
+	for (va = 0; va < na; va++)
+		free(a[va].template);
+	for (vb = 0; vb < nb; vb++)
+		free(b[vb].template);
+	free(a);
+	free(b);
+
+	return 0;
+}
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iso_fmr/v20.h"
+#include "iso_fmr/v030.h"
+#include "mcc.h"
+#include "minutiae.h"
+
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-v VIEW] -o OUTPUT NAME\n", comm);
+	fprintf(stderr, "       %s [-h] [-v VIEW] [-n ITERATIONS] NAME1 NAME2\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-v\tview (representation) of FMR files, 0 by default\n");
+	fprintf(stderr, "\t-o\twrite descriptors of NAME to OUTPUT\n");
+	fprintf(stderr, "\t-n\trepeat comparison and report rate of every variant\n");
+	fprintf(stderr, "\tNAME\tFMR v20 or v030 file, or descriptors written with -o\n");
+}
+
+static void *read_file(const char *name, size_t *len)
+{
+	FILE *f = fopen(name, "rb");
+	uint8_t *buf = NULL;
+	long size;
+
+	if (!f)
+		return NULL;
+
+	if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+			fseek(f, 0, SEEK_SET) == 0) {
+		buf = malloc(size ? size : 1);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+		*len = size;
+	}
+
+	fclose(f);
+
+	return buf;
+}
+
+static struct fmr_mcc *extract(const char *name, const uint8_t *buf,
+		size_t len, int v)
+{
+	struct fmr_minutiae *minutiae = NULL;
+	struct fmr_mcc *mcc = NULL;
+	size_t bytes;
+
+	if (len >= 8 && !memcmp(buf + 4, "\x20\x32\x30\x00", 4)) {
+		enum iso_fmr_v20_error error;
+		struct iso_fmr_v20 *record;
+
+		record = iso_fmr_v20_decode_buffer(buf, len, &error, &bytes);
+		if (error) {
+			fprintf(stderr, "%s: error: %s at byte %zu\n", name,
+					iso_fmr_v20_get_error_string(error),
+					bytes);
+			return NULL;
+		}
+		minutiae = fmr_minutiae_create_v20(record, v);
+		iso_fmr_v20_free(record);
+	} else {
+		enum iso_fmr_v030_error error;
+		struct iso_fmr_v030 *record;
+
+		record = iso_fmr_v030_decode_buffer(buf, len, &error, &bytes);
+		if (error) {
+			fprintf(stderr, "%s: error: %s at byte %zu\n", name,
+					iso_fmr_v030_get_error_string(error),
+					bytes);
+			return NULL;
+		}
+		minutiae = fmr_minutiae_create_v030(record, v);
+		iso_fmr_v030_free(record);
+	}
+
+	if (!minutiae) {
+		fprintf(stderr, "%s: error: no view %d\n", name, v);
+		return NULL;
+	}
+
+	mcc = aligned_alloc(FMR_MINUTIAE_ALIGN,
+			fmr_mcc_size(minutiae->number_minutiae));
+	if (mcc)
+		fmr_mcc_init(mcc, minutiae);
+	else
+		fprintf(stderr, "error: out of memory for descriptors\n");
+	free(minutiae);
+
+	return mcc;
+}
+
+/* Descriptors, either extracted from an FMR file, or decoded */
+static struct fmr_mcc *load(const char *name, int v)
+{
+	struct fmr_mcc *mcc = NULL;
+	uint8_t *buf;
+	size_t len, size;
+
+	buf = read_file(name, &len);
+	if (!buf) {
+		perror(name);
+		return NULL;
+	}
+
+	if (len >= 4 && !memcmp(buf, "MCCD", 4)) {
+		size = fmr_mcc_decode_size(buf, len);
+		if (!size) {
+			fprintf(stderr, "%s: error: invalid descriptors\n",
+					name);
+		} else {
+			mcc = aligned_alloc(FMR_MINUTIAE_ALIGN, size);
+			if (mcc)
+				fmr_mcc_decode(mcc, buf, len);
+			else
+				fprintf(stderr, "error: out of memory for descriptors\n");
+		}
+	} else {
+		mcc = extract(name, buf, len, v);
+	}
+
+	free(buf);
+
+	return mcc;
+}
+
+static int write_descriptors(const struct fmr_mcc *mcc, const char *output)
+{
+	size_t len = fmr_mcc_encode(mcc, NULL, 0);
+	uint8_t *buf = malloc(len);
+	FILE *f;
+	int res = 0;
+
+	if (!buf) {
+		fprintf(stderr, "error: out of memory for descriptors\n");
+		return 1;
+	}
+	fmr_mcc_encode(mcc, buf, len);
+
+	f = fopen(output, "wb");
+	if (!f || fwrite(buf, 1, len, f) != len) {
+		perror("failed to write output file");
+		res = 1;
+	}
+	if (f && fclose(f) && !res) {
+		perror("failed to write output file");
+		res = 1;
+	}
+
+	free(buf);
+
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	int view = 0;
+	long iterations = 0, i;
+	const char *output = NULL;
+	struct fmr_mcc *a, *b;
+	int variant, res;
+
+	while ((opt = getopt(argc, argv, "hv:o:n:")) != -1) {
+		switch (opt) {
+		case 'v':
+			view = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'n':
+			iterations = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind != (output ? 1 : 2) || (output && iterations)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	a = load(argv[optind], view);
+	if (!a)
+		return 1;
+
+	if (output) {
+		printf("%d descriptors\n", fmr_mcc_get_number_descriptors(a));
+		res = write_descriptors(a, output);
+		free(a);
+		return res;
+	}
+
+	b = load(argv[optind + 1], view);
+	if (!b)
+		return 1;
+
+	printf("%d and %d descriptors, similarity %d (out of %d)\n",
+			fmr_mcc_get_number_descriptors(a),
+			fmr_mcc_get_number_descriptors(b),
+			fmr_mcc_compare(a, b), FMR_MCC_SCORE_MAX);
+
+	for (variant = 0; iterations > 0 && variant < __fmr_mcc_variants;
+			variant++) {
+		struct timespec start, end;
+		volatile int sink = 0;
+		double seconds;
+
+		if (!fmr_mcc_variant_supported(variant)) {
+			printf("%-8s not supported\n",
+					fmr_mcc_get_variant_string(variant));
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < iterations; i++)
+			sink += fmr_mcc_compare_variant(variant, a, b);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		seconds = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("%-8s %10.0f comparisons/s\n",
+				fmr_mcc_get_variant_string(variant),
+				iterations / seconds);
+	}
+
+	free(a);
+	free(b);
+
+	return 0;
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "minutiae.h"
+#include "pairs.h"
+
+
+/* Different templates, so that the branch predictor can't learn one */
+#define TEMPLATES 64
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-n ITERATIONS] [-m MINUTIAE] [-d DISTANCE] [-a ANGLE] [-s SEED]\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-n\tnumber of template pairs processed, 200000 by default\n");
+	fprintf(stderr, "\t-m\tminutiae per template, 48 by default\n");
+	fprintf(stderr, "\t-d\tdistance tolerance, 16 by default\n");
+	fprintf(stderr, "\t-a\tangle tolerance, 16 by default\n");
+	fprintf(stderr, "\t-s\trandom seed, 1 by default\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct fmr_minutiae *generate(int number_minutiae)
+{
+	struct fmr_minutiae *minutiae;
+	int16_t *x, *y;
+	uint8_t *angle, *type;
+	int m;
+
+	minutiae = aligned_alloc(FMR_MINUTIAE_ALIGN,
+			fmr_minutiae_size(number_minutiae));
+	if (!minutiae)
+		return NULL;
+	fmr_minutiae_init(minutiae, number_minutiae);
+
+	x = fmr_minutiae_x(minutiae);
+	y = fmr_minutiae_y(minutiae);
+	angle = fmr_minutiae_angle(minutiae);
+	type = fmr_minutiae_type(minutiae);
+	for (m = 0; m < number_minutiae; m++) {
+		/* Typical area of a 500 dpi live scan */
+		x[m] = rand() % 400;
+		y[m] = rand() % 500;
+		angle[m] = rand();
+		type[m] = 1 + rand() % 2;
+	}
+
+	return minutiae;
+}
+
+int main(int argc, char *argv[])
+{
+	static uint64_t compatible[FMR_MATCH_MINUTIAE_MAX][FMR_PAIRS_WORDS];
+	static uint64_t expected[FMR_MATCH_MINUTIAE_MAX][FMR_PAIRS_WORDS];
+	struct fmr_minutiae *templates[TEMPLATES];
+	int opt;
+	long iterations = 200000, i;
+	int minutiae = 48, distance = 16, angle = 16;
+	unsigned int seed = 1;
+	double scalar = 0;
+	int variant, t, res = 0;
+
+	while ((opt = getopt(argc, argv, "hn:m:d:a:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = atol(optarg);
+			break;
+		case 'm':
+			minutiae = atoi(optarg);
+			break;
+		case 'd':
+			distance = atoi(optarg);
+			break;
+		case 'a':
+			angle = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || iterations < 1 || minutiae < 1 ||
+			minutiae > FMR_MATCH_MINUTIAE_MAX) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	srand(seed);
+	for (t = 0; t < TEMPLATES; t++) {
+		templates[t] = generate(minutiae);
+		if (!templates[t]) {
+			fprintf(stderr, "error: out of memory for templates\n");
+			return 1;
+		}
+	}
+
+	printf("%d minutiae, distance %d, angle %d, best variant %s\n",
+			minutiae, distance, angle, fmr_pairs_get_variant_string(
+			fmr_pairs_get_best_variant()));
+
+	for (variant = 0; variant < __fmr_pairs_variants; variant++) {
+		const char *name = fmr_pairs_get_variant_string(variant);
+		volatile long sink = 0;
+		double start, seconds, rate;
+
+		if (!fmr_pairs_variant_supported(variant)) {
+			printf("%-8s not supported\n", name);
+			continue;
+		}
+
+		/* Every variant must give exactly what the scalar one does */
+		for (t = 0; t < TEMPLATES; t++) {
+			const struct fmr_minutiae *a = templates[t];
+			const struct fmr_minutiae *b =
+					templates[(t + 1) % TEMPLATES];
+
+			fmr_pairs_variant(fmr_pairs_scalar, a, b, distance,
+					angle, expected);
+			fmr_pairs_variant(variant, a, b, distance, angle,
+					compatible);
+			if (memcmp(expected, compatible,
+					sizeof(*expected) * minutiae)) {
+				fprintf(stderr, "error: %s differs from scalar for templates %d and %d\n",
+						name, t, (t + 1) % TEMPLATES);
+				res = 1;
+				break;
+			}
+		}
+
+		start = now();
+		for (i = 0; i < iterations; i++)
+			sink += fmr_pairs_variant(variant,
+					templates[i % TEMPLATES],
+					templates[(i + 1) % TEMPLATES],
+					distance, angle, compatible);
+		seconds = now() - start;
+
+		rate = (double)minutiae * minutiae * iterations / seconds;
+		if (variant == fmr_pairs_scalar)
+			scalar = rate;
+		printf("%-8s %12.0f pairs/s %10.0f templates/s %6.2fx scalar\n",
+				name, rate, iterations / seconds,
+				scalar ? rate / scalar : 0);
+	}
+
+	for (t = 0; t < TEMPLATES; t++)
+		free(templates[t]);
+
+	return res;
+}
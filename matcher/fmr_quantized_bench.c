@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "match.h"
+#include "trig.h"
+
+
+/* Typical area of a 500 dpi live scan */
+#define WIDTH 400
+#define HEIGHT 500
+
+/* Decision thresholds the modes are compared at */
+static const int thresholds[] = { 500, 1000, 2000, 3000 };
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-n PAIRS] [-s SEED]\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-n\tnumber of genuine, and of impostor, pairs, 5000 by default\n");
+	fprintf(stderr, "\t-s\trandom seed, 1 by default\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int random_range(int min, int max)
+{
+	return min + rand() % (max - min + 1);
+}
+
+struct template {
+	int number_minutiae;
+	struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+};
+
+/* Minutiae directions follow a smooth, random, ridge flow */
+static void generate(struct template *template)
+{
+	int flow_x = random_range(-64, 64), flow_y = random_range(-64, 64);
+	uint8_t flow = rand();
+	int m;
+
+	template->number_minutiae = random_range(30, 60);
+	for (m = 0; m < template->number_minutiae; m++) {
+		struct fmr_match_minutia *minutia = &template->minutiae[m];
+
+		minutia->x = rand() % WIDTH;
+		minutia->y = rand() % HEIGHT;
+		minutia->angle = flow + (minutia->x * flow_x +
+				minutia->y * flow_y) / 256 +
+				random_range(-16, 16) + (rand() % 2) * 128;
+		minutia->type = 1 + rand() % 2;
+	}
+}
+
+/* Another impression of the same finger, as in fmr_index_bench */
+static void distort(const struct template *in, struct template *out)
+{
+	uint8_t rotation = random_range(-20, 20);
+	int c = fmr_match_cos[rotation], s = fmr_match_sin(rotation);
+	int shift_x = random_range(-30, 30), shift_y = random_range(-30, 30);
+	int m, n = 0, spurious = random_range(0, 10);
+
+	for (m = 0; m < in->number_minutiae; m++) {
+		int x = in->minutiae[m].x - WIDTH / 2;
+		int y = in->minutiae[m].y - HEIGHT / 2;
+		int u, v;
+
+		if (rand() % 100 < 25)
+			continue;
+
+		u = ((x * c + y * s) >> 14) + WIDTH / 2 + shift_x +
+				random_range(-5, 5);
+		v = ((y * c - x * s) >> 14) + HEIGHT / 2 + shift_y +
+				random_range(-5, 5);
+		if (u < 0 || u >= WIDTH || v < 0 || v >= HEIGHT)
+			continue;
+
+		out->minutiae[n].x = u;
+		out->minutiae[n].y = v;
+		out->minutiae[n].angle = in->minutiae[m].angle + rotation +
+				random_range(-8, 8);
+		out->minutiae[n].type = in->minutiae[m].type;
+		n++;
+	}
+
+	while (spurious-- && n < FMR_MATCH_MINUTIAE_MAX) {
+		out->minutiae[n].x = rand() % WIDTH;
+		out->minutiae[n].y = rand() % HEIGHT;
+		out->minutiae[n].angle = rand();
+		out->minutiae[n].type = 1 + rand() % 2;
+		n++;
+	}
+
+	out->number_minutiae = n;
+}
+
+static struct fmr_match_template *to_template(const struct template *in)
+{
+	void *buffer = malloc(fmr_match_template_size(in->number_minutiae));
+
+	return buffer ? fmr_match_template_init(buffer, in->minutiae,
+			in->number_minutiae) : NULL;
+}
+
+/* Comparisons per second of all the pairs, and their scores */
+static double run(int (*compare)(const struct fmr_match_template *,
+		const struct fmr_match_template *),
+		struct fmr_match_template **templates, int number_pairs,
+		int *scores)
+{
+	double start = now();
+	int i;
+
+	for (i = 0; i < number_pairs; i++)
+		scores[i] = compare(templates[2 * i], templates[2 * i + 1]);
+
+	return number_pairs / (now() - start);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fmr_match_template **templates;
+	struct template template, distorted;
+	int *reference, *quantized;
+	int opt, number_pairs = 5000, i, t;
+	unsigned int seed = 1;
+	double reference_rate, quantized_rate;
+	long delta_sum = 0;
+	int delta_max = 0, equal = 0;
+
+	while ((opt = getopt(argc, argv, "hn:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			number_pairs = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || number_pairs < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Genuine pairs first, then impostor ones, of 4 * n templates */
+	number_pairs *= 2;
+	templates = malloc(sizeof(*templates) * 2 * number_pairs);
+	reference = malloc(sizeof(*reference) * number_pairs);
+	quantized = malloc(sizeof(*quantized) * number_pairs);
+	if (!templates || !reference || !quantized) {
+		fprintf(stderr, "error: out of memory\n");
+		return 1;
+	}
+
+	srand(seed);
+	for (i = 0; i < number_pairs; i++) {
+		generate(&template);
+		if (i < number_pairs / 2)
+			distort(&template, &distorted);
+		else
+			generate(&distorted);
+		templates[2 * i] = to_template(&template);
+		templates[2 * i + 1] = to_template(&distorted);
+		if (!templates[2 * i] || !templates[2 * i + 1]) {
+			fprintf(stderr, "error: out of memory for templates\n");
+			return 1;
+		}
+	}
+
+	/* Once for the caches, and once more for the time */
+	run(fmr_match_compare, templates, number_pairs, reference);
+	reference_rate = run(fmr_match_compare, templates, number_pairs,
+			reference);
+	run(fmr_match_compare_quantized, templates, number_pairs, quantized);
+	quantized_rate = run(fmr_match_compare_quantized, templates,
+			number_pairs, quantized);
+
+	for (i = 0; i < number_pairs; i++) {
+		int delta = abs(quantized[i] - reference[i]);
+
+		delta_sum += delta;
+		if (delta > delta_max)
+			delta_max = delta;
+		equal += !delta;
+	}
+
+	printf("reference %.0f comparisons/s, quantized %.0f comparisons/s, %.2fx\n",
+			reference_rate, quantized_rate,
+			quantized_rate / reference_rate);
+	printf("scores equal for %.2f%% of pairs, difference %.1f on average, %d at most\n",
+			100.0 * equal / number_pairs,
+			(double)delta_sum / number_pairs, delta_max);
+	printf("%9s %18s %18s\n", "threshold", "genuine accepted", "impostor accepted");
+
+	for (t = 0; t < ARRAY_SIZE(thresholds); t++) {
+		int accepted[2][2] = { { 0 } };
+
+		for (i = 0; i < number_pairs; i++) {
+			int impostor = i >= number_pairs / 2;
+
+			accepted[impostor][0] += reference[i] >= thresholds[t];
+			accepted[impostor][1] += quantized[i] >= thresholds[t];
+		}
+
+		printf("%9d %8.2f%% %7.2f%% %8.2f%% %7.2f%%\n", thresholds[t],
+				200.0 * accepted[0][0] / number_pairs,
+				200.0 * accepted[0][1] / number_pairs,
+				200.0 * accepted[1][0] / number_pairs,
+				200.0 * accepted[1][1] / number_pairs);
+	}
+
+	for (i = 0; i < 2 * number_pairs; i++)
+		free(templates[i]);
+	free(templates);
+	free(reference);
+	free(quantized);
+
+	return 0;
+}
@@ -0,0 +1,449 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iso_fmr/gallery.h"
+#include "iso_fmr/v20.h"
+#include "iso_fmr/v030.h"
+#include "match.h"
+#include "search.h"
+
+
+static void usage(const char *comm)
+{
+	fprintf(stderr, "Usage: %s [-h] [-k CANDIDATES] [-j THREADS] [-v VIEW] [-n SEARCHES] [-c] [-t THRESHOLDS] -g GALLERY|-d DIR PROBE\n", comm);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tusage syntax (this message)\n");
+	fprintf(stderr, "\t-k\tnumber of candidates, 10 by default\n");
+	fprintf(stderr, "\t-j\tnumber of threads, all CPUs by default\n");
+	fprintf(stderr, "\t-v\tview (representation) of the probe, 0 by default\n");
+	fprintf(stderr, "\t-n\trepeat the search and report the rate of all\n");
+	fprintf(stderr, "\t-c\tcascade search, with default thresholds\n");
+	fprintf(stderr, "\t-t\tcascade search, with thresholds: minutiae ratio,\n");
+	fprintf(stderr, "\t\thistogram difference, rotation, descriptors score and\n");
+	fprintf(stderr, "\t\tscore, separated by commas\n");
+	fprintf(stderr, "\t-g\tsearch in gallery container\n");
+	fprintf(stderr, "\t-d\tsearch in FMR v20 or v030 files in directory\n");
+	fprintf(stderr, "\tPROBE\tFMR v20 or v030 file\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *read_file(const char *name, size_t *len)
+{
+	FILE *f = fopen(name, "rb");
+	uint8_t *buf = NULL;
+	long size;
+
+	if (!f)
+		return NULL;
+
+	if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+			fseek(f, 0, SEEK_SET) == 0) {
+		buf = malloc(size ? size : 1);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+		*len = size;
+	}
+
+	fclose(f);
+
+	return buf;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Sorted, so that ids (indices) don't depend on the directory order */
+static char **list_dir(const char *dir, uint32_t *number_names)
+{
+	DIR *d = opendir(dir);
+	struct dirent *entry;
+	char **names = NULL;
+	uint32_t n = 0;
+
+	if (!d)
+		return NULL;
+
+	while ((entry = readdir(d))) {
+		char *path;
+
+		if (entry->d_name[0] == '.')
+			continue;
+		if (entry->d_type != DT_REG && entry->d_type != DT_LNK &&
+				entry->d_type != DT_UNKNOWN)
+			continue;
+
+		if (!(n & (n - 1))) {
+			char **tmp = realloc(names, sizeof(*names) *
+					(n ? n * 2 : 1));
+
+			if (!tmp)
+				goto fail;
+			names = tmp;
+		}
+		path = malloc(strlen(dir) + 1 + strlen(entry->d_name) + 1);
+		if (!path)
+			goto fail;
+		sprintf(path, "%s/%s", dir, entry->d_name);
+		names[n++] = path;
+	}
+	closedir(d);
+
+	qsort(names, n, sizeof(*names), name_cmp);
+	*number_names = n;
+
+	return names;
+
+fail:
+	closedir(d);
+	while (n)
+		free(names[--n]);
+	free(names);
+
+	return NULL;
+}
+
+static const char *stage_names[__fmr_search_stages] = {
+	[fmr_search_stage_summary] = "summary",
+	[fmr_search_stage_descriptors] = "descriptors",
+	[fmr_search_stage_matcher] = "matcher",
+};
+
+static int parse_thresholds(const char *arg, struct fmr_search_cascade *cascade)
+{
+	char end;
+
+	return sscanf(arg, "%d,%d,%d,%d,%d%c", &cascade->minutiae_ratio,
+			&cascade->histogram_difference, &cascade->rotation,
+			&cascade->descriptors_score, &cascade->score,
+			&end) == 5 ? 0 : -1;
+}
+
+static struct fmr_search_gallery *create_gallery(int descriptors)
+{
+	struct fmr_search_gallery *gallery = fmr_search_gallery_create();
+
+	if (gallery && descriptors)
+		fmr_search_gallery_enable_descriptors(gallery);
+
+	return gallery;
+}
+
+static struct fmr_search_gallery *load_gallery(const char *path,
+		int descriptors)
+{
+	struct fmr_search_gallery *gallery = create_gallery(descriptors);
+	struct iso_fmr_gallery *container;
+	uint32_t i, number_records, invalid = 0;
+
+	container = iso_fmr_gallery_open(path);
+	if (!gallery || !container) {
+		perror(path);
+		fmr_search_gallery_free(gallery);
+		return NULL;
+	}
+
+	number_records = iso_fmr_gallery_get_number_records(container);
+	for (i = 0; i < number_records; i++) {
+		const void *record;
+		size_t len;
+
+		record = iso_fmr_gallery_get_record(container, i, &len);
+		if (fmr_search_gallery_add_record(gallery, i, record, len) < 0) {
+			if (errno != EINVAL) {
+				perror("Failed to load gallery");
+				fmr_search_gallery_free(gallery);
+				gallery = NULL;
+				break;
+			}
+			invalid++;
+		}
+	}
+	if (invalid)
+		fprintf(stderr, "warning: %u invalid records skipped\n",
+				invalid);
+
+	iso_fmr_gallery_close(container);
+
+	return gallery;
+}
+
+static struct fmr_search_gallery *load_dir(char **names, uint32_t number_names,
+		int descriptors)
+{
+	struct fmr_search_gallery *gallery = create_gallery(descriptors);
+	uint32_t i;
+
+	if (!gallery) {
+		perror("Failed to load gallery");
+		return NULL;
+	}
+
+	for (i = 0; i < number_names; i++) {
+		size_t len;
+		void *record = read_file(names[i], &len);
+
+		if (!record) {
+			perror(names[i]);
+			continue;
+		}
+		if (fmr_search_gallery_add_record(gallery, i, record, len) < 0) {
+			if (errno != EINVAL) {
+				perror("Failed to load gallery");
+				free(record);
+				fmr_search_gallery_free(gallery);
+				return NULL;
+			}
+			fprintf(stderr, "warning: %s: invalid record skipped\n",
+					names[i]);
+		}
+		free(record);
+	}
+
+	return gallery;
+}
+
+/* Returns the number of minutiae, -1 on failure */
+static int load_probe(const char *name, int v,
+		struct fmr_match_minutia *minutiae, uint8_t *finger_position)
+{
+	int number_minutiae = -1;
+	uint8_t *buf;
+	size_t len, bytes;
+
+	buf = read_file(name, &len);
+	if (!buf) {
+		perror(name);
+		return -1;
+	}
+
+	if (len >= 8 && !memcmp(buf + 4, "\x20\x32\x30\x00", 4)) {
+		enum iso_fmr_v20_error error;
+		struct iso_fmr_v20 *record;
+
+		record = iso_fmr_v20_decode_buffer(buf, len, &error, &bytes);
+		if (error) {
+			fprintf(stderr, "%s: error: %s at byte %zu\n", name,
+					iso_fmr_v20_get_error_string(error),
+					bytes);
+			goto out;
+		}
+		number_minutiae = fmr_match_minutiae_from_v20(record, v,
+				minutiae);
+		if (number_minutiae >= 0)
+			*finger_position = record->views[v].finger_position;
+		iso_fmr_v20_free(record);
+	} else {
+		enum iso_fmr_v030_error error;
+		struct iso_fmr_v030 *record;
+
+		record = iso_fmr_v030_decode_buffer(buf, len, &error, &bytes);
+		if (error) {
+			fprintf(stderr, "%s: error: %s at byte %zu\n", name,
+					iso_fmr_v030_get_error_string(error),
+					bytes);
+			goto out;
+		}
+		number_minutiae = fmr_match_minutiae_from_v030(record, v,
+				minutiae);
+		if (number_minutiae >= 0)
+			*finger_position =
+				record->representations[v].finger_position;
+		iso_fmr_v030_free(record);
+	}
+
+	if (number_minutiae < 0)
+		fprintf(stderr, "%s: error: no view %d\n", name, v);
+
+out:
+	free(buf);
+
+	return number_minutiae;
+}
+
+int main(int argc, char *argv[])
+{
+	struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+	int opt;
+	int k = 10, threads = 0, view = 0;
+	long searches = 1, i;
+	const char *gallery_path = NULL, *dir = NULL;
+	char **names = NULL;
+	uint32_t number_names = 0;
+	struct fmr_search_gallery *gallery;
+	struct fmr_search_candidate *candidates;
+	struct fmr_search_stats stats, total;
+	struct fmr_search_cascade cascade;
+	struct fmr_match_template *template = NULL;
+	struct fmr_search_probe *probe = NULL;
+	uint8_t finger_position = 0;
+	double start, seconds;
+	int number_minutiae, number_candidates = 0, use_cascade = 0, c, s;
+
+	fmr_search_cascade_init(&cascade);
+
+	while ((opt = getopt(argc, argv, "hk:j:v:n:ct:g:d:")) != -1) {
+		switch (opt) {
+		case 'k':
+			k = atoi(optarg);
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'v':
+			view = atoi(optarg);
+			break;
+		case 'n':
+			searches = atol(optarg);
+			break;
+		case 'c':
+			use_cascade = 1;
+			break;
+		case 't':
+			if (parse_thresholds(optarg, &cascade)) {
+				usage(argv[0]);
+				return 1;
+			}
+			use_cascade = 1;
+			break;
+		case 'g':
+			gallery_path = optarg;
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1 || !gallery_path == !dir || k < 1 ||
+			threads < 0 || searches < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	number_minutiae = load_probe(argv[optind], view, minutiae,
+			&finger_position);
+	if (number_minutiae < 0)
+		return 1;
+	if (use_cascade) {
+		probe = fmr_search_probe_create(minutiae, number_minutiae,
+				finger_position);
+	} else {
+		template = malloc(fmr_match_template_size(number_minutiae));
+		if (template)
+			fmr_match_template_init(template, minutiae,
+					number_minutiae);
+	}
+	if (!probe && !template) {
+		fprintf(stderr, "error: out of memory for probe\n");
+		return 1;
+	}
+
+	start = now();
+	if (gallery_path) {
+		gallery = load_gallery(gallery_path,
+				use_cascade && cascade.descriptors_score);
+	} else {
+		names = list_dir(dir, &number_names);
+		if (!names) {
+			perror(dir);
+			return 1;
+		}
+		gallery = load_dir(names, number_names,
+				use_cascade && cascade.descriptors_score);
+	}
+	if (!gallery)
+		return 1;
+	seconds = now() - start;
+	printf("Gallery: %u entries, %.1f MB of templates, loaded in %.3f s\n",
+			fmr_search_gallery_get_number_entries(gallery),
+			fmr_search_gallery_get_size(gallery) / 1e6, seconds);
+
+	candidates = calloc(k, sizeof(*candidates));
+	if (!candidates) {
+		fprintf(stderr, "error: out of memory for candidates\n");
+		return 1;
+	}
+
+	memset(&total, 0, sizeof(total));
+	start = now();
+	for (i = 0; i < searches; i++) {
+		if (use_cascade)
+			number_candidates = fmr_search_cascade(gallery, probe,
+					&cascade, candidates, k, threads,
+					&stats);
+		else
+			number_candidates = fmr_search(gallery, template,
+					finger_position, candidates, k,
+					threads, &stats);
+		if (number_candidates < 0) {
+			perror("Search failed");
+			return 1;
+		}
+		total.comparisons += stats.comparisons;
+		for (s = 0; s < __fmr_search_stages; s++) {
+			total.stages[s].templates += stats.stages[s].templates;
+			total.stages[s].passed += stats.stages[s].passed;
+			total.stages[s].nanoseconds +=
+					stats.stages[s].nanoseconds;
+		}
+	}
+	seconds = now() - start;
+
+	for (c = 0; c < number_candidates; c++) {
+		if (names)
+			printf("%d: %s %d\n", c + 1,
+					names[candidates[c].id],
+					candidates[c].score);
+		else
+			printf("%d: %u %d\n", c + 1, candidates[c].id,
+					candidates[c].score);
+	}
+	printf("%llu comparisons in %.3f s, %.0f comparisons/s, %d threads, %llu steals\n",
+			(unsigned long long)total.comparisons, seconds,
+			total.comparisons / seconds, stats.threads,
+			(unsigned long long)stats.steals);
+
+	/* Per search, time of all threads */
+	for (s = 0; use_cascade && s < __fmr_search_stages; s++) {
+		const struct fmr_search_stage_stats *stage = &total.stages[s];
+
+		printf("%-12s %10.0f templates %10.0f passed %6.2f%% %9.3f ms\n",
+				stage_names[s],
+				(double)stage->templates / searches,
+				(double)stage->passed / searches,
+				stage->templates ? 100.0 * stage->passed /
+				stage->templates : 0,
+				stage->nanoseconds / 1e6 / searches);
+	}
+
+	fmr_search_gallery_free(gallery);
+	free(candidates);
+	free(template);
+	free(probe);
+	while (number_names)
+		free(names[--number_names]);
+	free(names);
+
+	return 0;
+}
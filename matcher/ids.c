@@ -0,0 +1,113 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "ids.h"
+
+/* Smallest table, not to grow it over and over for a handful of ids */
+#define IDS_SIZE_MIN 256
+
+static inline uint32_t fmr_ids_hash(uint32_t id)
+{
+	return id * 0x9e3779b1u;
+}
+
+void fmr_ids_release(struct fmr_ids *ids)
+{
+	free(ids->buckets);
+	ids->buckets = NULL;
+	ids->size = 0;
+	ids->number = 0;
+}
+
+uint32_t fmr_ids_find(const struct fmr_ids *ids, uint32_t id)
+{
+	uint32_t mask = ids->size - 1, i;
+
+	if (!ids->size)
+		return FMR_IDS_NONE;
+
+	for (i = fmr_ids_hash(id) & mask; ids->buckets[i].value != FMR_IDS_NONE;
+			i = (i + 1) & mask)
+		if (ids->buckets[i].id == id)
+			return i;
+
+	return FMR_IDS_NONE;
+}
+
+int fmr_ids_reserve(struct fmr_ids *ids, uint32_t number)
+{
+	struct fmr_ids_bucket *buckets;
+	uint64_t size = ids->size ? ids->size : IDS_SIZE_MIN;
+	uint32_t mask, i, j;
+
+	while ((ids->number + (uint64_t)number) * 2 > size)
+		size *= 2;
+	if (size == ids->size)
+		return 0;
+	if (size > (uint64_t)1 << 31) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	buckets = malloc(sizeof(*buckets) * size);
+	if (!buckets)
+		return -1;
+	for (i = 0; i < size; i++)
+		buckets[i].value = FMR_IDS_NONE;
+
+	mask = size - 1;
+	for (i = 0; i < ids->size; i++) {
+		if (ids->buckets[i].value == FMR_IDS_NONE)
+			continue;
+		for (j = fmr_ids_hash(ids->buckets[i].id) & mask;
+				buckets[j].value != FMR_IDS_NONE;
+				j = (j + 1) & mask)
+			;
+		buckets[j] = ids->buckets[i];
+	}
+
+	free(ids->buckets);
+	ids->buckets = buckets;
+	ids->size = size;
+
+	return 0;
+}
+
+void fmr_ids_set(struct fmr_ids *ids, uint32_t id, uint32_t value)
+{
+	uint32_t mask = ids->size - 1, i;
+
+	for (i = fmr_ids_hash(id) & mask; ids->buckets[i].value !=
+			FMR_IDS_NONE && ids->buckets[i].id != id;
+			i = (i + 1) & mask)
+		;
+	if (ids->buckets[i].value == FMR_IDS_NONE)
+		ids->number++;
+
+	ids->buckets[i].id = id;
+	ids->buckets[i].value = value;
+}
+
+/* Backward shift, so that no probing sequence is broken by a hole */
+void fmr_ids_remove(struct fmr_ids *ids, uint32_t bucket)
+{
+	uint32_t mask = ids->size - 1, i = bucket, j, home;
+
+	for (j = (i + 1) & mask; ids->buckets[j].value != FMR_IDS_NONE;
+			j = (j + 1) & mask) {
+		home = fmr_ids_hash(ids->buckets[j].id) & mask;
+		/* Can the id at j move to the hole at i? */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			ids->buckets[i] = ids->buckets[j];
+			i = j;
+		}
+	}
+
+	ids->buckets[i].value = FMR_IDS_NONE;
+	ids->number--;
+}
+
+size_t fmr_ids_get_size(const struct fmr_ids *ids)
+{
+	return sizeof(*ids->buckets) * ids->size;
+}
@@ -0,0 +1,51 @@
+#ifndef __FMR_IDS_H
+#define __FMR_IDS_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Map of ids to 32-bit values, a hash table, power of two sized, with
+ * linear probing and load factor 1/2 at most, for writers keeping track
+ * of their entries. An empty bucket has the value of FMR_IDS_NONE, which
+ * is no id's value then. Zeroed struct fmr_ids is an empty map.
+ */
+#define FMR_IDS_NONE UINT32_MAX
+
+struct fmr_ids_bucket {
+	uint32_t id;
+	uint32_t value;
+};
+
+struct fmr_ids {
+	struct fmr_ids_bucket *buckets;
+	uint32_t size, number;
+};
+
+void fmr_ids_release(struct fmr_ids *ids);
+
+/* Bucket of @id, or FMR_IDS_NONE if there's no such id */
+uint32_t fmr_ids_find(const struct fmr_ids *ids, uint32_t id);
+
+/* Room for @number more ids. Returns -1, with errno set, on failure */
+int fmr_ids_reserve(struct fmr_ids *ids, uint32_t number);
+
+/* Of an existing id, or a new one, with room reserved for it */
+void fmr_ids_set(struct fmr_ids *ids, uint32_t id, uint32_t value);
+
+/* Of the id in @bucket, as returned by fmr_ids_find() */
+void fmr_ids_remove(struct fmr_ids *ids, uint32_t bucket);
+
+/* Memory taken by the buckets, in bytes */
+size_t fmr_ids_get_size(const struct fmr_ids *ids);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,625 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ids.h"
+#include "index.h"
+#include "match.h"
+#include "trig.h"
+
+/* Neighbours of every minutia making triangles with it */
+#define NEIGHBOURS 4
+/* Shortest and longest side from a minutia to its neighbour, in pixels */
+#define SIDE_MIN 12
+#define SIDE_MAX 120
+/* Quantization of sides, in pixels, and directions, in angle units */
+#define SIDE_STEP 12
+#define SIDE_BITS 5
+#define ANGLE_SHIFT 5
+#define ANGLE_BITS (8 - ANGLE_SHIFT)
+/* Probe's values this close to a step boundary look up both buckets */
+#define SIDE_MARGIN 3
+#define ANGLE_MARGIN 6
+
+#define TRIPLETS_MAX (FMR_MATCH_MINUTIAE_MAX * \
+		(NEIGHBOURS * (NEIGHBOURS - 1) / 2))
+
+/* Deleted templates are removed from the lists when there's that many */
+#define PURGE_MIN 64
+
+struct fmr_index_triplet {
+	/* Longest first */
+	int side[3];
+	/* Direction of every vertex relative to the following side */
+	uint8_t angle[3];
+};
+
+/* Templates having a key; empty bucket has no slots at all */
+struct fmr_index_postings {
+	uint32_t key;
+	uint32_t number_slots;
+	uint32_t allocated;
+	uint32_t *slots;
+};
+
+enum fmr_index_slot_state {
+	slot_free,
+	slot_live,
+	/* Still in the lists, until the next purge */
+	slot_deleted,
+};
+
+/* Free slots are in a list, linked through the id */
+struct fmr_index_slot {
+	uint32_t id;
+	uint32_t number_keys;
+	enum fmr_index_slot_state state;
+};
+
+#define SLOT_NONE UINT32_MAX
+
+struct fmr_index {
+	/* Hash table, power of two sized, with linear probing */
+	struct fmr_index_postings *postings;
+	uint32_t postings_size, number_postings;
+	/* 32 less log2 of the size */
+	int postings_shift;
+	/* Id to slot map */
+	struct fmr_ids ids;
+
+	struct fmr_index_slot *slots;
+	uint32_t number_slots, free_slot, number_deleted;
+};
+
+/*
+ * Bucket of @key, the top bits of the product, as the low ones only
+ * depend on the low bits of the key, not on the angle fields above
+ */
+static inline uint32_t fmr_index_hash(uint32_t key, int shift)
+{
+	return (key * 0x9e3779b1u) >> shift;
+}
+
+/*
+ * Triangles of every minutia and pairs of its nearest neighbours. The same
+ * triangle may come from more than one minutia, that's dealt with by
+ * the keys being unique.
+ */
+static int fmr_index_triplets(const struct fmr_minutiae *minutiae,
+		struct fmr_index_triplet *triplets)
+{
+	const int16_t *x = fmr_minutiae_x(minutiae);
+	const int16_t *y = fmr_minutiae_y(minutiae);
+	const uint8_t *angle = fmr_minutiae_angle(minutiae);
+	int n = minutiae->number_minutiae, number = 0;
+	int m, i, j, k;
+
+	for (m = 0; m < n; m++) {
+		int nearest[NEIGHBOURS], distance[NEIGHBOURS];
+		int number_nearest = 0;
+
+		for (i = 0; i < n; i++) {
+			int dx = x[i] - x[m], dy = y[i] - y[m];
+			int d = dx * dx + dy * dy;
+
+			if (i == m || d < SIDE_MIN * SIDE_MIN ||
+					d > SIDE_MAX * SIDE_MAX)
+				continue;
+			if (number_nearest == NEIGHBOURS &&
+					d >= distance[NEIGHBOURS - 1])
+				continue;
+
+			if (number_nearest < NEIGHBOURS)
+				number_nearest++;
+			for (k = number_nearest - 1; k > 0 &&
+					distance[k - 1] > d; k--) {
+				nearest[k] = nearest[k - 1];
+				distance[k] = distance[k - 1];
+			}
+			nearest[k] = i;
+			distance[k] = d;
+		}
+
+		for (i = 0; i < number_nearest; i++) {
+			for (j = i + 1; j < number_nearest; j++) {
+				int vertices[3] = { m, nearest[i], nearest[j] };
+				struct fmr_index_triplet *triplet =
+						&triplets[number++];
+				int sides[3], order[3] = { 0, 1, 2 };
+
+				/* Side opposite to every vertex */
+				for (k = 0; k < 3; k++) {
+					int a = vertices[(k + 1) % 3];
+					int b = vertices[(k + 2) % 3];
+					int dx = x[b] - x[a], dy = y[b] - y[a];
+
+					sides[k] = fmr_match_sqrt(dx * dx +
+							dy * dy);
+				}
+
+				/* Vertices in order of their sides, longest first */
+				for (k = 1; k < 3; k++) {
+					int v = order[k], l;
+
+					for (l = k; l > 0 && sides[order[l - 1]] <
+							sides[v]; l--)
+						order[l] = order[l - 1];
+					order[l] = v;
+				}
+
+				for (k = 0; k < 3; k++) {
+					int a = vertices[order[k]];
+					int b = vertices[order[(k + 1) % 3]];
+
+					triplet->side[k] = sides[order[k]];
+					triplet->angle[k] = angle[a] -
+							fmr_match_atan2(x[b] - x[a],
+							y[b] - y[a]);
+				}
+			}
+		}
+	}
+
+	return number;
+}
+
+static inline uint32_t fmr_index_side_bucket(int side)
+{
+	int bucket = side / SIDE_STEP;
+
+	return bucket < (1 << SIDE_BITS) ? bucket : (1 << SIDE_BITS) - 1;
+}
+
+static uint32_t fmr_index_key(const uint32_t buckets[6])
+{
+	return buckets[0] | buckets[1] << SIDE_BITS |
+			buckets[2] << (SIDE_BITS * 2) |
+			buckets[3] << (SIDE_BITS * 3) |
+			buckets[4] << (SIDE_BITS * 3 + ANGLE_BITS) |
+			buckets[5] << (SIDE_BITS * 3 + ANGLE_BITS * 2);
+}
+
+/*
+ * Key of @triplet, or with @soft all the keys of the buckets it's close
+ * to, up to 64 of them. Returns the number of keys.
+ */
+static int fmr_index_triplet_keys(const struct fmr_index_triplet *triplet,
+		int soft, uint32_t *keys)
+{
+	uint32_t buckets[6][2], key[6];
+	int number_buckets[6], number = 0;
+	int f, i;
+
+	for (f = 0; f < 3; f++) {
+		int side = triplet->side[f];
+		int rest = side % SIDE_STEP;
+
+		buckets[f][0] = fmr_index_side_bucket(side);
+		number_buckets[f] = 1;
+		if (!soft || buckets[f][0] == (1 << SIDE_BITS) - 1)
+			continue;
+		if (rest < SIDE_MARGIN && buckets[f][0] > 0)
+			buckets[f][number_buckets[f]++] = buckets[f][0] - 1;
+		else if (rest >= SIDE_STEP - SIDE_MARGIN)
+			buckets[f][number_buckets[f]++] =
+					fmr_index_side_bucket(side + SIDE_MARGIN);
+	}
+
+	for (f = 3; f < 6; f++) {
+		uint8_t angle = triplet->angle[f - 3];
+		int rest = angle & ((1 << ANGLE_SHIFT) - 1);
+
+		buckets[f][0] = angle >> ANGLE_SHIFT;
+		number_buckets[f] = 1;
+		if (!soft)
+			continue;
+		if (rest < ANGLE_MARGIN)
+			buckets[f][number_buckets[f]++] =
+					(uint8_t)(angle - ANGLE_MARGIN) >>
+					ANGLE_SHIFT;
+		else if (rest >= (1 << ANGLE_SHIFT) - ANGLE_MARGIN)
+			buckets[f][number_buckets[f]++] =
+					(uint8_t)(angle + ANGLE_MARGIN) >>
+					ANGLE_SHIFT;
+	}
+
+	/* Every combination of the buckets */
+	for (i = 0; ; i++) {
+		int rest = i;
+
+		for (f = 0; f < 6; f++) {
+			key[f] = buckets[f][rest % number_buckets[f]];
+			rest /= number_buckets[f];
+		}
+		if (rest)
+			break;
+		keys[number++] = fmr_index_key(key);
+	}
+
+	return number;
+}
+
+static int fmr_index_key_cmp(const void *a, const void *b)
+{
+	uint32_t key_a = *(const uint32_t *)a, key_b = *(const uint32_t *)b;
+
+	return key_a < key_b ? -1 : key_a > key_b;
+}
+
+/* Unique, sorted keys of @minutiae in a malloc()ed array, or NULL */
+static uint32_t *fmr_index_keys(const struct fmr_minutiae *minutiae,
+		int soft, int *number_keys)
+{
+	struct fmr_index_triplet *triplets;
+	uint32_t *keys;
+	int number_triplets, number = 0, t, i;
+
+	triplets = malloc(sizeof(*triplets) * TRIPLETS_MAX);
+	if (!triplets)
+		return NULL;
+	number_triplets = fmr_index_triplets(minutiae, triplets);
+
+	keys = malloc(sizeof(*keys) * (number_triplets ? number_triplets : 1) *
+			(soft ? 64 : 1));
+	if (!keys) {
+		free(triplets);
+		return NULL;
+	}
+
+	for (t = 0; t < number_triplets; t++)
+		number += fmr_index_triplet_keys(&triplets[t], soft,
+				keys + number);
+	free(triplets);
+
+	qsort(keys, number, sizeof(*keys), fmr_index_key_cmp);
+	for (i = 0, t = 0; t < number; t++)
+		if (!i || keys[t] != keys[i - 1])
+			keys[i++] = keys[t];
+	*number_keys = i;
+
+	return keys;
+}
+
+struct fmr_index *fmr_index_create(void)
+{
+	struct fmr_index *index = calloc(1, sizeof(*index));
+
+	if (index)
+		index->free_slot = SLOT_NONE;
+
+	return index;
+}
+
+void fmr_index_free(struct fmr_index *index)
+{
+	uint32_t i;
+
+	if (!index)
+		return;
+
+	for (i = 0; i < index->postings_size; i++)
+		free(index->postings[i].slots);
+	free(index->postings);
+	fmr_ids_release(&index->ids);
+	free(index->slots);
+	free(index);
+}
+
+static struct fmr_index_postings *fmr_index_find_postings(
+		const struct fmr_index *index, uint32_t key)
+{
+	uint32_t mask = index->postings_size - 1, i;
+
+	if (!index->postings_size)
+		return NULL;
+
+	for (i = fmr_index_hash(key, index->postings_shift);
+			index->postings[i].slots; i = (i + 1) & mask)
+		if (index->postings[i].key == key)
+			return &index->postings[i];
+
+	return NULL;
+}
+
+/* Make sure there's room for @number more keys, load factor 1/2 at most */
+static int fmr_index_reserve_postings(struct fmr_index *index,
+		uint32_t number)
+{
+	struct fmr_index_postings *postings;
+	uint32_t size = index->postings_size ? index->postings_size : 1024;
+	int shift = index->postings_size ? index->postings_shift : 32 - 10;
+	uint32_t mask, i, j;
+
+	while ((index->number_postings + number) * 2 > size) {
+		size *= 2;
+		shift--;
+	}
+	if (size == index->postings_size)
+		return 0;
+
+	postings = calloc(size, sizeof(*postings));
+	if (!postings)
+		return -1;
+
+	mask = size - 1;
+	for (i = 0; i < index->postings_size; i++) {
+		if (!index->postings[i].slots)
+			continue;
+		for (j = fmr_index_hash(index->postings[i].key, shift);
+				postings[j].slots; j = (j + 1) & mask)
+			;
+		postings[j] = index->postings[i];
+	}
+
+	free(index->postings);
+	index->postings = postings;
+	index->postings_size = size;
+	index->postings_shift = shift;
+
+	return 0;
+}
+
+static int fmr_index_add_posting(struct fmr_index *index, uint32_t key,
+		uint32_t slot)
+{
+	uint32_t mask = index->postings_size - 1, i;
+	struct fmr_index_postings *postings;
+
+	for (i = fmr_index_hash(key, index->postings_shift);
+			index->postings[i].slots &&
+			index->postings[i].key != key; i = (i + 1) & mask)
+		;
+	postings = &index->postings[i];
+
+	if (!postings->slots) {
+		postings->slots = malloc(sizeof(*postings->slots) * 4);
+		if (!postings->slots)
+			return -1;
+		postings->key = key;
+		postings->number_slots = 0;
+		postings->allocated = 4;
+		index->number_postings++;
+	} else if (postings->number_slots == postings->allocated) {
+		uint32_t *slots = realloc(postings->slots,
+				sizeof(*slots) * postings->allocated * 2);
+
+		if (!slots)
+			return -1;
+		postings->slots = slots;
+		postings->allocated *= 2;
+	}
+
+	postings->slots[postings->number_slots++] = slot;
+
+	return 0;
+}
+
+static uint32_t fmr_index_get_slot(struct fmr_index *index)
+{
+	uint32_t n = index->number_slots, slot;
+
+	if (index->free_slot != SLOT_NONE) {
+		slot = index->free_slot;
+		index->free_slot = index->slots[slot].id;
+		return slot;
+	}
+
+	if (n == SLOT_NONE) {
+		errno = EFBIG;
+		return SLOT_NONE;
+	}
+
+	/* Table grows in powers of two */
+	if (!(n & (n - 1))) {
+		struct fmr_index_slot *slots = realloc(index->slots,
+				sizeof(*slots) * (n ? n * 2 : 1));
+
+		if (!slots)
+			return SLOT_NONE;
+		index->slots = slots;
+	}
+
+	return index->number_slots++;
+}
+
+/* Take deleted templates out of the lists, and reuse their slots */
+static void fmr_index_purge(struct fmr_index *index)
+{
+	uint32_t i, j, number;
+
+	for (i = 0; i < index->postings_size; i++) {
+		struct fmr_index_postings *postings = &index->postings[i];
+
+		if (!postings->slots)
+			continue;
+		for (j = 0, number = 0; j < postings->number_slots; j++)
+			if (index->slots[postings->slots[j]].state ==
+					slot_live)
+				postings->slots[number++] = postings->slots[j];
+		postings->number_slots = number;
+	}
+
+	for (i = 0; i < index->number_slots; i++) {
+		if (index->slots[i].state != slot_deleted)
+			continue;
+		index->slots[i].state = slot_free;
+		index->slots[i].id = index->free_slot;
+		index->free_slot = i;
+	}
+	index->number_deleted = 0;
+}
+
+int fmr_index_insert(struct fmr_index *index, uint32_t id,
+		const struct fmr_minutiae *minutiae)
+{
+	struct fmr_index_slot *slot;
+	uint32_t *keys, s;
+	int number_keys, k;
+
+	if (fmr_ids_find(&index->ids, id) != FMR_IDS_NONE) {
+		errno = EEXIST;
+		return -1;
+	}
+
+	keys = fmr_index_keys(minutiae, 0, &number_keys);
+	if (!keys)
+		return -1;
+
+	if (fmr_ids_reserve(&index->ids, 1) ||
+			fmr_index_reserve_postings(index, number_keys)) {
+		free(keys);
+		return -1;
+	}
+
+	s = fmr_index_get_slot(index);
+	if (s == SLOT_NONE) {
+		free(keys);
+		return -1;
+	}
+	slot = &index->slots[s];
+	slot->id = id;
+	slot->number_keys = number_keys;
+	slot->state = slot_live;
+
+	for (k = 0; k < number_keys; k++) {
+		if (fmr_index_add_posting(index, keys[k], s)) {
+			/* Lists with it are cleaned up by the next purge */
+			slot->state = slot_deleted;
+			index->number_deleted++;
+			free(keys);
+			return -1;
+		}
+	}
+	free(keys);
+
+	fmr_ids_set(&index->ids, id, s);
+
+	return 0;
+}
+
+int fmr_index_delete(struct fmr_index *index, uint32_t id)
+{
+	uint32_t i = fmr_ids_find(&index->ids, id);
+
+	if (i == FMR_IDS_NONE) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	index->slots[index->ids.buckets[i].value].state = slot_deleted;
+	index->number_deleted++;
+	fmr_ids_remove(&index->ids, i);
+
+	if (index->number_deleted >= PURGE_MIN &&
+			index->number_deleted * 4 >= index->ids.number)
+		fmr_index_purge(index);
+
+	return 0;
+}
+
+uint32_t fmr_index_get_number_templates(const struct fmr_index *index)
+{
+	return index->ids.number;
+}
+
+size_t fmr_index_get_size(const struct fmr_index *index)
+{
+	size_t size = sizeof(*index->postings) * index->postings_size +
+			fmr_ids_get_size(&index->ids) +
+			sizeof(*index->slots) * index->number_slots;
+	uint32_t i;
+
+	for (i = 0; i < index->postings_size; i++)
+		size += sizeof(uint32_t) * index->postings[i].allocated;
+
+	return size;
+}
+
+/* Fewer votes, and higher id for the same votes, so the order is stable */
+static int fmr_index_worse(const struct fmr_index_candidate *a,
+		const struct fmr_index_candidate *b)
+{
+	return a->votes < b->votes || (a->votes == b->votes && a->id > b->id);
+}
+
+static int fmr_index_candidate_cmp(const void *a, const void *b)
+{
+	if (fmr_index_worse(a, b))
+		return 1;
+
+	return fmr_index_worse(b, a) ? -1 : 0;
+}
+
+/* Bounded heap of the best candidates, the worst one on top */
+static void fmr_index_heap_push(struct fmr_index_candidate *heap,
+		int *number, int k, uint32_t id, uint32_t votes)
+{
+	struct fmr_index_candidate candidate = { id, votes };
+	int i, child;
+
+	if (*number < k) {
+		for (i = (*number)++; i > 0 && fmr_index_worse(&candidate,
+				&heap[(i - 1) / 2]); i = (i - 1) / 2)
+			heap[i] = heap[(i - 1) / 2];
+		heap[i] = candidate;
+		return;
+	}
+
+	if (!fmr_index_worse(&heap[0], &candidate))
+		return;
+
+	for (i = 0; (child = 2 * i + 1) < k; i = child) {
+		if (child + 1 < k && fmr_index_worse(&heap[child + 1],
+				&heap[child]))
+			child++;
+		if (!fmr_index_worse(&heap[child], &candidate))
+			break;
+		heap[i] = heap[child];
+	}
+	heap[i] = candidate;
+}
+
+int fmr_index_search(const struct fmr_index *index,
+		const struct fmr_minutiae *probe,
+		struct fmr_index_candidate *candidates, int k)
+{
+	struct fmr_index_postings *postings;
+	uint32_t *keys, *votes, i, j;
+	int number_keys, number = 0, key;
+
+	if (k < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	keys = fmr_index_keys(probe, 1, &number_keys);
+	if (!keys)
+		return -1;
+
+	votes = calloc(index->number_slots ? index->number_slots : 1,
+			sizeof(*votes));
+	if (!votes) {
+		free(keys);
+		return -1;
+	}
+
+	for (key = 0; key < number_keys; key++) {
+		postings = fmr_index_find_postings(index, keys[key]);
+		if (!postings)
+			continue;
+		for (j = 0; j < postings->number_slots; j++)
+			votes[postings->slots[j]]++;
+	}
+	free(keys);
+
+	for (i = 0; i < index->number_slots; i++)
+		if (votes[i] && index->slots[i].state == slot_live)
+			fmr_index_heap_push(candidates, &number, k,
+					index->slots[i].id, votes[i]);
+	free(votes);
+
+	qsort(candidates, number, sizeof(*candidates),
+			fmr_index_candidate_cmp);
+
+	return number;
+}
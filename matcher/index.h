@@ -0,0 +1,67 @@
+#ifndef __FMR_INDEX_H
+#define __FMR_INDEX_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "minutiae.h"
+
+/*
+ * Geometric hashing of minutiae triplets, for pruning a large gallery
+ * before the real matching. Every minutia makes triangles with pairs of
+ * its nearest neighbours, and a triangle's key is its three sides, and
+ * the minutiae directions relative to the sides, quantized, all of that
+ * independent of the finger's position and rotation. The index is a hash
+ * table of keys, each with the list of templates having such a triangle.
+ *
+ * A probe's triangles vote for the templates they are found in, and the
+ * ones with the most votes are the candidates for the matcher. Probe's
+ * sides and directions close to a quantization step boundary look up the
+ * keys on both sides of it, so that small distortions don't lose votes.
+ *
+ * Templates are inserted and deleted one at a time, any time. Deleted
+ * ones are only marked as such, and removed from the lists in one go
+ * when there's enough of them.
+ */
+struct fmr_index;
+
+struct fmr_index *fmr_index_create(void);
+void fmr_index_free(struct fmr_index *index);
+
+/*
+ * Add triangles of @minutiae as the template @id. Returns -1, with errno
+ * set, on failure, EEXIST if there's @id in the index already.
+ */
+int fmr_index_insert(struct fmr_index *index, uint32_t id,
+		const struct fmr_minutiae *minutiae);
+/* Returns -1, with errno ENOENT, if there's no @id in the index */
+int fmr_index_delete(struct fmr_index *index, uint32_t id);
+
+uint32_t fmr_index_get_number_templates(const struct fmr_index *index);
+/* Memory taken by the hash table and the lists, in bytes */
+size_t fmr_index_get_size(const struct fmr_index *index);
+
+struct fmr_index_candidate {
+	uint32_t id;
+	uint32_t votes;
+};
+
+/*
+ * Put up to @k templates with the most votes of @probe's triangles, best
+ * first, in @candidates. Templates with no votes are not candidates at all.
+ * Returns the number of candidates, or -1 with errno set.
+ */
+int fmr_index_search(const struct fmr_index *index,
+		const struct fmr_minutiae *probe,
+		struct fmr_index_candidate *candidates, int k);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
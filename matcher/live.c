@@ -0,0 +1,557 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ids.h"
+#include "live.h"
+
+struct fmr_live_segment {
+	struct fmr_search_gallery *gallery;
+	/* A bit for every entry, set with __atomic builtins */
+	uint64_t *deleted;
+	uint32_t number_entries;
+	/* Writers only */
+	uint32_t number_deleted;
+};
+
+struct fmr_live_version {
+	int number_segments;
+	struct fmr_live_segment *segments[];
+};
+
+/* Version, and its segments not in the next one, until nobody sees them */
+struct fmr_live_retired {
+	struct fmr_live_retired *next;
+	uint64_t epoch;
+	struct fmr_live_version *version;
+	int number_segments;
+	struct fmr_live_segment *segments[];
+};
+
+/* Where an entry is, for writers, free ones linked through the index */
+struct fmr_live_location {
+	struct fmr_live_segment *segment;
+	uint32_t index;
+};
+
+#define LOCATION_NONE UINT32_MAX
+
+/* Every search in progress has a slot, with the epoch it started in */
+struct fmr_live_reader {
+	atomic_uint_fast64_t epoch;
+} __attribute__((aligned(64)));
+
+struct fmr_live {
+	_Atomic(struct fmr_live_version *) version;
+	atomic_uint_fast64_t epoch;
+	struct fmr_live_reader readers[FMR_LIVE_SEARCHES_MAX];
+
+	/* All that follows is for writers only, holding the lock */
+	pthread_mutex_t lock;
+	int descriptors;
+	struct fmr_live_retired *retired;
+	/* Id to location map, and the locations */
+	struct fmr_ids ids;
+	struct fmr_live_location *locations;
+	uint32_t number_locations, free_location;
+};
+
+/*
+ * Take a free slot, with the epoch the search starts in, before looking
+ * at the version, so that whatever is retired from now on isn't freed
+ * until the slot is released
+ */
+static int fmr_live_enter(struct fmr_live *live)
+{
+	int slot = ((uintptr_t)pthread_self() >> 6) % FMR_LIVE_SEARCHES_MAX;
+
+	for (;; slot = (slot + 1) % FMR_LIVE_SEARCHES_MAX) {
+		uint_fast64_t free = 0;
+		uint_fast64_t epoch = atomic_load(&live->epoch);
+
+		if (atomic_compare_exchange_strong(&live->readers[slot].epoch,
+				&free, epoch))
+			return slot;
+		if (slot == FMR_LIVE_SEARCHES_MAX - 1)
+			sched_yield();
+	}
+}
+
+static void fmr_live_leave(struct fmr_live *live, int slot)
+{
+	atomic_store_explicit(&live->readers[slot].epoch, 0,
+			memory_order_release);
+}
+
+struct fmr_live *fmr_live_create(int descriptors)
+{
+	struct fmr_live *live = aligned_alloc(64,
+			(sizeof(*live) + 63) & ~(size_t)63);
+	struct fmr_live_version *version = calloc(1, sizeof(*version));
+	int i;
+
+	if (!live || !version || pthread_mutex_init(&live->lock, NULL)) {
+		free(live);
+		free(version);
+		return NULL;
+	}
+
+	atomic_init(&live->version, version);
+	/* 0 is a free reader slot */
+	atomic_init(&live->epoch, 1);
+	for (i = 0; i < FMR_LIVE_SEARCHES_MAX; i++)
+		atomic_init(&live->readers[i].epoch, 0);
+	live->descriptors = descriptors;
+	live->retired = NULL;
+	memset(&live->ids, 0, sizeof(live->ids));
+	live->locations = NULL;
+	live->number_locations = 0;
+	live->free_location = LOCATION_NONE;
+
+	return live;
+}
+
+static void fmr_live_segment_free(struct fmr_live_segment *segment)
+{
+	if (!segment)
+		return;
+
+	fmr_search_gallery_free(segment->gallery);
+	free(segment->deleted);
+	free(segment);
+}
+
+void fmr_live_free(struct fmr_live *live)
+{
+	struct fmr_live_version *version;
+	int i;
+
+	if (!live)
+		return;
+
+	while (live->retired) {
+		struct fmr_live_retired *retired = live->retired;
+
+		live->retired = retired->next;
+		for (i = 0; i < retired->number_segments; i++)
+			fmr_live_segment_free(retired->segments[i]);
+		free(retired->version);
+		free(retired);
+	}
+
+	version = atomic_load(&live->version);
+	for (i = 0; i < version->number_segments; i++)
+		fmr_live_segment_free(version->segments[i]);
+	free(version);
+
+	fmr_ids_release(&live->ids);
+	free(live->locations);
+	pthread_mutex_destroy(&live->lock);
+	free(live);
+}
+
+/* Free location for a new entry, taken by fmr_live_set_location() */
+static int fmr_live_reserve_location(struct fmr_live *live)
+{
+	struct fmr_live_location *locations;
+	uint32_t n = live->number_locations;
+
+	if (live->free_location != LOCATION_NONE)
+		return 0;
+
+	if (n == LOCATION_NONE) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	/* Table grows in powers of two */
+	if (!(n & (n - 1))) {
+		locations = realloc(live->locations,
+				sizeof(*locations) * (n ? n * 2 : 1));
+		if (!locations)
+			return -1;
+		live->locations = locations;
+	}
+
+	live->locations[n].segment = NULL;
+	live->locations[n].index = LOCATION_NONE;
+	live->free_location = n;
+	live->number_locations++;
+
+	return 0;
+}
+
+/* Of an existing entry, or a new one, with room reserved for it */
+static void fmr_live_set_location(struct fmr_live *live, uint32_t id,
+		struct fmr_live_segment *segment, uint32_t index)
+{
+	uint32_t bucket = fmr_ids_find(&live->ids, id), location;
+
+	if (bucket != FMR_IDS_NONE) {
+		location = live->ids.buckets[bucket].value;
+	} else {
+		location = live->free_location;
+		live->free_location = live->locations[location].index;
+		fmr_ids_set(&live->ids, id, location);
+	}
+
+	live->locations[location].segment = segment;
+	live->locations[location].index = index;
+}
+
+/* Of the entry in @bucket of the ids */
+static void fmr_live_remove_location(struct fmr_live *live, uint32_t bucket)
+{
+	uint32_t location = live->ids.buckets[bucket].value;
+
+	live->locations[location].segment = NULL;
+	live->locations[location].index = live->free_location;
+	live->free_location = location;
+	fmr_ids_remove(&live->ids, bucket);
+}
+
+static struct fmr_live_segment *fmr_live_segment_create(
+		struct fmr_search_gallery *gallery)
+{
+	struct fmr_live_segment *segment = malloc(sizeof(*segment));
+	uint32_t n = fmr_search_gallery_get_number_entries(gallery);
+
+	if (!segment)
+		return NULL;
+
+	segment->deleted = calloc((n + 63) / 64 ? (n + 63) / 64 : 1,
+			sizeof(*segment->deleted));
+	if (!segment->deleted) {
+		free(segment);
+		return NULL;
+	}
+	segment->gallery = gallery;
+	segment->number_entries = n;
+	segment->number_deleted = 0;
+
+	return segment;
+}
+
+/* One segment with the entries of @segments, but the deleted ones */
+static struct fmr_live_segment *fmr_live_merge(struct fmr_live *live,
+		struct fmr_live_segment **segments, int number_segments)
+{
+	struct fmr_search_gallery *gallery = fmr_search_gallery_create();
+	struct fmr_live_segment *segment;
+	int i;
+
+	if (!gallery)
+		return NULL;
+	if (live->descriptors)
+		fmr_search_gallery_enable_descriptors(gallery);
+
+	for (i = 0; i < number_segments; i++) {
+		if (fmr_search_gallery_merge(gallery, segments[i]->gallery,
+				segments[i]->deleted)) {
+			fmr_search_gallery_free(gallery);
+			return NULL;
+		}
+	}
+
+	segment = fmr_live_segment_create(gallery);
+	if (!segment)
+		fmr_search_gallery_free(gallery);
+
+	return segment;
+}
+
+/* Free whatever was retired before the oldest search in progress started */
+static void fmr_live_reclaim(struct fmr_live *live)
+{
+	struct fmr_live_retired **link = &live->retired;
+	uint64_t oldest = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < FMR_LIVE_SEARCHES_MAX; i++) {
+		uint64_t epoch = atomic_load(&live->readers[i].epoch);
+
+		if (epoch && epoch < oldest)
+			oldest = epoch;
+	}
+
+	while (*link) {
+		struct fmr_live_retired *retired = *link;
+
+		if (retired->epoch >= oldest) {
+			link = &retired->next;
+			continue;
+		}
+
+		*link = retired->next;
+		for (i = 0; i < retired->number_segments; i++)
+			fmr_live_segment_free(retired->segments[i]);
+		free(retired->version);
+		free(retired);
+	}
+}
+
+/*
+ * New version, with @number_replaced segments from @first replaced with
+ * @added (or just removed for NULL). Searches starting after that see
+ * the new version, the ones in progress keep using the old one, and the
+ * old one, with the segments replaced, is retired until they're done.
+ */
+static int fmr_live_publish(struct fmr_live *live, int first,
+		int number_replaced, struct fmr_live_segment *added)
+{
+	struct fmr_live_version *old = atomic_load(&live->version);
+	struct fmr_live_version *version;
+	struct fmr_live_retired *retired;
+	int n = old->number_segments, number = 0, i;
+
+	version = malloc(sizeof(*version) + sizeof(*version->segments) *
+			(n - number_replaced + 1));
+	retired = malloc(sizeof(*retired) + sizeof(*retired->segments) *
+			number_replaced);
+	if (!version || !retired) {
+		free(version);
+		free(retired);
+		return -1;
+	}
+
+	for (i = 0; i < first; i++)
+		version->segments[number++] = old->segments[i];
+	if (added)
+		version->segments[number++] = added;
+	for (i = first + number_replaced; i < n; i++)
+		version->segments[number++] = old->segments[i];
+	version->number_segments = number;
+
+	retired->version = old;
+	retired->number_segments = number_replaced;
+	memcpy(retired->segments, old->segments + first,
+			sizeof(*retired->segments) * number_replaced);
+
+	/* Writers only look entries up, all the room is reserved already */
+	for (i = 0; added && i < added->number_entries; i++)
+		fmr_live_set_location(live, fmr_search_gallery_get_id(
+				added->gallery, i), added, i);
+
+	atomic_store(&live->version, version);
+	retired->epoch = atomic_fetch_add(&live->epoch, 1);
+	retired->next = live->retired;
+	live->retired = retired;
+
+	fmr_live_reclaim(live);
+
+	return 0;
+}
+
+static inline uint32_t fmr_live_segment_entries(
+		const struct fmr_live_segment *segment)
+{
+	return segment->number_entries - segment->number_deleted;
+}
+
+/* Add the single entry of @gallery, which is taken over on success */
+static int fmr_live_add(struct fmr_live *live, uint32_t id,
+		struct fmr_search_gallery *gallery)
+{
+	struct fmr_live_version *version;
+	struct fmr_live_segment *segment, *merged = NULL;
+	struct fmr_live_segment **merging;
+	uint64_t entries = 1;
+	int first, n, res = -1;
+
+	pthread_mutex_lock(&live->lock);
+
+	if (fmr_ids_find(&live->ids, id) != FMR_IDS_NONE) {
+		errno = EEXIST;
+		goto out;
+	}
+	version = atomic_load(&live->version);
+	n = version->number_segments;
+
+	/*
+	 * Merged with the last segments, as long as they're not more than
+	 * twice as big, so that sizes grow geometrically
+	 */
+	for (first = n; first > 0 && fmr_live_segment_entries(
+			version->segments[first - 1]) <= 2 * entries; first--)
+		entries += fmr_live_segment_entries(
+				version->segments[first - 1]);
+	if (fmr_ids_reserve(&live->ids, 1) ||
+			fmr_live_reserve_location(live))
+		goto out;
+
+	segment = fmr_live_segment_create(gallery);
+	if (!segment)
+		goto out;
+
+	/* Failing that, it's just another segment, merged next time */
+	merging = malloc(sizeof(*merging) * (n - first + 1));
+	if (merging && first < n) {
+		memcpy(merging, version->segments + first,
+				sizeof(*merging) * (n - first));
+		merging[n - first] = segment;
+		merged = fmr_live_merge(live, merging, n - first + 1);
+	}
+	free(merging);
+
+	if (merged && !fmr_live_publish(live, first, n - first, merged)) {
+		fmr_live_segment_free(segment);
+		res = 0;
+	} else if (!fmr_live_publish(live, n, 0, segment)) {
+		fmr_live_segment_free(merged);
+		res = 0;
+	} else {
+		fmr_live_segment_free(merged);
+		/* The caller's to free */
+		segment->gallery = NULL;
+		fmr_live_segment_free(segment);
+	}
+
+out:
+	pthread_mutex_unlock(&live->lock);
+
+	return res;
+}
+
+int fmr_live_add_minutiae(struct fmr_live *live, uint32_t id,
+		uint8_t finger_position,
+		const struct fmr_match_minutia *minutiae, int number_minutiae)
+{
+	struct fmr_search_gallery *gallery = fmr_search_gallery_create();
+
+	/* Templates and descriptors are worked out with no lock held */
+	if (!gallery || (live->descriptors &&
+			fmr_search_gallery_enable_descriptors(gallery)) ||
+			fmr_search_gallery_add_minutiae(gallery, id,
+			finger_position, minutiae, number_minutiae) ||
+			fmr_live_add(live, id, gallery)) {
+		fmr_search_gallery_free(gallery);
+		return -1;
+	}
+
+	return 0;
+}
+
+int fmr_live_add_record(struct fmr_live *live, uint32_t id,
+		const void *buffer, size_t len)
+{
+	struct fmr_search_gallery *gallery = fmr_search_gallery_create();
+
+	if (!gallery || (live->descriptors &&
+			fmr_search_gallery_enable_descriptors(gallery)) ||
+			fmr_search_gallery_add_record(gallery, id, buffer,
+			len) || fmr_live_add(live, id, gallery)) {
+		fmr_search_gallery_free(gallery);
+		return -1;
+	}
+
+	return 0;
+}
+
+int fmr_live_delete(struct fmr_live *live, uint32_t id)
+{
+	struct fmr_live_version *version;
+	struct fmr_live_segment *segment, *rewritten;
+	struct fmr_live_location *location;
+	uint32_t i, index;
+	int s;
+
+	pthread_mutex_lock(&live->lock);
+
+	i = fmr_ids_find(&live->ids, id);
+	if (i == FMR_IDS_NONE) {
+		pthread_mutex_unlock(&live->lock);
+		errno = ENOENT;
+		return -1;
+	}
+	location = &live->locations[live->ids.buckets[i].value];
+	segment = location->segment;
+	index = location->index;
+
+	/* Searches see it gone as soon as that's done */
+	__atomic_fetch_or(&segment->deleted[index / 64],
+			(uint64_t)1 << (index % 64), __ATOMIC_RELAXED);
+	segment->number_deleted++;
+	fmr_live_remove_location(live, i);
+
+	/* Rewrite it if that's worth it, and leave it as it is otherwise */
+	if (segment->number_deleted * 4 >= segment->number_entries) {
+		version = atomic_load(&live->version);
+		for (s = 0; version->segments[s] != segment; s++)
+			;
+
+		if (segment->number_deleted == segment->number_entries) {
+			fmr_live_publish(live, s, 1, NULL);
+		} else {
+			rewritten = fmr_live_merge(live, &segment, 1);
+			if (rewritten && fmr_live_publish(live, s, 1,
+					rewritten))
+				fmr_live_segment_free(rewritten);
+		}
+	}
+
+	pthread_mutex_unlock(&live->lock);
+
+	return 0;
+}
+
+uint32_t fmr_live_get_number_entries(struct fmr_live *live)
+{
+	uint32_t number;
+
+	pthread_mutex_lock(&live->lock);
+	number = live->ids.number;
+	pthread_mutex_unlock(&live->lock);
+
+	return number;
+}
+
+int fmr_live_get_number_segments(struct fmr_live *live)
+{
+	struct fmr_live_version *version;
+	int slot, number;
+
+	slot = fmr_live_enter(live);
+	version = atomic_load(&live->version);
+	number = version->number_segments;
+	fmr_live_leave(live, slot);
+
+	return number;
+}
+
+/* All segments of the version, in one search, with no id in two of them */
+int fmr_live_search(struct fmr_live *live,
+		const struct fmr_search_probe *probe,
+		const struct fmr_search_cascade *cascade,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats)
+{
+	struct fmr_live_version *version;
+	struct fmr_search_part *parts;
+	int slot, i, number;
+
+	slot = fmr_live_enter(live);
+	version = atomic_load(&live->version);
+
+	parts = malloc(sizeof(*parts) * (version->number_segments ?
+			version->number_segments : 1));
+	if (!parts) {
+		fmr_live_leave(live, slot);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < version->number_segments; i++) {
+		parts[i].gallery = version->segments[i]->gallery;
+		parts[i].excluded = version->segments[i]->deleted;
+	}
+
+	number = fmr_search_cascade_parts(parts, version->number_segments,
+			probe, cascade, candidates, k, threads, stats);
+
+	fmr_live_leave(live, slot);
+	free(parts);
+
+	return number;
+}
@@ -0,0 +1,72 @@
+#ifndef __FMR_LIVE_H
+#define __FMR_LIVE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "match.h"
+#include "search.h"
+
+/*
+ * Gallery of a service searching all the time, while entries are added
+ * and deleted. Searches never take a lock, nor wait for a writer.
+ *
+ * Entries are in segments, search.h galleries which never change once
+ * searchable, but for a bitmap of deleted entries. The list of segments
+ * is a version, published with a single atomic pointer store. An added
+ * entry is a new segment, merged with the previous ones when they're not
+ * much bigger, so that there are about log2 of the number of entries of
+ * them. Segments with a quarter of their entries deleted are rewritten
+ * without them.
+ *
+ * Versions and segments replaced are freed once no search can see them,
+ * with epoch-based reclamation: every search announces the epoch it has
+ * started in, and writers free what was retired before the oldest one.
+ * Writers are serialized with a mutex, which searches never take.
+ */
+#define FMR_LIVE_SEARCHES_MAX 256
+
+struct fmr_live;
+
+/* With MCC descriptors of all templates, for a cascade search, or not */
+struct fmr_live *fmr_live_create(int descriptors);
+/* With no searches in progress */
+void fmr_live_free(struct fmr_live *live);
+
+/*
+ * Add a v20 or v030 record, or a single template of @minutiae, as
+ * fmr_search_gallery_add_record() and fmr_search_gallery_add_minutiae()
+ * do. Returns -1 with errno set on failure, EEXIST if there's @id
+ * already, and the entry is searchable as soon as they return.
+ */
+int fmr_live_add_record(struct fmr_live *live, uint32_t id,
+		const void *buffer, size_t len);
+int fmr_live_add_minutiae(struct fmr_live *live, uint32_t id,
+		uint8_t finger_position,
+		const struct fmr_match_minutia *minutiae, int number_minutiae);
+/* Returns -1, with errno ENOENT, if there's no @id */
+int fmr_live_delete(struct fmr_live *live, uint32_t id);
+
+uint32_t fmr_live_get_number_entries(struct fmr_live *live);
+int fmr_live_get_number_segments(struct fmr_live *live);
+
+/*
+ * As fmr_search_cascade(), in all segments. Up to FMR_LIVE_SEARCHES_MAX
+ * searches run at the same time, any more wait for one of them to end.
+ */
+int fmr_live_search(struct fmr_live *live,
+		const struct fmr_search_probe *probe,
+		const struct fmr_search_cascade *cascade,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
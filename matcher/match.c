@@ -0,0 +1,1013 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "match.h"
+#include "minutiae.h"
+#include "trig.h"
+
+/* Resolution all the minutiae are scaled to, in pixels per cm */
+#define RESOLUTION 197
+
+/* Neighbours describing every minutia's local structure */
+#define NEIGHBOURS 2
+/* Local structures tolerances, in pixels and angle units */
+#define LOCAL_DISTANCE 10
+#define LOCAL_ANGLE 14
+/* Number of best matching local structures tried as the alignment */
+#define REFERENCES 4
+/* Minutiae pairing tolerances, after alignment */
+#define PAIR_DISTANCE 16
+#define PAIR_ANGLE 16
+
+struct fmr_match_feature {
+	uint16_t x;
+	uint16_t y;
+	uint8_t angle;
+	uint8_t type;
+	/* Index of the n-th feature in local structure order */
+	uint8_t local_order;
+	uint8_t reserved;
+	/* Distance, direction and angle of the neighbours, relative */
+	uint16_t distance[NEIGHBOURS];
+	uint8_t direction[NEIGHBOURS];
+	uint8_t rotation[NEIGHBOURS];
+};
+
+/*
+ * Local structures are ordered by the nearest neighbour's rotation, in
+ * buckets, then by its distance, so that only those within tolerances
+ * are compared at all
+ */
+#define ROTATION_SHIFT 4
+#define ROTATION_BUCKETS (256 >> ROTATION_SHIFT)
+
+struct fmr_match_template {
+	int number_minutiae;
+	/* First of the local structures in every rotation bucket */
+	uint8_t rotation_first[ROTATION_BUCKETS + 1];
+	/* Sorted by x */
+	struct fmr_match_feature features[];
+};
+
+const int16_t fmr_match_cos[256] = {
+	16384, 16379, 16364, 16340, 16305, 16261, 16207, 16143,
+	16069, 15986, 15893, 15791, 15679, 15557, 15426, 15286,
+	15137, 14978, 14811, 14635, 14449, 14256, 14053, 13842,
+	13623, 13395, 13160, 12916, 12665, 12406, 12140, 11866,
+	11585, 11297, 11003, 10702, 10394, 10080, 9760, 9434,
+	9102, 8765, 8423, 8076, 7723, 7366, 7005, 6639,
+	6270, 5897, 5520, 5139, 4756, 4370, 3981, 3590,
+	3196, 2801, 2404, 2006, 1606, 1205, 804, 402,
+	0, -402, -804, -1205, -1606, -2006, -2404, -2801,
+	-3196, -3590, -3981, -4370, -4756, -5139, -5520, -5897,
+	-6270, -6639, -7005, -7366, -7723, -8076, -8423, -8765,
+	-9102, -9434, -9760, -10080, -10394, -10702, -11003, -11297,
+	-11585, -11866, -12140, -12406, -12665, -12916, -13160, -13395,
+	-13623, -13842, -14053, -14256, -14449, -14635, -14811, -14978,
+	-15137, -15286, -15426, -15557, -15679, -15791, -15893, -15986,
+	-16069, -16143, -16207, -16261, -16305, -16340, -16364, -16379,
+	-16384, -16379, -16364, -16340, -16305, -16261, -16207, -16143,
+	-16069, -15986, -15893, -15791, -15679, -15557, -15426, -15286,
+	-15137, -14978, -14811, -14635, -14449, -14256, -14053, -13842,
+	-13623, -13395, -13160, -12916, -12665, -12406, -12140, -11866,
+	-11585, -11297, -11003, -10702, -10394, -10080, -9760, -9434,
+	-9102, -8765, -8423, -8076, -7723, -7366, -7005, -6639,
+	-6270, -5897, -5520, -5139, -4756, -4370, -3981, -3590,
+	-3196, -2801, -2404, -2006, -1606, -1205, -804, -402,
+	0, 402, 804, 1205, 1606, 2006, 2404, 2801,
+	3196, 3590, 3981, 4370, 4756, 5139, 5520, 5897,
+	6270, 6639, 7005, 7366, 7723, 8076, 8423, 8765,
+	9102, 9434, 9760, 10080, 10394, 10702, 11003, 11297,
+	11585, 11866, 12140, 12406, 12665, 12916, 13160, 13395,
+	13623, 13842, 14053, 14256, 14449, 14635, 14811, 14978,
+	15137, 15286, 15426, 15557, 15679, 15791, 15893, 15986,
+	16069, 16143, 16207, 16261, 16305, 16340, 16364, 16379,
+};
+
+/* atan() of 0/32 to 32/32, in angle units */
+static const uint8_t fmr_match_atan[33] = {
+	0, 1, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 15, 16, 17, 18,
+	19, 20, 21, 22, 23, 24, 25, 25, 26, 27, 28, 29, 29, 30, 31, 31,
+	32,
+};
+
+/* Direction of the vector, counter-clockwise, y growing downwards */
+uint8_t fmr_match_atan2(int dx, int dy)
+{
+	int ax = abs(dx), ay = abs(dy);
+	int angle;
+
+	if (!ax && !ay)
+		return 0;
+
+	if (ax >= ay)
+		angle = fmr_match_atan[(ay * 32 + ax / 2) / ax];
+	else
+		angle = 64 - fmr_match_atan[(ax * 32 + ay / 2) / ay];
+	if (dx < 0)
+		angle = 128 - angle;
+	if (dy > 0)
+		angle = 256 - angle;
+
+	return angle;
+}
+
+static inline int fmr_match_angle_diff(uint8_t a, uint8_t b)
+{
+	uint8_t diff = a - b;
+
+	return diff > 128 ? 256 - diff : diff;
+}
+
+unsigned int fmr_match_sqrt(unsigned int val)
+{
+	unsigned int root = 0, bit = 1u << 30;
+
+	while (bit > val)
+		bit >>= 2;
+
+	while (bit) {
+		if (val >= root + bit) {
+			val -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return root;
+}
+
+/* Clipped to 14 bits, as fmr_minutiae_scale() does, for any record */
+static uint16_t fmr_match_scale(uint16_t val, uint16_t resolution)
+{
+	uint32_t scaled = val;
+
+	if (resolution && resolution != RESOLUTION)
+		scaled = scaled * RESOLUTION / resolution;
+
+	return scaled < FMR_MINUTIAE_COORDINATE_MAX ?
+			scaled : FMR_MINUTIAE_COORDINATE_MAX;
+}
+
+int fmr_match_minutiae_from_v20(const struct iso_fmr_v20 *record, int v,
+		struct fmr_match_minutia *minutiae)
+{
+	const struct iso_fmr_v20_view *view;
+	int m;
+
+	if (v < 0 || v >= record->number_views)
+		return -1;
+	view = &record->views[v];
+
+	for (m = 0; m < view->number_minutiae; m++) {
+		minutiae[m].x = fmr_match_scale(view->minutiae[m].x,
+				record->resolution_x);
+		minutiae[m].y = fmr_match_scale(view->minutiae[m].y,
+				record->resolution_y);
+		minutiae[m].angle = view->minutiae[m].angle;
+		minutiae[m].type = view->minutiae[m].type;
+	}
+
+	return view->number_minutiae;
+}
+
+int fmr_match_minutiae_from_v030(const struct iso_fmr_v030 *record, int r,
+		struct fmr_match_minutia *minutiae)
+{
+	const struct iso_fmr_v030_representation *repr;
+	int m;
+
+	if (r < 0 || r >= record->number_representations)
+		return -1;
+	repr = &record->representations[r];
+
+	for (m = 0; m < repr->number_minutiae; m++) {
+		minutiae[m].x = fmr_match_scale(repr->minutiae[m].x,
+				repr->sampling_rate_x);
+		minutiae[m].y = fmr_match_scale(repr->minutiae[m].y,
+				repr->sampling_rate_y);
+		minutiae[m].angle = repr->minutiae[m].angle;
+		minutiae[m].type = repr->minutiae[m].type;
+	}
+
+	return repr->number_minutiae;
+}
+
+size_t fmr_match_template_size(int number_minutiae)
+{
+	return sizeof(struct fmr_match_template) +
+			sizeof(struct fmr_match_feature) * number_minutiae;
+}
+
+static int fmr_match_feature_cmp(const void *a, const void *b)
+{
+	const struct fmr_match_feature *fa = a, *fb = b;
+
+	if (fa->x != fb->x)
+		return fa->x - fb->x;
+
+	return fa->y - fb->y;
+}
+
+static int fmr_match_local_cmp(const struct fmr_match_feature *a,
+		const struct fmr_match_feature *b)
+{
+	int bucket_a = a->rotation[0] >> ROTATION_SHIFT;
+	int bucket_b = b->rotation[0] >> ROTATION_SHIFT;
+
+	if (bucket_a != bucket_b)
+		return bucket_a - bucket_b;
+
+	return a->distance[0] - b->distance[0];
+}
+
+struct fmr_match_template *fmr_match_template_init(void *buffer,
+		const struct fmr_match_minutia *minutiae, int number_minutiae)
+{
+	struct fmr_match_template *template = buffer;
+	struct fmr_match_feature *features = template->features;
+	uint8_t order[FMR_MATCH_MINUTIAE_MAX];
+	int i, j, k;
+
+	if (number_minutiae < 0 || number_minutiae > FMR_MATCH_MINUTIAE_MAX)
+		return NULL;
+
+	template->number_minutiae = number_minutiae;
+	for (i = 0; i < number_minutiae; i++) {
+		memset(&features[i], 0, sizeof(features[i]));
+		features[i].x = minutiae[i].x;
+		features[i].y = minutiae[i].y;
+		features[i].angle = minutiae[i].angle;
+		features[i].type = minutiae[i].type;
+	}
+	qsort(features, number_minutiae, sizeof(*features),
+			fmr_match_feature_cmp);
+
+	/* Local structure is made of the nearest neighbours */
+	for (i = 0; i < number_minutiae; i++) {
+		struct fmr_match_feature *feature = &features[i];
+		unsigned int nearest[NEIGHBOURS];
+		int neighbours[NEIGHBOURS];
+
+		for (k = 0; k < NEIGHBOURS; k++) {
+			nearest[k] = -1;
+			neighbours[k] = -1;
+		}
+
+		for (j = 0; j < number_minutiae; j++) {
+			int dx = features[j].x - feature->x;
+			int dy = features[j].y - feature->y;
+			unsigned int dist = dx * dx + dy * dy;
+
+			if (j == i || dist >= nearest[NEIGHBOURS - 1])
+				continue;
+
+			for (k = NEIGHBOURS - 1; k > 0 && dist < nearest[k - 1];
+					k--) {
+				nearest[k] = nearest[k - 1];
+				neighbours[k] = neighbours[k - 1];
+			}
+			nearest[k] = dist;
+			neighbours[k] = j;
+		}
+
+		for (k = 0; k < NEIGHBOURS; k++) {
+			const struct fmr_match_feature *neighbour;
+			unsigned int dist;
+
+			if (neighbours[k] < 0) {
+				feature->distance[k] = UINT16_MAX;
+				continue;
+			}
+			neighbour = &features[neighbours[k]];
+			dist = fmr_match_sqrt(nearest[k]);
+
+			feature->distance[k] = dist < UINT16_MAX ?
+					dist : UINT16_MAX - 1;
+			feature->direction[k] = fmr_match_atan2(
+					neighbour->x - feature->x,
+					neighbour->y - feature->y) -
+					feature->angle;
+			feature->rotation[k] = neighbour->angle -
+					feature->angle;
+		}
+	}
+
+	for (i = 0; i < number_minutiae; i++) {
+		for (j = i; j > 0 && fmr_match_local_cmp(&features[order[j - 1]],
+				&features[i]) > 0; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+	for (i = 0, k = 0; i < number_minutiae; i++) {
+		int bucket = features[order[i]].rotation[0] >> ROTATION_SHIFT;
+
+		while (k <= bucket)
+			template->rotation_first[k++] = i;
+		features[i].local_order = order[i];
+	}
+	while (k <= ROTATION_BUCKETS)
+		template->rotation_first[k++] = number_minutiae;
+
+	return template;
+}
+
+int fmr_match_template_get_number_minutiae(
+		const struct fmr_match_template *template)
+{
+	return template->number_minutiae;
+}
+
+struct fmr_match_reference {
+	int similarity;
+	uint8_t a;
+	uint8_t b;
+};
+
+static int fmr_match_local(const struct fmr_match_feature *a,
+		const struct fmr_match_feature *b)
+{
+	int similarity = 0;
+	int k;
+
+	/* The nearest neighbour must match, the others add to similarity */
+	for (k = 0; k < NEIGHBOURS; k++) {
+		int distance = abs(a->distance[k] - b->distance[k]);
+		int direction = fmr_match_angle_diff(a->direction[k],
+				b->direction[k]);
+		int rotation = fmr_match_angle_diff(a->rotation[k],
+				b->rotation[k]);
+
+		/* One branch, mostly not taken, rather than three */
+		if ((distance > LOCAL_DISTANCE) | (direction > LOCAL_ANGLE) |
+				(rotation > LOCAL_ANGLE) |
+				(a->distance[k] == UINT16_MAX))
+			break;
+
+		similarity += 3 * (LOCAL_DISTANCE - distance) +
+				(LOCAL_ANGLE - direction) +
+				(LOCAL_ANGLE - rotation) + 1;
+	}
+
+	return k ? similarity : 0;
+}
+
+/*
+ * Minutiae of a template, sorted by x, are looked up in buckets of
+ * pixels wide, the bucket table is built for each comparison
+ */
+#define BUCKET_SHIFT 4
+#define BUCKETS_MAX ((UINT16_MAX >> BUCKET_SHIFT) + 1)
+
+struct fmr_match_buckets {
+	int number_buckets;
+	/* First feature in, or after, every bucket */
+	uint8_t first[BUCKETS_MAX];
+};
+
+static void fmr_match_buckets_init(struct fmr_match_buckets *buckets,
+		const struct fmr_match_template *template)
+{
+	int n = template->number_minutiae;
+	int bucket, i = 0;
+
+	buckets->number_buckets =
+			(template->features[n - 1].x >> BUCKET_SHIFT) + 1;
+	for (bucket = 0; bucket < buckets->number_buckets; bucket++) {
+		while (template->features[i].x >> BUCKET_SHIFT < bucket)
+			i++;
+		buckets->first[bucket] = i;
+	}
+}
+
+/* Aligns @a on @b, as the reference pair says, and counts paired minutiae */
+static int fmr_match_pair(const struct fmr_match_template *a,
+		const struct fmr_match_template *b,
+		const struct fmr_match_buckets *buckets,
+		const struct fmr_match_reference *reference,
+		uint8_t *paired, uint8_t stamp, uint8_t *mates)
+{
+	const struct fmr_match_feature *a0 = &a->features[reference->a];
+	const struct fmr_match_feature *b0 = &b->features[reference->b];
+	uint8_t rotation = b0->angle - a0->angle;
+	int cos = fmr_match_cos[rotation], sin = fmr_match_sin(rotation);
+	int number_paired = 0;
+	int i, j;
+
+	for (i = 0; i < a->number_minutiae; i++) {
+		const struct fmr_match_feature *feature = &a->features[i];
+		int rx = feature->x - a0->x, ry = feature->y - a0->y;
+		int x = ((rx * cos + ry * sin) >> 14) + b0->x;
+		int y = ((ry * cos - rx * sin) >> 14) + b0->y;
+		uint8_t angle = feature->angle + rotation;
+		int best = -1, best_dist = PAIR_DISTANCE * PAIR_DISTANCE + 1;
+		int bucket = (x - PAIR_DISTANCE) >> BUCKET_SHIFT;
+
+		if (bucket >= buckets->number_buckets)
+			continue;
+
+		for (j = bucket > 0 ? buckets->first[bucket] : 0;
+				j < b->number_minutiae &&
+				b->features[j].x <= x + PAIR_DISTANCE; j++) {
+			const struct fmr_match_feature *candidate =
+					&b->features[j];
+			int dx = candidate->x - x, dy = candidate->y - y;
+			int dist;
+
+			if ((paired[j] == stamp) | (abs(dx) > PAIR_DISTANCE) |
+					(abs(dy) > PAIR_DISTANCE))
+				continue;
+
+			dist = dx * dx + dy * dy;
+			if (dist < best_dist && fmr_match_angle_diff(
+					candidate->angle, angle) <= PAIR_ANGLE) {
+				best = j;
+				best_dist = dist;
+			}
+		}
+
+		if (best >= 0) {
+			paired[best] = stamp;
+			mates[i] = best;
+			number_paired++;
+		}
+	}
+
+	return number_paired;
+}
+
+/* Best matching local structures, returns the number of them */
+static int fmr_match_references(const struct fmr_match_template *a,
+		const struct fmr_match_template *b,
+		struct fmr_match_reference references[REFERENCES])
+{
+	int na = a->number_minutiae;
+	int i, j, r;
+
+	memset(references, 0, sizeof(*references) * REFERENCES);
+
+	for (i = 0; i < na; i++) {
+		const struct fmr_match_feature *fa = &a->features[i];
+		int first = (fa->rotation[0] - LOCAL_ANGLE) >> ROTATION_SHIFT;
+		int last = (fa->rotation[0] + LOCAL_ANGLE) >> ROTATION_SHIFT;
+		int bucket;
+
+		if (fa->distance[0] == UINT16_MAX)
+			continue;
+
+		for (bucket = first; bucket <= last; bucket++) {
+			int k = bucket & (ROTATION_BUCKETS - 1);
+
+			for (j = b->rotation_first[k];
+					j < b->rotation_first[k + 1]; j++) {
+				int fb_index = b->features[j].local_order;
+				const struct fmr_match_feature *fb =
+						&b->features[fb_index];
+				int similarity;
+
+				if (fb->distance[0] + LOCAL_DISTANCE <
+						fa->distance[0])
+					continue;
+				if (fb->distance[0] > fa->distance[0] +
+						LOCAL_DISTANCE)
+					break;
+
+				similarity = fmr_match_local(fa, fb);
+				if (similarity <=
+					references[REFERENCES - 1].similarity)
+					continue;
+
+				for (r = REFERENCES - 1; r > 0 && similarity >
+						references[r - 1].similarity;
+						r--)
+					references[r] = references[r - 1];
+				references[r].similarity = similarity;
+				references[r].a = i;
+				references[r].b = fb_index;
+			}
+		}
+	}
+
+	for (r = 0; r < REFERENCES && references[r].similarity; r++)
+		;
+
+	return r;
+}
+
+int fmr_match_compare(const struct fmr_match_template *a,
+		const struct fmr_match_template *b)
+{
+	struct fmr_match_reference references[REFERENCES];
+	struct fmr_match_buckets buckets;
+	uint8_t paired[FMR_MATCH_MINUTIAE_MAX];
+	uint8_t mates[FMR_MATCH_MINUTIAE_MAX];
+	int na = a->number_minutiae, nb = b->number_minutiae;
+	int number_references, r;
+	int best = 0;
+
+	if (na < 2 || nb < 2)
+		return 0;
+
+	number_references = fmr_match_references(a, b, references);
+	if (!number_references)
+		return 0;
+
+	fmr_match_buckets_init(&buckets, b);
+	memset(paired, 0, nb);
+	memset(mates, UINT8_MAX, na);
+	for (r = 0; r < number_references; r++) {
+		int number_paired;
+
+		/* Already paired, so it's the same alignment once again */
+		if (mates[references[r].a] == references[r].b)
+			continue;
+
+		number_paired = fmr_match_pair(a, b, &buckets, &references[r],
+				paired, r + 1, mates);
+
+		if (number_paired > best)
+			best = number_paired;
+	}
+
+	return best * best * FMR_MATCH_SCORE_MAX / (na * nb);
+}
+
+#ifdef __SSE2__
+
+/*
+ * Local structures of a template, quantized to bytes, in local structure
+ * order, and padded with ones matching nothing to a multiple of 16
+ */
+#define LOCAL_NONE UINT8_MAX
+#define LOCALS_MAX ((FMR_MATCH_MINUTIAE_MAX + 16) & ~15)
+
+struct fmr_match_locals {
+	uint8_t distance[NEIGHBOURS][LOCALS_MAX];
+	uint8_t direction[NEIGHBOURS][LOCALS_MAX];
+	uint8_t rotation[NEIGHBOURS][LOCALS_MAX];
+	/* Feature of every local structure */
+	uint8_t feature[LOCALS_MAX];
+	int number_locals;
+};
+
+/* Distances of 255 pixels and more, very rare, are all LOCAL_NONE - 1 */
+static inline uint8_t fmr_match_local_distance(uint16_t distance)
+{
+	if (distance == UINT16_MAX)
+		return LOCAL_NONE;
+
+	return distance < LOCAL_NONE - 1 ? distance : LOCAL_NONE - 1;
+}
+
+static void fmr_match_locals_init(struct fmr_match_locals *locals,
+		const struct fmr_match_template *template)
+{
+	int n = template->number_minutiae;
+	int i, k;
+
+	locals->number_locals = (n + 15) & ~15;
+	for (i = 0; i < n; i++) {
+		int f = template->features[i].local_order;
+		const struct fmr_match_feature *feature = &template->features[f];
+
+		for (k = 0; k < NEIGHBOURS; k++) {
+			locals->distance[k][i] = fmr_match_local_distance(
+					feature->distance[k]);
+			locals->direction[k][i] = feature->direction[k];
+			locals->rotation[k][i] = feature->rotation[k];
+		}
+		locals->feature[i] = f;
+	}
+	for (k = 0; k < NEIGHBOURS; k++)
+		memset(&locals->distance[k][n], LOCAL_NONE,
+				locals->number_locals - n);
+}
+
+static inline __m128i fmr_match_le_epu8(__m128i val, __m128i max)
+{
+	return _mm_cmpeq_epi8(_mm_min_epu8(val, max), val);
+}
+
+/*
+ * fmr_match_local() of @a with all of @locals, to @similarity, in bytes
+ * with saturation; the sum is 2 * (3 * 10 + 14 + 14 + 1) at most anyway.
+ * Bit i % 16 of @nonzero[i / 16] is set for every non-zero one.
+ */
+static void fmr_match_local_row(const struct fmr_match_feature *a,
+		const struct fmr_match_locals *locals, uint8_t *similarity,
+		uint16_t *nonzero)
+{
+	const __m128i local_distance = _mm_set1_epi8(LOCAL_DISTANCE);
+	const __m128i local_angle = _mm_set1_epi8(LOCAL_ANGLE);
+	const __m128i none = _mm_set1_epi8((char)LOCAL_NONE);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i zero = _mm_setzero_si128();
+	int i, k;
+
+	for (i = 0; i < locals->number_locals; i += 16) {
+		/* All neighbours so far matched, and the sum */
+		__m128i matched = _mm_cmpeq_epi8(one, one);
+		__m128i sum = zero;
+
+		for (k = 0; k < NEIGHBOURS &&
+				a->distance[k] != UINT16_MAX; k++) {
+			__m128i ad = _mm_set1_epi8(
+				fmr_match_local_distance(a->distance[k]));
+			__m128i bd = _mm_load_si128((const void *)
+					&locals->distance[k][i]);
+			__m128i distance = _mm_or_si128(_mm_subs_epu8(ad, bd),
+					_mm_subs_epu8(bd, ad));
+			__m128i direction = _mm_sub_epi8(
+					_mm_set1_epi8(a->direction[k]),
+					_mm_load_si128((const void *)
+					&locals->direction[k][i]));
+			__m128i rotation = _mm_sub_epi8(
+					_mm_set1_epi8(a->rotation[k]),
+					_mm_load_si128((const void *)
+					&locals->rotation[k][i]));
+			__m128i part;
+
+			/* Either way round, as fmr_match_angle_diff() */
+			direction = _mm_min_epu8(direction,
+					_mm_sub_epi8(zero, direction));
+			rotation = _mm_min_epu8(rotation,
+					_mm_sub_epi8(zero, rotation));
+
+			matched = _mm_and_si128(matched, _mm_andnot_si128(
+					_mm_cmpeq_epi8(bd, none), _mm_and_si128(
+					fmr_match_le_epu8(distance, local_distance),
+					_mm_and_si128(
+					fmr_match_le_epu8(direction, local_angle),
+					fmr_match_le_epu8(rotation, local_angle)))));
+
+			distance = _mm_subs_epu8(local_distance, distance);
+			part = _mm_adds_epu8(_mm_adds_epu8(distance, distance),
+					distance);
+			part = _mm_adds_epu8(part, _mm_subs_epu8(local_angle,
+					direction));
+			part = _mm_adds_epu8(part, _mm_subs_epu8(local_angle,
+					rotation));
+			part = _mm_adds_epu8(part, one);
+			sum = _mm_adds_epu8(sum, _mm_and_si128(matched, part));
+
+			/* The nearest neighbour must match, and mostly doesn't */
+			if (!_mm_movemask_epi8(matched))
+				break;
+		}
+
+		_mm_store_si128((void *)&similarity[i], sum);
+		nonzero[i / 16] = ~_mm_movemask_epi8(_mm_cmpeq_epi8(sum, zero));
+	}
+}
+
+static void fmr_match_reference_add(
+		struct fmr_match_reference references[REFERENCES],
+		int similarity, uint8_t a, uint8_t b)
+{
+	int r;
+
+	if (similarity <= references[REFERENCES - 1].similarity)
+		return;
+
+	for (r = REFERENCES - 1; r > 0 &&
+			similarity > references[r - 1].similarity; r--)
+		references[r] = references[r - 1];
+	references[r].similarity = similarity;
+	references[r].a = a;
+	references[r].b = b;
+}
+
+/*
+ * fmr_match_references(), with all of @b's local structures at once, 16
+ * of them in every vector, rather than only those in the buckets
+ */
+static int fmr_match_references_quantized(const struct fmr_match_template *a,
+		const struct fmr_match_template *b,
+		struct fmr_match_reference references[REFERENCES])
+{
+	struct fmr_match_locals locals __attribute__((aligned(16)));
+	uint8_t similarity[LOCALS_MAX] __attribute__((aligned(16)));
+	uint16_t nonzero[LOCALS_MAX / 16];
+	int i, r, w;
+
+	memset(references, 0, sizeof(*references) * REFERENCES);
+	fmr_match_locals_init(&locals, b);
+
+	for (i = 0; i < a->number_minutiae; i++) {
+		if (a->features[i].distance[0] == UINT16_MAX)
+			continue;
+
+		fmr_match_local_row(&a->features[i], &locals, similarity,
+				nonzero);
+
+		for (w = 0; w < locals.number_locals / 16; w++) {
+			unsigned int bits;
+
+			for (bits = nonzero[w]; bits; bits &= bits - 1) {
+				int j = w * 16 + __builtin_ctz(bits);
+
+				fmr_match_reference_add(references,
+						similarity[j], i,
+						locals.feature[j]);
+			}
+		}
+	}
+
+	for (r = 0; r < REFERENCES && references[r].similarity; r++)
+		;
+
+	return r;
+}
+
+/*
+ * Minutiae of a template, sorted by x, as int16 vectors, padded with
+ * 8 of them out of any range, for the last vector loaded to be valid
+ */
+#define POINTS_MAX (LOCALS_MAX + 8)
+
+struct fmr_match_points {
+	int16_t x[POINTS_MAX];
+	int16_t y[POINTS_MAX];
+	int16_t angle[POINTS_MAX];
+	/* Stamp of the alignment pairing them, as in fmr_match_pair() */
+	int16_t paired[POINTS_MAX];
+};
+
+static void fmr_match_points_init(struct fmr_match_points *points,
+		const struct fmr_match_template *template)
+{
+	int n = template->number_minutiae;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		points->x[i] = template->features[i].x;
+		points->y[i] = template->features[i].y;
+		points->angle[i] = template->features[i].angle;
+		points->paired[i] = 0;
+	}
+	for (; i < ((n + 7) & ~7) + 8; i++) {
+		points->x[i] = points->y[i] = INT16_MAX;
+		points->angle[i] = points->paired[i] = 0;
+	}
+}
+
+/*
+ * Rotated x, or y, of 8 minutiae, (@u * @cos + @v * @sin) >> 14 in int32,
+ * as in fmr_match_pair(), and saturated to int16
+ */
+static inline __m128i fmr_match_rotate(__m128i u, __m128i v, __m128i cos_sin)
+{
+	return _mm_packs_epi32(
+			_mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(u, v),
+			cos_sin), 14),
+			_mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(u, v),
+			cos_sin), 14));
+}
+
+/*
+ * fmr_match_pair(), with @a's minutiae rotated 8 at a time, and compared
+ * with 8 of @b's at a time, all in int16 with saturation
+ */
+static int fmr_match_pair_quantized(const struct fmr_match_points *a,
+		int na, struct fmr_match_points *b, int nb,
+		const struct fmr_match_buckets *buckets,
+		const struct fmr_match_reference *reference,
+		int16_t stamp, uint8_t *mates)
+{
+	int16_t x[POINTS_MAX], y[POINTS_MAX];
+	int16_t dist[8] __attribute__((aligned(16)));
+	uint8_t rotation = b->angle[reference->b] - a->angle[reference->a];
+	int cos = fmr_match_cos[rotation], sin = fmr_match_sin(rotation);
+	/* Pairs of x and y, or y and -x, times cos and sin */
+	const __m128i cos_sin = _mm_set1_epi32((uint16_t)cos |
+			(uint32_t)(uint16_t)sin << 16);
+	const __m128i a0x = _mm_set1_epi16(a->x[reference->a]);
+	const __m128i a0y = _mm_set1_epi16(a->y[reference->a]);
+	const __m128i b0x = _mm_set1_epi16(b->x[reference->b]);
+	const __m128i b0y = _mm_set1_epi16(b->y[reference->b]);
+	const __m128i low = _mm_set1_epi16(-PAIR_DISTANCE - 1);
+	const __m128i high = _mm_set1_epi16(PAIR_DISTANCE + 1);
+	const __m128i angle_max = _mm_set1_epi16(PAIR_ANGLE + 1);
+	const __m128i stamps = _mm_set1_epi16(stamp);
+	const __m128i angles = _mm_set1_epi16(255);
+	int number_paired = 0;
+	int i, j, lane;
+
+	for (i = 0; i < na; i += 8) {
+		__m128i rx = _mm_subs_epi16(_mm_loadu_si128((const void *)
+				&a->x[i]), a0x);
+		__m128i ry = _mm_subs_epi16(_mm_loadu_si128((const void *)
+				&a->y[i]), a0y);
+
+		_mm_storeu_si128((void *)&x[i], _mm_adds_epi16(
+				fmr_match_rotate(rx, ry, cos_sin), b0x));
+		_mm_storeu_si128((void *)&y[i], _mm_adds_epi16(
+				fmr_match_rotate(ry, _mm_subs_epi16(
+				_mm_setzero_si128(), rx), cos_sin), b0y));
+	}
+
+	for (i = 0; i < na; i++) {
+		const __m128i xi = _mm_set1_epi16(x[i]);
+		const __m128i yi = _mm_set1_epi16(y[i]);
+		const __m128i angle = _mm_set1_epi16((a->angle[i] + rotation) &
+				255);
+		int best = -1, best_dist = PAIR_DISTANCE * PAIR_DISTANCE + 1;
+		int bucket = (x[i] - PAIR_DISTANCE) >> BUCKET_SHIFT;
+
+		if (bucket >= buckets->number_buckets)
+			continue;
+
+		for (j = bucket > 0 ? buckets->first[bucket] : 0;
+				j < nb && b->x[j] <= x[i] + PAIR_DISTANCE;
+				j += 8) {
+			__m128i dx = _mm_subs_epi16(_mm_loadu_si128(
+					(const void *)&b->x[j]), xi);
+			__m128i dy = _mm_subs_epi16(_mm_loadu_si128(
+					(const void *)&b->y[j]), yi);
+			__m128i da = _mm_and_si128(_mm_sub_epi16(
+					_mm_loadu_si128((const void *)
+					&b->angle[j]), angle), angles);
+			__m128i near;
+			int mask;
+
+			/* Angle difference either way round */
+			da = _mm_min_epi16(da, _mm_sub_epi16(_mm_set1_epi16(256),
+					da));
+
+			near = _mm_and_si128(_mm_and_si128(
+					_mm_cmpgt_epi16(dx, low),
+					_mm_cmpgt_epi16(high, dx)),
+					_mm_and_si128(_mm_cmpgt_epi16(dy, low),
+					_mm_cmpgt_epi16(high, dy)));
+			near = _mm_and_si128(near,
+					_mm_cmpgt_epi16(angle_max, da));
+			near = _mm_andnot_si128(_mm_cmpeq_epi16(
+					_mm_loadu_si128((const void *)
+					&b->paired[j]), stamps), near);
+
+			mask = _mm_movemask_epi8(near) & 0x5555;
+			if (!mask)
+				continue;
+
+			/* Near ones are 16 apart at most, that's 512 at most */
+			_mm_store_si128((void *)dist, _mm_add_epi16(
+					_mm_mullo_epi16(dx, dx),
+					_mm_mullo_epi16(dy, dy)));
+			for (; mask; mask &= mask - 1) {
+				lane = __builtin_ctz(mask) / 2;
+				if (j + lane < nb && dist[lane] < best_dist) {
+					best = j + lane;
+					best_dist = dist[lane];
+				}
+			}
+		}
+
+		if (best >= 0) {
+			b->paired[best] = stamp;
+			mates[i] = best;
+			number_paired++;
+		}
+	}
+
+	return number_paired;
+}
+
+int fmr_match_compare_quantized(const struct fmr_match_template *a,
+		const struct fmr_match_template *b)
+{
+	struct fmr_match_reference references[REFERENCES];
+	struct fmr_match_points points_a, points_b;
+	struct fmr_match_buckets buckets;
+	uint8_t mates[FMR_MATCH_MINUTIAE_MAX];
+	int na = a->number_minutiae, nb = b->number_minutiae;
+	int number_references, r;
+	int best = 0;
+
+	if (na < 2 || nb < 2)
+		return 0;
+
+	number_references = fmr_match_references_quantized(a, b, references);
+	if (!number_references)
+		return 0;
+
+	fmr_match_points_init(&points_a, a);
+	fmr_match_points_init(&points_b, b);
+	fmr_match_buckets_init(&buckets, b);
+	memset(mates, UINT8_MAX, na);
+	for (r = 0; r < number_references; r++) {
+		int number_paired;
+
+		if (mates[references[r].a] == references[r].b)
+			continue;
+
+		number_paired = fmr_match_pair_quantized(&points_a, na,
+				&points_b, nb, &buckets, &references[r],
+				r + 1, mates);
+
+		if (number_paired > best)
+			best = number_paired;
+	}
+
+	return best * best * FMR_MATCH_SCORE_MAX / (na * nb);
+}
+
+#else
+
+/* No vectors to speak of, the reference is the fastest then */
+int fmr_match_compare_quantized(const struct fmr_match_template *a,
+		const struct fmr_match_template *b)
+{
+	return fmr_match_compare(a, b);
+}
+
+#endif
+
+/* Big enough for any template, and aligned */
+#define TEMPLATE_WORDS ((sizeof(struct fmr_match_template) + \
+		sizeof(struct fmr_match_feature) * FMR_MATCH_MINUTIAE_MAX + \
+		sizeof(uint64_t) - 1) / sizeof(uint64_t))
+
+static int fmr_match_same_finger(uint8_t a, uint8_t b)
+{
+	return !a || !b || a == b;
+}
+
+int fmr_match_v20(const struct iso_fmr_v20 *a, const struct iso_fmr_v20 *b)
+{
+	struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+	uint64_t buffer_a[TEMPLATE_WORDS], buffer_b[TEMPLATE_WORDS];
+	int best = -1;
+	int va, vb;
+
+	for (va = 0; va < a->number_views; va++) {
+		struct fmr_match_template *ta = NULL;
+
+		for (vb = 0; vb < b->number_views; vb++) {
+			struct fmr_match_template *tb;
+			int score;
+
+			if (!fmr_match_same_finger(
+					a->views[va].finger_position,
+					b->views[vb].finger_position))
+				continue;
+
+			if (!ta)
+				ta = fmr_match_template_init(buffer_a,
+						minutiae,
+						fmr_match_minutiae_from_v20(a,
+						va, minutiae));
+			tb = fmr_match_template_init(buffer_b, minutiae,
+					fmr_match_minutiae_from_v20(b, vb,
+					minutiae));
+
+			score = fmr_match_compare(ta, tb);
+			if (score > best)
+				best = score;
+		}
+	}
+
+	return best;
+}
+
+int fmr_match_v030(const struct iso_fmr_v030 *a, const struct iso_fmr_v030 *b)
+{
+	struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+	uint64_t buffer_a[TEMPLATE_WORDS], buffer_b[TEMPLATE_WORDS];
+	int best = -1;
+	int ra, rb;
+
+	for (ra = 0; ra < a->number_representations; ra++) {
+		struct fmr_match_template *ta = NULL;
+
+		for (rb = 0; rb < b->number_representations; rb++) {
+			struct fmr_match_template *tb;
+			int score;
+
+			if (!fmr_match_same_finger(
+					a->representations[ra].finger_position,
+					b->representations[rb].finger_position))
+				continue;
+
+			if (!ta)
+				ta = fmr_match_template_init(buffer_a,
+						minutiae,
+						fmr_match_minutiae_from_v030(a,
+						ra, minutiae));
+			tb = fmr_match_template_init(buffer_b, minutiae,
+					fmr_match_minutiae_from_v030(b, rb,
+					minutiae));
+
+			score = fmr_match_compare(ta, tb);
+			if (score > best)
+				best = score;
+		}
+	}
+
+	return best;
+}
@@ -0,0 +1,9 @@
+TEMPLATE = lib
+CONFIG = staticlib
+
+TARGET = matcher
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += ids.c index.c live.c match.c mcc.c minutiae.c pairs.c search.c
+HEADERS += ids.h index.h live.h match.h mcc.h minutiae.h pairs.h search.h trig.h
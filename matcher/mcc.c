@@ -0,0 +1,468 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86
+#endif
+
+#include "iso_fmr/be.h"
+#include "match.h"
+#include "mcc.h"
+#include "trig.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*a))
+
+/* Cylinder radius and cells, in pixels */
+#define RADIUS 64
+#define CELLS 8
+#define CELL_SIZE (2 * RADIUS / CELLS)
+/* Cells closer than that to a neighbour are set */
+#define SIGMA 12
+/* Sections of relative direction, 32 angle units each */
+#define SECTION_SHIFT 5
+/* Neighbours that close to a section's border are in the next one too */
+#define SECTION_MARGIN 8
+#define NEIGHBOURS_MIN 2
+/* Number of best local similarities making the template similarity */
+#define LOCAL_MIN 4
+#define LOCAL_MAX 12
+
+#define HEADER_SIZE 12
+
+/* Every descriptor is a word per section, a bit per cell in it */
+struct fmr_mcc_descriptor {
+	uint64_t bits[FMR_MCC_WORDS];
+};
+
+struct fmr_mcc {
+	uint16_t number_descriptors;
+	uint8_t reserved[FMR_MINUTIAE_ALIGN - 2];
+	/* Followed by the descriptors, then their popcounts */
+};
+
+static inline struct fmr_mcc_descriptor *fmr_mcc_descriptors(
+		const struct fmr_mcc *mcc)
+{
+	return (struct fmr_mcc_descriptor *)(mcc + 1);
+}
+
+static inline uint16_t *fmr_mcc_popcounts(const struct fmr_mcc *mcc)
+{
+	return (uint16_t *)(fmr_mcc_descriptors(mcc) +
+			mcc->number_descriptors);
+}
+
+size_t fmr_mcc_size(int number_minutiae)
+{
+	size_t popcounts = sizeof(uint16_t) * number_minutiae;
+
+	return sizeof(struct fmr_mcc) +
+			sizeof(struct fmr_mcc_descriptor) * number_minutiae +
+			((popcounts + FMR_MINUTIAE_ALIGN - 1) &
+			~(size_t)(FMR_MINUTIAE_ALIGN - 1));
+}
+
+/*
+ * FMR_MCC_SCORE_MAX / n, in Q16, for the local similarities, as |a ^ b|
+ * is never more than |a| + |b|, it's never more than the maximum score in
+ * Q16, and fits in 32 bits. Filled in whole, once, before any descriptors
+ * are set up or decoded, so no comparison can see it partly filled.
+ */
+static uint32_t fmr_mcc_reciprocal[2 * FMR_MCC_BITS + 1];
+static pthread_once_t fmr_mcc_reciprocal_once = PTHREAD_ONCE_INIT;
+
+static void fmr_mcc_reciprocal_fill(void)
+{
+	int n;
+
+	for (n = 1; n < ARRAY_SIZE(fmr_mcc_reciprocal); n++)
+		fmr_mcc_reciprocal[n] = (FMR_MCC_SCORE_MAX << 16) / n;
+}
+
+static void fmr_mcc_reciprocal_init(void)
+{
+	pthread_once(&fmr_mcc_reciprocal_once, fmr_mcc_reciprocal_fill);
+}
+
+static uint16_t fmr_mcc_popcount(const struct fmr_mcc_descriptor *descriptor)
+{
+	int w, popcount = 0;
+
+	for (w = 0; w < FMR_MCC_WORDS; w++)
+		popcount += __builtin_popcountll(descriptor->bits[w]);
+
+	return popcount;
+}
+
+/* Cells with the centre within @SIGMA of u, v, in the cylinder only */
+static uint64_t fmr_mcc_cells(int u, int v)
+{
+	uint64_t cells = 0;
+	int i, j;
+
+	for (i = 0; i < CELLS; i++) {
+		int cu = i * CELL_SIZE + CELL_SIZE / 2;
+
+		if (abs(cu - u) > SIGMA)
+			continue;
+
+		for (j = 0; j < CELLS; j++) {
+			int cv = j * CELL_SIZE + CELL_SIZE / 2;
+
+			if ((cu - u) * (cu - u) + (cv - v) * (cv - v) >
+					SIGMA * SIGMA)
+				continue;
+			if ((cu - RADIUS) * (cu - RADIUS) +
+					(cv - RADIUS) * (cv - RADIUS) >
+					RADIUS * RADIUS)
+				continue;
+
+			cells |= 1ull << (i * CELLS + j);
+		}
+	}
+
+	return cells;
+}
+
+struct fmr_mcc *fmr_mcc_init(void *buffer,
+		const struct fmr_minutiae *minutiae)
+{
+	const int16_t *x = fmr_minutiae_x(minutiae);
+	const int16_t *y = fmr_minutiae_y(minutiae);
+	const uint8_t *angle = fmr_minutiae_angle(minutiae);
+	struct fmr_mcc *mcc = buffer;
+	struct fmr_mcc_descriptor *descriptors = fmr_mcc_descriptors(mcc);
+	uint16_t popcounts[FMR_MATCH_MINUTIAE_MAX];
+	int m, t, n = 0;
+
+	fmr_mcc_reciprocal_init();
+	memset(mcc, 0, sizeof(*mcc));
+
+	for (m = 0; m < minutiae->number_minutiae; m++) {
+		struct fmr_mcc_descriptor *descriptor = &descriptors[n];
+		int cos = fmr_match_cos[angle[m]], sin = fmr_match_sin(angle[m]);
+		int neighbours = 0;
+
+		memset(descriptor, 0, sizeof(*descriptor));
+
+		for (t = 0; t < minutiae->number_minutiae; t++) {
+			int dx = x[t] - x[m], dy = y[t] - y[m];
+			uint8_t direction = angle[t] - angle[m];
+			int section = direction >> SECTION_SHIFT;
+			int offset = direction & ((1 << SECTION_SHIFT) - 1);
+			uint64_t cells;
+			int u, v;
+
+			if (t == m || dx * dx + dy * dy >
+					(RADIUS + SIGMA) * (RADIUS + SIGMA))
+				continue;
+
+			/* Rotated, so that the minutia points along u */
+			u = ((dx * cos - dy * sin) >> 14) + RADIUS;
+			v = ((dx * sin + dy * cos) >> 14) + RADIUS;
+			cells = fmr_mcc_cells(u, v);
+			if (!cells)
+				continue;
+
+			descriptor->bits[section] |= cells;
+			if (offset < SECTION_MARGIN)
+				descriptor->bits[(section - 1) &
+						(FMR_MCC_WORDS - 1)] |= cells;
+			else if (offset >= (1 << SECTION_SHIFT) - SECTION_MARGIN)
+				descriptor->bits[(section + 1) &
+						(FMR_MCC_WORDS - 1)] |= cells;
+			neighbours++;
+		}
+
+		if (neighbours >= NEIGHBOURS_MIN)
+			popcounts[n++] = fmr_mcc_popcount(descriptor);
+	}
+
+	mcc->number_descriptors = n;
+	memcpy(fmr_mcc_popcounts(mcc), popcounts, sizeof(*popcounts) * n);
+
+	return mcc;
+}
+
+int fmr_mcc_get_number_descriptors(const struct fmr_mcc *mcc)
+{
+	return mcc->number_descriptors;
+}
+
+/* Popcount of @a XOR every one of @b */
+
+static void fmr_mcc_scalar_row(const struct fmr_mcc_descriptor *a,
+		const struct fmr_mcc_descriptor *b, int nb, uint16_t *xors)
+{
+	int j, w;
+
+	for (j = 0; j < nb; j++) {
+		int popcount = 0;
+
+		for (w = 0; w < FMR_MCC_WORDS; w++)
+			popcount += __builtin_popcountll(a->bits[w] ^
+					b[j].bits[w]);
+		xors[j] = popcount;
+	}
+}
+
+#ifdef X86
+
+/* Same as the scalar one, only with the instruction in place of a call */
+__attribute__((target("popcnt")))
+static void fmr_mcc_popcnt_row(const struct fmr_mcc_descriptor *a,
+		const struct fmr_mcc_descriptor *b, int nb, uint16_t *xors)
+{
+	int j, w;
+
+	for (j = 0; j < nb; j++) {
+		int popcount = 0;
+
+		for (w = 0; w < FMR_MCC_WORDS; w++)
+			popcount += __builtin_popcountll(a->bits[w] ^
+					b[j].bits[w]);
+		xors[j] = popcount;
+	}
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void fmr_mcc_avx512_row(const struct fmr_mcc_descriptor *a,
+		const struct fmr_mcc_descriptor *b, int nb, uint16_t *xors)
+{
+	const __m512i va = _mm512_load_si512(a->bits);
+	__m512i p[8], s[4];
+	int j, k;
+
+	/* Eight at once, added up across the vectors, not within each one */
+	for (j = 0; j + 8 <= nb; j += 8) {
+		for (k = 0; k < 8; k++)
+			p[k] = _mm512_popcnt_epi64(_mm512_xor_si512(va,
+					_mm512_load_si512(b[j + k].bits)));
+		for (k = 0; k < 4; k++)
+			s[k] = _mm512_add_epi64(
+					_mm512_unpacklo_epi64(p[2 * k],
+					p[2 * k + 1]),
+					_mm512_unpackhi_epi64(p[2 * k],
+					p[2 * k + 1]));
+		for (k = 0; k < 2; k++)
+			s[k] = _mm512_add_epi64(
+					_mm512_shuffle_i64x2(s[2 * k],
+					s[2 * k + 1], 0x88),
+					_mm512_shuffle_i64x2(s[2 * k],
+					s[2 * k + 1], 0xdd));
+		s[0] = _mm512_add_epi64(
+				_mm512_shuffle_i64x2(s[0], s[1], 0x88),
+				_mm512_shuffle_i64x2(s[0], s[1], 0xdd));
+		_mm_storeu_si128((void *)(xors + j),
+				_mm512_cvtepi64_epi16(s[0]));
+	}
+
+	for (; j < nb; j++)
+		xors[j] = _mm512_reduce_add_epi64(_mm512_popcnt_epi64(
+				_mm512_xor_si512(va,
+				_mm512_load_si512(b[j].bits))));
+}
+
+#endif
+
+static const struct {
+	const char *name;
+	void (*row)(const struct fmr_mcc_descriptor *a,
+			const struct fmr_mcc_descriptor *b, int nb,
+			uint16_t *xors);
+} fmr_mcc_variants[] = {
+	[fmr_mcc_scalar] = { "scalar", fmr_mcc_scalar_row },
+#ifdef X86
+	[fmr_mcc_popcnt] = { "popcnt", fmr_mcc_popcnt_row },
+	[fmr_mcc_avx512] = { "avx512", fmr_mcc_avx512_row },
+#else
+	[fmr_mcc_popcnt] = { "popcnt" },
+	[fmr_mcc_avx512] = { "avx512" },
+#endif
+};
+
+int fmr_mcc_variant_supported(enum fmr_mcc_variant variant)
+{
+	if (variant >= ARRAY_SIZE(fmr_mcc_variants) ||
+			!fmr_mcc_variants[variant].row)
+		return 0;
+
+#ifdef X86
+	/* The builtin needs a literal */
+	switch (variant) {
+	case fmr_mcc_popcnt:
+		return __builtin_cpu_supports("popcnt");
+	case fmr_mcc_avx512:
+		return __builtin_cpu_supports("avx512f") &&
+				__builtin_cpu_supports("avx512vpopcntdq");
+	default:
+		break;
+	}
+#endif
+
+	return variant == fmr_mcc_scalar;
+}
+
+enum fmr_mcc_variant fmr_mcc_get_best_variant(void)
+{
+	/* Found by the first callers, atomic as they may be concurrent */
+	static int best = -1;
+	int variant = __atomic_load_n(&best, __ATOMIC_RELAXED);
+
+	if (variant < 0) {
+		for (variant = __fmr_mcc_variants - 1; variant > 0; variant--)
+			if (fmr_mcc_variant_supported(variant))
+				break;
+		__atomic_store_n(&best, variant, __ATOMIC_RELAXED);
+	}
+
+	return variant;
+}
+
+const char *fmr_mcc_get_variant_string(enum fmr_mcc_variant variant)
+{
+	if (variant >= ARRAY_SIZE(fmr_mcc_variants))
+		return "unknown";
+
+	return fmr_mcc_variants[variant].name;
+}
+
+/* With @variant known to be supported */
+static int fmr_mcc_compare_supported(enum fmr_mcc_variant variant,
+		const struct fmr_mcc *a, const struct fmr_mcc *b)
+{
+	const struct fmr_mcc_descriptor *da = fmr_mcc_descriptors(a);
+	const struct fmr_mcc_descriptor *db = fmr_mcc_descriptors(b);
+	const uint16_t *pa = fmr_mcc_popcounts(a), *pb = fmr_mcc_popcounts(b);
+	int na = a->number_descriptors, nb = b->number_descriptors;
+	uint16_t xors[FMR_MATCH_MINUTIAE_MAX];
+	uint32_t best[LOCAL_MAX];
+	int number_best, number_local, sum = 0;
+	int i, j, k;
+
+	if (!na || !nb)
+		return 0;
+
+	number_local = LOCAL_MIN + (na < nb ? na : nb) / 6;
+	if (number_local > LOCAL_MAX)
+		number_local = LOCAL_MAX;
+	number_best = 0;
+
+	for (i = 0; i < na; i++) {
+		uint32_t similarity = 0;
+
+		/* 1 - |a ^ b| / (|a| + |b|), the best one */
+		fmr_mcc_variants[variant].row(&da[i], db, nb, xors);
+		for (j = 0; j < nb; j++) {
+			uint32_t total = pa[i] + pb[j];
+			uint32_t local = ((total - xors[j]) *
+					fmr_mcc_reciprocal[total]) >> 16;
+
+			if (local > similarity)
+				similarity = local;
+		}
+
+		/* The best local similarities, in descending order */
+		if (number_best == number_local &&
+				similarity <= best[number_best - 1])
+			continue;
+		if (number_best < number_local)
+			number_best++;
+		for (k = number_best - 1; k > 0 && similarity > best[k - 1];
+				k--)
+			best[k] = best[k - 1];
+		best[k] = similarity;
+	}
+
+	for (k = 0; k < number_best; k++)
+		sum += best[k];
+
+	/* Too few descriptors count as zeroes */
+	return sum / number_local;
+}
+
+int fmr_mcc_compare_variant(enum fmr_mcc_variant variant,
+		const struct fmr_mcc *a, const struct fmr_mcc *b)
+{
+	if (!fmr_mcc_variant_supported(variant))
+		return -1;
+
+	return fmr_mcc_compare_supported(variant, a, b);
+}
+
+int fmr_mcc_compare(const struct fmr_mcc *a, const struct fmr_mcc *b)
+{
+	return fmr_mcc_compare_supported(fmr_mcc_get_best_variant(), a, b);
+}
+
+size_t fmr_mcc_encode(const struct fmr_mcc *mcc, void *buffer, size_t size)
+{
+	const struct fmr_mcc_descriptor *descriptors = fmr_mcc_descriptors(mcc);
+	size_t len = HEADER_SIZE + (size_t)mcc->number_descriptors *
+			FMR_MCC_WORDS * 8;
+	uint8_t *buf = buffer;
+	int i, w;
+
+	if (size < len)
+		return len;
+
+	iso_fmr_put_be32(buf, FMR_MCC_FORMAT_ID);
+	iso_fmr_put_be32(buf + 4, FMR_MCC_VERSION);
+	iso_fmr_put_be16(buf + 8, mcc->number_descriptors);
+	iso_fmr_put_be16(buf + 10, FMR_MCC_BITS);
+	buf += HEADER_SIZE;
+
+	for (i = 0; i < mcc->number_descriptors; i++)
+		for (w = 0; w < FMR_MCC_WORDS; w++, buf += 8)
+			iso_fmr_put_be64(buf, descriptors[i].bits[w]);
+
+	return len;
+}
+
+size_t fmr_mcc_decode_size(const void *data, size_t len)
+{
+	const uint8_t *buf = data;
+	uint16_t n;
+
+	if (len < HEADER_SIZE ||
+			iso_fmr_get_be32(buf) != FMR_MCC_FORMAT_ID ||
+			iso_fmr_get_be32(buf + 4) != FMR_MCC_VERSION ||
+			iso_fmr_get_be16(buf + 10) != FMR_MCC_BITS)
+		return 0;
+
+	n = iso_fmr_get_be16(buf + 8);
+	if (n > FMR_MATCH_MINUTIAE_MAX ||
+			len != HEADER_SIZE + (size_t)n * FMR_MCC_WORDS * 8)
+		return 0;
+
+	return fmr_mcc_size(n);
+}
+
+struct fmr_mcc *fmr_mcc_decode(void *buffer, const void *data, size_t len)
+{
+	const uint8_t *buf = data;
+	struct fmr_mcc *mcc = buffer;
+	struct fmr_mcc_descriptor *descriptors;
+	uint16_t *popcounts;
+	int i, w;
+
+	if (!fmr_mcc_decode_size(data, len))
+		return NULL;
+
+	fmr_mcc_reciprocal_init();
+	memset(mcc, 0, sizeof(*mcc));
+	mcc->number_descriptors = iso_fmr_get_be16(buf + 8);
+	descriptors = fmr_mcc_descriptors(mcc);
+	popcounts = fmr_mcc_popcounts(mcc);
+	buf += HEADER_SIZE;
+
+	for (i = 0; i < mcc->number_descriptors; i++) {
+		for (w = 0; w < FMR_MCC_WORDS; w++, buf += 8)
+			descriptors[i].bits[w] = iso_fmr_get_be64(buf);
+		popcounts[i] = fmr_mcc_popcount(&descriptors[i]);
+	}
+
+	return mcc;
+}
@@ -0,0 +1,89 @@
+#ifndef __FMR_MCC_H
+#define __FMR_MCC_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "minutiae.h"
+
+/*
+ * Minutia Cylinder-Code, binary: every minutia is described by the
+ * minutiae around it, within a cylinder of 64 pixels radius, aligned with
+ * the minutia's direction. It's 8 x 8 spatial cells of 16 pixels times
+ * 8 sections of the relative direction, 45 degrees each, a bit set for
+ * every cell and section with a neighbour in (or near) it. Minutiae with
+ * less than two neighbours have no descriptor.
+ *
+ * Descriptors of two templates are compared with XOR and popcount, and
+ * the template similarity is the mean of the best local similarities.
+ * That's cheap, and independent of any alignment, so it's meant for
+ * prefiltering the gallery before the real matching.
+ */
+
+#define FMR_MCC_BITS 512
+#define FMR_MCC_WORDS (FMR_MCC_BITS / 64)
+#define FMR_MCC_SCORE_MAX 10000
+
+/* Descriptors of one template, a flat block, FMR_MINUTIAE_ALIGN aligned */
+struct fmr_mcc;
+
+size_t fmr_mcc_size(int number_minutiae);
+/* Extracts the descriptors of @minutiae into @buffer */
+struct fmr_mcc *fmr_mcc_init(void *buffer,
+		const struct fmr_minutiae *minutiae);
+int fmr_mcc_get_number_descriptors(const struct fmr_mcc *mcc);
+
+/* Similarity, from 0 to FMR_MCC_SCORE_MAX */
+int fmr_mcc_compare(const struct fmr_mcc *a, const struct fmr_mcc *b);
+
+/*
+ * XOR and popcount is done by scalar code, the POPCNT instruction or
+ * AVX-512 VPOPCNTDQ, the best one the CPU supports is used by
+ * fmr_mcc_compare(), as found by cpuid once.
+ */
+enum fmr_mcc_variant {
+	fmr_mcc_scalar,
+	fmr_mcc_popcnt,
+	fmr_mcc_avx512,
+	__fmr_mcc_variants,
+};
+
+/* Returns -1 when the CPU doesn't support @variant */
+int fmr_mcc_compare_variant(enum fmr_mcc_variant variant,
+		const struct fmr_mcc *a, const struct fmr_mcc *b);
+int fmr_mcc_variant_supported(enum fmr_mcc_variant variant);
+enum fmr_mcc_variant fmr_mcc_get_best_variant(void);
+const char *fmr_mcc_get_variant_string(enum fmr_mcc_variant variant);
+
+/*
+ * Serialized descriptors, to be stored with the record, so that they're
+ * extracted once, on enrollment. All fields are big-endian:
+ *
+ *	format id (0x4d434344, "MCCD")	4 bytes
+ *	version (1)			4 bytes
+ *	number of descriptors		2 bytes
+ *	bits per descriptor (512)	2 bytes
+ *	descriptors, FMR_MCC_WORDS 8 bytes words each
+ *
+ * fmr_mcc_encode() fills up to @size bytes of @buffer, returns the size
+ * of the whole data. fmr_mcc_decode_size() returns the size of the block
+ * the data decodes to, 0 if the data is invalid, and fmr_mcc_decode()
+ * decodes it into @buffer, FMR_MINUTIAE_ALIGN aligned.
+ */
+#define FMR_MCC_FORMAT_ID 0x4d434344
+#define FMR_MCC_VERSION 1
+
+size_t fmr_mcc_encode(const struct fmr_mcc *mcc, void *buffer, size_t size);
+size_t fmr_mcc_decode_size(const void *data, size_t len);
+struct fmr_mcc *fmr_mcc_decode(void *buffer, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
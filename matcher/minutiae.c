@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+#include "minutiae.h"
+
+/* Resolution all the minutiae are scaled to, in pixels per cm */
+#define RESOLUTION 197
+
+static int fmr_minutiae_capacity(int number_minutiae)
+{
+	return (number_minutiae + FMR_MINUTIAE_ALIGN - 1) &
+			~(FMR_MINUTIAE_ALIGN - 1);
+}
+
+size_t fmr_minutiae_size(int number_minutiae)
+{
+	/* Two bytes for x and y, one for the rest */
+	return sizeof(struct fmr_minutiae) +
+			fmr_minutiae_capacity(number_minutiae) * (2 + 2 + 1 + 1 + 1);
+}
+
+struct fmr_minutiae *fmr_minutiae_init(void *buffer, int number_minutiae)
+{
+	struct fmr_minutiae *minutiae = buffer;
+	int16_t *x, *y;
+	int i;
+
+	if (number_minutiae < 0 || number_minutiae > FMR_MATCH_MINUTIAE_MAX)
+		return NULL;
+
+	memset(minutiae, 0, sizeof(*minutiae));
+	minutiae->number_minutiae = number_minutiae;
+	minutiae->capacity = fmr_minutiae_capacity(number_minutiae);
+
+	x = fmr_minutiae_x(minutiae);
+	y = fmr_minutiae_y(minutiae);
+	for (i = 0; i < minutiae->capacity; i++)
+		x[i] = y[i] = FMR_MINUTIAE_PADDING;
+	memset(fmr_minutiae_angle(minutiae), 0, minutiae->capacity * 3);
+
+	return minutiae;
+}
+
+static int16_t fmr_minutiae_scale(uint16_t val, uint16_t resolution)
+{
+	uint32_t scaled = val;
+
+	/* Kept in 14 bits, as in the records, whatever the record says */
+	if (resolution && resolution != RESOLUTION)
+		scaled = scaled * RESOLUTION / resolution;
+
+	return scaled < FMR_MINUTIAE_COORDINATE_MAX ?
+			scaled : FMR_MINUTIAE_COORDINATE_MAX;
+}
+
+struct fmr_minutiae *fmr_minutiae_from_v20(void *buffer,
+		const struct iso_fmr_v20 *record, int v)
+{
+	const struct iso_fmr_v20_view *view;
+	struct fmr_minutiae *minutiae;
+	int16_t *x, *y;
+	uint8_t *angle, *type, *quality;
+	int m;
+
+	if (v < 0 || v >= record->number_views)
+		return NULL;
+	view = &record->views[v];
+
+	minutiae = fmr_minutiae_init(buffer, view->number_minutiae);
+	x = fmr_minutiae_x(minutiae);
+	y = fmr_minutiae_y(minutiae);
+	angle = fmr_minutiae_angle(minutiae);
+	type = fmr_minutiae_type(minutiae);
+	quality = fmr_minutiae_quality(minutiae);
+
+	for (m = 0; m < view->number_minutiae; m++) {
+		x[m] = fmr_minutiae_scale(view->minutiae[m].x,
+				record->resolution_x);
+		y[m] = fmr_minutiae_scale(view->minutiae[m].y,
+				record->resolution_y);
+		angle[m] = view->minutiae[m].angle;
+		type[m] = view->minutiae[m].type;
+		quality[m] = view->minutiae[m].quality;
+	}
+
+	return minutiae;
+}
+
+struct fmr_minutiae *fmr_minutiae_from_v030(void *buffer,
+		const struct iso_fmr_v030 *record, int r)
+{
+	const struct iso_fmr_v030_representation *repr;
+	struct fmr_minutiae *minutiae;
+	int16_t *x, *y;
+	uint8_t *angle, *type, *quality;
+	int m;
+
+	if (r < 0 || r >= record->number_representations)
+		return NULL;
+	repr = &record->representations[r];
+
+	minutiae = fmr_minutiae_init(buffer, repr->number_minutiae);
+	x = fmr_minutiae_x(minutiae);
+	y = fmr_minutiae_y(minutiae);
+	angle = fmr_minutiae_angle(minutiae);
+	type = fmr_minutiae_type(minutiae);
+	quality = fmr_minutiae_quality(minutiae);
+
+	for (m = 0; m < repr->number_minutiae; m++) {
+		x[m] = fmr_minutiae_scale(repr->minutiae[m].x,
+				repr->sampling_rate_x);
+		y[m] = fmr_minutiae_scale(repr->minutiae[m].y,
+				repr->sampling_rate_y);
+		angle[m] = repr->minutiae[m].angle;
+		type[m] = repr->minutiae[m].type;
+		/* Not in the record at all for 5 bytes long minutiae */
+		quality[m] = repr->minutia_field_length == 6 ?
+				repr->minutiae[m].quality : 0;
+	}
+
+	return minutiae;
+}
+
+struct fmr_minutiae *fmr_minutiae_from_array(void *buffer,
+		const struct fmr_match_minutia *minutiae, int number_minutiae)
+{
+	struct fmr_minutiae *soa;
+	int16_t *x, *y;
+	uint8_t *angle, *type;
+	int m;
+
+	soa = fmr_minutiae_init(buffer, number_minutiae);
+	if (!soa)
+		return NULL;
+	x = fmr_minutiae_x(soa);
+	y = fmr_minutiae_y(soa);
+	angle = fmr_minutiae_angle(soa);
+	type = fmr_minutiae_type(soa);
+
+	for (m = 0; m < number_minutiae; m++) {
+		x[m] = minutiae[m].x < FMR_MINUTIAE_COORDINATE_MAX ?
+				minutiae[m].x : FMR_MINUTIAE_COORDINATE_MAX;
+		y[m] = minutiae[m].y < FMR_MINUTIAE_COORDINATE_MAX ?
+				minutiae[m].y : FMR_MINUTIAE_COORDINATE_MAX;
+		angle[m] = minutiae[m].angle;
+		type[m] = minutiae[m].type;
+	}
+
+	return soa;
+}
+
+struct fmr_minutiae *fmr_minutiae_create_v20(const struct iso_fmr_v20 *record,
+		int v)
+{
+	struct fmr_minutiae *minutiae;
+	void *buffer;
+
+	if (v < 0 || v >= record->number_views)
+		return NULL;
+
+	buffer = aligned_alloc(FMR_MINUTIAE_ALIGN,
+			fmr_minutiae_size(record->views[v].number_minutiae));
+	if (!buffer)
+		return NULL;
+
+	minutiae = fmr_minutiae_from_v20(buffer, record, v);
+	if (!minutiae)
+		free(buffer);
+
+	return minutiae;
+}
+
+struct fmr_minutiae *fmr_minutiae_create_v030(
+		const struct iso_fmr_v030 *record, int r)
+{
+	struct fmr_minutiae *minutiae;
+	void *buffer;
+
+	if (r < 0 || r >= record->number_representations)
+		return NULL;
+
+	buffer = aligned_alloc(FMR_MINUTIAE_ALIGN, fmr_minutiae_size(
+			record->representations[r].number_minutiae));
+	if (!buffer)
+		return NULL;
+
+	minutiae = fmr_minutiae_from_v030(buffer, record, r);
+	if (!minutiae)
+		free(buffer);
+
+	return minutiae;
+}
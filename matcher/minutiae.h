@@ -0,0 +1,108 @@
+#ifndef __FMR_MINUTIAE_H
+#define __FMR_MINUTIAE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "iso_fmr/v20.h"
+#include "iso_fmr/v030.h"
+#include "match.h"
+
+/*
+ * Minutiae as a structure of arrays, for kernels processing many minutiae
+ * at once with vector instructions. It's a flat block, with no pointers:
+ *
+ *	header				FMR_MINUTIAE_ALIGN bytes
+ *	int16_t x[capacity]
+ *	int16_t y[capacity]
+ *	uint8_t angle[capacity]
+ *	uint8_t type[capacity]
+ *	uint8_t quality[capacity]
+ *
+ * The block and every array are FMR_MINUTIAE_ALIGN (widest vector, 512
+ * bits) aligned, and capacity is the number of minutiae rounded up to
+ * FMR_MINUTIAE_ALIGN, so that any vector load within the capacity is
+ * aligned and valid. Padding has x and y of FMR_MINUTIAE_PADDING, far from
+ * any real minutia, angle, type and quality of 0. Coordinates are within
+ * 0 and FMR_MINUTIAE_COORDINATE_MAX, so a difference of any two, padding
+ * included, fits in int16_t.
+ *
+ * Coordinates are in pixels at 197 pixels per cm, as in match.h, angles
+ * in the records' 1.40625 degree units, quality 0 when not reported.
+ */
+
+#define FMR_MINUTIAE_ALIGN 64
+#define FMR_MINUTIAE_COORDINATE_MAX 0x3fff
+#define FMR_MINUTIAE_PADDING (-0x4000)
+
+struct fmr_minutiae {
+	uint16_t number_minutiae;
+	uint16_t capacity;
+	uint8_t reserved[FMR_MINUTIAE_ALIGN - 4];
+};
+
+static inline int16_t *fmr_minutiae_x(const struct fmr_minutiae *minutiae)
+{
+	return (int16_t *)(minutiae + 1);
+}
+
+static inline int16_t *fmr_minutiae_y(const struct fmr_minutiae *minutiae)
+{
+	return fmr_minutiae_x(minutiae) + minutiae->capacity;
+}
+
+static inline uint8_t *fmr_minutiae_angle(const struct fmr_minutiae *minutiae)
+{
+	return (uint8_t *)(fmr_minutiae_y(minutiae) + minutiae->capacity);
+}
+
+static inline uint8_t *fmr_minutiae_type(const struct fmr_minutiae *minutiae)
+{
+	return fmr_minutiae_angle(minutiae) + minutiae->capacity;
+}
+
+static inline uint8_t *fmr_minutiae_quality(
+		const struct fmr_minutiae *minutiae)
+{
+	return fmr_minutiae_type(minutiae) + minutiae->capacity;
+}
+
+/* Size of the block, a multiple of FMR_MINUTIAE_ALIGN */
+size_t fmr_minutiae_size(int number_minutiae);
+/*
+ * Set up the block in @buffer, FMR_MINUTIAE_ALIGN aligned, with all the
+ * minutiae as padding, for the caller to fill in. NULL for invalid
+ * @number_minutiae.
+ */
+struct fmr_minutiae *fmr_minutiae_init(void *buffer, int number_minutiae);
+
+/*
+ * Minutiae of view @v or representation @r, scaled as in match.h, in
+ * @buffer of at least fmr_minutiae_size() of their number. NULL for
+ * a non-existing view or representation.
+ */
+struct fmr_minutiae *fmr_minutiae_from_v20(void *buffer,
+		const struct iso_fmr_v20 *record, int v);
+struct fmr_minutiae *fmr_minutiae_from_v030(void *buffer,
+		const struct iso_fmr_v030 *record, int r);
+
+/* Same, for an array of match.h minutiae, scaled already */
+struct fmr_minutiae *fmr_minutiae_from_array(void *buffer,
+		const struct fmr_match_minutia *minutiae, int number_minutiae);
+
+/* Same, in a block allocated with aligned_alloc(), released with free() */
+struct fmr_minutiae *fmr_minutiae_create_v20(const struct iso_fmr_v20 *record,
+		int v);
+struct fmr_minutiae *fmr_minutiae_create_v030(
+		const struct iso_fmr_v030 *record, int r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,316 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86
+#endif
+
+#include "pairs.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*a))
+
+/*
+ * Every variant goes through all of @b's capacity, padding included, as
+ * padding is never compatible with anything, and sets whole words of the
+ * rows, one for 64 minutiae.
+ */
+
+static void fmr_pairs_scalar_rows(const struct fmr_minutiae *a,
+		const struct fmr_minutiae *b, int distance, int angle,
+		uint64_t compatible[][FMR_PAIRS_WORDS])
+{
+	const int16_t *ax = fmr_minutiae_x(a), *ay = fmr_minutiae_y(a);
+	const int16_t *bx = fmr_minutiae_x(b), *by = fmr_minutiae_y(b);
+	const uint8_t *aa = fmr_minutiae_angle(a), *ba = fmr_minutiae_angle(b);
+	int i, j;
+
+	for (i = 0; i < a->number_minutiae; i++) {
+		for (j = 0; j < b->capacity; j += 64) {
+			uint64_t row = 0;
+			int k;
+
+			for (k = 0; k < 64; k++) {
+				int dx = bx[j + k] - ax[i];
+				int dy = by[j + k] - ay[i];
+				uint8_t diff = ba[j + k] - aa[i];
+				uint8_t neg = -diff;
+
+				if (neg < diff)
+					diff = neg;
+				row |= (uint64_t)(abs(dx) <= distance &&
+						abs(dy) <= distance &&
+						diff <= angle) << k;
+			}
+			compatible[i][j / 64] = row;
+		}
+	}
+}
+
+#ifdef X86
+
+__attribute__((target("sse4.2")))
+static void fmr_pairs_sse42_rows(const struct fmr_minutiae *a,
+		const struct fmr_minutiae *b, int distance, int angle,
+		uint64_t compatible[][FMR_PAIRS_WORDS])
+{
+	const int16_t *ax = fmr_minutiae_x(a), *ay = fmr_minutiae_y(a);
+	const int16_t *bx = fmr_minutiae_x(b), *by = fmr_minutiae_y(b);
+	const uint8_t *aa = fmr_minutiae_angle(a), *ba = fmr_minutiae_angle(b);
+	const __m128i d = _mm_set1_epi16(distance);
+	const __m128i t = _mm_set1_epi8(angle);
+	const __m128i zero = _mm_setzero_si128();
+	int i, j;
+
+	for (i = 0; i < a->number_minutiae; i++) {
+		const __m128i x = _mm_set1_epi16(ax[i]);
+		const __m128i y = _mm_set1_epi16(ay[i]);
+		const __m128i theta = _mm_set1_epi8(aa[i]);
+		uint64_t row = 0;
+
+		for (j = 0; j < b->capacity; j += 16) {
+			__m128i far0, far1, diff, near;
+
+			far0 = _mm_or_si128(_mm_cmpgt_epi16(_mm_abs_epi16(
+					_mm_sub_epi16(_mm_load_si128((const void *)
+					(bx + j)), x)), d),
+					_mm_cmpgt_epi16(_mm_abs_epi16(
+					_mm_sub_epi16(_mm_load_si128((const void *)
+					(by + j)), y)), d));
+			far1 = _mm_or_si128(_mm_cmpgt_epi16(_mm_abs_epi16(
+					_mm_sub_epi16(_mm_load_si128((const void *)
+					(bx + j + 8)), x)), d),
+					_mm_cmpgt_epi16(_mm_abs_epi16(
+					_mm_sub_epi16(_mm_load_si128((const void *)
+					(by + j + 8)), y)), d));
+
+			/* Circular difference, the smaller of d and -d */
+			diff = _mm_sub_epi8(_mm_load_si128((const void *)
+					(ba + j)), theta);
+			diff = _mm_min_epu8(diff, _mm_sub_epi8(zero, diff));
+			near = _mm_cmpeq_epi8(_mm_max_epu8(diff, t), t);
+
+			near = _mm_andnot_si128(_mm_packs_epi16(far0, far1),
+					near);
+			row |= (uint64_t)(uint16_t)_mm_movemask_epi8(near) <<
+					(j % 64);
+			if (j % 64 == 48) {
+				compatible[i][j / 64] = row;
+				row = 0;
+			}
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void fmr_pairs_avx2_rows(const struct fmr_minutiae *a,
+		const struct fmr_minutiae *b, int distance, int angle,
+		uint64_t compatible[][FMR_PAIRS_WORDS])
+{
+	const int16_t *ax = fmr_minutiae_x(a), *ay = fmr_minutiae_y(a);
+	const int16_t *bx = fmr_minutiae_x(b), *by = fmr_minutiae_y(b);
+	const uint8_t *aa = fmr_minutiae_angle(a), *ba = fmr_minutiae_angle(b);
+	const __m256i d = _mm256_set1_epi16(distance);
+	const __m256i t = _mm256_set1_epi8(angle);
+	const __m256i zero = _mm256_setzero_si256();
+	int i, j;
+
+	for (i = 0; i < a->number_minutiae; i++) {
+		const __m256i x = _mm256_set1_epi16(ax[i]);
+		const __m256i y = _mm256_set1_epi16(ay[i]);
+		const __m256i theta = _mm256_set1_epi8(aa[i]);
+		uint64_t row = 0;
+
+		for (j = 0; j < b->capacity; j += 32) {
+			__m256i far0, far1, far, diff, near;
+
+			far0 = _mm256_or_si256(_mm256_cmpgt_epi16(
+					_mm256_abs_epi16(_mm256_sub_epi16(
+					_mm256_load_si256((const void *)
+					(bx + j)), x)), d),
+					_mm256_cmpgt_epi16(_mm256_abs_epi16(
+					_mm256_sub_epi16(_mm256_load_si256(
+					(const void *)(by + j)), y)), d));
+			far1 = _mm256_or_si256(_mm256_cmpgt_epi16(
+					_mm256_abs_epi16(_mm256_sub_epi16(
+					_mm256_load_si256((const void *)
+					(bx + j + 16)), x)), d),
+					_mm256_cmpgt_epi16(_mm256_abs_epi16(
+					_mm256_sub_epi16(_mm256_load_si256(
+					(const void *)(by + j + 16)), y)), d));
+			/* Packing works within 128-bit lanes, so reorder */
+			far = _mm256_permute4x64_epi64(
+					_mm256_packs_epi16(far0, far1), 0xd8);
+
+			diff = _mm256_sub_epi8(_mm256_load_si256((const void *)
+					(ba + j)), theta);
+			diff = _mm256_min_epu8(diff,
+					_mm256_sub_epi8(zero, diff));
+			near = _mm256_cmpeq_epi8(_mm256_max_epu8(diff, t), t);
+
+			near = _mm256_andnot_si256(far, near);
+			row |= (uint64_t)(uint32_t)_mm256_movemask_epi8(near) <<
+					(j % 64);
+			if (j % 64 == 32) {
+				compatible[i][j / 64] = row;
+				row = 0;
+			}
+		}
+	}
+}
+
+__attribute__((target("avx512bw")))
+static void fmr_pairs_avx512_rows(const struct fmr_minutiae *a,
+		const struct fmr_minutiae *b, int distance, int angle,
+		uint64_t compatible[][FMR_PAIRS_WORDS])
+{
+	const int16_t *ax = fmr_minutiae_x(a), *ay = fmr_minutiae_y(a);
+	const int16_t *bx = fmr_minutiae_x(b), *by = fmr_minutiae_y(b);
+	const uint8_t *aa = fmr_minutiae_angle(a), *ba = fmr_minutiae_angle(b);
+	const __m512i d = _mm512_set1_epi16(distance);
+	const __m512i t = _mm512_set1_epi8(angle);
+	const __m512i zero = _mm512_setzero_si512();
+	int i, j;
+
+	for (i = 0; i < a->number_minutiae; i++) {
+		const __m512i x = _mm512_set1_epi16(ax[i]);
+		const __m512i y = _mm512_set1_epi16(ay[i]);
+		const __m512i theta = _mm512_set1_epi8(aa[i]);
+
+		for (j = 0; j < b->capacity; j += 64) {
+			__mmask32 near0, near1;
+			__mmask64 near;
+			__m512i diff;
+
+			near0 = _mm512_cmple_epi16_mask(_mm512_abs_epi16(
+					_mm512_sub_epi16(_mm512_load_si512(
+					bx + j), x)), d) &
+					_mm512_cmple_epi16_mask(
+					_mm512_abs_epi16(_mm512_sub_epi16(
+					_mm512_load_si512(by + j), y)), d);
+			near1 = _mm512_cmple_epi16_mask(_mm512_abs_epi16(
+					_mm512_sub_epi16(_mm512_load_si512(
+					bx + j + 32), x)), d) &
+					_mm512_cmple_epi16_mask(
+					_mm512_abs_epi16(_mm512_sub_epi16(
+					_mm512_load_si512(by + j + 32), y)), d);
+
+			diff = _mm512_sub_epi8(_mm512_load_si512(ba + j),
+					theta);
+			diff = _mm512_min_epu8(diff,
+					_mm512_sub_epi8(zero, diff));
+			near = _mm512_cmple_epu8_mask(diff, t);
+
+			compatible[i][j / 64] = near & (near0 |
+					(uint64_t)near1 << 32);
+		}
+	}
+}
+
+#endif
+
+static const struct {
+	const char *name;
+	void (*rows)(const struct fmr_minutiae *a,
+			const struct fmr_minutiae *b, int distance, int angle,
+			uint64_t compatible[][FMR_PAIRS_WORDS]);
+} fmr_pairs_variants[] = {
+	[fmr_pairs_scalar] = { "scalar", fmr_pairs_scalar_rows },
+#ifdef X86
+	[fmr_pairs_sse42] = { "sse4.2", fmr_pairs_sse42_rows },
+	[fmr_pairs_avx2] = { "avx2", fmr_pairs_avx2_rows },
+	[fmr_pairs_avx512] = { "avx512", fmr_pairs_avx512_rows },
+#else
+	[fmr_pairs_sse42] = { "sse4.2" },
+	[fmr_pairs_avx2] = { "avx2" },
+	[fmr_pairs_avx512] = { "avx512" },
+#endif
+};
+
+int fmr_pairs_variant_supported(enum fmr_pairs_variant variant)
+{
+	if (variant >= ARRAY_SIZE(fmr_pairs_variants) ||
+			!fmr_pairs_variants[variant].rows)
+		return 0;
+
+#ifdef X86
+	/* The builtin needs a literal */
+	switch (variant) {
+	case fmr_pairs_sse42:
+		return __builtin_cpu_supports("sse4.2");
+	case fmr_pairs_avx2:
+		return __builtin_cpu_supports("avx2");
+	case fmr_pairs_avx512:
+		return __builtin_cpu_supports("avx512bw");
+	default:
+		break;
+	}
+#endif
+
+	return variant == fmr_pairs_scalar;
+}
+
+enum fmr_pairs_variant fmr_pairs_get_best_variant(void)
+{
+	/* Any thread may find it first, so it's read and set atomically */
+	static int best = -1;
+	int variant = __atomic_load_n(&best, __ATOMIC_RELAXED);
+
+	if (variant < 0) {
+		for (variant = __fmr_pairs_variants - 1; variant > 0; variant--)
+			if (fmr_pairs_variant_supported(variant))
+				break;
+		__atomic_store_n(&best, variant, __ATOMIC_RELAXED);
+	}
+
+	return variant;
+}
+
+const char *fmr_pairs_get_variant_string(enum fmr_pairs_variant variant)
+{
+	if (variant >= ARRAY_SIZE(fmr_pairs_variants))
+		return "unknown";
+
+	return fmr_pairs_variants[variant].name;
+}
+
+int fmr_pairs_variant(enum fmr_pairs_variant variant,
+		const struct fmr_minutiae *a, const struct fmr_minutiae *b,
+		int distance, int angle,
+		uint64_t compatible[][FMR_PAIRS_WORDS])
+{
+	int words = b->capacity / 64;
+	int i, w, number_pairs = 0;
+
+	if (!fmr_pairs_variant_supported(variant))
+		return -1;
+
+	/* No difference is that big, or bigger */
+	if (distance > FMR_MINUTIAE_COORDINATE_MAX)
+		distance = FMR_MINUTIAE_COORDINATE_MAX;
+	if (angle > 128)
+		angle = 128;
+
+	if (distance < 0 || angle < 0)
+		memset(compatible, 0, sizeof(*compatible) * a->number_minutiae);
+	else
+		fmr_pairs_variants[variant].rows(a, b, distance, angle,
+				compatible);
+
+	for (i = 0; i < a->number_minutiae; i++) {
+		for (w = 0; w < words; w++)
+			number_pairs += __builtin_popcountll(compatible[i][w]);
+		for (; w < FMR_PAIRS_WORDS; w++)
+			compatible[i][w] = 0;
+	}
+
+	return number_pairs;
+}
+
+int fmr_pairs(const struct fmr_minutiae *a, const struct fmr_minutiae *b,
+		int distance, int angle,
+		uint64_t compatible[][FMR_PAIRS_WORDS])
+{
+	return fmr_pairs_variant(fmr_pairs_get_best_variant(), a, b, distance,
+			angle, compatible);
+}
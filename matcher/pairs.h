@@ -0,0 +1,53 @@
+#ifndef __FMR_PAIRS_H
+#define __FMR_PAIRS_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+#include "match.h"
+#include "minutiae.h"
+
+/*
+ * Pairwise compatibility of two sets of minutiae: minutia i of @a and j
+ * of @b are compatible when both their x and y differ by @distance at
+ * most, and their angles by @angle at most (either way round). Bit j of
+ * compatible[i] is set for every such pair, and the number of all of them
+ * is returned.
+ *
+ * That's the inner loop of the pairing, so there are scalar, SSE4.2, AVX2
+ * and AVX-512 (BW) variants, all with the very same results. fmr_pairs()
+ * uses the fastest one the CPU supports, as found by cpuid once.
+ */
+
+#define FMR_PAIRS_WORDS ((FMR_MATCH_MINUTIAE_MAX + 64) / 64)
+
+enum fmr_pairs_variant {
+	fmr_pairs_scalar,
+	fmr_pairs_sse42,
+	fmr_pairs_avx2,
+	fmr_pairs_avx512,
+	__fmr_pairs_variants,
+};
+
+int fmr_pairs(const struct fmr_minutiae *a, const struct fmr_minutiae *b,
+		int distance, int angle,
+		uint64_t compatible[][FMR_PAIRS_WORDS]);
+
+/* Returns -1 when the CPU doesn't support @variant */
+int fmr_pairs_variant(enum fmr_pairs_variant variant,
+		const struct fmr_minutiae *a, const struct fmr_minutiae *b,
+		int distance, int angle,
+		uint64_t compatible[][FMR_PAIRS_WORDS]);
+int fmr_pairs_variant_supported(enum fmr_pairs_variant variant);
+enum fmr_pairs_variant fmr_pairs_get_best_variant(void);
+const char *fmr_pairs_get_variant_string(enum fmr_pairs_variant variant);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1030 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "minutiae.h"
+#include "search.h"
+
+/* Minutiae directions histogram, in 45 degrees bins */
+#define HISTOGRAM_SHIFT 5
+#define HISTOGRAM_BINS (256 >> HISTOGRAM_SHIFT)
+
+/* Default cascade thresholds, see fmr_search_cascade_init() */
+#define MINUTIAE_RATIO 40
+#define HISTOGRAM_DIFFERENCE 100
+#define ROTATION 32
+#define DESCRIPTORS_SCORE 4000
+
+/* Hot data of a template, all the first stage of the cascade looks at */
+struct fmr_search_summary {
+	uint8_t finger_position;
+	uint8_t number_minutiae;
+	uint8_t histogram[HISTOGRAM_BINS];
+	uint8_t reserved[6];
+};
+
+/*
+ * Templates, and descriptors, of an entry follow one another, and their
+ * sizes only depend on the number of minutiae, so they're found with the
+ * summaries alone
+ */
+struct fmr_search_entry {
+	uint64_t offset;
+	uint64_t descriptors;
+	uint32_t id;
+	uint32_t first_summary;
+	uint32_t number_templates;
+	uint32_t reserved;
+};
+
+struct fmr_search_gallery {
+	struct fmr_search_entry *entries;
+	uint32_t number_entries;
+	struct fmr_search_summary *summaries;
+	uint32_t number_summaries;
+	uint32_t max_templates;
+	/* Cold data, FMR_MINUTIAE_ALIGN aligned blocks */
+	uint8_t *templates;
+	size_t size, allocated;
+	uint8_t *descriptors;
+	size_t descriptors_size, descriptors_allocated;
+	int has_descriptors;
+};
+
+struct fmr_search_probe {
+	struct fmr_search_summary summary;
+	const struct fmr_match_template *template;
+	const struct fmr_mcc *mcc;
+};
+
+#define TEMPLATE_ALIGN 8
+/* Big enough for any minutiae, as in minutiae.h */
+#define MINUTIAE_SIZE_MAX (FMR_MINUTIAE_ALIGN + (FMR_MATCH_MINUTIAE_MAX + 1) * 7)
+
+static size_t fmr_search_template_size(int number_minutiae)
+{
+	return (fmr_match_template_size(number_minutiae) + TEMPLATE_ALIGN - 1) &
+			~(size_t)(TEMPLATE_ALIGN - 1);
+}
+
+static void fmr_search_summarize(struct fmr_search_summary *summary,
+		uint8_t finger_position,
+		const struct fmr_match_minutia *minutiae, int number_minutiae)
+{
+	int m;
+
+	memset(summary, 0, sizeof(*summary));
+	summary->finger_position = finger_position;
+	summary->number_minutiae = number_minutiae;
+	for (m = 0; m < number_minutiae; m++)
+		summary->histogram[minutiae[m].angle >> HISTOGRAM_SHIFT]++;
+}
+
+struct fmr_search_gallery *fmr_search_gallery_create(void)
+{
+	return calloc(1, sizeof(struct fmr_search_gallery));
+}
+
+void fmr_search_gallery_free(struct fmr_search_gallery *gallery)
+{
+	if (!gallery)
+		return;
+
+	free(gallery->entries);
+	free(gallery->summaries);
+	free(gallery->templates);
+	free(gallery->descriptors);
+	free(gallery);
+}
+
+int fmr_search_gallery_enable_descriptors(struct fmr_search_gallery *gallery)
+{
+	if (gallery->number_entries) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	gallery->has_descriptors = 1;
+
+	return 0;
+}
+
+static struct fmr_search_entry *fmr_search_gallery_add_entry(
+		struct fmr_search_gallery *gallery, uint32_t id)
+{
+	uint32_t n = gallery->number_entries;
+	struct fmr_search_entry *entry;
+
+	if (n == UINT32_MAX) {
+		errno = EFBIG;
+		return NULL;
+	}
+
+	/* Table grows in powers of two */
+	if (!(n & (n - 1))) {
+		struct fmr_search_entry *entries = realloc(gallery->entries,
+				sizeof(*entries) * (n ? n * 2 : 1));
+
+		if (!entries)
+			return NULL;
+		gallery->entries = entries;
+	}
+
+	entry = &gallery->entries[n];
+	entry->offset = gallery->size;
+	entry->descriptors = gallery->descriptors_size;
+	entry->id = id;
+	entry->first_summary = gallery->number_summaries;
+	entry->number_templates = 0;
+	entry->reserved = 0;
+
+	return entry;
+}
+
+/* Drop the templates of an entry which failed to be added */
+static void fmr_search_gallery_drop_entry(struct fmr_search_gallery *gallery,
+		const struct fmr_search_entry *entry)
+{
+	gallery->size = entry->offset;
+	gallery->descriptors_size = entry->descriptors;
+	gallery->number_summaries = entry->first_summary;
+}
+
+/* Blocks grow in powers of two, and stay FMR_MINUTIAE_ALIGN aligned */
+static int fmr_search_gallery_reserve(uint8_t **block, size_t *allocated,
+		size_t size, size_t more)
+{
+	size_t new_allocated = *allocated ? *allocated : 65536;
+	uint8_t *new_block;
+
+	if (size + more <= *allocated)
+		return 0;
+
+	while (size + more > new_allocated)
+		new_allocated *= 2;
+	new_block = aligned_alloc(FMR_MINUTIAE_ALIGN, new_allocated);
+	if (!new_block)
+		return -1;
+
+	if (*block)
+		memcpy(new_block, *block, size);
+	free(*block);
+	*block = new_block;
+	*allocated = new_allocated;
+
+	return 0;
+}
+
+/* Room for one more summary, template, and descriptors */
+static int fmr_search_gallery_reserve_template(
+		struct fmr_search_gallery *gallery, size_t size,
+		size_t descriptors_size)
+{
+	uint32_t n = gallery->number_summaries;
+
+	if (n == UINT32_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+	if (!(n & (n - 1))) {
+		struct fmr_search_summary *summaries = realloc(
+				gallery->summaries,
+				sizeof(*summaries) * (n ? n * 2 : 1));
+
+		if (!summaries)
+			return -1;
+		gallery->summaries = summaries;
+	}
+	if (fmr_search_gallery_reserve(&gallery->templates,
+			&gallery->allocated, gallery->size, size))
+		return -1;
+	if (descriptors_size && fmr_search_gallery_reserve(
+			&gallery->descriptors, &gallery->descriptors_allocated,
+			gallery->descriptors_size, descriptors_size))
+		return -1;
+
+	return 0;
+}
+
+static int fmr_search_gallery_add_template(struct fmr_search_gallery *gallery,
+		struct fmr_search_entry *entry, uint8_t finger_position,
+		const struct fmr_match_minutia *minutiae, int number_minutiae)
+{
+	uint8_t buffer[MINUTIAE_SIZE_MAX]
+			__attribute__((aligned(FMR_MINUTIAE_ALIGN)));
+	uint32_t n = gallery->number_summaries;
+	size_t size, descriptors_size;
+
+	if (number_minutiae < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size = fmr_search_template_size(number_minutiae);
+	descriptors_size = gallery->has_descriptors ?
+			fmr_mcc_size(number_minutiae) : 0;
+
+	if (fmr_search_gallery_reserve_template(gallery, size,
+			descriptors_size))
+		return -1;
+
+	fmr_search_summarize(&gallery->summaries[n], finger_position,
+			minutiae, number_minutiae);
+	gallery->number_summaries++;
+
+	fmr_match_template_init(gallery->templates + gallery->size, minutiae,
+			number_minutiae);
+	gallery->size += size;
+
+	if (descriptors_size) {
+		fmr_mcc_init(gallery->descriptors + gallery->descriptors_size,
+				fmr_minutiae_from_array(buffer, minutiae,
+				number_minutiae));
+		gallery->descriptors_size += descriptors_size;
+	}
+
+	entry->number_templates++;
+	if (entry->number_templates > gallery->max_templates)
+		gallery->max_templates = entry->number_templates;
+
+	return 0;
+}
+
+/* Template, and its descriptors, as they are in another gallery */
+static int fmr_search_gallery_copy_template(struct fmr_search_gallery *gallery,
+		struct fmr_search_entry *entry,
+		const struct fmr_search_summary *summary, const void *template,
+		const void *mcc)
+{
+	size_t size = fmr_search_template_size(summary->number_minutiae);
+	size_t descriptors_size = mcc ?
+			fmr_mcc_size(summary->number_minutiae) : 0;
+
+	if (fmr_search_gallery_reserve_template(gallery, size,
+			descriptors_size))
+		return -1;
+
+	gallery->summaries[gallery->number_summaries++] = *summary;
+	memcpy(gallery->templates + gallery->size, template, size);
+	gallery->size += size;
+	if (descriptors_size) {
+		memcpy(gallery->descriptors + gallery->descriptors_size, mcc,
+				descriptors_size);
+		gallery->descriptors_size += descriptors_size;
+	}
+
+	entry->number_templates++;
+	if (entry->number_templates > gallery->max_templates)
+		gallery->max_templates = entry->number_templates;
+
+	return 0;
+}
+
+int fmr_search_gallery_add_v20(struct fmr_search_gallery *gallery,
+		uint32_t id, const struct iso_fmr_v20 *record)
+{
+	struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+	struct fmr_search_entry *entry;
+	int v;
+
+	entry = fmr_search_gallery_add_entry(gallery, id);
+	if (!entry)
+		return -1;
+
+	for (v = 0; v < record->number_views; v++) {
+		if (fmr_search_gallery_add_template(gallery, entry,
+				record->views[v].finger_position, minutiae,
+				fmr_match_minutiae_from_v20(record, v,
+				minutiae)) < 0) {
+			fmr_search_gallery_drop_entry(gallery, entry);
+			return -1;
+		}
+	}
+	gallery->number_entries++;
+
+	return 0;
+}
+
+int fmr_search_gallery_add_v030(struct fmr_search_gallery *gallery,
+		uint32_t id, const struct iso_fmr_v030 *record)
+{
+	struct fmr_match_minutia minutiae[FMR_MATCH_MINUTIAE_MAX];
+	struct fmr_search_entry *entry;
+	int r;
+
+	entry = fmr_search_gallery_add_entry(gallery, id);
+	if (!entry)
+		return -1;
+
+	for (r = 0; r < record->number_representations; r++) {
+		if (fmr_search_gallery_add_template(gallery, entry,
+				record->representations[r].finger_position,
+				minutiae, fmr_match_minutiae_from_v030(record,
+				r, minutiae)) < 0) {
+			fmr_search_gallery_drop_entry(gallery, entry);
+			return -1;
+		}
+	}
+	gallery->number_entries++;
+
+	return 0;
+}
+
+int fmr_search_gallery_add_minutiae(struct fmr_search_gallery *gallery,
+		uint32_t id, uint8_t finger_position,
+		const struct fmr_match_minutia *minutiae, int number_minutiae)
+{
+	struct fmr_search_entry *entry;
+
+	if (number_minutiae < 0 || number_minutiae > FMR_MATCH_MINUTIAE_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	entry = fmr_search_gallery_add_entry(gallery, id);
+	if (!entry)
+		return -1;
+
+	if (fmr_search_gallery_add_template(gallery, entry, finger_position,
+			minutiae, number_minutiae) < 0) {
+		fmr_search_gallery_drop_entry(gallery, entry);
+		return -1;
+	}
+	gallery->number_entries++;
+
+	return 0;
+}
+
+int fmr_search_gallery_add_record(struct fmr_search_gallery *gallery,
+		uint32_t id, const void *buffer, size_t len)
+{
+	const uint8_t *buf = buffer;
+	int res;
+
+	if (len >= 8 && !memcmp(buf + 4, "\x20\x32\x30\x00", 4)) {
+		enum iso_fmr_v20_error error;
+		struct iso_fmr_v20 *record;
+
+		record = iso_fmr_v20_decode_arena(buffer, len, NULL, 0, &error,
+				NULL);
+		if (!record) {
+			errno = error == iso_fmr_v20_out_of_memory ?
+					ENOMEM : EINVAL;
+			return -1;
+		}
+		res = fmr_search_gallery_add_v20(gallery, id, record);
+		iso_fmr_v20_free_arena(record);
+	} else {
+		enum iso_fmr_v030_error error;
+		struct iso_fmr_v030 *record;
+
+		record = iso_fmr_v030_decode_arena(buffer, len, NULL, 0, &error,
+				NULL);
+		if (!record) {
+			errno = error == iso_fmr_v030_out_of_memory ?
+					ENOMEM : EINVAL;
+			return -1;
+		}
+		res = fmr_search_gallery_add_v030(gallery, id, record);
+		iso_fmr_v030_free_arena(record);
+	}
+
+	return res;
+}
+
+uint32_t fmr_search_gallery_get_number_entries(
+		const struct fmr_search_gallery *gallery)
+{
+	return gallery->number_entries;
+}
+
+uint32_t fmr_search_gallery_get_id(const struct fmr_search_gallery *gallery,
+		uint32_t index)
+{
+	return gallery->entries[index].id;
+}
+
+int fmr_search_gallery_merge(struct fmr_search_gallery *gallery,
+		const struct fmr_search_gallery *source, const uint64_t *excluded)
+{
+	const struct fmr_search_summary *summary = source->summaries;
+	const uint8_t *template = source->templates;
+	const uint8_t *mcc = source->descriptors;
+	uint32_t i, t;
+
+	if (gallery->has_descriptors && !source->has_descriptors) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < source->number_entries; i++) {
+		const struct fmr_search_entry *from = &source->entries[i];
+		struct fmr_search_entry *entry;
+		int skip = excluded && (excluded[i / 64] >> (i % 64)) & 1;
+
+		if (!skip) {
+			entry = fmr_search_gallery_add_entry(gallery, from->id);
+			if (!entry)
+				return -1;
+		}
+
+		for (t = 0; t < from->number_templates; t++, summary++) {
+			size_t size = fmr_search_template_size(
+					summary->number_minutiae);
+			size_t descriptors_size = source->has_descriptors ?
+					fmr_mcc_size(summary->number_minutiae) :
+					0;
+
+			if (!skip && fmr_search_gallery_copy_template(gallery,
+					entry, summary, template,
+					gallery->has_descriptors ? mcc : NULL)) {
+				fmr_search_gallery_drop_entry(gallery, entry);
+				return -1;
+			}
+			template += size;
+			mcc += descriptors_size;
+		}
+
+		if (!skip)
+			gallery->number_entries++;
+	}
+
+	return 0;
+}
+
+size_t fmr_search_gallery_get_size(const struct fmr_search_gallery *gallery)
+{
+	return gallery->size + gallery->descriptors_size +
+			sizeof(*gallery->summaries) * gallery->number_summaries;
+}
+
+struct fmr_search_probe *fmr_search_probe_create(
+		const struct fmr_match_minutia *minutiae, int number_minutiae,
+		uint8_t finger_position)
+{
+	uint8_t buffer[MINUTIAE_SIZE_MAX]
+			__attribute__((aligned(FMR_MINUTIAE_ALIGN)));
+	struct fmr_search_probe *probe;
+	size_t header = (sizeof(*probe) + FMR_MINUTIAE_ALIGN - 1) &
+			~(size_t)(FMR_MINUTIAE_ALIGN - 1);
+	size_t descriptors_size = fmr_mcc_size(number_minutiae), size;
+	uint8_t *block;
+
+	if (number_minutiae < 0 || number_minutiae > FMR_MATCH_MINUTIAE_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size = (header + descriptors_size +
+			fmr_search_template_size(number_minutiae) +
+			FMR_MINUTIAE_ALIGN - 1) & ~(size_t)(FMR_MINUTIAE_ALIGN - 1);
+	block = aligned_alloc(FMR_MINUTIAE_ALIGN, size);
+	if (!block)
+		return NULL;
+
+	probe = (void *)block;
+	fmr_search_summarize(&probe->summary, finger_position, minutiae,
+			number_minutiae);
+	probe->mcc = fmr_mcc_init(block + header, fmr_minutiae_from_array(
+			buffer, minutiae, number_minutiae));
+	probe->template = fmr_match_template_init(block + header +
+			descriptors_size, minutiae, number_minutiae);
+
+	return probe;
+}
+
+void fmr_search_cascade_init(struct fmr_search_cascade *cascade)
+{
+	cascade->minutiae_ratio = MINUTIAE_RATIO;
+	cascade->histogram_difference = HISTOGRAM_DIFFERENCE;
+	cascade->rotation = ROTATION;
+	cascade->descriptors_score = DESCRIPTORS_SCORE;
+	cascade->score = 0;
+}
+
+/*
+ * Entries are shared out in equal, contiguous, ranges, and taken from them
+ * in chunks. A thread done with its own range steals chunks from the
+ * others'. Owner and thieves take from the same end, with a single atomic
+ * add, which for a read-only walk is all the stealing needs.
+ */
+#define CHUNK 64
+#define THREADS_MAX 1024
+
+/* Template of a chunk, which passed the stages so far */
+struct fmr_search_survivor {
+	const struct fmr_match_template *template;
+	const struct fmr_mcc *mcc;
+	uint32_t entry;
+};
+
+struct fmr_search;
+
+struct fmr_search_worker {
+	struct fmr_search *search;
+	int index;
+	pthread_t thread;
+	atomic_uint_fast64_t next;
+	uint64_t end;
+	/* Bounded heap of the best candidates, the worst one on top */
+	struct fmr_search_candidate *heap;
+	int number_candidates;
+	/* Room for all templates of a chunk */
+	struct fmr_search_survivor *survivors;
+	uint64_t comparisons, steals;
+	struct fmr_search_stage_stats stages[__fmr_search_stages];
+} __attribute__((aligned(64)));
+
+/*
+ * Entries of all parts are numbered one after another, those of part p
+ * from first[p] on, with first[number_parts] the number of all of them
+ */
+struct fmr_search {
+	const struct fmr_search_part *parts;
+	uint64_t *first;
+	int number_parts;
+	const struct fmr_search_probe *probe;
+	struct fmr_search_cascade cascade;
+	/* Rotations of the histogram tried, both ways, in bins */
+	int histogram_shifts;
+	int k;
+	struct fmr_search_worker *workers;
+	int number_workers;
+};
+
+/* Lower score, and higher id for the same score, so the order is stable */
+static int fmr_search_worse(const struct fmr_search_candidate *a,
+		const struct fmr_search_candidate *b)
+{
+	return a->score < b->score || (a->score == b->score && a->id > b->id);
+}
+
+static void fmr_search_heap_push(struct fmr_search_worker *worker, int k,
+		uint32_t id, int score)
+{
+	struct fmr_search_candidate *heap = worker->heap;
+	struct fmr_search_candidate candidate = { id, score };
+	int i, child;
+
+	if (worker->number_candidates < k) {
+		for (i = worker->number_candidates++; i > 0 &&
+				fmr_search_worse(&candidate,
+				&heap[(i - 1) / 2]); i = (i - 1) / 2)
+			heap[i] = heap[(i - 1) / 2];
+		heap[i] = candidate;
+		return;
+	}
+
+	if (!fmr_search_worse(&heap[0], &candidate))
+		return;
+
+	for (i = 0; (child = 2 * i + 1) < k; i = child) {
+		if (child + 1 < k && fmr_search_worse(&heap[child + 1],
+				&heap[child]))
+			child++;
+		if (!fmr_search_worse(&heap[child], &candidate))
+			break;
+		heap[i] = heap[child];
+	}
+	heap[i] = candidate;
+}
+
+static int fmr_search_next(struct fmr_search_worker *worker, uint64_t *begin,
+		uint64_t *end)
+{
+	struct fmr_search *search = worker->search;
+	int i;
+
+	for (i = 0; i < search->number_workers; i++) {
+		struct fmr_search_worker *victim = &search->workers[
+				(worker->index + i) % search->number_workers];
+		uint64_t next;
+
+		if (atomic_load_explicit(&victim->next,
+				memory_order_relaxed) >= victim->end)
+			continue;
+		next = atomic_fetch_add_explicit(&victim->next, CHUNK,
+				memory_order_relaxed);
+		if (next >= victim->end)
+			continue;
+
+		*begin = next;
+		*end = next + CHUNK < victim->end ? next + CHUNK : victim->end;
+		if (i)
+			worker->steals++;
+		return 1;
+	}
+
+	return 0;
+}
+
+static uint64_t fmr_search_nanoseconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Sum of differences of the bins, in percent of both numbers of minutiae */
+static int fmr_search_histogram_difference(const struct fmr_search_summary *a,
+		const struct fmr_search_summary *b, int shifts)
+{
+	int na = a->number_minutiae, nb = b->number_minutiae;
+	int best = INT_MAX, shift, i;
+
+	if (!na || !nb)
+		return na == nb ? 0 : 200;
+
+	for (shift = -shifts; shift <= shifts; shift++) {
+		int difference = 0;
+
+		for (i = 0; i < HISTOGRAM_BINS; i++)
+			difference += abs(a->histogram[i] * nb -
+					b->histogram[(i + shift) &
+					(HISTOGRAM_BINS - 1)] * na);
+		if (difference < best)
+			best = difference;
+	}
+
+	return best * 100 / (na * nb);
+}
+
+/* First stage, summaries of all templates of the chunk, all in @part */
+static int fmr_search_summaries(struct fmr_search_worker *worker,
+		const struct fmr_search_part *part, uint64_t begin,
+		uint64_t end)
+{
+	struct fmr_search *search = worker->search;
+	const struct fmr_search_gallery *gallery = part->gallery;
+	const struct fmr_search_cascade *cascade = &search->cascade;
+	const struct fmr_search_summary *probe = &search->probe->summary;
+	struct fmr_search_stage_stats *stage =
+			&worker->stages[fmr_search_stage_summary];
+	int number = 0;
+
+	for (; begin < end; begin++) {
+		const struct fmr_search_entry *entry =
+				&gallery->entries[begin];
+		const struct fmr_search_summary *summary =
+				&gallery->summaries[entry->first_summary];
+		const uint8_t *template = gallery->templates + entry->offset;
+		const uint8_t *mcc = gallery->descriptors + entry->descriptors;
+		uint32_t t;
+
+		if (part->excluded && (__atomic_load_n(
+				&part->excluded[begin / 64],
+				__ATOMIC_RELAXED) >> (begin % 64)) & 1)
+			continue;
+
+		for (t = 0; t < entry->number_templates; t++, summary++) {
+			int n = summary->number_minutiae;
+			int smaller = n < probe->number_minutiae ?
+					n : probe->number_minutiae;
+			int bigger = n + probe->number_minutiae - smaller;
+			struct fmr_search_survivor *survivor;
+
+			survivor = &worker->survivors[number];
+			survivor->template = (const void *)template;
+			survivor->mcc = (const void *)mcc;
+			survivor->entry = begin;
+			template += fmr_search_template_size(n);
+			if (gallery->has_descriptors)
+				mcc += fmr_mcc_size(n);
+
+			if (probe->finger_position &&
+					summary->finger_position &&
+					summary->finger_position !=
+					probe->finger_position)
+				continue;
+			if (smaller * 100 < bigger * cascade->minutiae_ratio)
+				continue;
+			if (cascade->histogram_difference < 200 &&
+					fmr_search_histogram_difference(probe,
+					summary, search->histogram_shifts) >
+					cascade->histogram_difference)
+				continue;
+
+			number++;
+		}
+		stage->templates += entry->number_templates;
+	}
+	stage->passed += number;
+
+	return number;
+}
+
+/* Second stage, descriptors of the ones left, in place */
+static int fmr_search_descriptors(struct fmr_search_worker *worker,
+		int number_survivors)
+{
+	struct fmr_search *search = worker->search;
+	struct fmr_search_stage_stats *stage =
+			&worker->stages[fmr_search_stage_descriptors];
+	int number = 0, i;
+
+	stage->templates += number_survivors;
+	if (!search->cascade.descriptors_score) {
+		stage->passed += number_survivors;
+		return number_survivors;
+	}
+
+	for (i = 0; i < number_survivors; i++) {
+		struct fmr_search_survivor *survivor = &worker->survivors[i];
+
+		if (fmr_mcc_compare(search->probe->mcc, survivor->mcc) >=
+				search->cascade.descriptors_score)
+			worker->survivors[number++] = *survivor;
+	}
+	stage->passed += number;
+
+	return number;
+}
+
+/* Last stage, the matcher, and the entries' best scores as candidates */
+static void fmr_search_matcher(struct fmr_search_worker *worker,
+		const struct fmr_search_part *part, int number_survivors)
+{
+	struct fmr_search *search = worker->search;
+	const struct fmr_search_entry *entries = part->gallery->entries;
+	struct fmr_search_stage_stats *stage =
+			&worker->stages[fmr_search_stage_matcher];
+	uint32_t entry = 0;
+	int best = -1, i;
+
+	for (i = 0; i < number_survivors; i++) {
+		const struct fmr_search_survivor *survivor =
+				&worker->survivors[i];
+		int score;
+
+		if (survivor->entry != entry && best >= 0) {
+			fmr_search_heap_push(worker, search->k,
+					entries[entry].id, best);
+			best = -1;
+		}
+		entry = survivor->entry;
+
+		score = fmr_match_compare(search->probe->template,
+				survivor->template);
+		worker->comparisons++;
+		if (score < search->cascade.score)
+			continue;
+		stage->passed++;
+		if (score > best)
+			best = score;
+	}
+	if (best >= 0)
+		fmr_search_heap_push(worker, search->k, entries[entry].id,
+				best);
+	stage->templates += number_survivors;
+}
+
+/* Entries from @begin to @end, all of one part, through all stages */
+static void fmr_search_chunk(struct fmr_search_worker *worker,
+		const struct fmr_search_part *part, uint64_t begin,
+		uint64_t end)
+{
+	uint64_t start, now;
+	int number;
+
+	start = fmr_search_nanoseconds();
+	number = fmr_search_summaries(worker, part, begin, end);
+	now = fmr_search_nanoseconds();
+	worker->stages[fmr_search_stage_summary].nanoseconds += now - start;
+
+	start = now;
+	number = fmr_search_descriptors(worker, number);
+	now = fmr_search_nanoseconds();
+	worker->stages[fmr_search_stage_descriptors].nanoseconds +=
+			now - start;
+
+	start = now;
+	fmr_search_matcher(worker, part, number);
+	now = fmr_search_nanoseconds();
+	worker->stages[fmr_search_stage_matcher].nanoseconds += now - start;
+}
+
+static void *fmr_search_worker(void *context)
+{
+	struct fmr_search_worker *worker = context;
+	struct fmr_search *search = worker->search;
+	uint64_t begin, end, next;
+	int p;
+
+	/* A chunk may span a few parts, the small ones */
+	while (fmr_search_next(worker, &begin, &end)) {
+		for (p = 0; search->first[p + 1] <= begin; p++)
+			;
+		for (; begin < end; begin = next, p++) {
+			next = end < search->first[p + 1] ?
+					end : search->first[p + 1];
+			fmr_search_chunk(worker, &search->parts[p],
+					begin - search->first[p],
+					next - search->first[p]);
+		}
+	}
+
+	return NULL;
+}
+
+static int fmr_search_candidate_cmp(const void *a, const void *b)
+{
+	if (fmr_search_worse(a, b))
+		return 1;
+
+	return fmr_search_worse(b, a) ? -1 : 0;
+}
+
+/* Finger position, and nothing else, before the matcher */
+static const struct fmr_search_cascade fmr_search_no_cascade = {
+	.minutiae_ratio = 0,
+	.histogram_difference = 200,
+	.rotation = 0,
+	.descriptors_score = 0,
+	.score = 0,
+};
+
+static int fmr_search_run(const struct fmr_search_part *parts,
+		int number_parts, const struct fmr_search_probe *probe,
+		const struct fmr_search_cascade *cascade,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats)
+{
+	struct fmr_search search;
+	struct fmr_search_candidate *heaps, *all;
+	struct fmr_search_survivor *survivors;
+	uint32_t max_templates = 0;
+	size_t chunk_templates;
+	uint64_t n;
+	int i, s, started, number_candidates = 0;
+
+	if (!cascade)
+		cascade = &fmr_search_no_cascade;
+	if (k < 1 || threads < 0 || number_parts < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < number_parts; i++) {
+		const struct fmr_search_gallery *gallery = parts[i].gallery;
+
+		if (cascade->descriptors_score && !gallery->has_descriptors) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (gallery->max_templates > max_templates)
+			max_templates = gallery->max_templates;
+	}
+	chunk_templates = (size_t)CHUNK * max_templates;
+	if (!threads)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > THREADS_MAX)
+		threads = THREADS_MAX;
+
+	search.parts = parts;
+	search.number_parts = number_parts;
+	search.probe = probe;
+	search.cascade = *cascade;
+	search.histogram_shifts = cascade->rotation >= 128 ?
+			HISTOGRAM_BINS / 2 : (cascade->rotation +
+			(1 << HISTOGRAM_SHIFT) - 1) >> HISTOGRAM_SHIFT;
+	search.k = k;
+	search.number_workers = threads;
+	search.first = malloc(sizeof(*search.first) * (number_parts + 1));
+	search.workers = aligned_alloc(64, sizeof(*search.workers) * threads);
+	heaps = malloc(sizeof(*heaps) * k * threads);
+	survivors = malloc(sizeof(*survivors) * (chunk_templates ?
+			chunk_templates : 1) * threads);
+	if (!search.first || !search.workers || !heaps || !survivors) {
+		free(search.first);
+		free(search.workers);
+		free(heaps);
+		free(survivors);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0, n = 0; i < number_parts; i++) {
+		search.first[i] = n;
+		n += parts[i].gallery->number_entries;
+	}
+	search.first[number_parts] = n;
+
+	for (i = 0; i < threads; i++) {
+		struct fmr_search_worker *worker = &search.workers[i];
+
+		worker->search = &search;
+		worker->index = i;
+		atomic_init(&worker->next, n * i / threads);
+		worker->end = n * (i + 1) / threads;
+		worker->heap = heaps + (size_t)k * i;
+		worker->number_candidates = 0;
+		worker->survivors = survivors + chunk_templates * i;
+		worker->comparisons = 0;
+		worker->steals = 0;
+		memset(worker->stages, 0, sizeof(worker->stages));
+	}
+
+	/* The calling thread is one of the workers */
+	for (started = 1; started < threads; started++) {
+		if (pthread_create(&search.workers[started].thread, NULL,
+				fmr_search_worker,
+				&search.workers[started]))
+			break;
+	}
+	fmr_search_worker(&search.workers[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(search.workers[i].thread, NULL);
+
+	/* Threads that failed to start had their shares stolen anyway */
+	if (stats) {
+		memset(stats, 0, sizeof(*stats));
+		stats->threads = started;
+	}
+	all = heaps;
+	for (i = 0; i < threads; i++) {
+		struct fmr_search_worker *worker = &search.workers[i];
+
+		memmove(all + number_candidates, worker->heap,
+				sizeof(*all) * worker->number_candidates);
+		number_candidates += worker->number_candidates;
+		if (!stats)
+			continue;
+		stats->comparisons += worker->comparisons;
+		stats->steals += worker->steals;
+		for (s = 0; s < __fmr_search_stages; s++) {
+			stats->stages[s].templates +=
+					worker->stages[s].templates;
+			stats->stages[s].passed += worker->stages[s].passed;
+			stats->stages[s].nanoseconds +=
+					worker->stages[s].nanoseconds;
+		}
+	}
+	qsort(all, number_candidates, sizeof(*all), fmr_search_candidate_cmp);
+	if (number_candidates > k)
+		number_candidates = k;
+	memcpy(candidates, all, sizeof(*candidates) * number_candidates);
+
+	free(search.first);
+	free(search.workers);
+	free(heaps);
+	free(survivors);
+
+	return number_candidates;
+}
+
+int fmr_search(const struct fmr_search_gallery *gallery,
+		const struct fmr_match_template *probe, uint8_t finger_position,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats)
+{
+	struct fmr_search_probe search_probe = {
+		.summary.finger_position = finger_position,
+		.template = probe,
+	};
+	struct fmr_search_part part = { gallery, NULL };
+
+	return fmr_search_run(&part, 1, &search_probe, NULL, candidates, k,
+			threads, stats);
+}
+
+int fmr_search_cascade(const struct fmr_search_gallery *gallery,
+		const struct fmr_search_probe *probe,
+		const struct fmr_search_cascade *cascade,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats)
+{
+	struct fmr_search_part part = { gallery, NULL };
+
+	return fmr_search_run(&part, 1, probe, cascade, candidates, k, threads,
+			stats);
+}
+
+int fmr_search_cascade_excluding(const struct fmr_search_gallery *gallery,
+		const uint64_t *excluded, const struct fmr_search_probe *probe,
+		const struct fmr_search_cascade *cascade,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats)
+{
+	struct fmr_search_part part = { gallery, excluded };
+
+	return fmr_search_run(&part, 1, probe, cascade, candidates, k, threads,
+			stats);
+}
+
+int fmr_search_cascade_parts(const struct fmr_search_part *parts,
+		int number_parts, const struct fmr_search_probe *probe,
+		const struct fmr_search_cascade *cascade,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats)
+{
+	return fmr_search_run(parts, number_parts, probe, cascade, candidates,
+			k, threads, stats);
+}
@@ -0,0 +1,192 @@
+#ifndef __FMR_SEARCH_H
+#define __FMR_SEARCH_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "match.h"
+#include "mcc.h"
+
+/*
+ * 1:N identification. Gallery is a set of entries, each made of the
+ * templates of all views (representations) of one record, identified by
+ * a caller-chosen id. Templates of all entries are packed, one after
+ * another, in a single block of memory, and the entries' table is kept
+ * apart from them, so that a search is a linear walk through both.
+ *
+ * Every template has a summary, its finger position, number of minutiae
+ * and a histogram of their directions, 16 bytes, in a packed array of
+ * its own. That's all the first stage of a cascade search looks at, so
+ * most of the gallery is rejected without touching the templates at all.
+ */
+struct fmr_search_gallery;
+
+struct fmr_search_gallery *fmr_search_gallery_create(void);
+void fmr_search_gallery_free(struct fmr_search_gallery *gallery);
+
+/*
+ * Keep MCC descriptors (see mcc.h) of every template as well, for the
+ * second stage of a cascade search. That's about 5 times the memory of
+ * the templates, so it's off by default. Only for an empty gallery,
+ * returns -1 with errno EBUSY otherwise.
+ */
+int fmr_search_gallery_enable_descriptors(struct fmr_search_gallery *gallery);
+
+/*
+ * Add a v20 or v030 record in @buffer (of any version, as the version
+ * field says) as a new entry. Returns -1, with errno set, on failure,
+ * EINVAL for an invalid record.
+ */
+int fmr_search_gallery_add_record(struct fmr_search_gallery *gallery,
+		uint32_t id, const void *buffer, size_t len);
+int fmr_search_gallery_add_v20(struct fmr_search_gallery *gallery,
+		uint32_t id, const struct iso_fmr_v20 *record);
+int fmr_search_gallery_add_v030(struct fmr_search_gallery *gallery,
+		uint32_t id, const struct iso_fmr_v030 *record);
+
+/* Entry of a single template, of @minutiae scaled already */
+int fmr_search_gallery_add_minutiae(struct fmr_search_gallery *gallery,
+		uint32_t id, uint8_t finger_position,
+		const struct fmr_match_minutia *minutiae, int number_minutiae);
+
+/*
+ * Append all entries of @source, but those with their bit set in
+ * @excluded (bit i % 64 of word i / 64 for entry i), NULL for none.
+ * Descriptors are copied too, @source must have them if @gallery does.
+ */
+int fmr_search_gallery_merge(struct fmr_search_gallery *gallery,
+		const struct fmr_search_gallery *source, const uint64_t *excluded);
+
+uint32_t fmr_search_gallery_get_number_entries(
+		const struct fmr_search_gallery *gallery);
+/* Id of the entry at @index, in order of addition */
+uint32_t fmr_search_gallery_get_id(const struct fmr_search_gallery *gallery,
+		uint32_t index);
+/* Memory taken by the templates, summaries and descriptors, in bytes */
+size_t fmr_search_gallery_get_size(const struct fmr_search_gallery *gallery);
+
+struct fmr_search_candidate {
+	uint32_t id;
+	int score;
+};
+
+enum fmr_search_stage {
+	fmr_search_stage_summary,
+	fmr_search_stage_descriptors,
+	fmr_search_stage_matcher,
+	__fmr_search_stages,
+};
+
+struct fmr_search_stage_stats {
+	/* Templates getting to the stage, and passing it */
+	uint64_t templates;
+	uint64_t passed;
+	/* Time spent in the stage, by all threads */
+	uint64_t nanoseconds;
+};
+
+struct fmr_search_stats {
+	uint64_t comparisons;
+	/* Chunks of entries taken by threads from the others' share */
+	uint64_t steals;
+	int threads;
+	struct fmr_search_stage_stats stages[__fmr_search_stages];
+};
+
+/*
+ * Compare @probe, of @finger_position (0 for unknown), with every entry
+ * of the gallery, using @threads threads (all online CPUs for 0) and put
+ * up to @k best candidates, best first, in @candidates. An entry's score
+ * is the best one of its templates of the same, or unknown, finger, and
+ * entries with no such templates are not candidates at all. Returns the
+ * number of candidates, or -1 with errno set.
+ */
+int fmr_search(const struct fmr_search_gallery *gallery,
+		const struct fmr_match_template *probe, uint8_t finger_position,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats);
+
+/*
+ * Probe of a cascade search: its template, summary and descriptors, in
+ * a single block, released with free()
+ */
+struct fmr_search_probe;
+
+struct fmr_search_probe *fmr_search_probe_create(
+		const struct fmr_match_minutia *minutiae, int number_minutiae,
+		uint8_t finger_position);
+
+/*
+ * Thresholds of the stages, a template failing any of them is dropped:
+ *
+ * 1. Summary: finger position, the same or unknown; number of minutiae,
+ *    the smaller one at least @minutiae_ratio percent of the bigger one;
+ *    directions histograms, different by @histogram_difference percent at
+ *    most (0 for the same, 200 for disjoint ones) for the best of the
+ *    rotations up to @rotation angle units (128 or more for any rotation).
+ * 2. Descriptors: MCC similarity at least @descriptors_score, 0 skips the
+ *    stage, which is the only choice for a gallery with no descriptors.
+ * 3. Matcher: score at least @score.
+ */
+struct fmr_search_cascade {
+	int minutiae_ratio;
+	int histogram_difference;
+	int rotation;
+	int descriptors_score;
+	int score;
+};
+
+/* Thresholds dropping next to no genuine candidates */
+void fmr_search_cascade_init(struct fmr_search_cascade *cascade);
+
+/*
+ * As fmr_search(), with the candidates going through @cascade, or only
+ * the finger position check and the matcher for NULL. Stages run one
+ * after another on chunks of entries, and the stats have the number of
+ * templates passing every one and time spent in it.
+ */
+int fmr_search_cascade(const struct fmr_search_gallery *gallery,
+		const struct fmr_search_probe *probe,
+		const struct fmr_search_cascade *cascade,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats);
+
+/*
+ * As fmr_search_cascade(), skipping entries with their bit set in
+ * @excluded, as in fmr_search_gallery_merge(). Bits may be set by other
+ * threads during the search, with __atomic builtins, the entries are
+ * skipped or not then.
+ */
+int fmr_search_cascade_excluding(const struct fmr_search_gallery *gallery,
+		const uint64_t *excluded, const struct fmr_search_probe *probe,
+		const struct fmr_search_cascade *cascade,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats);
+
+/* Gallery, and its entries skipped, as in fmr_search_cascade_excluding() */
+struct fmr_search_part {
+	const struct fmr_search_gallery *gallery;
+	const uint64_t *excluded;
+};
+
+/*
+ * As fmr_search_cascade_excluding(), in all @number_parts galleries at
+ * once, by one pool of threads, sharing out the entries of all of them.
+ * Entries of the same id in different parts are different candidates.
+ */
+int fmr_search_cascade_parts(const struct fmr_search_part *parts,
+		int number_parts, const struct fmr_search_probe *probe,
+		const struct fmr_search_cascade *cascade,
+		struct fmr_search_candidate *candidates, int k, int threads,
+		struct fmr_search_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __FMR_TRIG_H
+#define __FMR_TRIG_H
+
+#include <stdint.h>
+
+/* Cosine of the 256 angle units, in Q14 fixed point, in match.c */
+extern const int16_t fmr_match_cos[256];
+
+static inline int fmr_match_sin(uint8_t angle)
+{
+	return fmr_match_cos[(uint8_t)(angle - 64)];
+}
+
+/* Direction of the vector, counter-clockwise, y growing downwards */
+uint8_t fmr_match_atan2(int dx, int dy);
+/* Integer square root, rounded down */
+unsigned int fmr_match_sqrt(unsigned int val);
+
+#endif
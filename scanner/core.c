@@ -1,17 +1,129 @@
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include "driver.h"
 
-#define SCANNERS_MAX 8
+#define SCANNERS_MAX 32
+
+/* How often pending asynchronous scans are checked */
+#define SCAN_POLL_MS 5
 
 struct scanner {
-	struct scanner_ops *ops;
+	struct scanner_device_ops *ops;
+	void *context;
 	int in_use;
+
+	/* Asynchronous scan, all under scan_lock */
+	int pending, cancel, result, in_callback;
+	struct timespec deadline;
+	void (*callback)(struct scanner *scanner, int result, void *data);
+	void *data;
+	int fd;
+
+	/* Stream, filled by the API thread for @streaming, under scan_lock */
+	struct scanner_stream *stream;
+	int streaming, polling;
+};
+
+/*
+ * Ring of frames: slots are taken by the driver (acquired) for the next
+ * frame, the oldest one first, except for the one held by the user, and
+ * become ready when committed.
+ */
+struct scanner_stream_slot {
+	enum {
+		slot_free,
+		slot_writing,
+		slot_ready,
+	} state;
+	int size;
+	unsigned long long sequence;
+	struct timespec timestamp;
+};
+
+struct scanner_stream {
+	pthread_mutex_t lock;
+	int number_frames, frame_size;
+	unsigned char *buffers;
+	struct scanner_stream_slot *slots;
+	/* Slot held by the user, -1 for none */
+	int held;
+	/* Sequence of the next committed frame, and next one to be pulled */
+	unsigned long long sequence, read_sequence;
+	unsigned long long overruns;
+	int fd;
 };
 
 static const char *scanner_names[SCANNERS_MAX];
 static struct scanner scanners[SCANNERS_MAX];
 static int scanners_number;
 
+/*
+ * The thread checking pending scans, and filling streams of drivers with
+ * no streaming of their own, runs while there are some
+ */
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t scan_done = PTHREAD_COND_INITIALIZER;
+static int scanners_active;
+static int scan_thread_running;
+
+/* Drivers with no contexts, their ops being the context */
+
+static int legacy_on(void *context)
+{
+	struct scanner_ops *ops = context;
+
+	return ops->on();
+}
+
+static void legacy_off(void *context)
+{
+	struct scanner_ops *ops = context;
+
+	ops->off();
+}
+
+static int legacy_get_caps(void *context, struct scanner_caps *caps)
+{
+	struct scanner_ops *ops = context;
+
+	return ops->get_caps(caps);
+}
+
+static int legacy_scan(void *context, int timeout)
+{
+	struct scanner_ops *ops = context;
+
+	return ops->scan(timeout);
+}
+
+static int legacy_get_image(void *context, void *buffer, int size)
+{
+	struct scanner_ops *ops = context;
+
+	return ops->get_image(buffer, size);
+}
+
+static int legacy_get_iso_template(void *context, void *buffer, int size)
+{
+	struct scanner_ops *ops = context;
+
+	return ops->get_iso_template(buffer, size);
+}
+
+static struct scanner_device_ops legacy_ops = {
+	.on = legacy_on,
+	.off = legacy_off,
+	.get_caps = legacy_get_caps,
+	.scan = legacy_scan,
+	.get_image = legacy_get_image,
+	.get_iso_template = legacy_get_iso_template,
+};
+
 const char **scanner_list(int *number)
 {
 	*number = scanners_number;
@@ -20,29 +132,43 @@ const char **scanner_list(int *number)
 
 }
 
-int scanner_register(const char *name, struct scanner_ops *ops)
+int scanner_register_devices(const char **names, struct scanner_device_ops *ops,
+		void **contexts, int number)
 {
-	if (scanners_number == SCANNERS_MAX)
+	int i;
+
+	if (number < 1 || number > SCANNERS_MAX - scanners_number)
 		return -1;
 
-	scanner_names[scanners_number] = name;
-	scanners[scanners_number].ops = ops;
+	for (i = 0; i < number; i++) {
+		scanner_names[scanners_number] = names[i];
+		scanners[scanners_number].ops = ops;
+		scanners[scanners_number].context = contexts[i];
+		scanners[scanners_number].result = SCANNER_SCAN_CANCELLED;
+		scanners[scanners_number].fd = -1;
 
-	scanners_number++;
+		scanners_number++;
+	}
 
 	return 0;
 }
 
+int scanner_register(const char *name, struct scanner_ops *ops)
+{
+	void *context = ops;
+
+	return scanner_register_devices(&name, &legacy_ops, &context, 1);
+}
+
 struct scanner *scanner_get(const char *name)
 {
 	int i;
 
 	for (i = 0; i < scanners_number; i++) {
-		if (!scanners[i].in_use &&
-				strcmp(name, scanner_names[i]) == 0) {
-			scanners[i].in_use = 1;
+		if (strcmp(name, scanner_names[i]) == 0 &&
+				!__atomic_exchange_n(&scanners[i].in_use, 1,
+				__ATOMIC_ACQUIRE))
 			return &scanners[i];
-		}
 	}
 
 	return NULL;
@@ -50,35 +176,647 @@ struct scanner *scanner_get(const char *name)
 
 void scanner_put(struct scanner *scanner)
 {
-	scanner->in_use = 0;
+	scanner_stream_stop(scanner);
+
+	pthread_mutex_lock(&scan_lock);
+	while (scanner->pending || scanner->in_callback) {
+		if (scanner->pending) {
+			scanner->cancel = 1;
+			pthread_cond_signal(&scan_work);
+		}
+		pthread_cond_wait(&scan_done, &scan_lock);
+	}
+	if (scanner->fd >= 0) {
+		close(scanner->fd);
+		scanner->fd = -1;
+	}
+	pthread_mutex_unlock(&scan_lock);
+
+	__atomic_store_n(&scanner->in_use, 0, __ATOMIC_RELEASE);
 }
 
 int scanner_on(struct scanner *scanner)
 {
-	return scanner->ops->on();
+	return scanner->ops->on(scanner->context);
 }
 
 void scanner_off(struct scanner *scanner)
 {
-	scanner->ops->off();
+	scanner->ops->off(scanner->context);
 }
 
 int scanner_get_caps(struct scanner *scanner, struct scanner_caps *caps)
 {
-	return scanner->ops->get_caps(caps);
+	return scanner->ops->get_caps(scanner->context, caps);
 }
 
 int scanner_scan(struct scanner *scanner, int timeout)
 {
-	return scanner->ops->scan(timeout);
+	return scanner->ops->scan(scanner->context, timeout);
 }
 
 int scanner_get_image(struct scanner *scanner, void *buffer, int size)
 {
-	return scanner->ops->get_image(buffer, size);
+	return scanner->ops->get_image(scanner->context, buffer, size);
 }
 
 int scanner_get_iso_template(struct scanner *scanner, void *buffer, int size)
 {
-	return scanner->ops->get_iso_template(buffer, size);
+	return scanner->ops->get_iso_template(scanner->context, buffer, size);
+}
+
+static int capture_fallback(struct scanner *scanner, int timeout,
+		struct scanner_capture *capture)
+{
+	struct scanner_caps caps;
+	int err;
+
+	err = scanner->ops->get_caps(scanner->context, &caps);
+	if (err)
+		return err;
+
+	err = scanner->ops->scan(scanner->context, timeout);
+	if (err)
+		return err;
+
+	capture->image_format = caps.image_format;
+	capture->image_width = caps.image_width;
+	capture->image_height = caps.image_height;
+
+	if (capture->image)
+		capture->image_length = scanner->ops->get_image(
+				scanner->context, capture->image,
+				capture->image_size);
+	if (capture->iso_template)
+		capture->iso_template_length = scanner->ops->get_iso_template(
+				scanner->context, capture->iso_template,
+				capture->iso_template_size);
+
+	return 0;
+}
+
+int scanner_capture(struct scanner *scanner, int timeout,
+		struct scanner_capture *capture)
+{
+	int err;
+
+	capture->image_length = 0;
+	capture->iso_template_length = 0;
+
+	if (scanner->ops->capture)
+		err = scanner->ops->capture(scanner->context, timeout, capture);
+	else
+		err = capture_fallback(scanner, timeout, capture);
+
+	if (!err)
+		clock_gettime(CLOCK_MONOTONIC, &capture->timestamp);
+
+	return err;
+}
+
+void scanner_buffer_init(struct scanner_buffer *buffer, const void *data,
+		int size, void (*release)(struct scanner_buffer *buffer))
+{
+	buffer->data = data;
+	buffer->size = size;
+	buffer->refs = 1;
+	buffer->release = release;
+}
+
+void scanner_buffer_get(struct scanner_buffer *buffer)
+{
+	__atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+}
+
+void scanner_buffer_put(struct scanner_buffer *buffer)
+{
+	if (!__atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) &&
+			buffer->release)
+		buffer->release(buffer);
+}
+
+/* Buffer of drivers with no buffers of their own, a copy */
+struct copied_buffer {
+	struct scanner_buffer buffer;
+	unsigned char data[];
+};
+
+static void copied_buffer_release(struct scanner_buffer *buffer)
+{
+	free(buffer);
+}
+
+static struct scanner_buffer *copied_buffer_create(struct scanner *scanner,
+		int (*get)(void *context, void *buffer, int size))
+{
+	struct copied_buffer *copy;
+	int size = get(scanner->context, NULL, 0);
+
+	if (size < 0)
+		return NULL;
+
+	copy = malloc(sizeof(*copy) + size);
+	if (!copy)
+		return NULL;
+
+	if (get(scanner->context, copy->data, size) != size) {
+		free(copy);
+		return NULL;
+	}
+	scanner_buffer_init(&copy->buffer, copy->data, size,
+			copied_buffer_release);
+
+	return &copy->buffer;
+}
+
+struct scanner_buffer *scanner_get_image_buffer(struct scanner *scanner)
+{
+	if (scanner->ops->get_image_buffer)
+		return scanner->ops->get_image_buffer(scanner->context);
+
+	return copied_buffer_create(scanner, scanner->ops->get_image);
+}
+
+struct scanner_buffer *scanner_get_iso_template_buffer(struct scanner *scanner)
+{
+	if (scanner->ops->get_iso_template_buffer)
+		return scanner->ops->get_iso_template_buffer(scanner->context);
+
+	return copied_buffer_create(scanner, scanner->ops->get_iso_template);
+}
+
+/* Called with scan_lock held, which is dropped for the callback */
+static void scan_complete(struct scanner *scanner, int result)
+{
+	void (*callback)(struct scanner *scanner, int result, void *data);
+	void *data = scanner->data;
+
+	callback = scanner->callback;
+	scanner->pending = 0;
+	scanner->result = result;
+	scanners_active--;
+	if (scanner->fd >= 0)
+		eventfd_write(scanner->fd, 1);
+
+	if (callback) {
+		scanner->in_callback = 1;
+		pthread_mutex_unlock(&scan_lock);
+		callback(scanner, result, data);
+		pthread_mutex_lock(&scan_lock);
+		scanner->in_callback = 0;
+	}
+	pthread_cond_broadcast(&scan_done);
+}
+
+static int scan_expired(const struct scanner *scanner)
+{
+	struct timespec now;
+
+	if (scanner->deadline.tv_sec < 0)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec > scanner->deadline.tv_sec ||
+			(now.tv_sec == scanner->deadline.tv_sec &&
+			now.tv_nsec >= scanner->deadline.tv_nsec);
+}
+
+/* Called with scan_lock held, which is dropped for the ops */
+static void stream_poll(struct scanner *scanner)
+{
+	struct scanner_stream *stream = scanner->stream;
+	void *buffer;
+	int size;
+
+	scanner->polling = 1;
+	pthread_mutex_unlock(&scan_lock);
+
+	if (!scanner->ops->scan(scanner->context, 0)) {
+		buffer = scanner_stream_acquire(stream, &size);
+		size = scanner->ops->get_image(scanner->context, buffer, size);
+		scanner_stream_commit(stream, buffer,
+				size <= stream->frame_size ? size : 0);
+	}
+
+	pthread_mutex_lock(&scan_lock);
+	scanner->polling = 0;
+	pthread_cond_broadcast(&scan_done);
+}
+
+static void *scan_thread(void *arg)
+{
+	int i, result;
+
+	pthread_mutex_lock(&scan_lock);
+	while (scanners_active) {
+		struct timespec wait;
+
+		for (i = 0; i < scanners_number; i++) {
+			struct scanner *scanner = &scanners[i];
+
+			if (scanner->streaming) {
+				stream_poll(scanner);
+				continue;
+			}
+
+			if (!scanner->pending)
+				continue;
+
+			/* Only this thread calls the ops of pending scanners */
+			result = SCANNER_SCAN_CANCELLED;
+			if (!scanner->cancel) {
+				pthread_mutex_unlock(&scan_lock);
+				result = scanner->ops->scan(scanner->context, 0);
+				pthread_mutex_lock(&scan_lock);
+			}
+
+			if (scanner->cancel)
+				result = SCANNER_SCAN_CANCELLED;
+			else if (result == -1 && !scan_expired(scanner))
+				continue;
+
+			scan_complete(scanner, result);
+		}
+
+		if (!scanners_active)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &wait);
+		wait.tv_nsec += SCAN_POLL_MS * 1000000;
+		if (wait.tv_nsec >= 1000000000) {
+			wait.tv_sec++;
+			wait.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&scan_work, &scan_lock, &wait);
+	}
+	scan_thread_running = 0;
+	pthread_mutex_unlock(&scan_lock);
+
+	return NULL;
+}
+
+/* Called with scan_lock held */
+static int scan_thread_start(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int err;
+
+	if (scan_thread_running)
+		return 0;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	err = pthread_create(&thread, &attr, scan_thread, NULL);
+	pthread_attr_destroy(&attr);
+	if (err)
+		return -1;
+
+	scan_thread_running = 1;
+
+	return 0;
+}
+
+int scanner_scan_async(struct scanner *scanner, int timeout,
+		void (*callback)(struct scanner *scanner, int result,
+		void *data), void *data)
+{
+	eventfd_t count;
+
+	pthread_mutex_lock(&scan_lock);
+	if (scanner->pending || scanner->stream) {
+		pthread_mutex_unlock(&scan_lock);
+		return -1;
+	}
+
+	if (scan_thread_start()) {
+		pthread_mutex_unlock(&scan_lock);
+		return -2;
+	}
+
+	if (timeout < 0) {
+		scanner->deadline.tv_sec = -1;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &scanner->deadline);
+		scanner->deadline.tv_sec += timeout / 1000;
+		scanner->deadline.tv_nsec += (timeout % 1000) * 1000000;
+		if (scanner->deadline.tv_nsec >= 1000000000) {
+			scanner->deadline.tv_sec++;
+			scanner->deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	/* Previous scan's completion is not signalled any more */
+	if (scanner->fd >= 0)
+		eventfd_read(scanner->fd, &count);
+
+	scanner->callback = callback;
+	scanner->data = data;
+	scanner->cancel = 0;
+	scanner->result = SCANNER_SCAN_PENDING;
+	scanner->pending = 1;
+	scanners_active++;
+	pthread_cond_signal(&scan_work);
+	pthread_mutex_unlock(&scan_lock);
+
+	return 0;
+}
+
+int scanner_scan_cancel(struct scanner *scanner)
+{
+	int err = -1;
+
+	pthread_mutex_lock(&scan_lock);
+	if (scanner->pending) {
+		scanner->cancel = 1;
+		pthread_cond_signal(&scan_work);
+		err = 0;
+	}
+	pthread_mutex_unlock(&scan_lock);
+
+	return err;
+}
+
+int scanner_get_fd(struct scanner *scanner)
+{
+	int fd;
+
+	pthread_mutex_lock(&scan_lock);
+	if (scanner->fd < 0)
+		scanner->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	fd = scanner->fd;
+	pthread_mutex_unlock(&scan_lock);
+
+	return fd < 0 ? -1 : fd;
+}
+
+int scanner_scan_result(struct scanner *scanner)
+{
+	eventfd_t count;
+	int result;
+
+	pthread_mutex_lock(&scan_lock);
+	result = scanner->result;
+	if (!scanner->pending && scanner->fd >= 0)
+		eventfd_read(scanner->fd, &count);
+	pthread_mutex_unlock(&scan_lock);
+
+	return result;
+}
+
+void *scanner_stream_acquire(struct scanner_stream *stream, int *size)
+{
+	int i, slot = -1;
+
+	pthread_mutex_lock(&stream->lock);
+	for (i = 0; i < stream->number_frames; i++) {
+		if (i == stream->held || stream->slots[i].state == slot_writing)
+			continue;
+		if (stream->slots[i].state == slot_free) {
+			slot = i;
+			break;
+		}
+		if (slot < 0 || stream->slots[i].sequence <
+				stream->slots[slot].sequence)
+			slot = i;
+	}
+
+	/* Frame never pulled is lost */
+	if (stream->slots[slot].state == slot_ready &&
+			stream->slots[slot].sequence >= stream->read_sequence)
+		stream->overruns++;
+	stream->slots[slot].state = slot_writing;
+	pthread_mutex_unlock(&stream->lock);
+
+	*size = stream->frame_size;
+
+	return stream->buffers + (size_t)slot * stream->frame_size;
+}
+
+void scanner_stream_commit(struct scanner_stream *stream, void *buffer,
+		int size)
+{
+	struct scanner_stream_slot *slot;
+
+	slot = &stream->slots[((unsigned char *)buffer - stream->buffers) /
+			stream->frame_size];
+
+	pthread_mutex_lock(&stream->lock);
+	if (size > 0) {
+		slot->state = slot_ready;
+		slot->size = size;
+		slot->sequence = stream->sequence++;
+		clock_gettime(CLOCK_MONOTONIC, &slot->timestamp);
+	} else {
+		slot->state = slot_free;
+	}
+	pthread_mutex_unlock(&stream->lock);
+
+	if (size > 0)
+		eventfd_write(stream->fd, 1);
+}
+
+static void stream_free(struct scanner_stream *stream)
+{
+	if (stream->fd >= 0)
+		close(stream->fd);
+	pthread_mutex_destroy(&stream->lock);
+	free(stream->slots);
+	free(stream->buffers);
+	free(stream);
+}
+
+static struct scanner_stream *stream_create(int number_frames, int frame_size)
+{
+	struct scanner_stream *stream = calloc(1, sizeof(*stream));
+
+	if (!stream)
+		return NULL;
+
+	pthread_mutex_init(&stream->lock, NULL);
+	stream->number_frames = number_frames;
+	stream->frame_size = frame_size;
+	stream->held = -1;
+	stream->buffers = malloc((size_t)number_frames * frame_size);
+	stream->slots = calloc(number_frames, sizeof(*stream->slots));
+	stream->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!stream->buffers || !stream->slots || stream->fd < 0) {
+		stream_free(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+int scanner_stream_start(struct scanner *scanner, int frames)
+{
+	struct scanner_stream *stream;
+	struct scanner_caps caps;
+	int err;
+
+	if (frames < 2 || scanner->ops->get_caps(scanner->context, &caps) ||
+			!caps.image || caps.image_width <= 0 ||
+			caps.image_height <= 0)
+		return -1;
+
+	stream = stream_create(frames, caps.image_width * caps.image_height);
+	if (!stream)
+		return -2;
+
+	pthread_mutex_lock(&scan_lock);
+	if (scanner->pending || scanner->stream) {
+		pthread_mutex_unlock(&scan_lock);
+		stream_free(stream);
+		return -1;
+	}
+
+	if (!scanner->ops->stream_start) {
+		if (scan_thread_start()) {
+			pthread_mutex_unlock(&scan_lock);
+			stream_free(stream);
+			return -2;
+		}
+		scanner->stream = stream;
+		scanner->streaming = 1;
+		scanners_active++;
+		pthread_cond_signal(&scan_work);
+		pthread_mutex_unlock(&scan_lock);
+
+		return 0;
+	}
+
+	scanner->stream = stream;
+	pthread_mutex_unlock(&scan_lock);
+
+	err = scanner->ops->stream_start(scanner->context, stream);
+	if (err) {
+		pthread_mutex_lock(&scan_lock);
+		scanner->stream = NULL;
+		pthread_mutex_unlock(&scan_lock);
+		stream_free(stream);
+	}
+
+	return err;
+}
+
+int scanner_stream_stop(struct scanner *scanner)
+{
+	struct scanner_stream *stream;
+
+	pthread_mutex_lock(&scan_lock);
+	stream = scanner->stream;
+	if (!stream) {
+		pthread_mutex_unlock(&scan_lock);
+		return -1;
+	}
+
+	if (scanner->streaming) {
+		scanner->streaming = 0;
+		scanners_active--;
+		while (scanner->polling)
+			pthread_cond_wait(&scan_done, &scan_lock);
+	}
+	pthread_mutex_unlock(&scan_lock);
+
+	if (scanner->ops->stream_stop)
+		scanner->ops->stream_stop(scanner->context);
+
+	pthread_mutex_lock(&scan_lock);
+	scanner->stream = NULL;
+	pthread_mutex_unlock(&scan_lock);
+	stream_free(stream);
+
+	return 0;
+}
+
+int scanner_stream_get_fd(struct scanner *scanner)
+{
+	return scanner->stream ? scanner->stream->fd : -1;
+}
+
+/* Called with the stream lock held */
+static void stream_hold(struct scanner_stream *stream, int slot,
+		struct scanner_frame *frame)
+{
+	stream->held = slot;
+	frame->image = stream->buffers + (size_t)slot * stream->frame_size;
+	frame->size = stream->slots[slot].size;
+	frame->sequence = stream->slots[slot].sequence;
+	frame->timestamp = stream->slots[slot].timestamp;
+	frame->overruns = stream->overruns;
+}
+
+/* Called with the stream lock held, @newest or the oldest not pulled yet */
+static int stream_find(struct scanner_stream *stream, int newest)
+{
+	int i, slot = -1;
+
+	for (i = 0; i < stream->number_frames; i++) {
+		const struct scanner_stream_slot *s = &stream->slots[i];
+
+		if (s->state != slot_ready || (!newest &&
+				s->sequence < stream->read_sequence))
+			continue;
+		if (slot < 0 || (newest ? s->sequence >
+				stream->slots[slot].sequence : s->sequence <
+				stream->slots[slot].sequence))
+			slot = i;
+	}
+
+	return slot;
+}
+
+static int stream_get(struct scanner *scanner, struct scanner_frame *frame,
+		int newest)
+{
+	struct scanner_stream *stream = scanner->stream;
+	eventfd_t count;
+	int slot;
+
+	if (!stream)
+		return -2;
+
+	pthread_mutex_lock(&stream->lock);
+	if (stream->held >= 0) {
+		pthread_mutex_unlock(&stream->lock);
+		return -2;
+	}
+
+	slot = stream_find(stream, newest);
+	if (slot < 0) {
+		/* Drained here, so that frames committed later signal it */
+		eventfd_read(stream->fd, &count);
+		pthread_mutex_unlock(&stream->lock);
+		return -1;
+	}
+
+	stream_hold(stream, slot, frame);
+	if (!newest)
+		stream->read_sequence = frame->sequence + 1;
+	pthread_mutex_unlock(&stream->lock);
+
+	return 0;
+}
+
+int scanner_stream_pull(struct scanner *scanner, struct scanner_frame *frame)
+{
+	return stream_get(scanner, frame, 0);
+}
+
+int scanner_stream_peek(struct scanner *scanner, struct scanner_frame *frame)
+{
+	return stream_get(scanner, frame, 1);
+}
+
+void scanner_stream_release(struct scanner *scanner)
+{
+	struct scanner_stream *stream = scanner->stream;
+
+	if (!stream)
+		return;
+
+	pthread_mutex_lock(&stream->lock);
+	stream->held = -1;
+	pthread_mutex_unlock(&stream->lock);
 }
@@ -8,6 +8,8 @@ extern "C"
 
 #include "scanner.h"
 
+struct scanner_stream;
+
 /**
  * struct scanner_ops - scanner driver operations
  *
@@ -29,6 +31,55 @@ struct scanner_ops {
 	int (*get_iso_template)(void *buffer, int size);
 };
 
+/**
+ * struct scanner_device_ops - scanner device driver operations
+ *
+ * Same as struct scanner_ops, but every operation is given the context
+ * of the device it is called for, as registered with
+ * scanner_register_devices(), so that one driver can serve a number of
+ * devices. Operations of different devices may be called at the same time,
+ * from different threads; operations of one device are never called
+ * at the same time.
+ *
+ * @on:			scanner_on() implementation
+ * @off:		scanner_off() implementation
+ * @get_caps:		scanner_get_caps() implementation
+ * @scan:		scanner_scan() implementation
+ * @get_image:		scanner_get_image() implementation
+ * @get_iso_template:	scanner_get_iso_template() implementation
+ * @stream_start:	optional, start pushing frames into the @stream (see
+ *				scanner_stream_acquire()), until @stream_stop;
+ *				with no @stream_start, the scanner API fills
+ *				streams checking @scan and calling @get_image
+ * @stream_stop:	stop pushing frames, none may be pushed after
+ *				it returns
+ * @get_image_buffer:	optional, scanner_get_image_buffer() implementation,
+ *				with no @get_image_buffer, the scanner API
+ *				copies the image from @get_image
+ * @get_iso_template_buffer: optional,
+ *				scanner_get_iso_template_buffer() implementation,
+ *				with no @get_iso_template_buffer, the scanner
+ *				API copies the template from @get_iso_template
+ * @capture:		optional, scanner_capture() implementation, filling
+ *				the descriptor but the timestamp, with no
+ *				@capture, the scanner API calls @get_caps,
+ *				@scan, @get_image and @get_iso_template
+ */
+struct scanner_device_ops {
+	int (*on)(void *context);
+	void (*off)(void *context);
+	int (*get_caps)(void *context, struct scanner_caps *caps);
+	int (*scan)(void *context, int timeout);
+	int (*get_image)(void *context, void *buffer, int size);
+	int (*get_iso_template)(void *context, void *buffer, int size);
+	int (*stream_start)(void *context, struct scanner_stream *stream);
+	void (*stream_stop)(void *context);
+	struct scanner_buffer *(*get_image_buffer)(void *context);
+	struct scanner_buffer *(*get_iso_template_buffer)(void *context);
+	int (*capture)(void *context, int timeout,
+			struct scanner_capture *capture);
+};
+
 /**
  * scanner_register - register a scanner driver
  *
@@ -42,6 +93,67 @@ struct scanner_ops {
  */
 int scanner_register(const char *name, struct scanner_ops *ops);
 
+/**
+ * scanner_register_devices - register devices of a scanner driver
+ *
+ * Registers @number devices served by one driver, making each of them
+ * available to scanner API users under its own name. Either all the devices
+ * are registered, or none of them.
+ *
+ * @names:	unique scanner names, one per device
+ * @ops:	scanner device operations function pointers
+ * @contexts:	contexts given to the operations, one per device
+ * @number:	number of devices
+ *
+ * @returns:	0 for success
+ *		negative value for error
+ */
+int scanner_register_devices(const char **names, struct scanner_device_ops *ops,
+		void **contexts, int number);
+
+/**
+ * scanner_stream_acquire - take a buffer for the next frame of a stream
+ *
+ * Returns a buffer of the stream's ring, preallocated, for the driver
+ * to fill with the next frame, in the scanner_get_image() format, and
+ * commit. The oldest frame of the ring is overwritten, reported as overrun
+ * when it was never pulled. Frames of one stream must be pushed by one
+ * thread at a time, one at a time.
+ *
+ * @stream:	stream given to the stream_start operation
+ * @size:	(pointer to a) size of the buffer in bytes
+ *
+ * @returns:	pointer to the buffer
+ */
+void *scanner_stream_acquire(struct scanner_stream *stream, int *size);
+
+/**
+ * scanner_stream_commit - push a frame into a stream
+ *
+ * Makes the frame in the acquired @buffer available to the stream's user,
+ * with the next sequence number and the current time as the timestamp.
+ *
+ * @stream:	stream given to the stream_start operation
+ * @buffer:	buffer returned by scanner_stream_acquire()
+ * @size:	frame size in bytes, 0 to drop the frame
+ */
+void scanner_stream_commit(struct scanner_stream *stream, void *buffer,
+		int size);
+
+/**
+ * scanner_buffer_init - initialise a buffer
+ *
+ * Initialises the buffer, typically a part of a larger driver's structure,
+ * with one reference, held by the driver, or given to the user.
+ *
+ * @buffer:	pointer to the buffer
+ * @data:	pointer to the contents
+ * @size:	size of the contents in bytes
+ * @release:	function called when the last reference is put, or NULL
+ */
+void scanner_buffer_init(struct scanner_buffer *buffer, const void *data,
+		int size, void (*release)(struct scanner_buffer *buffer));
+
 /**
  * scanner_init - scanner driver initialisation
  *
@@ -5,29 +5,56 @@
 
 #define DUMMY_NAME "Dummy"
 
-static int on;
+/* Number of identical dummy scanners, "Dummy", "Dummy 2" and so on */
+#define DUMMY_DEVICES 4
+
+struct dummy {
+	const char *name;
+	int on;
+	/* Example data, never released */
+	struct scanner_buffer image, iso_template;
+};
+
+static struct dummy dummies[DUMMY_DEVICES] = {
+	{ DUMMY_NAME },
+	{ DUMMY_NAME " 2" },
+	{ DUMMY_NAME " 3" },
+	{ DUMMY_NAME " 4" },
+};
+
+/*
+ * One more dummy, registered with plain struct scanner_ops, so that the
+ * scanner API falls back on its own buffers and capture for it
+ */
+static struct dummy legacy = { DUMMY_NAME " legacy" };
 
-static int dummy_on(void)
+static int dummy_on(void *context)
 {
-	if (on)
+	struct dummy *dummy = context;
+
+	if (dummy->on)
 		return -1;
 
-	on = 1;
+	dummy->on = 1;
 
 	return 0;
 }
 
-static void dummy_off(void)
+static void dummy_off(void *context)
 {
-	on = 0;
+	struct dummy *dummy = context;
+
+	dummy->on = 0;
 }
 
-static int dummy_get_caps(struct scanner_caps *caps)
+static int dummy_get_caps(void *context, struct scanner_caps *caps)
 {
-	if (!on)
+	struct dummy *dummy = context;
+
+	if (!dummy->on)
 		return -1;
 
-	caps->name = DUMMY_NAME;
+	caps->name = dummy->name;
 	caps->image = 1;
 	caps->iso_template = 1;
 	caps->image_format = scanner_image_gray_8bit;
@@ -37,45 +64,173 @@ static int dummy_get_caps(struct scanner_caps *caps)
 	return 0;
 }
 
-static int dummy_scan(int timeout)
+static int dummy_scan(void *context, int timeout)
 {
-	if (!on)
+	struct dummy *dummy = context;
+
+	if (!dummy->on)
 		return -2;
 
 	return 0;
 }
 
-static int dummy_get_image(void *buffer, int size)
+static int dummy_get_image(void *context, void *buffer, int size)
 {
-	if (!on)
+	struct dummy *dummy = context;
+
+	if (!dummy->on)
 		return -1;
 
+	if (size > example_image_gray_8bit_size)
+		size = example_image_gray_8bit_size;
 	memcpy(buffer, example_image_gray_8bit, size);
 
 	return example_image_gray_8bit_size;
 }
 
-static int dummy_get_iso_template(void *buffer, int size)
+static int dummy_get_iso_template(void *context, void *buffer, int size)
 {
-	if (!on)
+	struct dummy *dummy = context;
+
+	if (!dummy->on)
 		return -1;
 
+	if (size > example_iso_template_size)
+		size = example_iso_template_size;
 	memcpy(buffer, example_iso_template, size);
 
 	return example_iso_template_size;
 }
 
-static struct scanner_ops dummy_ops = {
+static struct scanner_buffer *dummy_get_image_buffer(void *context)
+{
+	struct dummy *dummy = context;
+
+	if (!dummy->on)
+		return NULL;
+
+	scanner_buffer_get(&dummy->image);
+
+	return &dummy->image;
+}
+
+static struct scanner_buffer *dummy_get_iso_template_buffer(void *context)
+{
+	struct dummy *dummy = context;
+
+	if (!dummy->on)
+		return NULL;
+
+	scanner_buffer_get(&dummy->iso_template);
+
+	return &dummy->iso_template;
+}
+
+static int dummy_capture(void *context, int timeout,
+		struct scanner_capture *capture)
+{
+	struct dummy *dummy = context;
+
+	if (!dummy->on)
+		return -2;
+
+	capture->image_format = scanner_image_gray_8bit;
+	capture->image_width = example_image_width;
+	capture->image_height = example_image_height;
+
+	if (capture->image) {
+		memcpy(capture->image, example_image_gray_8bit,
+				capture->image_size < example_image_gray_8bit_size ?
+				capture->image_size :
+				example_image_gray_8bit_size);
+		capture->image_length = example_image_gray_8bit_size;
+	}
+
+	if (capture->iso_template) {
+		memcpy(capture->iso_template, example_iso_template,
+				capture->iso_template_size <
+				example_iso_template_size ?
+				capture->iso_template_size :
+				example_iso_template_size);
+		capture->iso_template_length = example_iso_template_size;
+	}
+
+	return 0;
+}
+
+static struct scanner_device_ops dummy_ops = {
 	.on = dummy_on,
 	.off = dummy_off,
 	.get_caps = dummy_get_caps,
 	.scan = dummy_scan,
 	.get_image = dummy_get_image,
 	.get_iso_template = dummy_get_iso_template,
+	.get_image_buffer = dummy_get_image_buffer,
+	.get_iso_template_buffer = dummy_get_iso_template_buffer,
+	.capture = dummy_capture,
+};
+
+static int dummy_legacy_on(void)
+{
+	return dummy_on(&legacy);
+}
+
+static void dummy_legacy_off(void)
+{
+	dummy_off(&legacy);
+}
+
+static int dummy_legacy_get_caps(struct scanner_caps *caps)
+{
+	return dummy_get_caps(&legacy, caps);
+}
+
+static int dummy_legacy_scan(int timeout)
+{
+	return dummy_scan(&legacy, timeout);
+}
+
+static int dummy_legacy_get_image(void *buffer, int size)
+{
+	return dummy_get_image(&legacy, buffer, size);
+}
+
+static int dummy_legacy_get_iso_template(void *buffer, int size)
+{
+	return dummy_get_iso_template(&legacy, buffer, size);
+}
+
+static struct scanner_ops dummy_legacy_ops = {
+	.on = dummy_legacy_on,
+	.off = dummy_legacy_off,
+	.get_caps = dummy_legacy_get_caps,
+	.scan = dummy_legacy_scan,
+	.get_image = dummy_legacy_get_image,
+	.get_iso_template = dummy_legacy_get_iso_template,
 };
 
 int dummy_init(void)
 {
-	return scanner_register(DUMMY_NAME, &dummy_ops);
+	const char *names[DUMMY_DEVICES];
+	void *contexts[DUMMY_DEVICES];
+	int err;
+	int i;
+
+	for (i = 0; i < DUMMY_DEVICES; i++) {
+		names[i] = dummies[i].name;
+		contexts[i] = &dummies[i];
+		scanner_buffer_init(&dummies[i].image, example_image_gray_8bit,
+				example_image_gray_8bit_size, NULL);
+		scanner_buffer_init(&dummies[i].iso_template,
+				example_iso_template, example_iso_template_size,
+				NULL);
+	}
+
+	err = scanner_register_devices(names, &dummy_ops, contexts,
+			DUMMY_DEVICES);
+	if (err)
+		return err;
+
+	return scanner_register(legacy.name, &dummy_legacy_ops);
 }
 __scanner_init(dummy_init);
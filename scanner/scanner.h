@@ -6,6 +6,8 @@ extern "C"
 {
 #endif
 
+#include <time.h>
+
 struct scanner;
 
 /**
@@ -30,7 +32,10 @@ const char **scanner_list(int *number);
 /**
  * scanner_get - obtains a pointer to a scanner
  *
- * There may be only one user of a scanner at any time.
+ * There may be only one user of a scanner at any time. Scanners may be
+ * obtained and returned from different threads, and different scanners
+ * used at the same time, but operations of one scanner must not be called
+ * at the same time.
  *
  * @name:	name of a scanner, one of the @scanner_list
  *
@@ -42,7 +47,9 @@ struct scanner *scanner_get(const char *name);
 /**
  * scanner_put - returns a pointer to a scanner
  *
- * Returns the scanner for other users.
+ * Returns the scanner for other users, stopping its stream and cancelling
+ * and waiting for its asynchronous scan and callback, if any, so it must
+ * not be called from the callback.
  *
  * @scanner:	pointer to a scanner
  */
@@ -122,6 +129,164 @@ int scanner_get_caps(struct scanner *scanner, struct scanner_caps *caps);
  */
 int scanner_scan(struct scanner *scanner, int timeout);
 
+/* Result of a cancelled asynchronous scan */
+#define SCANNER_SCAN_CANCELLED	-100
+/* Result of an asynchronous scan not completed yet */
+#define SCANNER_SCAN_PENDING	-101
+
+/**
+ * scanner_scan_async - start a single scan
+ *
+ * Starts a scan and returns at once. The scan is carried out by a thread
+ * of the scanner API, shared by all scanners, which checks the pending
+ * scans every few milliseconds, so that no thread blocks for any single
+ * scanner. When the scan completes, the scanner's file descriptor (see
+ * scanner_get_fd) becomes readable and the @callback, if any, is called
+ * from the API thread with the scan result, as returned by scanner_scan()
+ * or SCANNER_SCAN_CANCELLED. It may start another scan. No other scanner
+ * operation may be called until the scan completes.
+ *
+ * @scanner:	pointer to a scanner
+ * @timeout:	in miliseconds, as of scanner_scan()
+ * @callback:	function called when the scan completes, or NULL
+ * @data:	pointer passed to the @callback
+ *
+ * @returns:	0 for success
+ *		negative value for error, for example a scan already pending
+ */
+int scanner_scan_async(struct scanner *scanner, int timeout,
+		void (*callback)(struct scanner *scanner, int result,
+		void *data), void *data);
+
+/**
+ * scanner_scan_cancel - cancel an asynchronous scan
+ *
+ * The scan completes soon after, as usual, with SCANNER_SCAN_CANCELLED
+ * result, unless it has completed already.
+ *
+ * @scanner:	pointer to a scanner
+ *
+ * @returns:	0 for success
+ *		negative value when there is no scan pending
+ */
+int scanner_scan_cancel(struct scanner *scanner);
+
+/**
+ * scanner_get_fd - provide file descriptor signalling completed scans
+ *
+ * Returns the scanner's file descriptor (eventfd), which becomes readable
+ * when an asynchronous scan started after it was provided completes, until
+ * the scan result is collected with scanner_scan_result(), so it can be
+ * polled along with other descriptors. It's closed by scanner_put().
+ *
+ * @scanner:	pointer to a scanner
+ *
+ * @returns:	non-negative file descriptor
+ *		negative value for error
+ */
+int scanner_get_fd(struct scanner *scanner);
+
+/**
+ * scanner_scan_result - collect result of an asynchronous scan
+ *
+ * @scanner:	pointer to a scanner
+ *
+ * @returns:	result of the last asynchronous scan, as of scanner_scan()
+ *		SCANNER_SCAN_CANCELLED for a cancelled scan
+ *		SCANNER_SCAN_PENDING while the scan is pending
+ */
+int scanner_scan_result(struct scanner *scanner);
+
+/**
+ * scanner_stream_start - start continuous capture
+ *
+ * Frames (images, as of scanner_get_image()) are captured continuously into
+ * a ring of @frames preallocated buffers, so that none are lost between
+ * calls as long as the ring doesn't overflow, and pulled, or peeked at,
+ * in place. No scans can be done until the stream is stopped.
+ *
+ * @scanner:	pointer to a scanner, providing images
+ * @frames:	number of frames in the ring, 2 or more
+ *
+ * @returns:	0 for success
+ *		negative value for error
+ */
+int scanner_stream_start(struct scanner *scanner, int frames);
+
+/**
+ * scanner_stream_stop - stop continuous capture
+ *
+ * Frees the ring, so the frame held, if any, must not be used any more.
+ *
+ * @scanner:	pointer to a scanner
+ *
+ * @returns:	0 for success
+ *		negative value when there is no stream
+ */
+int scanner_stream_stop(struct scanner *scanner);
+
+/**
+ * scanner_stream_get_fd - provide file descriptor signalling new frames
+ *
+ * Returns the stream's file descriptor (eventfd), which becomes readable
+ * when a frame is captured, until scanner_stream_pull() or
+ * scanner_stream_peek() find no new frame, so it can be polled along with
+ * other descriptors. It's closed by scanner_stream_stop().
+ *
+ * @scanner:	pointer to a scanner
+ *
+ * @returns:	non-negative file descriptor
+ *		negative value when there is no stream
+ */
+int scanner_stream_get_fd(struct scanner *scanner);
+
+/**
+ * struct scanner_frame - frame of a stream
+ *
+ * @image:	pointer to the image, valid until scanner_stream_release()
+ * @size:	image size in bytes
+ * @sequence:	number of the frame, from 0, so gaps are frames not pulled
+ * @timestamp:	CLOCK_MONOTONIC time of the capture
+ * @overruns:	number of frames overwritten, never pulled, so far
+ */
+struct scanner_frame {
+	const void *image;
+	int size;
+	unsigned long long sequence;
+	struct timespec timestamp;
+	unsigned long long overruns;
+};
+
+/**
+ * scanner_stream_pull - take the next frame
+ *
+ * Provides the oldest frame not pulled yet, in place. It's held, not to be
+ * overwritten, until released, and only one frame can be held at a time.
+ *
+ * @scanner:	pointer to a scanner
+ * @frame:	pointer to a frame structure to be filled
+ *
+ * @returns:	0 for success
+ *		-1 when there is no new frame
+ *		other negative value for error
+ */
+int scanner_stream_pull(struct scanner *scanner, struct scanner_frame *frame);
+
+/**
+ * scanner_stream_peek - look at the newest frame
+ *
+ * Same as scanner_stream_pull(), but provides the newest frame captured,
+ * pulled or not, and leaves the frames to be pulled as they were.
+ */
+int scanner_stream_peek(struct scanner *scanner, struct scanner_frame *frame);
+
+/**
+ * scanner_stream_release - release the frame held
+ *
+ * @scanner:	pointer to a scanner
+ */
+void scanner_stream_release(struct scanner *scanner);
+
 /**
  * scanner_get_image - provide fingerprint image
  *
@@ -159,6 +324,119 @@ int scanner_get_image(struct scanner *scanner, void *buffer, int size);
  */
 int scanner_get_iso_template(struct scanner *scanner, void *buffer, int size);
 
+/**
+ * struct scanner_capture - capture descriptor
+ *
+ * Buffers for the image and the template of a single scan, filled by
+ * scanner_capture() up to their sizes, never more, with their full sizes,
+ * and the scan's metadata. The image is in the format of scanner_get_image()
+ * and the template of scanner_get_iso_template().
+ *
+ * @image:		buffer for the image, NULL for no image
+ * @image_size:		image buffer size in bytes
+ * @iso_template:	buffer for the template, NULL for no template
+ * @iso_template_size:	template buffer size in bytes
+ * @image_length:	size of the image in bytes (can be larger than
+ *				@image_size), negative value for error
+ * @iso_template_length: size of the template in bytes (can be larger than
+ *				@iso_template_size), negative value for error
+ * @image_format:	format of the image, as of scanner_caps
+ * @image_width:	number of pixels in an image row
+ * @image_height:	number of image rows
+ * @timestamp:		CLOCK_MONOTONIC time of the capture
+ */
+struct scanner_capture {
+	void *image;
+	int image_size;
+	void *iso_template;
+	int iso_template_size;
+
+	int image_length;
+	int iso_template_length;
+	int image_format;
+	int image_width, image_height;
+	struct timespec timestamp;
+};
+
+/**
+ * scanner_capture - perform a single scan and provide its results
+ *
+ * Same as scanner_scan() followed by scanner_get_image() and
+ * scanner_get_iso_template(), in a single operation, for the image,
+ * the template or both, as requested by the @capture buffers. Either
+ * of them failing is reported in its length only.
+ *
+ * @scanner:	pointer to a scanner
+ * @timeout:	in miliseconds, as of scanner_scan()
+ * @capture:	pointer to a capture descriptor
+ *
+ * @returns:	0 for success
+ *		-1 for timeout
+ *		other negative value for error
+ */
+int scanner_capture(struct scanner *scanner, int timeout,
+		struct scanner_capture *capture);
+
+/**
+ * struct scanner_buffer - read-only, reference counted, buffer
+ *
+ * Image or template, as of scanner_get_image() and
+ * scanner_get_iso_template(), in a buffer owned by the driver, so that it
+ * can be used with no copies. It stays valid and unchanged, even when
+ * other scans are done, until the last reference is put.
+ *
+ * @data:	pointer to the contents
+ * @size:	size of the contents in bytes
+ * @refs:	private, number of references
+ * @release:	private, called by the last scanner_buffer_put()
+ */
+struct scanner_buffer {
+	const void *data;
+	int size;
+
+	int refs;
+	void (*release)(struct scanner_buffer *buffer);
+};
+
+/**
+ * scanner_get_image_buffer - provide fingerprint image buffer
+ *
+ * Same as scanner_get_image(), but provides the image in place, with
+ * a reference to be put with scanner_buffer_put(). Drivers which can't
+ * provide it so have it copied to a new buffer, once.
+ *
+ * @scanner:	pointer to a scanner
+ *
+ * @returns:	pointer to a buffer
+ *		NULL for error
+ */
+struct scanner_buffer *scanner_get_image_buffer(struct scanner *scanner);
+
+/**
+ * scanner_get_iso_template_buffer - provide ISO fingerprint template buffer
+ *
+ * Same as scanner_get_image_buffer(), for scanner_get_iso_template().
+ */
+struct scanner_buffer *scanner_get_iso_template_buffer(
+		struct scanner *scanner);
+
+/**
+ * scanner_buffer_get - take another reference to a buffer
+ *
+ * @buffer:	pointer to a buffer
+ */
+void scanner_buffer_get(struct scanner_buffer *buffer);
+
+/**
+ * scanner_buffer_put - put a reference to a buffer
+ *
+ * The buffer must not be used after its reference is put. References may
+ * be taken and put by different threads.
+ *
+ * @buffer:	pointer to a buffer
+ */
+void scanner_buffer_put(struct scanner_buffer *buffer);
+
 #ifdef __cplusplus
 }
 #endif
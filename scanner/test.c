@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,9 @@ static int test(const char *name)
 	int err;
 	struct scanner *scanner = NULL;
 	struct scanner_caps caps;
+	struct pollfd pollfd;
+	struct scanner_buffer *buffer;
+	struct scanner_capture capture;
 
 	printf("Getting scanner '%s'...\n", name);
 	scanner = scanner_get(name);
@@ -36,6 +40,52 @@ static int test(const char *name)
 	if (err)
 		return 1;
 
+	printf("Scanning asynchronously...\n");
+	pollfd.fd = scanner_get_fd(scanner);
+	pollfd.events = POLLIN;
+	assert(pollfd.fd >= 0);
+	err = scanner_scan_async(scanner, -1, NULL, NULL);
+	assert(!err);
+	err = poll(&pollfd, 1, -1);
+	assert(err == 1);
+	err = scanner_scan_result(scanner);
+	assert(!err);
+	if (err)
+		return 1;
+
+	printf("Cancelling asynchronous scan...\n");
+	err = scanner_scan_async(scanner, -1, NULL, NULL);
+	assert(!err);
+	scanner_scan_cancel(scanner);
+	err = poll(&pollfd, 1, -1);
+	assert(err == 1);
+	err = scanner_scan_result(scanner);
+	assert(!err || err == SCANNER_SCAN_CANCELLED);
+	err = poll(&pollfd, 1, 0);
+	assert(err == 0);
+
+	if (caps.image) {
+		struct scanner_frame frame;
+
+		printf("Streaming...\n");
+		err = scanner_stream_start(scanner, 3);
+		assert(!err);
+		if (err)
+			return 1;
+		pollfd.fd = scanner_stream_get_fd(scanner);
+		assert(pollfd.fd >= 0);
+		do {
+			err = poll(&pollfd, 1, -1);
+			assert(err == 1);
+			err = scanner_stream_pull(scanner, &frame);
+		} while (err == -1);
+		assert(!err);
+		assert(frame.size == caps.image_width * caps.image_height);
+		scanner_stream_release(scanner);
+		err = scanner_stream_stop(scanner);
+		assert(!err);
+	}
+
 	if (caps.image) {
 		const char *format;
 		int bytes_per_pixel;
@@ -107,6 +157,15 @@ static int test(const char *name)
 
 		assert(memcmp(image, pattern, size) != 0);
 
+		printf("Getting the image buffer...\n");
+		buffer = scanner_get_image_buffer(scanner);
+		assert(buffer);
+		if (!buffer)
+			return 1;
+		assert(buffer->size == size);
+		assert(memcmp(buffer->data, image, size) == 0);
+		scanner_buffer_put(buffer);
+
 		free(pattern);
 		free(image);
 	}
@@ -157,10 +216,72 @@ static int test(const char *name)
 
 		assert(memcmp(template, pattern, size) != 0);
 
+		printf("Getting the template buffer...\n");
+		buffer = scanner_get_iso_template_buffer(scanner);
+		assert(buffer);
+		if (!buffer)
+			return 1;
+		assert(buffer->size == size);
+		assert(memcmp(buffer->data, template, size) == 0);
+		scanner_buffer_put(buffer);
+
 		free(pattern);
 		free(template);
 	}
 
+	printf("Capturing...\n");
+	memset(&capture, 0, sizeof(capture));
+	if (caps.image) {
+		capture.image_size = caps.image_width * caps.image_height;
+		capture.image = malloc(capture.image_size);
+		assert(capture.image);
+		memset(capture.image, 0, capture.image_size);
+	}
+	if (caps.iso_template) {
+		capture.iso_template_size = scanner_get_iso_template(scanner,
+				NULL, 0);
+		capture.iso_template = malloc(capture.iso_template_size);
+		assert(capture.iso_template);
+		memset(capture.iso_template, 0, capture.iso_template_size);
+	}
+	err = scanner_capture(scanner, -1, &capture);
+	assert(!err);
+	if (err)
+		return 1;
+	assert(capture.image_length == capture.image_size);
+	assert(capture.iso_template_length == capture.iso_template_size);
+	if (caps.image) {
+		unsigned char *image = malloc(capture.image_size);
+
+		assert(capture.image_format == caps.image_format);
+		assert(capture.image_width == caps.image_width);
+		assert(capture.image_height == caps.image_height);
+
+		/* Same image as the one got the old way */
+		assert(image);
+		if (!image)
+			return 1;
+		err = scanner_get_image(scanner, image, capture.image_size);
+		assert(err == capture.image_size);
+		assert(memcmp(capture.image, image, capture.image_size) == 0);
+		free(image);
+	}
+	if (caps.iso_template) {
+		unsigned char *template = malloc(capture.iso_template_size);
+
+		assert(template);
+		if (!template)
+			return 1;
+		err = scanner_get_iso_template(scanner, template,
+				capture.iso_template_size);
+		assert(err == capture.iso_template_size);
+		assert(memcmp(capture.iso_template, template,
+				capture.iso_template_size) == 0);
+		free(template);
+	}
+	free(capture.image);
+	free(capture.iso_template);
+
 	printf("Turning the scanner off...\n");
 
 	scanner_off(scanner);
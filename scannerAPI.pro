@@ -1,6 +1,6 @@
 TEMPLATE = subdirs
 
-SUBDIRS += iso_fmr scanner
+SUBDIRS += iso_fmr matcher scanner
 
 CONFIG += ordered
 
@@ -39,32 +39,12 @@ FingerprintMinutiaeRecord::~FingerprintMinutiaeRecord()
     delete(binary);
 }
 
-struct GetByteContext {
-    std::vector<unsigned char>::iterator it, end;
-};
-
-static int getByte(void *c)
-{
-    GetByteContext *context = (GetByteContext *)c;
-
-    if (context->it == context->end)
-        return -1;
-
-    return *(context->it)++;
-}
-
 FingerprintISOv20MinutiaeRecord::FingerprintISOv20MinutiaeRecord(void *binary, size_t size) :
     FingerprintMinutiaeRecord(binary, size)
 {
-    unsigned char *data = (unsigned char *)binary;
-    std::vector<unsigned char> buffer;
-
-    buffer.insert(buffer.end(), data, data + size);
-
-    GetByteContext context = { buffer.begin(), buffer.end() };
     iso_fmr_v20_error err;
     size_t bytes;
-    record = iso_fmr_v20_decode(getByte, &context, &err, &bytes);
+    record = iso_fmr_v20_decode_buffer(binary, size, &err, &bytes);
 
     if (err == iso_fmr_v20_invalid_version)
         throw FingerprintMinutiaeRecordInvalidVersion();
@@ -197,15 +177,9 @@ QString FingerprintISOv20MinutiaeRecord::getHtml()
 FingerprintISOv030MinutiaeRecord::FingerprintISOv030MinutiaeRecord(void *binary, size_t size) :
     FingerprintMinutiaeRecord(binary, size)
 {
-    unsigned char *data = (unsigned char *)binary;
-    std::vector<unsigned char> buffer;
-
-    buffer.insert(buffer.end(), data, data + size);
-
-    GetByteContext context = { buffer.begin(), buffer.end() };
     iso_fmr_v030_error err;
     size_t bytes;
-    record = iso_fmr_v030_decode(getByte, &context, &err, &bytes);
+    record = iso_fmr_v030_decode_buffer(binary, size, &err, &bytes);
 
     if (err == iso_fmr_v030_invalid_version)
         throw FingerprintMinutiaeRecordInvalidVersion();
@@ -66,43 +66,37 @@ Fingerprint *Scanner::getFingerprint(int timeout)
     Fingerprint *fingerprint = new Fingerprint();
 
     if (caps.image) {
-        int size = scanner_get_image(scanner, NULL, 0);
+        struct scanner_buffer *buffer = scanner_get_image_buffer(scanner);
 
-        if (size < 0)
-            throw ScannerException("Zero sized image");
+        if (!buffer)
+            throw ScannerException("Failed to obtain the image");
 
-        unsigned char buffer[size];
-
-        size = scanner_get_image(scanner, (void *)buffer, size);
-        if (size < 0)
-            throw ScannerException("Failed to obtain the image", size);
-
-        switch (caps.image_format) {
-        case scanner_caps::scanner_image_gray_8bit:
-            fingerprint->image = new FingerprintGreyscaleImage(caps.image_width, caps.image_height, buffer, size);
-            break;
-        default:
+        if (caps.image_format != scanner_caps::scanner_image_gray_8bit) {
+            scanner_buffer_put(buffer);
             throw ScannerException("Obtained unknown image format");
         }
+
+        fingerprint->image = new FingerprintGreyscaleImage(caps.image_width, caps.image_height, (void *)buffer->data, buffer->size);
+        scanner_buffer_put(buffer);
     }
 
     if (caps.iso_template) {
-        int size = scanner_get_iso_template(scanner, NULL, 0);
-
-        if (size < 0)
-            throw ScannerException("Zero sized template");
-
-        unsigned char buffer[size];
+        struct scanner_buffer *buffer = scanner_get_iso_template_buffer(scanner);
 
-        size = scanner_get_iso_template(scanner, (void *)buffer, size);
-        if (size < 0)
+        if (!buffer)
             throw ScannerException("Failed to obtain the template");
 
         try {
-            fingerprint->minutiaeRecord = new FingerprintISOv20MinutiaeRecord(buffer, size);
-        } catch (FingerprintMinutiaeRecordInvalidVersion &e) {
-            fingerprint->minutiaeRecord = new FingerprintISOv030MinutiaeRecord(buffer, size);
+            try {
+                fingerprint->minutiaeRecord = new FingerprintISOv20MinutiaeRecord((void *)buffer->data, buffer->size);
+            } catch (FingerprintMinutiaeRecordInvalidVersion &e) {
+                fingerprint->minutiaeRecord = new FingerprintISOv030MinutiaeRecord((void *)buffer->data, buffer->size);
+            }
+        } catch (...) {
+            scanner_buffer_put(buffer);
+            throw;
         }
+        scanner_buffer_put(buffer);
     }
 
     return fingerprint;
@@ -13,7 +13,7 @@ FORMS += viewer.ui
 
 INCLUDEPATH += $$PWD/..
 
-unix:!macx: LIBS += -L$$OUT_PWD/../iso_fmr/ -liso_fmr -L$$OUT_PWD/../scanner/ -lscanner
+unix:!macx: LIBS += -L$$OUT_PWD/../iso_fmr/ -liso_fmr -L$$OUT_PWD/../scanner/ -lscanner -lpthread
 
 unix:!macx: PRE_TARGETDEPS += $$OUT_PWD/../iso_fmr/libiso_fmr.a $$OUT_PWD/../scanner/libscanner.a
 